@@ -4,132 +4,1064 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 #include <arpa/inet.h>
 
 #include "account.h"
-#include "yaddns.h"
+#include "wan.h"
 #include "request.h"
 #include "services.h"
 #include "log.h"
 #include "util.h"
 
-/* sleep REQ_SLEEPTIME_ON_ERROR when got an request error */
-#define REQ_SLEEPTIME_ON_ERROR 5
+/* retry delays after a request error (see backoff.h), unless the cfg
+ * of the service sets them
+ */
+#define ACCOUNT_RETRY_MIN 5
+#define ACCOUNT_RETRY_MAX 1800
+
+/* retry delays after a temporary error from the service: the first
+ * one in [30 min, 1 h] (the dyndns2 services ask at least 30 min)
+ */
+#define ACCOUNT_SERVER_RETRY_MIN 3600
+#define ACCOUNT_SERVER_RETRY_MAX 21600
 
-/* sleep FREEZETIME_ON_TEMP_ERROR when received temporary error from service */
-#define FREEZETIME_ON_TEMP_ERROR 1800
+/* 28 days after last update, we need to send an updatepkt otherwise
+ * dyndns server desactive the account because he don't know we are
+ * still alive (unless the cfg of the service sets another period)
+ */
+#define REFRESH_INTERVAL 2419200
 
 /* decs public variables */
 struct list_head account_list;
 
-/* defs static functions */
-static void account_reqhook_readresponse(struct account *account,
-                                         struct request_buff *buff);
-static void account_reqhook_error(struct account *account,
-                                  unsigned int errcode);
-static void account_reqhook(struct request *request, void *data);
+/* decs static variables */
+static const struct backoff_policy account_server_retry = {
+        .min = ACCOUNT_SERVER_RETRY_MIN * 1000,
+        .max = ACCOUNT_SERVER_RETRY_MAX * 1000,
+};
+static struct hashtab account_index; /* accounts by name */
+static unsigned int account_generation = 0; /* of the last remap */
+static struct list_head account_dirty; /* accounts needing an update */
+static struct list_head account_queues[3]; /* accounts waiting an update
+                                            * slot, by priority */
+static unsigned int account_service_inflight[SERVICES_TABLE_SIZE];
+static struct list_head account_service_waiting[SERVICES_TABLE_SIZE];
+                                   /* queued accounts parked until their
+                                    * service gives back a slot */
+static struct account_stats account_stats;
+static int account_queue_backlog = 0; /* accounts had to wait a slot */
+static unsigned int account_state_generation = 0; /* of the states */
+static struct hashtab account_batch_index; /* queued accounts which can
+                                            * be batched, by credentials */
+
+/* report of a response not understood */
+static const struct rc_report account_report_unknown = {
+        .code = up_unknown_error,
+        .proprio_return = "unknown",
+        .proprio_return_info = "Unknown return",
+};
+
+/* defs static functions */
+static void account_reqhook_readresponse(struct account *account,
+                                         struct request_response *response);
+static void account_reqhook_batch(struct account *account,
+                                  struct request *request);
+static void account_batch_result(struct account *account,
+                                 const struct request *request,
+                                 const struct rc_report *reports,
+                                 int ret);
+static void account_read_failed(struct account *account);
+static void account_report(struct account *account,
+                           const struct rc_report *report);
+static void account_reqhook_error(struct account *account,
+                                  unsigned int errcode);
+static void account_reqhook(struct request *request, void *data);
+static void account_freeze(struct account *account, uint64_t delay);
+static void account_setpolicy(struct account *account,
+                              const struct cfg *cfg);
+static void account_unfreeze_cb(struct timer *timer, void *data);
+static void account_refresh_cb(struct timer *timer, void *data);
+static uint64_t account_refresh_phase(const char *name);
+static struct account *account_new(struct cfg_account *cfg,
+                                   struct service *def,
+                                   struct wan *wan);
+static void account_setwan(struct account *account, struct wan *wan);
+static void account_free(struct account *account);
+static void account_release(struct account *account);
+static int account_admit(const struct cfg *cfg,
+                         const struct account *account);
+static void account_wakeup(struct account *account);
+static int account_precheck(const struct cfg *cfg, struct account *account);
+static void account_precheck_cb(struct resolv_query *query,
+                                const struct resolv_result *result,
+                                void *data);
+static void account_precheck_cancel(struct account *account);
+static void account_enqueue(struct account *account, uint64_t now);
+static void account_dequeue(struct account *account);
+static int account_batchable(const struct account *account);
+static uint32_t account_batch_hash(const struct account *account);
+static void account_batch_collect(struct account *account);
+static void account_batch_break(struct account *account, int status);
+static void account_cancel(struct account *account);
+static unsigned int account_rank(const struct account *account);
+static void account_unpark(unsigned int slot);
+static int account_batch_cfg(const struct account *account,
+                             struct cfg_account *batch_cfg);
+static int account_send(struct account *account);
+static int account_dispatch(const struct cfg *cfg, struct list_head *queue,
+                            uint64_t now);
+
+/*
+ * Decs static functions
+ */
+static void account_reqhook_readresponse(struct account *account,
+                                         struct request_response *response)
+{
+        int ret;
+        struct rc_report report;
+
+        memcpy(&report, &account_report_unknown, sizeof(report));
+
+        ret = account->def->read_resp(response,
+                                      &report);
+        if(ret != 0)
+        {
+                account_read_failed(account);
+                return;
+        }
+
+        report.retry_after = MAX(report.retry_after,
+                                 request_response_retry_after(response));
+
+        account_report(account, &report);
+}
+
+static void account_reqhook_batch(struct account *account,
+                                  struct request *request)
+{
+        struct rc_report reports[SERVICE_BATCH_MAX];
+        struct account *member = NULL,
+                *safe = NULL;
+        unsigned int retry_after;
+        unsigned int i;
+        int ret = 0;
+
+        if(request->state == FSResponseReceived)
+        {
+                for(i = 0; i < account->batch_size; ++i)
+                {
+                        memcpy(&(reports[i]), &account_report_unknown,
+                               sizeof(reports[i]));
+                }
+
+                ret = account->def->read_batch(&(request->response),
+                                               reports, account->batch_size);
+
+                retry_after = request_response_retry_after(
+                        &(request->response));
+                for(i = 0; i < account->batch_size; ++i)
+                {
+                        reports[i].retry_after = MAX(reports[i].retry_after,
+                                                     retry_after);
+                }
+        }
+
+        /* fan out the result to the accounts of the query, the ones
+         * removed since have left the batch
+         */
+        account_batch_result(account, request, reports, ret);
+
+        list_for_each_entry_safe(member, safe, &(account->batch), batch)
+        {
+                list_del_init(&(member->batch));
+                account_batch_result(member, request, reports, ret);
+        }
+}
+
+static void account_batch_result(struct account *account,
+                                 const struct request *request,
+                                 const struct rc_report *reports,
+                                 int ret)
+{
+        if(request->state == FSError)
+        {
+                account_reqhook_error(account, request->errcode);
+        }
+        else if(request->state == FSResponseReceived)
+        {
+                if(ret != 0)
+                {
+                        account_read_failed(account);
+                }
+                else
+                {
+                        account_report(account,
+                                       &(reports[account->batch_pos]));
+                }
+        }
+}
+
+static void account_read_failed(struct account *account)
+{
+        log_error("Service %s read failed (critical error)",
+                  account->def->name);
+        account->locked = 1;
+        account->status = ASError;
+        ++account_state_generation;
+}
+
+static void account_report(struct account *account,
+                           const struct rc_report *report)
+{
+        uint64_t delay, now;
+
+        log_debug("Service %s (account '%s') return=%s (%s), code=%d",
+                  account->def->name,
+                  cfgstr_get(&(account->cfg->name)),
+                  report->proprio_return,
+                  report->proprio_return_info,
+                  report->code);
+
+        ++account_state_generation;
+
+        if(report->code == up_success)
+        {
+                log_info("Update success for account '%s'",
+                         cfgstr_get(&(account->cfg->name)));
+
+                account->status = ASOk;
+                account->updated = 1;
+                account->refreshing = 0;
+                backoff_reset(&(account->backoff));
+                backoff_reset(&(account->server_backoff));
+                account->last_update.tv_sec = util_getuptime();
+                account->updated_at = time(NULL);
+                now = timer_now();
+                timer_start(&(account->refresh_timer),
+                            account_refresh_at(account, now) - now);
+        }
+        else
+        {
+                log_notice("Update failed for account '%s' (%s, %s)",
+                           cfgstr_get(&(account->cfg->name)),
+                           report->proprio_return,
+                           report->proprio_return_info);
+
+                account->status = ASError;
+
+                if(report->code == up_server_error
+                   || report->code == up_unknown_error)
+                {
+                        /* no sooner than the service asks */
+                        delay = MAX(backoff_next(&(account->server_backoff),
+                                                 &account_server_retry),
+                                    (uint64_t)report->retry_after * 1000);
+
+                        log_notice("Freeze account '%s' for %lu sec.",
+                                   cfgstr_get(&(account->cfg->name)),
+                                   (unsigned long)(delay / 1000));
+
+                        account_freeze(account, delay);
+                }
+                else
+                {
+                        log_notice("Lock account '%s'",
+                                   cfgstr_get(&(account->cfg->name)));
+                        account->locked = 1;
+                }
+        }
+}
+
+static void account_reqhook_error(struct account *account,
+                                  unsigned int errcode)
+{
+        uint64_t delay = backoff_next(&(account->backoff),
+                                      &(account->retry));
+
+        account->status = ASError;
+        ++account_state_generation;
+        log_error("account '%s' update failed (%s). Retry in %lu ms.",
+                  cfgstr_get(&(account->cfg->name)),
+                  strreqerr(errcode),
+                  (unsigned long)delay);
+
+        account_freeze(account, delay);
+}
+
+static void account_reqhook(struct request *request, void *data)
+{
+        struct account *account = data;
+
+        account_release(account);
+
+        if(!list_empty(&(account->batch)))
+        {
+                account_reqhook_batch(account, request);
+                return;
+        }
+
+        if(request->state == FSError)
+        {
+                account_reqhook_error(account, request->errcode);
+        }
+        else if(request->state == FSResponseReceived)
+        {
+                account_reqhook_readresponse(account, &(request->response));
+        }
+}
+
+static void account_freeze(struct account *account, uint64_t delay)
+{
+        account->freezed = 1;
+        timer_start(&(account->freeze_timer), delay);
+}
+
+/*
+ * retry delays and refresh period of the cfg of its service
+ */
+static void account_setpolicy(struct account *account,
+                              const struct cfg *cfg)
+{
+        const struct cfg_service *servicecfg = NULL;
+        unsigned int min = ACCOUNT_RETRY_MIN;
+        unsigned int max = ACCOUNT_RETRY_MAX;
+        unsigned int refresh = REFRESH_INTERVAL;
+
+        servicecfg = config_service_get(cfg, account->def->name);
+        if(servicecfg != NULL)
+        {
+                if(servicecfg->refresh != 0)
+                {
+                        refresh = servicecfg->refresh;
+                }
+
+                if(servicecfg->retry_min != 0)
+                {
+                        min = servicecfg->retry_min;
+                }
+
+                if(servicecfg->retry_max != 0)
+                {
+                        max = servicecfg->retry_max;
+                }
+        }
+
+        account->retry.min = (uint64_t)min * 1000;
+        account->retry.max = (uint64_t)MAX(min, max) * 1000;
+        account->refresh_period = (uint64_t)refresh * 1000;
+        account->refresh_window = (uint64_t)MIN(refresh,
+                                                cfg->refresh_window) * 1000;
+}
+
+static void account_unfreeze_cb(struct timer *timer, void *data)
+{
+        struct account *account = data;
+
+        UNUSED(timer);
+
+        log_debug("Unfreeze account '%s'",
+                  cfgstr_get(&(account->cfg->name)));
+
+        account->freezed = 0;
+        account_wakeup(account);
+}
+
+static void account_refresh_cb(struct timer *timer, void *data)
+{
+        struct account *account = data;
+
+        UNUSED(timer);
+
+        /*
+         * at most a refresh period after last update, we need
+         * to send an updatepkt otherwise dyndns server desactive
+         * the account because he don't know we are still alive
+         */
+        log_notice("re-update account '%s' to keep it alive",
+                   cfgstr_get(&(account->cfg->name)));
+        account->updated = 0;
+        account->refreshing = 1;
+        account_wakeup(account);
+}
+
+/*
+ * phase of the refreshes of the account named name. The hash of the
+ * name is mixed (splitmix64 finalizer) so that close names get far
+ * phases.
+ */
+static uint64_t account_refresh_phase(const char *name)
+{
+        uint64_t x = hashtab_strhash(name);
+
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+
+        return x;
+}
+
+static struct account *account_new(struct cfg_account *cfg,
+                                   struct service *def,
+                                   struct wan *wan)
+{
+        struct account *account = NULL;
+
+        account = calloc(1, sizeof(struct account));
+        account->cfg = cfg;
+        account->def = def;
+        timer_init(&(account->freeze_timer), account_unfreeze_cb, account);
+        timer_init(&(account->refresh_timer), account_refresh_cb, account);
+        account->refresh_phase = account_refresh_phase(
+                cfgstr_get(&(cfg->name)));
+        INIT_LIST_HEAD(&(account->queue));
+        INIT_LIST_HEAD(&(account->batch));
+        INIT_LIST_HEAD(&(account->wnode));
+        account_setwan(account, wan);
+        hashtab_add(&account_index, &(account->hnode),
+                    hashtab_strhash(cfgstr_get(&(cfg->name))));
+
+        return account;
+}
+
+/*
+ * attach account to the source of its wan ip
+ */
+static void account_setwan(struct account *account, struct wan *wan)
+{
+        list_del_init(&(account->wnode));
+        account->wan = wan;
+        list_add_tail(&(account->wnode), &(wan->accounts));
+}
+
+static void account_free(struct account *account)
+{
+        account_precheck_cancel(account);
+        timer_stop(&(account->freeze_timer));
+        timer_stop(&(account->refresh_timer));
+        hashtab_del(&account_index, &(account->hnode));
+        list_del(&(account->wnode));
+
+        /* its request is removed without hook, the other accounts
+         * of its query have to be updated again
+         */
+        if(account->inflight)
+        {
+                account_batch_break(account, ASHatched);
+        }
+        else
+        {
+                list_del_init(&(account->batch));
+        }
+
+        account_release(account);
+        account_dequeue(account);
+
+        free(account);
+}
+
+/*
+ * give back the update slot of account
+ */
+static void account_release(struct account *account)
+{
+        if(!account->inflight)
+        {
+                return;
+        }
+
+        account->inflight = 0;
+        --account_service_inflight[account->slot];
+        --account_stats.inflight;
+
+        account_unpark(account->slot);
+}
+
+/*
+ * put the accounts parked by the cap of the service of slot back at
+ * the head of their ready queues (they waited first)
+ */
+static void account_unpark(unsigned int slot)
+{
+        struct list_head *waiting = &(account_service_waiting[slot]);
+        struct account *account = NULL;
+
+        while(!list_empty(waiting))
+        {
+                account = list_entry(waiting->prev, struct account, queue);
+                account->parked = 0;
+                --account_stats.parked;
+                list_del(&(account->queue));
+                list_add(&(account->queue),
+                         &(account_queues[account_rank(account)]));
+        }
+}
+
+/*
+ * @return 1 if account can take an update slot, 0 otherwise
+ */
+static int account_admit(const struct cfg *cfg,
+                         const struct account *account)
+{
+        unsigned int slot = services_hash(account->def->name);
+
+        if(cfg->service_inflight_max != 0
+           && account_service_inflight[slot] >= cfg->service_inflight_max)
+        {
+                return 0;
+        }
+
+        return 1;
+}
+
+/*
+ * put account needing an update in the dirty list (if not already
+ * there or queued). The locked accounts are parked (in no list) until
+ * a reload, the freezed ones wait their unfreeze timer.
+ */
+static void account_wakeup(struct account *account)
+{
+        if(account->updated || account->locked || account->freezed
+           || account->status == ASWorking
+           || !list_empty(&(account->queue)))
+        {
+                return;
+        }
+
+        list_add_tail(&(account->queue), &account_dirty);
+}
+
+/*
+ * ask the dns whether the hostname of account (out of the dirty list)
+ * resolves to the wan ip already. The keepalive updates and the
+ * accounts of several hostnames aren't checked.
+ *
+ * @return 0 if the check is started, -1 otherwise
+ */
+static int account_precheck(const struct cfg *cfg, struct account *account)
+{
+        const char *hostname = cfgstr_get(&(account->cfg->hostname));
+
+        /* never a caching resolver */
+        if(account->refreshing || strchr(hostname, ',') != NULL
+           || !cfgstr_is_set(&(cfg->precheck_server)))
+        {
+                return -1;
+        }
+
+        account->precheck = malloc(sizeof(struct resolv_query));
+        if(account->precheck == NULL)
+        {
+                log_error("Unable to allocate the dns check of '%s'",
+                          cfgstr_get(&(account->cfg->name)));
+                return -1;
+        }
+
+        if(resolv_query_start_fresh(account->precheck, hostname, AF_INET,
+                                    cfgstr_get(&(cfg->precheck_server)),
+                                    cfg->precheck_port, NULL,
+                                    account_precheck_cb, account) != 0)
+        {
+                free(account->precheck);
+                account->precheck = NULL;
+                return -1;
+        }
+
+        account->status = ASWorking;
+
+        return 0;
+}
+
+static void account_precheck_cb(struct resolv_query *query,
+                                const struct resolv_result *result,
+                                void *data)
+{
+        struct account *account = data;
+        const struct sockaddr_in *sin = NULL;
+        int match = (result->err == RESOLV_ERR_OK && result->count > 0);
+        uint64_t now = timer_now();
+        size_t i;
+
+        for(i = 0; i < result->count && match; ++i)
+        {
+                sin = (const struct sockaddr_in *)&(result->addrs[i]);
+                match = (sin->sin_family == AF_INET
+                         && sin->sin_addr.s_addr
+                         == account->wan->ip.s_addr);
+        }
+
+        free(query);
+        account->precheck = NULL;
+
+        if(!match || !account->wan->have_ip)
+        {
+                /* update it */
+                account->status = ASHatched;
+                account_enqueue(account, now);
+                return;
+        }
+
+        log_notice("Account '%s' already resolves to the wan ip,"
+                   " no update", cfgstr_get(&(account->cfg->name)));
+
+        account->status = ASOk;
+        account->updated = 1;
+        account->ip = account->wan->ip;
+        ++account_stats.prechecked;
+        ++account_state_generation;
+
+        /* its last update is unknown, keep it alive from now */
+        if(!timer_pending(&(account->refresh_timer)))
+        {
+                account->updated_at = time(NULL);
+                timer_start(&(account->refresh_timer),
+                            account_refresh_at(account, now) - now);
+        }
+}
+
+static void account_precheck_cancel(struct account *account)
+{
+        if(account->precheck == NULL)
+        {
+                return;
+        }
+
+        resolv_query_cancel(account->precheck);
+        free(account->precheck);
+        account->precheck = NULL;
+        account->status = ASHatched;
+}
+
+/*
+ * the ready queue of the priority of account
+ */
+static unsigned int account_rank(const struct account *account)
+{
+        switch(account->cfg->priority)
+        {
+        case cfg_priority_high:
+                return 0;
+        case cfg_priority_low:
+                return 2;
+        case cfg_priority_normal:
+        default:
+                return 1;
+        }
+}
+
+/*
+ * put account (out of the dirty list) in the ready queue of its
+ * priority
+ */
+static void account_enqueue(struct account *account, uint64_t now)
+{
+        account->queued_at = now;
+        account->ready = 1;
+        list_add_tail(&(account->queue),
+                      &(account_queues[account_rank(account)]));
+
+        if(account_batchable(account))
+        {
+                hashtab_add(&account_batch_index, &(account->bnode),
+                            account_batch_hash(account));
+        }
+
+        if(++account_stats.queued > account_stats.queued_high_water)
+        {
+                account_stats.queued_high_water = account_stats.queued;
+        }
+}
+
+static void account_dequeue(struct account *account)
+{
+        if(list_empty(&(account->queue)))
+        {
+                return;
+        }
+
+        list_del_init(&(account->queue));
+
+        if(!account->ready)
+        {
+                /* only in the dirty list */
+                return;
+        }
+
+        account->ready = 0;
+
+        if(account->parked)
+        {
+                account->parked = 0;
+                --account_stats.parked;
+        }
+
+        if(account_batchable(account))
+        {
+                hashtab_del(&account_batch_index, &(account->bnode));
+        }
+
+        --account_stats.queued;
+}
+
+static int account_batchable(const struct account *account)
+{
+        return (account->def->batch_max > 1
+                && account->def->read_batch != NULL);
+}
+
+static uint32_t account_batch_hash(const struct account *account)
+{
+        return hashtab_strhash(cfgstr_get(&(account->cfg->username)))
+                ^ (hashtab_strhash(cfgstr_get(&(account->cfg->passwd)))
+                   * 16777619U);
+}
+
+/*
+ * take out of the queue the accounts which can be updated by the
+ * query of account (the same service and credentials)
+ */
+static void account_batch_collect(struct account *account)
+{
+        struct account *members[SERVICE_BATCH_MAX];
+        struct account *other = NULL;
+        uint32_t hash = account_batch_hash(account);
+        unsigned int max = MIN(account->def->batch_max,
+                               (unsigned int)SERVICE_BATCH_MAX);
+        unsigned int count = 1;
+        unsigned int i;
+
+        hashtab_for_each_entry(other, &account_batch_index, hash, bnode)
+        {
+                if(count >= max)
+                {
+                        break;
+                }
+
+                if(other == account
+                   || other->def != account->def
+                   || other->wan != account->wan
+                   || other->locked || other->freezed
+                   || strcmp(cfgstr_get(&(other->cfg->username)),
+                             cfgstr_get(&(account->cfg->username))) != 0
+                   || strcmp(cfgstr_get(&(other->cfg->passwd)),
+                             cfgstr_get(&(account->cfg->passwd))) != 0)
+                {
+                        continue;
+                }
+
+                members[count++] = other;
+        }
+
+        account->batch_pos = 0;
+        account->batch_size = count;
+
+        for(i = 1; i < count; ++i)
+        {
+                account_dequeue(members[i]);
+                members[i]->batch_pos = i;
+                list_add_tail(&(members[i]->batch), &(account->batch));
+        }
+}
+
+/*
+ * dissolve the batch led by account, its other accounts get status
+ */
+static void account_batch_break(struct account *account, int status)
+{
+        struct account *member = NULL,
+                *safe = NULL;
+
+        list_for_each_entry_safe(member, safe, &(account->batch), batch)
+        {
+                list_del_init(&(member->batch));
+                member->status = status;
+                account_wakeup(member);
+        }
+}
+
+/*
+ * forget the update of account in flight, its response must not be
+ * read anymore. The other accounts of its query (if leader) have to
+ * be updated again, the query of its leader (if member) still updates
+ * the others.
+ */
+static void account_cancel(struct account *account)
+{
+        if(account->inflight)
+        {
+                request_ctl_remove_by_hook_data(account);
+                account_release(account);
+                account_batch_break(account, ASHatched);
+        }
+        else
+        {
+                list_del_init(&(account->batch));
+        }
+
+        if(account->status == ASWorking)
+        {
+                account->status = ASHatched;
+        }
+}
+
+/*
+ * the cfg of the query of a batch: the cfg of account with the
+ * hostnames of the batch separated by commas
+ *
+ * @return 0 if success, -1 otherwise
+ */
+static int account_batch_cfg(const struct account *account,
+                             struct cfg_account *batch_cfg)
+{
+        const struct account *member = NULL;
+        const char *hostname = cfgstr_get(&(account->cfg->hostname));
+        size_t size = strlen(hostname) + 1;
+        size_t len;
+        char *hostnames = NULL, *h = NULL;
+
+        list_for_each_entry(member, &(account->batch), batch)
+        {
+                size += strlen(cfgstr_get(&(member->cfg->hostname))) + 1;
+        }
+
+        hostnames = malloc(size);
+        if(hostnames == NULL)
+        {
+                log_error("Unable to allocate the batch hostnames");
+                return -1;
+        }
+
+        len = strlen(hostname);
+        memcpy(hostnames, hostname, len);
+        h = hostnames + len;
+
+        list_for_each_entry(member, &(account->batch), batch)
+        {
+                hostname = cfgstr_get(&(member->cfg->hostname));
+                len = strlen(hostname);
+
+                *h++ = ',';
+                memcpy(h, hostname, len);
+                h += len;
+        }
+
+        *h = '\0';
+
+        memcpy(batch_cfg, account->cfg, sizeof(struct cfg_account));
+        cfgstr_init(&(batch_cfg->hostname));
+        cfgstr_dup(&(batch_cfg->hostname), hostnames);
+        free(hostnames);
+
+        return 0;
+}
+
+/*
+ * build the update query of account (and its batch) with the ip of
+ * its wan and send it
+ *
+ * @return 0 if success, -1 otherwise
+ */
+static int account_send(struct account *account)
+{
+        struct request_host req_host;
+        struct request_ctl req_ctl = {
+                .hook_func = account_reqhook,
+        };
+        struct request_buff req_buff;
+        struct request_opt req_opt = {
+                .mask = 0,
+        };
+        struct cfg_account batch_cfg;
+        const struct cfg_account *query_cfg = account->cfg;
+        const char *buf_wanip = wan_ipstr(account->wan);
+        int ret;
+
+        if(buf_wanip == NULL)
+        {
+                return -1;
+        }
+
+        /* req_host structure */
+        snprintf(req_host.addr, sizeof(req_host.addr),
+                 "%s", account->def->ipserv);
+        req_host.port = account->def->portserv;
+
+        /* req_ctl structure */
+        req_ctl.hook_data = account;
+
+        /* a batch is updated by the query of all its hostnames */
+        if(!list_empty(&(account->batch)))
+        {
+                if(account_batch_cfg(account, &batch_cfg) != 0)
+                {
+                        return -1;
+                }
+
+                query_cfg = &batch_cfg;
+        }
+
+        /* req_buff structure, tell to service to fill it */
+        memset(&req_buff, 0, sizeof(req_buff));
+
+        ret = account->def->make_query(query_cfg,
+                                       buf_wanip,
+                                       &req_buff);
 
-/*
- * Decs static functions
- */
-static void account_reqhook_readresponse(struct account *account,
-                                         struct request_buff *buff)
-{
-        int ret;
-        struct rc_report report = {
-                .code = up_unknown_error,
-                .proprio_return = "unknown",
-                .proprio_return_info = "Unknown return",
-        };
+        if(query_cfg == &batch_cfg)
+        {
+                cfgstr_unset(&(batch_cfg.hostname));
+        }
 
-        ret = account->def->read_resp(buff,
-                                      &report);
         if(ret != 0)
         {
-                log_error("Service %s read failed (critical error)",
-                          account->def->name);
-                account->locked = 1;
-                account->status = ASError;
-                return;
+                request_buff_free(&req_buff);
+                return -1;
         }
 
-        log_debug("Service %s (account '%s') return=%s (%s), code=%d",
-                  account->def->name,
-                  cfgstr_get(&(account->cfg->name)),
-                  report.proprio_return,
-                  report.proprio_return_info,
-                  report.code);
-                
-        if(report.code == up_success)
+        /* req opt, from the address of its wan (if bound) */
+        if(account->wan->bind_addr.s_addr != INADDR_ANY)
         {
-                log_info("Update success for account '%s'",
-                         cfgstr_get(&(account->cfg->name)));
+                req_opt.mask |= REQ_OPT_BIND_ADDR;
+                req_opt.bind_addr = account->wan->bind_addr;
+        }
 
-                account->status = ASOk;
-                account->updated = 1;
-                account->last_update.tv_sec = util_getuptime();
+        if(account->def->pipeline > 1)
+        {
+                req_opt.mask |= REQ_OPT_PIPELINE;
+                req_opt.pipeline_depth = account->def->pipeline;
         }
-        else
+
+        /* send request */
+        return request_send(&req_host, &req_ctl, &req_buff, &req_opt);
+}
+
+/*
+ * launch update procedure for the accounts of queue which get a slot
+ *
+ * @return -1 if inflight_max is reached, 0 otherwise
+ */
+static int account_dispatch(const struct cfg *cfg, struct list_head *queue,
+                            uint64_t now)
+{
+        struct account *account = NULL,
+                *safe = NULL,
+                *member = NULL;
+        unsigned long wait;
+
+        list_for_each_entry_safe(account, safe, queue, queue)
         {
-                log_notice("Update failed for account '%s' (%s, %s)",
-                           cfgstr_get(&(account->cfg->name)),
-                           report.proprio_return,
-                           report.proprio_return_info);
+                if(cfg->inflight_max != 0
+                   && account_stats.inflight >= cfg->inflight_max)
+                {
+                        return -1;
+                }
 
-                account->status = ASError;
+                if(!account->locked && !account->freezed)
+                {
+                        if(!account->wan->have_ip)
+                        {
+                                continue;
+                        }
+
+                        if(!account_admit(cfg, account))
+                        {
+                                /* not scanned again until its service
+                                 * gives back a slot
+                                 */
+                                account->parked = 1;
+                                ++account_stats.parked;
+                                list_del(&(account->queue));
+                                list_add_tail(&(account->queue),
+                                              &(account_service_waiting[
+                                                      services_hash(
+                                                              account->def
+                                                              ->name)]));
+                                continue;
+                        }
+                }
+
+                account_dequeue(account);
 
-                if(report.code == up_server_error
-                   || report.code == up_unknown_error)
+                if(account->locked || account->freezed || account->updated)
                 {
-                        log_notice("Freeze account '%s' for %d sec.",
-                                   cfgstr_get(&(account->cfg->name)),
-                                   FREEZETIME_ON_TEMP_ERROR);
+                        continue;
+                }
 
-                        account->freezed = 1;
-                        account->freeze_time.tv_sec = util_getuptime();
-                        account->freeze_interval.tv_sec =
-                                FREEZETIME_ON_TEMP_ERROR;
+                wait = (unsigned long)(now - account->queued_at);
+                account_stats.wait_total += wait;
+                if(wait > account_stats.wait_max)
+                {
+                        account_stats.wait_max = wait;
                 }
-                else
+
+                if(account_batchable(account))
                 {
-                        log_notice("Lock account '%s'",
-                                   cfgstr_get(&(account->cfg->name)));
-                        account->locked = 1;
+                        account_batch_collect(account);
+
+                        /* the next one may have joined the batch */
+                        if(&(safe->queue) != queue
+                           && list_empty(&(safe->queue)))
+                        {
+                                safe = list_entry(queue->next,
+                                                  struct account, queue);
+                        }
                 }
-        }
-}
 
-static void account_reqhook_error(struct account *account,
-                                  unsigned int errcode)
-{
-        account->status = ASError;
-        log_error("account '%s' update failed (%s). Retry in %d seconds.",
-                  cfgstr_get(&(account->cfg->name)),
-                  strreqerr(errcode),
-                  REQ_SLEEPTIME_ON_ERROR);
+                if(account_send(account) != 0)
+                {
+                        account->status = ASError;
+                        account_batch_break(account, ASError);
+                        account_wakeup(account);
+                        continue;
+                }
 
-        account->freezed = 1;
-        account->freeze_time.tv_sec = util_getuptime();
-        account->freeze_interval.tv_sec = REQ_SLEEPTIME_ON_ERROR;
+                /* all is ok */
+                account->status = ASWorking;
+                account->ip = account->wan->ip;
+                list_for_each_entry(member, &(account->batch), batch)
+                {
+                        member->status = ASWorking;
+                        member->ip = account->wan->ip;
+                        ++account_stats.batched;
+                }
+                account->inflight = 1;
+                account->slot = services_hash(account->def->name);
+                ++account_service_inflight[account->slot];
+                ++account_stats.dispatched;
+
+                if(++account_stats.inflight
+                   > account_stats.inflight_high_water)
+                {
+                        account_stats.inflight_high_water =
+                                account_stats.inflight;
+                }
+        }
+
+        return 0;
 }
 
-static void account_reqhook(struct request *request, void *data)
+void account_ctl_init(void)
 {
-        struct account *account = data;
+        unsigned int i;
 
-        if(request->state == FSError)
+        INIT_LIST_HEAD(&account_list);
+        INIT_LIST_HEAD(&account_dirty);
+        for(i = 0; i < ARRAY_SIZE(account_queues); ++i)
         {
-                account_reqhook_error(account, request->errcode);
+                INIT_LIST_HEAD(&(account_queues[i]));
         }
-        else if(request->state == FSResponseReceived)
+        hashtab_init(&account_index);
+        hashtab_init(&account_batch_index);
+        memset(account_service_inflight, 0,
+               sizeof(account_service_inflight));
+        for(i = 0; i < ARRAY_SIZE(account_service_waiting); ++i)
         {
-                account_reqhook_readresponse(account, &(request->buff));
+                INIT_LIST_HEAD(&(account_service_waiting[i]));
         }
-}
-
-void account_ctl_init(void)
-{
-        INIT_LIST_HEAD(&account_list);
+        memset(&account_stats, 0, sizeof(account_stats));
+        account_queue_backlog = 0;
 }
 
 void account_ctl_cleanup(void)
@@ -141,120 +1073,107 @@ void account_ctl_cleanup(void)
                                  &(account_list), list)
         {
                 list_del(&(account->list));
-                free(account);
+                account_free(account);
+        }
+
+        hashtab_free(&account_index);
+        hashtab_free(&account_batch_index);
+
+        log_debug("accounts: %lu updates dispatched, queue high water %u,"
+                  " in flight high water %u, max wait %lu ms",
+                  account_stats.dispatched,
+                  account_stats.queued_high_water,
+                  account_stats.inflight_high_water,
+                  account_stats.wait_max);
+}
+
+uint64_t account_refresh_at(const struct account *account, uint64_t now)
+{
+        uint64_t end = now + account->refresh_period;
+        uint64_t window = account->refresh_window;
+
+        if(window == 0)
+        {
+                return end;
         }
+
+        /* the last instant of ]end - window, end] at its phase */
+        return end - (end % window + window
+                      - account->refresh_phase % window) % window;
 }
 
 /*
  * ctl manage of account:
- * - unfreeze account if the freezetime is over;
- * - force reupdate for account which have done their update 28 days ago:
- *    otherwise dyndns server don't know we are still alive...;
- * - if get wan ip addr, launch update procedure for accounts not updated;
+ * - move the dirty accounts whose wan has an ip addr to the ready
+ *   queue of their priority;
+ * - launch update procedure for the queued accounts which get a slot,
+ *   the high priority ones first.
+ *
+ * The accounts get dirty by events (new or changed cfg, wan ip
+ * change, unfreeze and keepalive timers, ...), so the cost of a call
+ * is proportional to the accounts needing an update, not to all of
+ * them.
+ *
+ * A queue is a FIFO but an account whose service is at its
+ * service_inflight_max doesn't block the other services. An account
+ * which gets a slot takes with it the queued accounts of the same
+ * service and credentials (up to the service batch_max), they are
+ * updated by a single query.
  */
 void account_ctl_manage(const struct cfg *cfg)
 {
-        struct request_host req_host;
-        struct request_ctl req_ctl = {
-                .hook_func = account_reqhook,
-        };
-        struct request_buff req_buff;
-        struct request_opt req_opt = {
-                .mask = 0,
-        };
-        char buf_wanip[32];
-        struct account *account = NULL;
-        time_t uptime = util_getuptime();
-
-        /* transform wan ip raw in ascii char */
-        if(!inet_ntop(AF_INET, &wanip, buf_wanip, sizeof(buf_wanip)))
-        {
-                log_error("inet_ntop(): %s", strerror(errno));
-                return;
-        }
+        struct account *account = NULL,
+                *safe = NULL;
+        unsigned int i;
+        uint64_t now = timer_now();
 
-        /* start update processus for service which need to update */
-        list_for_each_entry(account,
-                            &(account_list), list)
+        /* queue the accounts which need to update */
+        list_for_each_entry_safe(account, safe, &account_dirty, queue)
         {
-                /* unfreeze account ? */
-                if(account->freezed)
-                {
-                        if(uptime - account->freeze_time.tv_sec
-                           >= account->freeze_interval.tv_sec)
-                        {
-                                /* unfreeze ! */
-                                account->freezed = 0;
-                        }
-                }
-
-                if(account->locked || account->freezed)
+                if(!account->wan->have_ip)
                 {
-                        /* no deal with locked or freezed account
-                         * even if needs to be updated
-                         */
+                        /* dirty until its wan ip is known */
                         continue;
                 }
 
-                if(account->updated
-                   && uptime - account->last_update.tv_sec >= 2419200)
-                {
-                        /*
-                         * 28 days after last update, we need to send an
-                         * updatepkt otherwise dyndns server desactive
-                         * the account because he don't know we are still alive
-                         */
-                        log_notice("re-update service after 28 beautiful days");
-                        account->updated = 0;
-                }
+                list_del_init(&(account->queue));
 
-                if(have_wanip
-                   && !account->updated
-                   && account->status != ASWorking)
+                if(cfg->precheck && account_precheck(cfg, account) == 0)
                 {
-                        log_notice("Account '%s' service '%s'"
-                                   " need to be updated !",
-                                   cfgstr_get(&(account->cfg->name)),
-                                   cfgstr_get(&(account->cfg->service)));
-
-                        /* req_host structure */
-                        snprintf(req_host.addr, sizeof(req_host.addr),
-                                 "%s", account->def->ipserv);
-                        req_host.port = account->def->portserv;
-
-                        /* req_ctl structure */
-                        req_ctl.hook_data = account;
-
-                        /* req_buff structure, tell to service to fill it */
-                        memset(&req_buff, 0, sizeof(req_buff));
-
-                        if(account->def->make_query(account->cfg,
-                                                    buf_wanip,
-                                                    &req_buff) != 0)
-                        {
-                                account->status = ASError;
-                                continue;
-                        }
+                        /* queued if the dns doesn't match */
+                        continue;
+                }
 
-                        /* req opt */
-                        if(cfg->wan_cnt_type == wan_cnt_direct)
-                        {
-                                req_opt.mask = REQ_OPT_BIND_ADDR;
-                                req_opt.bind_addr = wanip;
-                        }
+                log_notice("Account '%s' service '%s'"
+                           " need to be updated !",
+                           cfgstr_get(&(account->cfg->name)),
+                           cfgstr_get(&(account->cfg->service)));
 
-                        /* send request */
-                        if(request_send(&req_host, &req_ctl,
-                                        &req_buff, &req_opt) != 0)
-                        {
-                                account->status = ASError;
-                                continue;
-                        }
+                account_enqueue(account, now);
+        }
 
-                        /* all is ok */
-                        account->status = ASWorking;
+        /* start update processus for the queued ones */
+        for(i = 0; i < ARRAY_SIZE(account_queues); ++i)
+        {
+                if(account_dispatch(cfg, &(account_queues[i]), now) != 0)
+                {
+                        break;
                 }
         }
+
+        if(account_stats.queued != 0)
+        {
+                account_queue_backlog = 1;
+        }
+        else if(account_queue_backlog)
+        {
+                log_notice("Update queue drained (%lu updates, max wait"
+                           " %lu ms, %u waiting at most)",
+                           account_stats.dispatched,
+                           account_stats.wait_max,
+                           account_stats.queued_high_water);
+                account_queue_backlog = 0;
+        }
 }
 
 void account_ctl_needupdate(void)
@@ -265,6 +1184,24 @@ void account_ctl_needupdate(void)
                             &(account_list), list)
         {
                 account->updated = 0;
+                account_wakeup(account);
+        }
+}
+
+void account_ctl_wanipchanged(struct wan *wan)
+{
+        struct account *account = NULL;
+
+        list_for_each_entry(account,
+                            &(wan->accounts), wnode)
+        {
+                if(account->updated && account->ip.s_addr == wan->ip.s_addr)
+                {
+                        continue;
+                }
+
+                account->updated = 0;
+                account_wakeup(account);
         }
 }
 
@@ -276,52 +1213,46 @@ void account_ctl_unfreeze_all(void)
                             &(account_list), list)
         {
                 account->freezed = 0;
+                timer_stop(&(account->freeze_timer));
+                account_wakeup(account);
         }
 }
 
 int account_ctl_mapcfg(struct cfg *cfg)
 {
         struct service *service = NULL;
+        struct wan *wan = NULL;
         struct cfg_account *accountcfg = NULL;
         struct account *account = NULL,
                 *safe = NULL;
-        int ismapped = 0;
         int ret = 0;
 
         list_for_each_entry(accountcfg,
                             &(cfg->account_list), list)
         {
-                ismapped = 0;
-
-                list_for_each_entry(service,
-                                    &(service_list), list)
+                service = services_get(cfgstr_get(&(accountcfg->service)));
+                wan = wan_ctl_get(cfgstr_get(&(accountcfg->wan)));
+                if(service != NULL && wan != NULL)
                 {
-                        if(strcmp(service->name,
-                                  cfgstr_get(&(accountcfg->service))) == 0)
-                        {
-                                account = calloc(1,
-                                                 sizeof(struct account));
-                                account->def = service;
-                                account->cfg = accountcfg;
+                        account = account_new(accountcfg, service, wan);
+                        account_setpolicy(account, cfg);
+                        account_wakeup(account);
 
-                                list_add(&(account->list),
-                                         &(account_list));
-
-                                ismapped = 1;
-                                break;
-                        }
+                        list_add(&(account->list),
+                                 &(account_list));
                 }
-
-                if(!ismapped)
+                else
                 {
-                        log_error("No service named '%s' available !",
-                                  cfgstr_get(&(accountcfg->service)));
+                        log_error("No service named '%s' or wan named"
+                                  " '%s' available !",
+                                  cfgstr_get(&(accountcfg->service)),
+                                  cfgstr_get(&(accountcfg->wan)));
 
                         list_for_each_entry_safe(account, safe,
                                                  &(account_list), list)
                         {
                                 list_del(&(account->list));
-                                free(account);
+                                account_free(account);
                         }
 
                         ret = -1;
@@ -332,150 +1263,239 @@ int account_ctl_mapcfg(struct cfg *cfg)
         return ret;
 }
 
-int account_ctl_mapnewcfg(const struct cfg *newcfg)
+int account_ctl_mapnewcfg(const struct cfg *newcfg,
+                          struct account_mapreport *report)
 {
-        int ret = 0, found = 0;
-
-        struct list_head entry_tomap_list;
-        struct {
-                struct cfg_account *newcfg;
-                struct service *service;
-                struct list_head list;
-        } *entry_tomap = NULL,
-                  *entry_tomap_safe = NULL;
-
+        struct account_mapreport counts = { 0, 0, 0, 0 };
         struct cfg_account *new_actcfg = NULL;
         struct account *accountctl = NULL,
                 *accountctl_safe = NULL;
         struct service *service = NULL;
+        struct wan *wan = NULL;
 
-        INIT_LIST_HEAD(&entry_tomap_list);
-
-        /* - make a list with all account cfg from newcfg (because
-         *   we need to know which account cfg haven't account
-         *   struct already defined).
-         * - check service exist for all account cfg.
+        /* check all the services and wans exist before touching
+         * anything
          */
         list_for_each_entry(new_actcfg, &(newcfg->account_list), list)
         {
-                /* check the service exist */
-                found = 0;
-                list_for_each_entry(service,
-                                    &(service_list), list)
+                if(services_get(cfgstr_get(&(new_actcfg->service))) == NULL)
                 {
-                        if(strcmp(service->name,
-                                  cfgstr_get(&(new_actcfg->service))) == 0)
-                        {
-                                found = 1;
-
-                                /* create a new entry and add to the list */
-                                entry_tomap = alloca(sizeof(*entry_tomap));
-                                entry_tomap->newcfg = new_actcfg;
-                                entry_tomap->service = service;
-
-                                list_add(&(entry_tomap->list),
-                                         &entry_tomap_list);
-                        }
+                        log_error("No service named '%s' available !"
+                                  " Abort the new config file.",
+                                  cfgstr_get(&(new_actcfg->service)));
+                        return -1;
                 }
 
-                if(!found)
+                if(wan_ctl_get(cfgstr_get(&(new_actcfg->wan))) == NULL)
                 {
-                        log_error("No service named '%s' available !"
+                        log_error("No wan named '%s' available !"
                                   " Abort the new config file.",
-                                  cfgstr_get(&(new_actcfg->service)));
-                        ret = -1;
-                        goto out;
+                                  cfgstr_get(&(new_actcfg->wan)));
+                        return -1;
                 }
         }
 
-        /* for each account already registered, check is defined in the
-         * new config. If not, remove account reference. Otherwise, compare
-         * the new config with old one. If account cfg is different,
-         * reset the account (to try a new update).
-         * And finally, link the new account config to the account.
+        /* join the new account cfgs with the account ctls by name
+         * (indexed), an account cfg with the same fingerprint is
+         * unchanged and keeps the account state as is
          */
-        list_for_each_entry_safe(accountctl, accountctl_safe,
-                                 &(account_list), list)
+        ++account_generation;
+
+        list_for_each_entry(new_actcfg, &(newcfg->account_list), list)
         {
-                found = 0;
-                list_for_each_entry_safe(entry_tomap, entry_tomap_safe,
-                                         &(entry_tomap_list), list)
+                service = services_get(cfgstr_get(&(new_actcfg->service)));
+                wan = wan_ctl_get(cfgstr_get(&(new_actcfg->wan)));
+                accountctl = account_ctl_get(cfgstr_get(&(new_actcfg->name)));
+
+                if(accountctl == NULL)
                 {
-                        if(strcmp(cfgstr_get(&(accountctl->cfg->name)),
-                                  cfgstr_get(&(entry_tomap->newcfg->name))) == 0)
-                        {
-                                /* found reference in new cfg */
-                                found = 1;
-
-                                /* view it cfg has changed */
-                                if(strcmp(cfgstr_get(&(entry_tomap->newcfg->service)),
-                                          cfgstr_get(&(accountctl->cfg->service))) != 0
-                                   || strcmp(cfgstr_get(&(entry_tomap->newcfg->username)),
-                                             cfgstr_get(&(accountctl->cfg->username))) != 0
-                                   || strcmp(cfgstr_get(&(entry_tomap->newcfg->passwd)),
-                                             cfgstr_get(&(accountctl->cfg->passwd))) != 0
-                                   || strcmp(cfgstr_get(&(entry_tomap->newcfg->hostname)),
-                                             cfgstr_get(&(accountctl->cfg->hostname))) != 0)
-                                {
-                                        /* cfg has changed */
-                                        log_debug("account cfg for '%s'"
-                                                  " has changed",
-                                                  cfgstr_get(&(entry_tomap->newcfg->name)));
-
-                                        accountctl->updated = 0;
-                                        accountctl->locked = 0;
-                                        accountctl->freezed = 0;
-                                }
-
-                                /* link the new cfg to account ctl struct */
-                                accountctl->cfg = entry_tomap->newcfg;
-                                accountctl->def = entry_tomap->service;
-
-                                /* the entry was mapped */
-                                list_del(&(entry_tomap->list));
-                        }
+                        log_debug("New account '%s'",
+                                  cfgstr_get(&(new_actcfg->name)));
+
+                        accountctl = account_new(new_actcfg, service, wan);
+                        account_setpolicy(accountctl, newcfg);
+                        account_wakeup(accountctl);
+                        list_add(&(accountctl->list), &(account_list));
+                        accountctl->generation = account_generation;
+                        ++counts.added;
+                        continue;
+                }
+
+                if(accountctl->generation == account_generation)
+                {
+                        /* the same name twice, the first one wins */
+                        log_warning("Account '%s' defined twice",
+                                    cfgstr_get(&(new_actcfg->name)));
+                        continue;
                 }
 
-                if(!found)
+                if(accountctl->cfg->fingerprint != new_actcfg->fingerprint)
+                {
+                        /* cfg has changed */
+                        log_debug("account cfg for '%s' has changed",
+                                  cfgstr_get(&(new_actcfg->name)));
+
+                        account_dequeue(accountctl);
+                        account_precheck_cancel(accountctl);
+                        account_cancel(accountctl);
+                        accountctl->refreshing = 0;
+                        accountctl->updated = 0;
+                        accountctl->locked = 0;
+                        accountctl->freezed = 0;
+                        timer_stop(&(accountctl->freeze_timer));
+                        timer_stop(&(accountctl->refresh_timer));
+                        backoff_reset(&(accountctl->backoff));
+                        backoff_reset(&(accountctl->server_backoff));
+                        ++counts.changed;
+                }
+                else
                 {
-                        /* remove reference of account */
-                        log_debug("Remove unused account ctl '%s'",
-                                  cfgstr_get(&(accountctl->cfg->name)));
+                        ++counts.unchanged;
+                }
 
-                        /* This old reference must not be used anymore,
-                         * this is why we remove all request which can
-                         * reference accountctl.
-                         */
-                        request_ctl_remove_by_hook_data(accountctl);
+                /* link the new cfg to account ctl struct */
+                accountctl->cfg = new_actcfg;
+                accountctl->def = service;
+                account_setwan(accountctl, wan);
+                account_setpolicy(accountctl, newcfg);
+                accountctl->generation = account_generation;
+                account_wakeup(accountctl);
+        }
 
-                        list_del(&(accountctl->list));
-                        free(accountctl);
+        /* the account ctls not joined aren't in the new cfg anymore */
+        list_for_each_entry_safe(accountctl, accountctl_safe,
+                                 &(account_list), list)
+        {
+                if(accountctl->generation == account_generation)
+                {
+                        continue;
                 }
+
+                log_debug("Remove unused account ctl '%s'",
+                          cfgstr_get(&(accountctl->cfg->name)));
+
+                /* This old reference must not be used anymore,
+                 * this is why we remove all request which can
+                 * reference accountctl.
+                 */
+                request_ctl_remove_by_hook_data(accountctl);
+
+                list_del(&(accountctl->list));
+                account_free(accountctl);
+                ++counts.removed;
         }
 
-        /* all entries not already mapped need a new account ctl struct */
-        list_for_each_entry(entry_tomap, &(entry_tomap_list), list)
+        if(counts.added != 0 || counts.removed != 0 || counts.changed != 0)
         {
-                log_debug("New account '%s'",
-                          cfgstr_get(&(entry_tomap->newcfg->name)));
+                ++account_state_generation;
+        }
 
-                accountctl = calloc(1, sizeof(struct account));
-                accountctl->cfg = entry_tomap->newcfg;
-                accountctl->def = entry_tomap->service;
+        log_notice("Accounts reloaded: %u added, %u removed, %u changed,"
+                   " %u unchanged",
+                   counts.added, counts.removed,
+                   counts.changed, counts.unchanged);
 
-                list_add(&(accountctl->list), &(account_list));
+        if(report != NULL)
+        {
+                memcpy(report, &counts, sizeof(counts));
         }
 
-out:
-        return ret;
+        return 0;
+}
+
+void account_getstate(const struct account *account,
+                      struct account_state *state)
+{
+        uint64_t now = timer_now();
+
+        memset(state, 0, sizeof(struct account_state));
+        state->fingerprint = account->cfg->fingerprint;
+        state->attempts = account->backoff.attempts;
+        state->locked = account->locked;
+
+        if(account->updated)
+        {
+                state->ip = account->ip;
+                state->updated_at = account->updated_at;
+        }
+
+        if(account->freezed && account->freeze_timer.expire > now)
+        {
+                state->freezed_until = time(NULL)
+                        + (time_t)((account->freeze_timer.expire - now)
+                                   / 1000 + 1);
+        }
+}
+
+void account_setstate(struct account *account,
+                      const struct account_state *state)
+{
+        time_t wallnow = time(NULL);
+        uint64_t now = timer_now();
+        uint64_t elapsed, due;
+
+        account->backoff.attempts = state->attempts;
+
+        if(state->locked)
+        {
+                log_notice("Account '%s' still locked",
+                           cfgstr_get(&(account->cfg->name)));
+                account_dequeue(account);
+                account->locked = 1;
+                account->status = ASError;
+                return;
+        }
+
+        if(state->freezed_until > wallnow)
+        {
+                account_dequeue(account);
+                account->status = ASError;
+                account_freeze(account,
+                               (uint64_t)(state->freezed_until - wallnow)
+                               * 1000);
+                return;
+        }
+
+        if(state->updated_at == 0 || state->ip.s_addr == 0)
+        {
+                return;
+        }
+
+        elapsed = (state->updated_at < wallnow
+                   ? (uint64_t)(wallnow - state->updated_at) * 1000 : 0);
+        if(elapsed >= account->refresh_period)
+        {
+                /* time to refresh it */
+                return;
+        }
+
+        account_dequeue(account);
+        account->status = ASOk;
+        account->updated = 1;
+        account->ip = state->ip;
+        account->updated_at = state->updated_at;
+
+        /* refreshed as if it had been updated elapsed ms ago */
+        due = account_refresh_at(account, now - MIN(elapsed, now));
+        timer_start(&(account->refresh_timer), (due > now ? due - now : 0));
+}
+
+unsigned int account_ctl_state_generation(void)
+{
+        return account_state_generation;
+}
+
+void account_ctl_stats(struct account_stats *stats)
+{
+        memcpy(stats, &account_stats, sizeof(account_stats));
 }
 
 struct account *account_ctl_get(const char *accountname)
 {
         struct account *account = NULL;
+        uint32_t hash = hashtab_strhash(accountname);
 
-        list_for_each_entry(account,
-                            &(account_list), list)
+        hashtab_for_each_entry(account, &account_index, hash, hnode)
         {
                 if(strcmp(cfgstr_get(&(account->cfg->name)), accountname) == 0)
                 {
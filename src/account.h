@@ -20,10 +20,17 @@
 #define _YADDNS_CTL_H_
 
 #include <sys/time.h>
+#include <time.h>
+#include <netinet/in.h>
 
 #include "list.h"
 #include "config.h"
 #include "service.h"
+#include "timer.h"
+#include "hashtab.h"
+#include "backoff.h"
+#include "resolv.h"
+#include "wan.h"
 
 struct account {
 	enum {
@@ -35,12 +42,78 @@ struct account {
         struct service *def;
 	struct cfg_account *cfg;
 	struct timeval last_update;
+        time_t updated_at;          /* wall clock of the last update */
+        struct in_addr ip;          /* sent by its last update */
         int updated; /* account is updated ? */
 	int locked;
 	int freezed;
-	struct timeval freeze_time;
-	struct timeval freeze_interval;
+	struct timer freeze_timer;  /* unfreeze the account */
+        struct backoff backoff;     /* failures since the last update */
+        struct backoff server_backoff; /* errors of the service since
+                                        * the last update */
+        struct backoff_policy retry; /* of its service */
+	struct timer refresh_timer; /* keepalive re-update */
+        uint64_t refresh_period;    /* ms, of its service */
+        uint64_t refresh_window;    /* ms, the refresh is in the last
+                                     * window of the period */
+        uint64_t refresh_phase;     /* hash of its name */
         struct list_head list;
+        struct hashtab_node hnode;  /* indexed by cfg name */
+        unsigned int generation;    /* remap which kept the account */
+        struct list_head queue;     /* in the dirty list or a ready
+                                     * queue */
+        int ready;                  /* in a ready queue, waiting for an
+                                     * update slot */
+        int parked;                 /* ready, but waiting for a slot of
+                                     * its service */
+        uint64_t queued_at;         /* timer_now() when queued */
+        int inflight;               /* holds an update slot */
+        unsigned int slot;          /* of its service for the slot */
+        struct hashtab_node bnode;  /* queued, by credentials */
+        struct list_head batch;     /* ring of the accounts updated by
+                                     * the same query */
+        unsigned int batch_pos;     /* of its hostname in the query */
+        unsigned int batch_size;    /* of the query it sends */
+        struct wan *wan;            /* source of its wan ip */
+        struct list_head wnode;     /* in the accounts of its wan */
+        struct resolv_query *precheck; /* dns check in progress */
+        int refreshing;             /* keepalive update, not skipped by
+                                     * the dns check */
+};
+
+/* admission of the updates (queue of the accounts waiting a slot) */
+struct account_stats {
+        unsigned int queued;        /* accounts waiting a slot */
+        unsigned int queued_high_water;
+        unsigned int parked;        /* queued ones waiting for a slot of
+                                     * their service */
+        unsigned int inflight;      /* updates in flight */
+        unsigned int inflight_high_water;
+        unsigned long dispatched;   /* updates given a slot */
+        unsigned long batched;      /* accounts updated by the query of
+                                     * another one */
+        unsigned long wait_total;   /* ms waited by the dispatched ones */
+        unsigned long wait_max;     /* ms */
+        unsigned long prechecked;   /* updates skipped, the dns already
+                                     * gave the wan ip */
+};
+
+/* what is kept of an account across restarts */
+struct account_state {
+        uint64_t fingerprint;       /* of its cfg */
+        struct in_addr ip;          /* pushed, 0 if not updated */
+        time_t updated_at;          /* 0 if not updated */
+        time_t freezed_until;       /* 0 if not freezed */
+        unsigned int attempts;      /* failures since the last update */
+        int locked;
+};
+
+/* what a remap did to the account ctls */
+struct account_mapreport {
+        unsigned int added;
+        unsigned int removed;
+        unsigned int changed;       /* reset for a new update */
+        unsigned int unchanged;     /* kept as they were */
 };
 
 /********* ctl.c *********/
@@ -53,7 +126,13 @@ extern void account_ctl_init(void);
 extern void account_ctl_cleanup(void);
 
 /* manage account list:
- * - unfreeze account if freeze time is over
+ * - queue the accounts which got dirty since the last call, once the
+ *   ip of their wan is known (with cfg precheck, once their hostname
+ *   is known not to resolve to it yet)
+ * - launch update procedure for the queued ones, by priority and in
+ *   order, as long as cfg inflight_max and service_inflight_max allow
+ *   it. The queued accounts of a service with batch_max, the same
+ *   credentials and the same wan are updated by the same query.
  * ...
  */
 extern void account_ctl_manage(const struct cfg *cfg);
@@ -62,6 +141,11 @@ extern void account_ctl_manage(const struct cfg *cfg);
  */
 extern void account_ctl_needupdate(void);
 
+/* the ip of wan has changed, set not updated its accounts which
+ * didn't push it
+ */
+extern void account_ctl_wanipchanged(struct wan *wan);
+
 /* unfreeze all accounts
  */
 extern void account_ctl_unfreeze_all(void);
@@ -69,11 +153,43 @@ extern void account_ctl_unfreeze_all(void);
 /* after reading cfg, create account controlers */
 extern int account_ctl_mapcfg(struct cfg *cfg);
 
-/* after reading a new cfg, resync controler */
-extern int account_ctl_mapnewcfg(const struct cfg *newcfg);
+/* after reading a new cfg, resync controler in O(accounts). The
+ * account cfgs are compared by fingerprint. report (if not NULL) is
+ * filled with what was done.
+ */
+extern int account_ctl_mapnewcfg(const struct cfg *newcfg,
+                                 struct account_mapreport *report);
 
 extern struct account *account_ctl_get(const char *accountname);
 
+/* when (timer_now() base) the account updated at now has to be
+ * refreshed: in the last refresh_window of its refresh_period, at the
+ * latest instant whose time modulo the window is the phase of the
+ * account. The refreshes of accounts updated together are spread over
+ * the window, and stay spread at the next periods.
+ */
+extern uint64_t account_refresh_at(const struct account *account,
+                                   uint64_t now);
+
+/* get the state of account to save it */
+extern void account_getstate(const struct account *account,
+                             struct account_state *state);
+
+/* restore the saved state of account, its cfg must have the same
+ * fingerprint. An account updated less than a refresh period ago
+ * isn't updated again (unless the wan ip differs).
+ */
+extern void account_setstate(struct account *account,
+                             const struct account_state *state);
+
+/* counter of the changes of the account states (updates, failures,
+ * remaps), to know whether they have to be saved again
+ */
+extern unsigned int account_ctl_state_generation(void);
+
+/* get the admission metrics */
+extern void account_ctl_stats(struct account_stats *stats);
+
 /********* services.c *********/
 extern struct list_head service_list;
 
@@ -0,0 +1,64 @@
+#include "backoff.h"
+
+/* state of the random delays (xorshift32, never 0) */
+static uint32_t backoff_random_state = 2463534242U;
+
+/*
+ * decs static functions
+ */
+static uint32_t backoff_random(void)
+{
+        uint32_t x = backoff_random_state;
+
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+
+        backoff_random_state = x;
+
+        return x;
+}
+
+/*
+ * decs API functions
+ */
+void backoff_ctl_seed(uint32_t seed)
+{
+        backoff_random_state = (seed != 0 ? seed : 2463534242U);
+}
+
+void backoff_reset(struct backoff *backoff)
+{
+        backoff->attempts = 0;
+}
+
+uint64_t backoff_ceiling(const struct backoff *backoff,
+                         const struct backoff_policy *policy)
+{
+        uint64_t ceiling = policy->min;
+        unsigned int i;
+
+        for(i = 0; i < backoff->attempts && ceiling < policy->max; ++i)
+        {
+                ceiling *= 2;
+        }
+
+        return (ceiling < policy->max ? ceiling : policy->max);
+}
+
+uint64_t backoff_next(struct backoff *backoff,
+                      const struct backoff_policy *policy)
+{
+        uint64_t ceiling = backoff_ceiling(backoff, policy);
+        uint64_t random;
+
+        if(ceiling < policy->max)
+        {
+                ++backoff->attempts;
+        }
+
+        /* 2 draws for the ceilings over 32 bits */
+        random = ((uint64_t)backoff_random() << 32) | backoff_random();
+
+        return ceiling / 2 + random % (ceiling - ceiling / 2 + 1);
+}
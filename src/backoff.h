@@ -0,0 +1,66 @@
+/*
+ *  Yaddns - Yet Another ddns client
+ *  Copyright (C) 2008 Anthony Viallard <anthony.viallard@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _YADDNS_BACKOFF_H_
+#define _YADDNS_BACKOFF_H_
+
+#include <stdint.h>
+
+/*
+ * This module computes the delays before retrying a failed action:
+ * exponential growth from the policy min, capped at the policy max,
+ * with equal jitter (a random delay between half the ceiling and the
+ * ceiling, so that the clients failing together don't retry together,
+ * but never right away).
+ *
+ * The n-th retry (from 0) is delayed in [c / 2, c], c = min(max, min * 2^n).
+ * A success resets the state to the first retry.
+ */
+
+struct backoff_policy {
+        uint64_t min;               /* in ms, ceiling of the 1st retry */
+        uint64_t max;               /* in ms, cap of the ceiling */
+};
+
+struct backoff {
+        unsigned int attempts;      /* retries since the last success */
+};
+
+/*
+ * Seed the random delays
+ */
+extern void backoff_ctl_seed(uint32_t seed);
+
+/*
+ * Forget the failures
+ */
+extern void backoff_reset(struct backoff *backoff);
+
+/*
+ * Ceiling of the next delay (without jitter)
+ */
+extern uint64_t backoff_ceiling(const struct backoff *backoff,
+                                const struct backoff_policy *policy);
+
+/*
+ * Delay in ms before the next retry, count a failure
+ */
+extern uint64_t backoff_next(struct backoff *backoff,
+                             const struct backoff_policy *policy);
+
+#endif
@@ -58,12 +58,27 @@ static inline int cfgstr_is_set(const struct cfgstr *cfgstr)
         return (cfgstr->s != cfgstr_status_notset);
 }
 
+/* cfgstrdst is unset if cfgstrsrc isn't set */
 static inline void cfgstr_copy(const struct cfgstr *cfgstrsrc,
                                struct cfgstr *cfgstrdst)
 {
+        if(!cfgstr_is_set(cfgstrsrc))
+        {
+                cfgstr_unset(cfgstrdst);
+                return;
+        }
+
         cfgstr_dup(cfgstrdst, cfgstrsrc->v.chs_const);
 }
 
+/* both unset or set to the same string */
+static inline int cfgstr_equal(const struct cfgstr *a,
+                               const struct cfgstr *b)
+{
+        return (cfgstr_is_set(a) == cfgstr_is_set(b)
+                && strcmp(cfgstr_get(a), cfgstr_get(b)) == 0);
+}
+
 static inline void cfgstr_move(struct cfgstr *cfgstrsrc,
                                struct cfgstr *cfgstrdst)
 {
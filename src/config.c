@@ -6,6 +6,8 @@
 #include <string.h>
 #include <getopt.h>
 #include <limits.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "config.h"
 #include "log.h"
@@ -15,6 +17,62 @@
 
 #define CFG_DEFAULT_FILENAME "/etc/yaddns.conf"
 #define CFG_DEFAULT_WANIFNAME "ppp0"
+#define CFG_DEFAULT_REQUEST_RESERVE 8
+#define CFG_MAX_REQUEST_RESERVE 4096
+#define CFG_DEFAULT_INFLIGHT_MAX 32
+#define CFG_DEFAULT_SERVICE_INFLIGHT_MAX 8
+#define CFG_MAX_INFLIGHT 4096
+#define CFG_MAX_RETRY 86400
+#define CFG_DEFAULT_REFRESH_WINDOW 86400
+#define CFG_MAX_REFRESH 31536000
+#define CFG_DEFAULT_PRECHECK_PORT 53
+
+/* myip interval while the changes of the wan are followed */
+#define CFG_DEFAULT_MYIP_SAFETY_UPINT 3600
+
+/* agreeing answers in the myip quorum mode */
+#define CFG_DEFAULT_MYIP_QUORUM 2
+
+/* port of a myip_provider without one */
+#define CFG_DEFAULT_MYIP_PORT 80
+
+/* port of a stun_server without one (RFC 5389) */
+#define CFG_DEFAULT_STUN_PORT 3478
+#define CFG_DEFAULT_STUN_RTO 500
+#define CFG_MAX_STUN_RTO 60000
+#define CFG_DEFAULT_STUN_UPINT 60
+
+#define CFG_DEFAULT_DNS_PORT 53
+#define CFG_DEFAULT_DNS_UPINT 60
+
+static void config_account_free(struct cfg_account *accountcfg);
+static void config_service_free(struct cfg_service *servicecfg);
+static void config_wan_free(struct cfg_wan *wancfg);
+
+/*
+ * a "name {" line opens a block
+ */
+static int config_is_block(const char *n)
+{
+        const char *t = n;
+
+        while(isalpha((unsigned char)*t))
+        {
+                t++;
+        }
+
+        if(t == n)
+        {
+                return 0;
+        }
+
+        while(isspace((unsigned char)*t))
+        {
+                t++;
+        }
+
+        return (t[0] == '{' && t[1] == '\0');
+}
 
 /*
  * spaces = space, \f, \n, \r, \t and \v
@@ -59,36 +117,20 @@ static int config_get_assignment(FILE *file, char *buffer, int buffer_size,
                         continue;
                 }
 
-                /* account definition ? */
-                if(memcmp(n, "account", sizeof("account") - 1) == 0)
+                /* block definition (account, service or wan) ? */
+                if(config_is_block(n))
                 {
-                        /* maybe a account line definition ? */
-                        if((equals = strchr(n, '{')) != NULL)
+                        /* end the block name at a space or { */
+                        t = n;
+                        while(isalpha((unsigned char)*t))
                         {
-                                /* remove whitespaces before { */
-                                for(t = equals - 1;
-                                    t > n && isspace(*t);
-                                    t--)
-                                {
-                                        *t = '\0';
-                                }
-
-                                /* maybe { is glued to account ? */
-                                *equals = '\0';
-
-                                *name = n;
-                                *value = NULL;
-                                ret = 0;
-                        }
-                        else
-                        {
-                                log_error("parsing error at '%s'. Invalid "
-                                          "account declaration. "
-                                          "(file %s - line %d)",
-                                          n, filename, (*linenum));
-                                ret = -1;
+                                t++;
                         }
+                        *t = '\0';
 
+                        *name = n;
+                        *value = NULL;
+                        ret = 0;
                         break;
                 }
 
@@ -152,6 +194,574 @@ static int config_get_assignment(FILE *file, char *buffer, int buffer_size,
         return ret;
 }
 
+static void config_myip_init(struct cfg_myip *myip)
+{
+        myip->quorum = CFG_DEFAULT_MYIP_QUORUM;
+        myip->safety_upint = CFG_DEFAULT_MYIP_SAFETY_UPINT;
+}
+
+/*
+ * add the myip provider "host[:port][/path]" after the first one
+ * (myip_host, myip_port and myip_path)
+ */
+static int config_myip_provider_add(struct cfg_myip *myip, const char *value)
+{
+        struct cfg_myip_provider *provider = NULL;
+        const char *path = strchr(value, '/');
+        const char *colon = NULL;
+        size_t hostlen = (path != NULL
+                          ? (size_t)(path - value) : strlen(value));
+        char host[256];
+        char port[8];
+        long n = CFG_DEFAULT_MYIP_PORT;
+
+        /* the first slot may stay unused, the limit is checked again
+         * without it
+         */
+        if(MAX(myip->count, 1u) > CFG_MYIP_MAX)
+        {
+                log_error("Too many myip providers (%d max)", CFG_MYIP_MAX);
+                return -1;
+        }
+
+        colon = memchr(value, ':', hostlen);
+        if(colon != NULL)
+        {
+                if((size_t)(value + hostlen - colon) > sizeof(port))
+                {
+                        log_error("Invalid myip provider %s", value);
+                        return -1;
+                }
+
+                snprintf(port, sizeof(port), "%.*s",
+                         (int)(value + hostlen - colon - 1), colon + 1);
+                n = strtol_safe(port, -1);
+                hostlen = (size_t)(colon - value);
+        }
+
+        if(hostlen == 0 || hostlen >= sizeof(host) || n <= 0 || n > 65535)
+        {
+                log_error("Invalid myip provider %s", value);
+                return -1;
+        }
+
+        snprintf(host, sizeof(host), "%.*s", (int)hostlen, value);
+
+        myip->count = MAX(myip->count, 1u);
+        provider = &(myip->provider[myip->count++]);
+        cfgstr_dup(&(provider->host), host);
+        provider->port = (unsigned short int)n;
+        cfgstr_dup(&(provider->path), (path != NULL ? path : "/"));
+
+        return 0;
+}
+
+/*
+ * the myip options shared by the general configuration and the wan
+ * blocks (but host, port, path and upint)
+ *
+ * @return 0 if success, -1 if the value is invalid, 1 if name isn't
+ *         one of them
+ */
+static int config_myip_option(struct cfg_myip *myip,
+                              const char *name, const char *value)
+{
+        long n;
+
+        if(strcmp(name, "myip_provider") == 0)
+        {
+                return config_myip_provider_add(myip, value);
+        }
+        else if(strcmp(name, "myip_mode") == 0)
+        {
+                if(strcmp(value, "failover") == 0)
+                {
+                        myip->mode = cfg_myip_failover;
+                }
+                else if(strcmp(value, "race") == 0)
+                {
+                        myip->mode = cfg_myip_race;
+                }
+                else if(strcmp(value, "quorum") == 0)
+                {
+                        myip->mode = cfg_myip_quorum;
+                }
+                else
+                {
+                        log_error("Invalid myip mode %s", value);
+                        return -1;
+                }
+        }
+        else if(strcmp(name, "myip_quorum") == 0)
+        {
+                n = strtol_safe(value, -1);
+                if(n <= 0 || n > CFG_MYIP_MAX)
+                {
+                        log_error("Invalid myip quorum %s", value);
+                        return -1;
+                }
+
+                myip->quorum = (unsigned int)n;
+        }
+        else if(strcmp(name, "myip_safety_upint") == 0)
+        {
+                n = strtol_safe(value, -1);
+                if(n < 0 || n > INT_MAX)
+                {
+                        log_error("Invalid myip safety upint %s", value);
+                        return -1;
+                }
+
+                myip->safety_upint = (int)n;
+        }
+        else
+        {
+                return 1;
+        }
+
+        return 0;
+}
+
+/*
+ * the providers are complete (the first one can be given by
+ * myip_provider lines only), and enough for the quorum
+ */
+static int config_myip_check(struct cfg_myip *myip)
+{
+        unsigned int i;
+
+        if(myip->count > 1 && !cfgstr_is_set(&(myip->provider[0].host))
+           && !cfgstr_is_set(&(myip->provider[0].path))
+           && myip->provider[0].port == 0)
+        {
+                memmove(&(myip->provider[0]), &(myip->provider[1]),
+                        sizeof(struct cfg_myip_provider) * (myip->count - 1));
+                memset(&(myip->provider[--myip->count]), 0,
+                       sizeof(struct cfg_myip_provider));
+        }
+
+        if(myip->count == 0 || myip->upint == 0)
+        {
+                return -1;
+        }
+
+        if(myip->count > CFG_MYIP_MAX)
+        {
+                log_error("Too many myip providers (%d max)", CFG_MYIP_MAX);
+                return -1;
+        }
+
+        for(i = 0; i < myip->count; ++i)
+        {
+                if(!cfgstr_is_set(&(myip->provider[i].host))
+                   || myip->provider[i].port == 0
+                   || !cfgstr_is_set(&(myip->provider[i].path)))
+                {
+                        return -1;
+                }
+        }
+
+        if(myip->mode == cfg_myip_quorum && myip->quorum > myip->count)
+        {
+                log_error("A myip quorum of %u needs as many providers",
+                          myip->quorum);
+                return -1;
+        }
+
+        return 0;
+}
+
+void config_myip_free(struct cfg_myip *myip)
+{
+        unsigned int i;
+
+        for(i = 0; i < ARRAY_SIZE(myip->provider); ++i)
+        {
+                cfgstr_unset(&(myip->provider[i].host));
+                cfgstr_unset(&(myip->provider[i].path));
+        }
+}
+
+void config_myip_copy(const struct cfg_myip *src, struct cfg_myip *dst)
+{
+        unsigned int i;
+
+        for(i = 0; i < ARRAY_SIZE(src->provider); ++i)
+        {
+                cfgstr_copy(&(src->provider[i].host),
+                            &(dst->provider[i].host));
+                cfgstr_copy(&(src->provider[i].path),
+                            &(dst->provider[i].path));
+                dst->provider[i].port = src->provider[i].port;
+        }
+
+        dst->count = src->count;
+        dst->mode = src->mode;
+        dst->quorum = src->quorum;
+        dst->upint = src->upint;
+        dst->safety_upint = src->safety_upint;
+}
+
+int config_myip_equal(const struct cfg_myip *a, const struct cfg_myip *b)
+{
+        unsigned int i;
+
+        if(a->count != b->count || a->mode != b->mode
+           || a->quorum != b->quorum || a->upint != b->upint
+           || a->safety_upint != b->safety_upint)
+        {
+                return 0;
+        }
+
+        for(i = 0; i < a->count; ++i)
+        {
+                if(!cfgstr_equal(&(a->provider[i].host),
+                                 &(b->provider[i].host))
+                   || !cfgstr_equal(&(a->provider[i].path),
+                                    &(b->provider[i].path))
+                   || a->provider[i].port != b->provider[i].port)
+                {
+                        return 0;
+                }
+        }
+
+        return 1;
+}
+
+static void config_myip_move(struct cfg_myip *src, struct cfg_myip *dst)
+{
+        unsigned int i;
+
+        for(i = 0; i < ARRAY_SIZE(src->provider); ++i)
+        {
+                cfgstr_move(&(src->provider[i].host),
+                            &(dst->provider[i].host));
+                cfgstr_move(&(src->provider[i].path),
+                            &(dst->provider[i].path));
+                dst->provider[i].port = src->provider[i].port;
+        }
+
+        dst->count = src->count;
+        dst->mode = src->mode;
+        dst->quorum = src->quorum;
+        dst->upint = src->upint;
+        dst->safety_upint = src->safety_upint;
+}
+
+static void config_stun_init(struct cfg_stun *stun)
+{
+        stun->rto = CFG_DEFAULT_STUN_RTO;
+        stun->upint = CFG_DEFAULT_STUN_UPINT;
+}
+
+/*
+ * add the stun server "host[:port]"
+ */
+static int config_stun_server_add(struct cfg_stun *stun, const char *value)
+{
+        struct cfg_stun_server *server = NULL;
+        const char *colon = strchr(value, ':');
+        size_t hostlen = (colon != NULL
+                          ? (size_t)(colon - value) : strlen(value));
+        char host[256];
+        long n = CFG_DEFAULT_STUN_PORT;
+
+        if(stun->count >= CFG_STUN_MAX)
+        {
+                log_error("Too many stun servers (%d max)", CFG_STUN_MAX);
+                return -1;
+        }
+
+        if(colon != NULL)
+        {
+                n = strtol_safe(colon + 1, -1);
+        }
+
+        if(hostlen == 0 || hostlen >= sizeof(host) || n <= 0 || n > 65535)
+        {
+                log_error("Invalid stun server %s", value);
+                return -1;
+        }
+
+        snprintf(host, sizeof(host), "%.*s", (int)hostlen, value);
+
+        server = &(stun->server[stun->count++]);
+        cfgstr_dup(&(server->host), host);
+        server->port = (unsigned short int)n;
+
+        return 0;
+}
+
+/*
+ * the stun options shared by the general configuration and the wan
+ * blocks
+ *
+ * @return 0 if success, -1 if the value is invalid, 1 if name isn't
+ *         one of them
+ */
+static int config_stun_option(struct cfg_stun *stun,
+                              const char *name, const char *value)
+{
+        long n;
+
+        if(strcmp(name, "stun_server") == 0)
+        {
+                return config_stun_server_add(stun, value);
+        }
+        else if(strcmp(name, "stun_rto") == 0)
+        {
+                n = strtol_safe(value, -1);
+                if(n <= 0 || n > CFG_MAX_STUN_RTO)
+                {
+                        log_error("Invalid stun rto %s", value);
+                        return -1;
+                }
+
+                stun->rto = (unsigned int)n;
+        }
+        else if(strcmp(name, "stun_upint") == 0)
+        {
+                n = strtol_safe(value, -1);
+                if(n <= 0 || n > INT_MAX)
+                {
+                        log_error("Invalid stun upint %s", value);
+                        return -1;
+                }
+
+                stun->upint = (int)n;
+        }
+        else
+        {
+                return 1;
+        }
+
+        return 0;
+}
+
+void config_stun_free(struct cfg_stun *stun)
+{
+        unsigned int i;
+
+        for(i = 0; i < CFG_STUN_MAX; ++i)
+        {
+                cfgstr_unset(&(stun->server[i].host));
+        }
+}
+
+void config_stun_copy(const struct cfg_stun *src, struct cfg_stun *dst)
+{
+        unsigned int i;
+
+        for(i = 0; i < CFG_STUN_MAX; ++i)
+        {
+                cfgstr_copy(&(src->server[i].host), &(dst->server[i].host));
+                dst->server[i].port = src->server[i].port;
+        }
+
+        dst->count = src->count;
+        dst->rto = src->rto;
+        dst->upint = src->upint;
+}
+
+int config_stun_equal(const struct cfg_stun *a, const struct cfg_stun *b)
+{
+        unsigned int i;
+
+        if(a->count != b->count || a->rto != b->rto || a->upint != b->upint)
+        {
+                return 0;
+        }
+
+        for(i = 0; i < a->count; ++i)
+        {
+                if(!cfgstr_equal(&(a->server[i].host), &(b->server[i].host))
+                   || a->server[i].port != b->server[i].port)
+                {
+                        return 0;
+                }
+        }
+
+        return 1;
+}
+
+static void config_stun_move(struct cfg_stun *src, struct cfg_stun *dst)
+{
+        unsigned int i;
+
+        for(i = 0; i < CFG_STUN_MAX; ++i)
+        {
+                cfgstr_move(&(src->server[i].host), &(dst->server[i].host));
+                dst->server[i].port = src->server[i].port;
+        }
+
+        dst->count = src->count;
+        dst->rto = src->rto;
+        dst->upint = src->upint;
+}
+
+static void config_dnsip_init(struct cfg_dnsip *dnsip)
+{
+        dnsip->port = CFG_DEFAULT_DNS_PORT;
+        dnsip->mixcase = 1;
+        dnsip->upint = CFG_DEFAULT_DNS_UPINT;
+}
+
+/*
+ * the dns options shared by the general configuration and the wan
+ * blocks
+ *
+ * @return 0 if success, -1 if the value is invalid, 1 if name isn't
+ *         one of them
+ */
+static int config_dnsip_option(struct cfg_dnsip *dnsip,
+                               const char *name, const char *value)
+{
+        struct in_addr addr;
+        long n;
+
+        if(strcmp(name, "dns_name") == 0)
+        {
+                cfgstr_dup(&(dnsip->name), value);
+        }
+        else if(strcmp(name, "dns_server") == 0)
+        {
+                /* numeric, no resolution to find the resolver */
+                if(inet_pton(AF_INET, value, &addr) != 1)
+                {
+                        log_error("Invalid dns server %s (an ipv4 address"
+                                  " is expected)", value);
+                        return -1;
+                }
+
+                cfgstr_dup(&(dnsip->server), value);
+        }
+        else if(strcmp(name, "dns_port") == 0)
+        {
+                n = strtol_safe(value, -1);
+                if(n <= 0 || n > 65535)
+                {
+                        log_error("Invalid dns port %s", value);
+                        return -1;
+                }
+
+                dnsip->port = (unsigned short int)n;
+        }
+        else if(strcmp(name, "dns_0x20") == 0)
+        {
+                n = strtol_safe(value, -1);
+                if(n != 0 && n != 1)
+                {
+                        log_error("Invalid dns 0x20 %s", value);
+                        return -1;
+                }
+
+                dnsip->mixcase = (int)n;
+        }
+        else if(strcmp(name, "dns_upint") == 0)
+        {
+                n = strtol_safe(value, -1);
+                if(n <= 0 || n > INT_MAX)
+                {
+                        log_error("Invalid dns upint %s", value);
+                        return -1;
+                }
+
+                dnsip->upint = (int)n;
+        }
+        else
+        {
+                return 1;
+        }
+
+        return 0;
+}
+
+static int config_dnsip_check(const struct cfg_dnsip *dnsip)
+{
+        if(!cfgstr_is_set(&(dnsip->name)) || !cfgstr_is_set(&(dnsip->server)))
+        {
+                log_error("The dns mode needs a dns_name and a dns_server");
+                return -1;
+        }
+
+        return 0;
+}
+
+void config_dnsip_free(struct cfg_dnsip *dnsip)
+{
+        cfgstr_unset(&(dnsip->name));
+        cfgstr_unset(&(dnsip->server));
+}
+
+void config_dnsip_copy(const struct cfg_dnsip *src, struct cfg_dnsip *dst)
+{
+        cfgstr_copy(&(src->name), &(dst->name));
+        cfgstr_copy(&(src->server), &(dst->server));
+        dst->port = src->port;
+        dst->mixcase = src->mixcase;
+        dst->upint = src->upint;
+}
+
+int config_dnsip_equal(const struct cfg_dnsip *a, const struct cfg_dnsip *b)
+{
+        return (cfgstr_equal(&(a->name), &(b->name))
+                && cfgstr_equal(&(a->server), &(b->server))
+                && a->port == b->port
+                && a->mixcase == b->mixcase
+                && a->upint == b->upint);
+}
+
+static void config_dnsip_move(struct cfg_dnsip *src, struct cfg_dnsip *dst)
+{
+        cfgstr_move(&(src->name), &(dst->name));
+        cfgstr_move(&(src->server), &(dst->server));
+        dst->port = src->port;
+        dst->mixcase = src->mixcase;
+        dst->upint = src->upint;
+}
+
+/*
+ * a wan block needs a new name and the settings of its mode
+ */
+static int config_wan_check(const struct cfg *cfg,
+                            struct cfg_wan *wancfg)
+{
+        if(!cfgstr_is_set(&(wancfg->name))
+           || config_wan_get(cfg, cfgstr_get(&(wancfg->name))) != NULL)
+        {
+                log_error("A wan needs a name of its own");
+                return -1;
+        }
+
+        if(wancfg->type == wan_cnt_direct
+           && !cfgstr_is_set(&(wancfg->ifname)))
+        {
+                log_error("A direct wan needs an ifname");
+                return -1;
+        }
+
+        if(wancfg->type == wan_cnt_indirect
+           && config_myip_check(&(wancfg->myip)) != 0)
+        {
+                log_error("Invalid myip definition(s)");
+                return -1;
+        }
+
+        if(wancfg->type == wan_cnt_stun && wancfg->stun.count == 0)
+        {
+                log_error("A stun wan needs a stun_server");
+                return -1;
+        }
+
+        if(wancfg->type == wan_cnt_dns
+           && config_dnsip_check(&(wancfg->dnsip)) != 0)
+        {
+                return -1;
+        }
+
+        return 0;
+}
+
 int config_parse(struct cfg *cfg, int argc, char **argv)
 {
         int cfgfile_flag = 0;
@@ -261,6 +871,12 @@ int config_parse_file(struct cfg *cfg)
         int accountdef_scope = 0;
         struct cfg_account *accountcfg = NULL,
                 *safe_accountcfg = NULL;
+        int servicedef_scope = 0;
+        struct cfg_service *servicecfg = NULL,
+                *safe_servicecfg = NULL;
+        int wandef_scope = 0;
+        struct cfg_wan *wancfg = NULL,
+                *safe_wancfg = NULL;
         int myip_assign_count = 0;
         const char *filename = NULL;
 
@@ -299,59 +915,348 @@ int config_parse_file(struct cfg *cfg)
                                    || !cfgstr_is_set(&(accountcfg->passwd))
                                    || !cfgstr_is_set(&(accountcfg->hostname)))
                                 {
-                                        log_error("Missing value(s) for "
-                                                  "account name '%s' service '%s'"
-                                                  "(file %s - line %d)",
-                                                  cfgstr_get(&(accountcfg->name)),
-                                                  cfgstr_get(&(accountcfg->service)),
+                                        log_error("Missing value(s) for "
+                                                  "account name '%s' service '%s'"
+                                                  "(file %s - line %d)",
+                                                  cfgstr_get(&(accountcfg->name)),
+                                                  cfgstr_get(&(accountcfg->service)),
+                                                  filename, linenum);
+
+                                        cfgstr_unset(&(accountcfg->name));
+                                        cfgstr_unset(&(accountcfg->service));
+                                        cfgstr_unset(&(accountcfg->username));
+                                        cfgstr_unset(&(accountcfg->passwd));
+                                        cfgstr_unset(&(accountcfg->hostname));
+                                        cfgstr_unset(&(accountcfg->wan));
+                                        free(accountcfg);
+
+                                        ret = -1;
+                                        break;
+                                }
+
+                                config_account_add(cfg, accountcfg);
+                        }
+                        else if(strcmp(name, "name") == 0)
+                        {
+                                cfgstr_dup(&(accountcfg->name), value);
+                        }
+                        else if(strcmp(name, "service") == 0)
+                        {
+                                cfgstr_dup(&(accountcfg->service), value);
+                        }
+                        else if(strcmp(name, "username") == 0)
+                        {
+                                cfgstr_dup(&(accountcfg->username), value);
+                        }
+                        else if(strcmp(name, "password") == 0)
+                        {
+                                cfgstr_dup(&(accountcfg->passwd), value);
+                        }
+                        else if(strcmp(name, "hostname") == 0)
+                        {
+                                cfgstr_dup(&(accountcfg->hostname), value);
+                        }
+                        else if(strcmp(name, "wan") == 0)
+                        {
+                                cfgstr_dup(&(accountcfg->wan), value);
+                        }
+                        else if(strcmp(name, "priority") == 0)
+                        {
+                                if(strcmp(value, "high") == 0)
+                                {
+                                        accountcfg->priority =
+                                                cfg_priority_high;
+                                }
+                                else if(strcmp(value, "normal") == 0)
+                                {
+                                        accountcfg->priority =
+                                                cfg_priority_normal;
+                                }
+                                else if(strcmp(value, "low") == 0)
+                                {
+                                        accountcfg->priority =
+                                                cfg_priority_low;
+                                }
+                                else
+                                {
+                                        log_error("Invalid priority %s for"
+                                                  " account name '%s'"
+                                                  " (file %s line %d)",
+                                                  value,
+                                                  cfgstr_get(&(accountcfg->name)),
+                                                  filename, linenum);
+
+                                        ret = -1;
+                                        break;
+                                }
+                        }
+                        else
+                        {
+                                log_error("Invalid option name '%s' for "
+                                          "account name '%s' (file %s line %d)",
+                                          name, cfgstr_get(&(accountcfg->name)),
+                                          filename, linenum);
+
+                                ret = -1;
+                                break;
+                        }
+                }
+                else if(servicedef_scope)
+                {
+                        if(name == NULL)
+                        {
+                                servicedef_scope = 0;
+
+                                /* check and insert */
+                                if(services_get(cfgstr_get(&(servicecfg->name)))
+                                   == NULL)
+                                {
+                                        log_error("No service named '%s'"
+                                                  " available (file %s"
+                                                  " - line %d)",
+                                                  cfgstr_get(&(servicecfg->name)),
+                                                  filename, linenum);
+                                        config_service_free(servicecfg);
+
+                                        ret = -1;
+                                        break;
+                                }
+
+                                if(servicecfg->retry_min != 0
+                                   && servicecfg->retry_max != 0
+                                   && servicecfg->retry_min
+                                   > servicecfg->retry_max)
+                                {
+                                        log_error("retry_min is over retry_max"
+                                                  " for service '%s' (file %s"
+                                                  " - line %d)",
+                                                  cfgstr_get(&(servicecfg->name)),
+                                                  filename, linenum);
+                                        config_service_free(servicecfg);
+
+                                        ret = -1;
+                                        break;
+                                }
+
+                                list_add_tail(&(servicecfg->list),
+                                              &(cfg->service_list));
+                        }
+                        else if(strcmp(name, "name") == 0)
+                        {
+                                cfgstr_dup(&(servicecfg->name), value);
+                        }
+                        else if(strcmp(name, "retry_min") == 0
+                                || strcmp(name, "retry_max") == 0)
+                        {
+                                n = strtol_safe(value, -1);
+                                if(n <= 0 || n > CFG_MAX_RETRY)
+                                {
+                                        log_error("Invalid %s %s for service"
+                                                  " '%s' (file %s line %d)",
+                                                  name, value,
+                                                  cfgstr_get(&(servicecfg->name)),
+                                                  filename, linenum);
+
+                                        ret = -1;
+                                        break;
+                                }
+
+                                if(strcmp(name, "retry_min") == 0)
+                                {
+                                        servicecfg->retry_min = (unsigned int)n;
+                                }
+                                else
+                                {
+                                        servicecfg->retry_max = (unsigned int)n;
+                                }
+                        }
+                        else if(strcmp(name, "refresh") == 0)
+                        {
+                                n = strtol_safe(value, -1);
+                                if(n <= 0 || n > CFG_MAX_REFRESH)
+                                {
+                                        log_error("Invalid refresh %s for"
+                                                  " service '%s' (file %s"
+                                                  " line %d)",
+                                                  value,
+                                                  cfgstr_get(&(servicecfg->name)),
+                                                  filename, linenum);
+
+                                        ret = -1;
+                                        break;
+                                }
+
+                                servicecfg->refresh = (unsigned int)n;
+                        }
+                        else
+                        {
+                                log_error("Invalid option name '%s' for "
+                                          "service '%s' (file %s line %d)",
+                                          name, cfgstr_get(&(servicecfg->name)),
+                                          filename, linenum);
+
+                                ret = -1;
+                                break;
+                        }
+                }
+                else if(wandef_scope)
+                {
+                        if(name == NULL)
+                        {
+                                wandef_scope = 0;
+
+                                /* check and insert */
+                                if(config_wan_check(cfg, wancfg) != 0)
+                                {
+                                        log_error("Invalid wan '%s'"
+                                                  " (file %s - line %d)",
+                                                  cfgstr_get(&(wancfg->name)),
                                                   filename, linenum);
-
-                                        cfgstr_unset(&(accountcfg->name));
-                                        cfgstr_unset(&(accountcfg->service));
-                                        cfgstr_unset(&(accountcfg->username));
-                                        cfgstr_unset(&(accountcfg->passwd));
-                                        cfgstr_unset(&(accountcfg->hostname));
-                                        free(accountcfg);
+                                        config_wan_free(wancfg);
 
                                         ret = -1;
                                         break;
                                 }
 
-                                list_add(&(accountcfg->list),
-                                         &(cfg->account_list));
+                                list_add_tail(&(wancfg->list),
+                                              &(cfg->wan_list));
                         }
                         else if(strcmp(name, "name") == 0)
                         {
-                                cfgstr_dup(&(accountcfg->name), value);
+                                cfgstr_dup(&(wancfg->name), value);
                         }
-                        else if(strcmp(name, "service") == 0)
+                        else if(strcmp(name, "mode") == 0)
                         {
-                                cfgstr_dup(&(accountcfg->service), value);
+                                if(strcmp(value, "direct") == 0)
+                                {
+                                        wancfg->type = wan_cnt_direct;
+                                }
+                                else if(strcmp(value, "indirect") == 0)
+                                {
+                                        wancfg->type = wan_cnt_indirect;
+                                }
+                                else if(strcmp(value, "stun") == 0)
+                                {
+                                        wancfg->type = wan_cnt_stun;
+                                }
+                                else if(strcmp(value, "dns") == 0)
+                                {
+                                        wancfg->type = wan_cnt_dns;
+                                }
+                                else
+                                {
+                                        log_error("Invalid mode %s for wan"
+                                                  " '%s' (file %s line %d)",
+                                                  value,
+                                                  cfgstr_get(&(wancfg->name)),
+                                                  filename, linenum);
+
+                                        ret = -1;
+                                        break;
+                                }
                         }
-                        else if(strcmp(name, "username") == 0)
+                        else if(strcmp(name, "ifname") == 0)
                         {
-                                cfgstr_dup(&(accountcfg->username), value);
+                                cfgstr_dup(&(wancfg->ifname), value);
                         }
-                        else if(strcmp(name, "password") == 0)
+                        else if(strcmp(name, "myip_host") == 0)
                         {
-                                cfgstr_dup(&(accountcfg->passwd), value);
+                                cfgstr_dup(&(wancfg->myip.provider[0].host),
+                                           value);
+                                wancfg->myip.count =
+                                        MAX(wancfg->myip.count, 1u);
                         }
-                        else if(strcmp(name, "hostname") == 0)
+                        else if(strcmp(name, "myip_path") == 0)
                         {
-                                cfgstr_dup(&(accountcfg->hostname), value);
+                                cfgstr_dup(&(wancfg->myip.provider[0].path),
+                                           value);
+                                wancfg->myip.count =
+                                        MAX(wancfg->myip.count, 1u);
+                        }
+                        else if((n = config_myip_option(&(wancfg->myip),
+                                                        name, value)) != 1
+                                || (n = config_stun_option(&(wancfg->stun),
+                                                           name, value)) != 1
+                                || (n = config_dnsip_option(&(wancfg->dnsip),
+                                                            name, value)) != 1)
+                        {
+                                if(n != 0)
+                                {
+                                        log_error("Invalid %s %s for wan"
+                                                  " '%s' (file %s line %d)",
+                                                  name, value,
+                                                  cfgstr_get(&(wancfg->name)),
+                                                  filename, linenum);
+
+                                        ret = -1;
+                                        break;
+                                }
+                        }
+                        else if(strcmp(name, "myip_port") == 0
+                                || strcmp(name, "myip_upint") == 0)
+                        {
+                                n = strtol_safe(value, -1);
+                                if(n <= 0
+                                   || (strcmp(name, "myip_port") == 0
+                                       && n > 65535)
+                                   || n > INT_MAX)
+                                {
+                                        log_error("Invalid %s %s for wan"
+                                                  " '%s' (file %s line %d)",
+                                                  name, value,
+                                                  cfgstr_get(&(wancfg->name)),
+                                                  filename, linenum);
+
+                                        ret = -1;
+                                        break;
+                                }
+
+                                if(strcmp(name, "myip_port") == 0)
+                                {
+                                        wancfg->myip.provider[0].port =
+                                                (unsigned short int)n;
+                                        wancfg->myip.count =
+                                                MAX(wancfg->myip.count, 1u);
+                                }
+                                else
+                                {
+                                        wancfg->myip.upint = (int)n;
+                                }
                         }
                         else
                         {
                                 log_error("Invalid option name '%s' for "
-                                          "account name '%s' (file %s line %d)",
-                                          name, cfgstr_get(&(accountcfg->name)),
+                                          "wan '%s' (file %s line %d)",
+                                          name, cfgstr_get(&(wancfg->name)),
                                           filename, linenum);
 
                                 ret = -1;
                                 break;
                         }
                 }
-                else if(strcmp(name, "account") == 0)
+                else if(name == NULL)
+                {
+                        log_error("Unexpected '}' (file %s line %d)",
+                                  filename, linenum);
+                        ret = -1;
+                        break;
+                }
+                else if(value == NULL && strcmp(name, "wan") == 0)
+                {
+                        wandef_scope = 1;
+                        wancfg = calloc(1, sizeof(struct cfg_wan));
+                        config_myip_init(&(wancfg->myip));
+                        config_stun_init(&(wancfg->stun));
+                        config_dnsip_init(&(wancfg->dnsip));
+                        log_debug("add wancfg '%p'", wancfg);
+                }
+                else if(value == NULL && strcmp(name, "service") == 0)
+                {
+                        servicedef_scope = 1;
+                        servicecfg = calloc(1, sizeof(struct cfg_service));
+                        log_debug("add servicecfg '%p'", servicecfg);
+                }
+                else if(value == NULL && strcmp(name, "account") == 0)
                 {
                         accountdef_scope = 1;
                         accountcfg = calloc(1, sizeof(struct cfg_account));
@@ -361,12 +1266,52 @@ int config_parse_file(struct cfg *cfg)
                 {
                         cfgstr_dup(&(cfg->wan_ifname), value);
                 }
+                else if(strcmp(name, "precheck") == 0)
+                {
+                        n = strtol_safe(value, -1);
+                        if(n != 0 && n != 1)
+                        {
+                                log_error("Invalid precheck %s", value);
+                                ret = -1;
+                                break;
+                        }
+
+                        cfg->precheck = (int)n;
+                }
+                else if(strcmp(name, "precheck_server") == 0)
+                {
+                        cfgstr_dup(&(cfg->precheck_server), value);
+                }
+                else if(strcmp(name, "precheck_port") == 0)
+                {
+                        n = strtol_safe(value, -1);
+                        if(n <= 0 || n > 65535)
+                        {
+                                log_error("Invalid precheck port %s", value);
+                                ret = -1;
+                                break;
+                        }
+
+                        cfg->precheck_port = (unsigned short int)n;
+                }
+                else if(strcmp(name, "state_file") == 0)
+                {
+                        cfgstr_dup(&(cfg->statefile), value);
+                }
                 else if(strcmp(name, "mode") == 0)
                 {
                         if(strcmp(value, "indirect") == 0)
                         {
                                 cfg->wan_cnt_type = wan_cnt_indirect;
                         }
+                        else if(strcmp(value, "stun") == 0)
+                        {
+                                cfg->wan_cnt_type = wan_cnt_stun;
+                        }
+                        else if(strcmp(value, "dns") == 0)
+                        {
+                                cfg->wan_cnt_type = wan_cnt_dns;
+                        }
                         else
                         {
                                 cfg->wan_cnt_type = wan_cnt_direct;
@@ -374,7 +1319,8 @@ int config_parse_file(struct cfg *cfg)
                 }
                 else if(strcmp(name, "myip_host") == 0)
                 {
-                        cfgstr_dup(&(cfg->myip.host), value);
+                        cfgstr_dup(&(cfg->myip.provider[0].host), value);
+                        cfg->myip.count = MAX(cfg->myip.count, 1u);
                         ++myip_assign_count;
                 }
                 else if(strcmp(name, "myip_port") == 0)
@@ -387,14 +1333,66 @@ int config_parse_file(struct cfg *cfg)
                                 break;
                         }
 
-                        cfg->myip.port = (unsigned short int)n;
+                        cfg->myip.provider[0].port = (unsigned short int)n;
+                        cfg->myip.count = MAX(cfg->myip.count, 1u);
                         ++myip_assign_count;
                 }
                 else if(strcmp(name, "myip_path") == 0)
                 {
-                        cfgstr_dup(&(cfg->myip.path), value);
+                        cfgstr_dup(&(cfg->myip.provider[0].path), value);
+                        cfg->myip.count = MAX(cfg->myip.count, 1u);
                         ++myip_assign_count;
                 }
+                else if(strcmp(name, "request_reserve") == 0)
+                {
+                        n = strtol_safe(value, -1);
+                        if(n < 0 || n > CFG_MAX_REQUEST_RESERVE)
+                        {
+                                log_error("Invalid request reserve %s",
+                                          value);
+                                ret = -1;
+                                break;
+                        }
+
+                        cfg->request_reserve = (unsigned int)n;
+                }
+                else if(strcmp(name, "inflight_max") == 0)
+                {
+                        n = strtol_safe(value, -1);
+                        if(n < 0 || n > CFG_MAX_INFLIGHT)
+                        {
+                                log_error("Invalid inflight max %s", value);
+                                ret = -1;
+                                break;
+                        }
+
+                        cfg->inflight_max = (unsigned int)n;
+                }
+                else if(strcmp(name, "service_inflight_max") == 0)
+                {
+                        n = strtol_safe(value, -1);
+                        if(n < 0 || n > CFG_MAX_INFLIGHT)
+                        {
+                                log_error("Invalid service inflight max %s",
+                                          value);
+                                ret = -1;
+                                break;
+                        }
+
+                        cfg->service_inflight_max = (unsigned int)n;
+                }
+                else if(strcmp(name, "refresh_window") == 0)
+                {
+                        n = strtol_safe(value, -1);
+                        if(n < 0 || n > CFG_MAX_REFRESH)
+                        {
+                                log_error("Invalid refresh window %s", value);
+                                ret = -1;
+                                break;
+                        }
+
+                        cfg->refresh_window = (unsigned int)n;
+                }
                 else if(strcmp(name, "myip_upint") == 0)
                 {
                         n = strtol_safe(value, -1);
@@ -408,6 +1406,28 @@ int config_parse_file(struct cfg *cfg)
                         cfg->myip.upint = (int)n;
                         ++myip_assign_count;
                 }
+                else if((n = config_myip_option(&(cfg->myip),
+                                                name, value)) != 1)
+                {
+                        if(n != 0)
+                        {
+                                ret = -1;
+                                break;
+                        }
+
+                        ++myip_assign_count;
+                }
+                else if((n = config_stun_option(&(cfg->stun),
+                                                name, value)) != 1
+                        || (n = config_dnsip_option(&(cfg->dnsip),
+                                                    name, value)) != 1)
+                {
+                        if(n != 0)
+                        {
+                                ret = -1;
+                                break;
+                        }
+                }
                 else
                 {
                         log_error("Invalid option name '%s' (file %s "
@@ -434,10 +1454,7 @@ int config_parse_file(struct cfg *cfg)
 
         if(cfg->wan_cnt_type == wan_cnt_indirect)
         {
-                if(!cfgstr_is_set(&(cfg->myip.host))
-                   || cfg->myip.port == 0
-                   || !cfgstr_is_set(&(cfg->myip.path))
-                   || cfg->myip.upint == 0)
+                if(config_myip_check(&(cfg->myip)) != 0)
                 {
                         log_error("Invalid myip definition(s)."
                                   " Check config file.");
@@ -445,6 +1462,25 @@ int config_parse_file(struct cfg *cfg)
                 }
         }
 
+        if(cfg->wan_cnt_type == wan_cnt_stun && cfg->stun.count == 0)
+        {
+                log_error("No stun_server defined. Check config file.");
+                ret = -1;
+        }
+
+        if(cfg->wan_cnt_type == wan_cnt_dns
+           && config_dnsip_check(&(cfg->dnsip)) != 0)
+        {
+                ret = -1;
+        }
+
+        /* a caching resolver may answer an old address */
+        if(cfg->precheck && !cfgstr_is_set(&(cfg->precheck_server)))
+        {
+                log_error("No precheck_server defined. Check config file.");
+                ret = -1;
+        }
+
         if(accountdef_scope)
         {
                 log_error("No found closure for account name '%s' service '%s' "
@@ -455,26 +1491,77 @@ int config_parse_file(struct cfg *cfg)
                 ret = -1;
         }
 
+        if(wandef_scope)
+        {
+                log_error("No found closure for wan '%s' (file %s line %d)",
+                          cfgstr_get(&(wancfg->name)),
+                          filename, linenum);
+                config_wan_free(wancfg);
+                ret = -1;
+        }
+
+        if(ret == 0)
+        {
+                /* the wan blocks may follow the accounts */
+                list_for_each_entry(accountcfg, &(cfg->account_list), list)
+                {
+                        if(cfgstr_is_set(&(accountcfg->wan))
+                           && config_wan_get(cfg,
+                                             cfgstr_get(&(accountcfg->wan)))
+                           == NULL)
+                        {
+                                log_error("No wan named '%s' for account"
+                                          " name '%s'",
+                                          cfgstr_get(&(accountcfg->wan)),
+                                          cfgstr_get(&(accountcfg->name)));
+                                ret = -1;
+                                break;
+                        }
+                }
+        }
+
+        if(servicedef_scope)
+        {
+                log_error("No found closure for service '%s' (file %s"
+                          " line %d)",
+                          cfgstr_get(&(servicecfg->name)),
+                          filename, linenum);
+                config_service_free(servicecfg);
+                ret = -1;
+        }
+
         if(ret == -1)
         {
                 /* error. need to cleanup */
                 cfgstr_unset(&(cfg->wan_ifname));
-                cfgstr_unset(&(cfg->myip.host));
-                cfgstr_unset(&(cfg->myip.path));
+                cfgstr_unset(&(cfg->statefile));
+                cfgstr_unset(&(cfg->precheck_server));
+                config_myip_free(&(cfg->myip));
+                config_stun_free(&(cfg->stun));
+                config_dnsip_free(&(cfg->dnsip));
 
                 list_for_each_entry_safe(accountcfg, safe_accountcfg,
                                          &(cfg->account_list), list)
                 {
-                        cfgstr_unset(&(accountcfg->name));
-                        cfgstr_unset(&(accountcfg->service));
-                        cfgstr_unset(&(accountcfg->username));
-                        cfgstr_unset(&(accountcfg->passwd));
-                        cfgstr_unset(&(accountcfg->hostname));
-
+                        hashtab_del(&(cfg->account_index),
+                                    &(accountcfg->hnode));
                         list_del(&(accountcfg->list));
-                        free(accountcfg);
+                        config_account_free(accountcfg);
+                }
+
+                list_for_each_entry_safe(servicecfg, safe_servicecfg,
+                                         &(cfg->service_list), list)
+                {
+                        list_del(&(servicecfg->list));
+                        config_service_free(servicecfg);
                 }
 
+                list_for_each_entry_safe(wancfg, safe_wancfg,
+                                         &(cfg->wan_list), list)
+                {
+                        list_del(&(wancfg->list));
+                        config_wan_free(wancfg);
+                }
         }
 
         fclose(file);
@@ -482,12 +1569,52 @@ int config_parse_file(struct cfg *cfg)
 	return ret;
 }
 
+/*
+ * FNV-1a 64 of the account cfg values (but the name), '\0' included
+ * to separate them
+ */
+static uint64_t config_account_fingerprint(const struct cfg_account *accountcfg)
+{
+        const char *values[] = {
+                cfgstr_get(&(accountcfg->service)),
+                cfgstr_get(&(accountcfg->username)),
+                cfgstr_get(&(accountcfg->passwd)),
+                cfgstr_get(&(accountcfg->hostname)),
+                cfgstr_get(&(accountcfg->wan)),
+        };
+        uint64_t hash = 14695981039346656037ULL;
+        const char *c = NULL;
+        size_t i;
+
+        for(i = 0; i < ARRAY_SIZE(values); ++i)
+        {
+                c = (values[i] != NULL ? values[i] : "");
+                do
+                {
+                        hash ^= (uint64_t)(unsigned char)*c;
+                        hash *= 1099511628211ULL;
+                } while(*c++ != '\0');
+        }
+
+        return hash;
+}
+
+void config_account_add(struct cfg *cfg, struct cfg_account *accountcfg)
+{
+        accountcfg->fingerprint = config_account_fingerprint(accountcfg);
+
+        list_add(&(accountcfg->list), &(cfg->account_list));
+        hashtab_add(&(cfg->account_index), &(accountcfg->hnode),
+                    hashtab_strhash(cfgstr_get(&(accountcfg->name))));
+}
+
 struct cfg_account *config_account_get(const struct cfg *cfg, const char *name)
 {
         struct cfg_account *accountcfg = NULL;
+        uint32_t hash = hashtab_strhash(name);
 
-        list_for_each_entry(accountcfg,
-                            &(cfg->account_list), list)
+        hashtab_for_each_entry(accountcfg, &(cfg->account_index),
+                               hash, hnode)
         {
                 if(strcmp(cfgstr_get(&(accountcfg->name)), name) == 0)
                 {
@@ -502,31 +1629,119 @@ void config_init(struct cfg *cfg)
 {
         memset(cfg, 0, sizeof(struct cfg));
 
+        cfg->request_reserve = CFG_DEFAULT_REQUEST_RESERVE;
+        cfg->inflight_max = CFG_DEFAULT_INFLIGHT_MAX;
+        cfg->service_inflight_max = CFG_DEFAULT_SERVICE_INFLIGHT_MAX;
+        cfg->refresh_window = CFG_DEFAULT_REFRESH_WINDOW;
+        cfg->precheck_port = CFG_DEFAULT_PRECHECK_PORT;
+        config_myip_init(&(cfg->myip));
+        config_stun_init(&(cfg->stun));
+        config_dnsip_init(&(cfg->dnsip));
         INIT_LIST_HEAD( &(cfg->account_list) );
+        hashtab_init(&(cfg->account_index));
+        INIT_LIST_HEAD( &(cfg->service_list) );
+        INIT_LIST_HEAD( &(cfg->wan_list) );
+}
+
+static void config_account_free(struct cfg_account *accountcfg)
+{
+        cfgstr_unset(&(accountcfg->name));
+        cfgstr_unset(&(accountcfg->service));
+        cfgstr_unset(&(accountcfg->username));
+        cfgstr_unset(&(accountcfg->passwd));
+        cfgstr_unset(&(accountcfg->hostname));
+        cfgstr_unset(&(accountcfg->wan));
+
+        free(accountcfg);
+}
+
+static void config_service_free(struct cfg_service *servicecfg)
+{
+        cfgstr_unset(&(servicecfg->name));
+
+        free(servicecfg);
+}
+
+struct cfg_service *config_service_get(const struct cfg *cfg, const char *name)
+{
+        struct cfg_service *servicecfg = NULL;
+
+        list_for_each_entry(servicecfg, &(cfg->service_list), list)
+        {
+                if(strcmp(cfgstr_get(&(servicecfg->name)), name) == 0)
+                {
+                        return servicecfg;
+                }
+        }
+
+        return NULL;
+}
+
+static void config_wan_free(struct cfg_wan *wancfg)
+{
+        cfgstr_unset(&(wancfg->name));
+        cfgstr_unset(&(wancfg->ifname));
+        config_myip_free(&(wancfg->myip));
+        config_stun_free(&(wancfg->stun));
+        config_dnsip_free(&(wancfg->dnsip));
+
+        free(wancfg);
+}
+
+struct cfg_wan *config_wan_get(const struct cfg *cfg, const char *name)
+{
+        struct cfg_wan *wancfg = NULL;
+
+        list_for_each_entry(wancfg, &(cfg->wan_list), list)
+        {
+                if(strcmp(cfgstr_get(&(wancfg->name)), name) == 0)
+                {
+                        return wancfg;
+                }
+        }
+
+        return NULL;
 }
 
 int config_free(struct cfg *cfg)
 {
         struct cfg_account *accountcfg = NULL,
                 *safe = NULL;
+        struct cfg_service *servicecfg = NULL,
+                *safe_servicecfg = NULL;
+        struct cfg_wan *wancfg = NULL,
+                *safe_wancfg = NULL;
 
         cfgstr_unset(&(cfg->wan_ifname));
-        cfgstr_unset(&(cfg->myip.host));
-        cfgstr_unset(&(cfg->myip.path));
+        config_myip_free(&(cfg->myip));
+        config_stun_free(&(cfg->stun));
+        config_dnsip_free(&(cfg->dnsip));
         cfgstr_unset(&(cfg->cfgfile));
         cfgstr_unset(&(cfg->pidfile));
+        cfgstr_unset(&(cfg->statefile));
+        cfgstr_unset(&(cfg->precheck_server));
 
         list_for_each_entry_safe(accountcfg, safe,
                                  &(cfg->account_list), list)
         {
-                cfgstr_unset(&(accountcfg->name));
-                cfgstr_unset(&(accountcfg->service));
-                cfgstr_unset(&(accountcfg->username));
-                cfgstr_unset(&(accountcfg->passwd));
-                cfgstr_unset(&(accountcfg->hostname));
-
                 list_del(&(accountcfg->list));
-                free(accountcfg);
+                config_account_free(accountcfg);
+        }
+
+        hashtab_free(&(cfg->account_index));
+
+        list_for_each_entry_safe(servicecfg, safe_servicecfg,
+                                 &(cfg->service_list), list)
+        {
+                list_del(&(servicecfg->list));
+                config_service_free(servicecfg);
+        }
+
+        list_for_each_entry_safe(wancfg, safe_wancfg,
+                                 &(cfg->wan_list), list)
+        {
+                list_del(&(wancfg->list));
+                config_wan_free(wancfg);
         }
 
 	return 0;
@@ -535,14 +1750,23 @@ int config_free(struct cfg *cfg)
 void config_print(struct cfg *cfg)
 {
         struct cfg_account *accountcfg = NULL;
+        struct cfg_service *servicecfg = NULL;
+        struct cfg_wan *wancfg = NULL;
 
         printf("Configuration:\n");
         printf(" cfg file = '%s'\n", cfgstr_get(&(cfg->cfgfile)));
         printf(" pid file = '%s'\n", cfgstr_get(&(cfg->pidfile)));
+        printf(" state file = '%s'\n", cfgstr_get(&(cfg->statefile)));
         printf(" daemonize = '%d'\n", cfg->daemonize);
         printf(" use syslog = '%d'\n", cfg->use_syslog);
         printf(" wan ifname = '%s'\n", cfgstr_get(&(cfg->wan_ifname)));
         printf(" wan mode = '%d'\n", cfg->wan_cnt_type);
+        printf(" request reserve = '%u'\n", cfg->request_reserve);
+        printf(" inflight max = '%u'\n", cfg->inflight_max);
+        printf(" service inflight max = '%u'\n", cfg->service_inflight_max);
+        printf(" refresh window = '%u'\n", cfg->refresh_window);
+        printf(" precheck = '%d' (server '%s' port '%u')\n", cfg->precheck,
+               cfgstr_get(&(cfg->precheck_server)), cfg->precheck_port);
 
         list_for_each_entry(accountcfg,
                             &(cfg->account_list), list)
@@ -557,6 +1781,51 @@ void config_print(struct cfg *cfg)
                        cfgstr_get(&(accountcfg->passwd)));
                 printf("   hostname = '%s'\n",
                        cfgstr_get(&(accountcfg->hostname)));
+                printf("   priority = '%s'\n",
+                       (accountcfg->priority == cfg_priority_high ? "high"
+                        : accountcfg->priority == cfg_priority_low ? "low"
+                        : "normal"));
+                printf("   wan = '%s'\n",
+                       cfgstr_get(&(accountcfg->wan)));
+        }
+
+        list_for_each_entry(servicecfg,
+                            &(cfg->service_list), list)
+        {
+                printf(" ---- service '%s' ----\n",
+                       cfgstr_get(&(servicecfg->name)));
+                printf("   retry min = '%u'\n", servicecfg->retry_min);
+                printf("   retry max = '%u'\n", servicecfg->retry_max);
+                printf("   refresh = '%u'\n", servicecfg->refresh);
+        }
+
+        list_for_each_entry(wancfg,
+                            &(cfg->wan_list), list)
+        {
+                printf(" ---- wan '%s' ----\n",
+                       cfgstr_get(&(wancfg->name)));
+                printf("   mode = '%d'\n", wancfg->type);
+                printf("   ifname = '%s'\n",
+                       cfgstr_get(&(wancfg->ifname)));
+                printf("   myip = '%s:%u%s' (%u providers, mode '%d',"
+                       " quorum '%u') every '%d' (safety '%d')\n",
+                       cfgstr_get(&(wancfg->myip.provider[0].host)),
+                       wancfg->myip.provider[0].port,
+                       cfgstr_get(&(wancfg->myip.provider[0].path)),
+                       wancfg->myip.count, wancfg->myip.mode,
+                       wancfg->myip.quorum, wancfg->myip.upint,
+                       wancfg->myip.safety_upint);
+                printf("   stun = '%s:%u' (%u servers, rto '%u') every"
+                       " '%d'\n",
+                       cfgstr_get(&(wancfg->stun.server[0].host)),
+                       wancfg->stun.server[0].port, wancfg->stun.count,
+                       wancfg->stun.rto, wancfg->stun.upint);
+                printf("   dns = '%s' from '%s:%u' (0x20 '%d') every"
+                       " '%d'\n",
+                       cfgstr_get(&(wancfg->dnsip.name)),
+                       cfgstr_get(&(wancfg->dnsip.server)),
+                       wancfg->dnsip.port, wancfg->dnsip.mixcase,
+                       wancfg->dnsip.upint);
         }
 }
 
@@ -564,26 +1833,80 @@ void config_move(struct cfg *cfgsrc, struct cfg *cfgdst)
 {
         struct cfg_account *actcfg = NULL,
                 *safe_actcfg = NULL;
+        struct cfg_service *servicecfg = NULL,
+                *safe_servicecfg = NULL;
+        struct cfg_wan *wancfg = NULL,
+                *safe_wancfg = NULL;
 
         /* general cfg */
         cfgdst->wan_cnt_type = cfgsrc->wan_cnt_type;
         cfgstr_move(&(cfgsrc->wan_ifname), &(cfgdst->wan_ifname));
         cfgstr_move(&(cfgsrc->cfgfile), &(cfgdst->cfgfile));
         cfgstr_move(&(cfgsrc->pidfile), &(cfgdst->pidfile));
+        cfgstr_move(&(cfgsrc->statefile), &(cfgdst->statefile));
         cfgdst->daemonize = cfgsrc->daemonize;
         cfgdst->use_syslog = cfgsrc->use_syslog;
+        cfgdst->request_reserve = cfgsrc->request_reserve;
+        cfgdst->inflight_max = cfgsrc->inflight_max;
+        cfgdst->service_inflight_max = cfgsrc->service_inflight_max;
+        cfgdst->refresh_window = cfgsrc->refresh_window;
+        cfgdst->precheck = cfgsrc->precheck;
+        cfgstr_move(&(cfgsrc->precheck_server), &(cfgdst->precheck_server));
+        cfgdst->precheck_port = cfgsrc->precheck_port;
 
         /* myip cfg */
-        cfgstr_move(&(cfgsrc->myip.host), &(cfgdst->myip.host));
-        cfgstr_move(&(cfgsrc->myip.path), &(cfgdst->myip.path));
-        cfgdst->myip.port = cfgsrc->myip.port;
-        cfgdst->myip.upint = cfgsrc->myip.upint;
+        config_myip_move(&(cfgsrc->myip), &(cfgdst->myip));
+
+        /* stun cfg */
+        config_stun_move(&(cfgsrc->stun), &(cfgdst->stun));
+
+        /* dns cfg */
+        config_dnsip_move(&(cfgsrc->dnsip), &(cfgdst->dnsip));
+
+        /* account(s) cfg, the old ones aren't referenced anymore */
+        list_for_each_entry_safe(actcfg, safe_actcfg,
+                                 &(cfgdst->account_list), list)
+        {
+                hashtab_del(&(cfgdst->account_index), &(actcfg->hnode));
+                list_del(&(actcfg->list));
+                config_account_free(actcfg);
+        }
 
-        /* account(s) cfg */
         list_for_each_entry_safe(actcfg, safe_actcfg,
                                  &(cfgsrc->account_list), list)
         {
                 list_move(&(actcfg->list), &(cfgdst->account_list));
+                hashtab_del(&(cfgsrc->account_index), &(actcfg->hnode));
+                hashtab_add(&(cfgdst->account_index), &(actcfg->hnode),
+                            actcfg->hnode.hash);
+        }
+
+        /* service(s) cfg */
+        list_for_each_entry_safe(servicecfg, safe_servicecfg,
+                                 &(cfgdst->service_list), list)
+        {
+                list_del(&(servicecfg->list));
+                config_service_free(servicecfg);
+        }
+
+        list_for_each_entry_safe(servicecfg, safe_servicecfg,
+                                 &(cfgsrc->service_list), list)
+        {
+                list_move_tail(&(servicecfg->list), &(cfgdst->service_list));
+        }
+
+        /* wan(s) cfg */
+        list_for_each_entry_safe(wancfg, safe_wancfg,
+                                 &(cfgdst->wan_list), list)
+        {
+                list_del(&(wancfg->list));
+                config_wan_free(wancfg);
+        }
+
+        list_for_each_entry_safe(wancfg, safe_wancfg,
+                                 &(cfgsrc->wan_list), list)
+        {
+                list_move_tail(&(wancfg->list), &(cfgdst->wan_list));
         }
 
         /* it's a move, so clean up src config */
@@ -3,26 +3,129 @@
 
 #include "list.h"
 #include "cfgstr.h"
+#include "hashtab.h"
 
-struct cfg_myip {
+/* max count of providers of a myip service */
+#define CFG_MYIP_MAX 8
+
+/* an http server giving the wan ip address */
+struct cfg_myip_provider {
         struct cfgstr host;
         unsigned short int port;
         struct cfgstr path;
+};
+
+/* how the providers are asked */
+enum cfg_myip_mode {
+        cfg_myip_failover = 0,      /* one at a time, the next one if
+                                     * it fails */
+        cfg_myip_race,              /* all, the first answer wins */
+        cfg_myip_quorum,            /* all, quorum answers must agree */
+};
+
+struct cfg_myip {
+        struct cfg_myip_provider provider[CFG_MYIP_MAX + 1]; /* myip_host,
+                                                              * port and
+                                                              * path are
+                                                              * the first
+                                                              * one, unused
+                                                              * slot removed
+                                                              * once parsed */
+        unsigned int count;
+        enum cfg_myip_mode mode;
+        unsigned int quorum;
         int upint;
+        int safety_upint;           /* upint while the link and route
+                                     * changes trigger the requests, 0
+                                     * to keep upint */
+};
+
+/* max count of stun servers */
+#define CFG_STUN_MAX 8
+
+/* a stun server giving the mapped address of its clients */
+struct cfg_stun_server {
+        struct cfgstr host;
+        unsigned short int port;
+};
+
+struct cfg_stun {
+        struct cfg_stun_server server[CFG_STUN_MAX]; /* asked in turn */
+        unsigned int count;
+        unsigned int rto;           /* ms, first retransmission timeout */
+        int upint;
+};
+
+/* a dns query whose answer is the address of the client */
+struct cfg_dnsip {
+        struct cfgstr name;         /* asked (A record) */
+        struct cfgstr server;       /* nameserver answering it */
+        unsigned short int port;
+        int mixcase;                /* dns 0x20, the answer must echo
+                                     * the random case of the name */
+        int upint;
+};
+
+/* how the wan ip address is got */
+enum cfg_wan_cnt {
+        wan_cnt_direct = 0,         /* address of an interface */
+        wan_cnt_indirect,           /* given by a myip service */
+        wan_cnt_stun,               /* mapped address of a stun server */
+        wan_cnt_dns,                /* answer of a dns query */
+};
+
+/* a named wan source, the global settings are the default one */
+struct cfg_wan {
+        struct cfgstr name;
+        enum cfg_wan_cnt type;
+        struct cfgstr ifname;       /* direct: the wan interface,
+                                     * otherwise: its address is
+                                     * bound if set */
+        struct cfg_myip myip;
+        struct cfg_stun stun;
+        struct cfg_dnsip dnsip;
+        struct list_head list;
 };
 
 struct cfg {
-        enum {
-                wan_cnt_direct = 0,
-                wan_cnt_indirect,
-        } wan_cnt_type;
+        enum cfg_wan_cnt wan_cnt_type;
         struct cfgstr wan_ifname;
         struct cfg_myip myip;
+        struct cfg_stun stun;
+        struct cfg_dnsip dnsip;
         struct cfgstr cfgfile;
         struct cfgstr pidfile;
+        struct cfgstr statefile;      /* state of the accounts */
         int daemonize;
         int use_syslog;
+        unsigned int request_reserve; /* requests allocated at start */
+        unsigned int inflight_max;    /* updates in flight, 0 = no limit */
+        unsigned int service_inflight_max; /* the same by service */
+        unsigned int refresh_window;  /* s, spread of the refreshes */
+        int precheck;                 /* skip the updates in effect */
+        struct cfgstr precheck_server; /* nameserver of the precheck,
+                                        * needed by precheck */
+        unsigned short int precheck_port;
         struct list_head account_list;
+        struct hashtab account_index; /* accounts by name */
+        struct list_head service_list; /* service blocks */
+        struct list_head wan_list;  /* wan blocks */
+};
+
+/* settings of a service, 0 for the default ones */
+struct cfg_service {
+        struct cfgstr name;
+        unsigned int retry_min;     /* s, ceiling of the 1st retry */
+        unsigned int retry_max;     /* s, cap of the retries */
+        unsigned int refresh;       /* s, keepalive re-update period */
+        struct list_head list;
+};
+
+/* update order of the accounts needing an update */
+enum cfg_priority {
+        cfg_priority_normal = 0,
+        cfg_priority_high,
+        cfg_priority_low,
 };
 
 struct cfg_account {
@@ -31,7 +134,13 @@ struct cfg_account {
 	struct cfgstr username;
 	struct cfgstr passwd;
 	struct cfgstr hostname;
+        struct cfgstr wan;          /* name of its wan source, the
+                                     * default one if unset */
         struct list_head list;
+        struct hashtab_node hnode;  /* in cfg account_index */
+        uint64_t fingerprint;       /* hash of service, username,
+                                     * passwd, hostname and wan */
+        enum cfg_priority priority;
 };
 
 extern int config_parse(struct cfg *cfg, int argc, char **argv);
@@ -42,8 +151,43 @@ extern void config_init(struct cfg *cfg);
 
 extern int config_free(struct cfg *cfg);
 
+extern void config_account_add(struct cfg *cfg, struct cfg_account *accountcfg);
+
 extern struct cfg_account * config_account_get(const struct cfg *cfg, const char *name);
 
+extern struct cfg_service * config_service_get(const struct cfg *cfg, const char *name);
+
+extern struct cfg_wan * config_wan_get(const struct cfg *cfg, const char *name);
+
+/* deep copy of the myip settings src in dst (freed by
+ * config_myip_free())
+ */
+extern void config_myip_copy(const struct cfg_myip *src, struct cfg_myip *dst);
+
+extern int config_myip_equal(const struct cfg_myip *a, const struct cfg_myip *b);
+
+extern void config_myip_free(struct cfg_myip *myip);
+
+/* deep copy of the stun settings src in dst (freed by
+ * config_stun_free())
+ */
+extern void config_stun_copy(const struct cfg_stun *src, struct cfg_stun *dst);
+
+extern int config_stun_equal(const struct cfg_stun *a, const struct cfg_stun *b);
+
+extern void config_stun_free(struct cfg_stun *stun);
+
+/* deep copy of the dns settings src in dst (freed by
+ * config_dnsip_free())
+ */
+extern void config_dnsip_copy(const struct cfg_dnsip *src,
+                              struct cfg_dnsip *dst);
+
+extern int config_dnsip_equal(const struct cfg_dnsip *a,
+                              const struct cfg_dnsip *b);
+
+extern void config_dnsip_free(struct cfg_dnsip *dnsip);
+
 extern void config_print(struct cfg *cfg);
 
 extern void config_move(struct cfg *cfgsrc, struct cfg *cfgdst);
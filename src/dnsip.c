@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dnsip.h"
+
+#include "util.h"
+#include "log.h"
+
+/*
+ * the address of the answer: a single one (all the records agree),
+ * which can be the one of a wan
+ *
+ * @return 0 if found, -1 otherwise
+ */
+static int dnsip_parse(const struct resolv_result *result,
+                       struct in_addr *addr)
+{
+        const struct sockaddr_in *sin = NULL;
+        size_t i, found = 0;
+        uint32_t host;
+
+        for(i = 0; i < result->count; ++i)
+        {
+                sin = (const struct sockaddr_in *)&(result->addrs[i]);
+                if(sin->sin_family != AF_INET)
+                {
+                        continue;
+                }
+
+                if(found++ > 0 && sin->sin_addr.s_addr != addr->s_addr)
+                {
+                        log_error("Several addresses in the dns answer");
+                        return -1;
+                }
+
+                *addr = sin->sin_addr;
+        }
+
+        if(found == 0)
+        {
+                log_error("No address in the dns answer");
+                return -1;
+        }
+
+        /* a resolver without this service may answer a sinkhole */
+        host = ntohl(addr->s_addr);
+        if(host == INADDR_ANY || (host >> 24) == 127
+           || IN_MULTICAST(host) || host == INADDR_BROADCAST)
+        {
+                log_error("Invalid address %s in the dns answer",
+                          inet_ntoa(*addr));
+                return -1;
+        }
+
+        return 0;
+}
+
+static void dnsip_resolv_cb(struct resolv_query *query,
+                            const struct resolv_result *result,
+                            void *data)
+{
+        struct dnsip *dnsip = data;
+        struct in_addr addr;
+
+        if(result->err != RESOLV_ERR_OK)
+        {
+                log_error("Unable to ask %s to the dns server: %s",
+                          query->host, strresolverr(result->err));
+                wanip_error(&(dnsip->src), 0);
+                return;
+        }
+
+        if(dnsip_parse(result, &addr) != 0)
+        {
+                wanip_error(&(dnsip->src), 0);
+                return;
+        }
+
+        wanip_accept(&(dnsip->src), &addr);
+}
+
+static void dnsip_send(struct wanip *wanip, const void *cfg,
+                       const struct in_addr *bind_addr)
+{
+        struct dnsip *dnsip = CONTAINER_OF(wanip, struct dnsip, src);
+        const struct cfg_dnsip *cfg_dnsip = cfg;
+        struct resolv_opt opt = {
+                .mask = 0,
+        };
+
+        if(cfg_dnsip->mixcase)
+        {
+                opt.mask |= RESOLV_OPT_0X20;
+        }
+
+        /* from the address of its wan */
+        if(bind_addr != NULL)
+        {
+                opt.mask |= RESOLV_OPT_BIND_ADDR;
+                opt.bind_addr = *bind_addr;
+        }
+
+        wanip->upint = cfg_dnsip->upint;
+
+        if(resolv_query_start_fresh(&(dnsip->query),
+                                    cfgstr_get(&(cfg_dnsip->name)), AF_INET,
+                                    cfgstr_get(&(cfg_dnsip->server)),
+                                    cfg_dnsip->port, &opt,
+                                    dnsip_resolv_cb, dnsip) != 0)
+        {
+                wanip_error(wanip, 0);
+        }
+}
+
+static void dnsip_cancel(struct wanip *wanip)
+{
+        struct dnsip *dnsip = CONTAINER_OF(wanip, struct dnsip, src);
+
+        resolv_query_cancel(&(dnsip->query));
+}
+
+static const struct wanip_ops dnsip_ops = {
+        .send = dnsip_send,
+        .cancel = dnsip_cancel,
+};
+
+void dnsip_init(struct dnsip *dnsip)
+{
+        memset(dnsip, 0, sizeof(struct dnsip));
+        wanip_init(&(dnsip->src), &dnsip_ops);
+}
@@ -0,0 +1,42 @@
+/*
+ *  Yaddns - Yet Another ddns client
+ *  Copyright (C) 2008 Anthony Viallard <anthony.viallard@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _YADDNS_DNSIP_H_
+#define _YADDNS_DNSIP_H_
+
+#include <netinet/in.h>
+
+#include "config.h"
+#include "resolv.h"
+#include "wanip.h"
+
+/* wan ip address given by a dns query (one by wan source), like
+ * myip.opendns.com asked to an opendns resolver: a single udp round
+ * trip
+ */
+struct dnsip {
+        struct wanip src;           /* its address and its updates */
+        struct resolv_query query;
+};
+
+/* init it, then it's used as a wan ip source (see wanip.h) with the
+ * cfg_dnsip settings
+ */
+void dnsip_init(struct dnsip *dnsip);
+
+#endif
@@ -0,0 +1,104 @@
+#include <stdlib.h>
+
+#include "hashtab.h"
+#include "log.h"
+
+/*
+ * decs static functions
+ */
+static void hashtab_resize(struct hashtab *tab, size_t size)
+{
+        struct list_head *buckets = NULL;
+        struct list_head *old_buckets = tab->buckets;
+        size_t old_size = tab->size;
+        struct hashtab_node *node = NULL,
+                *safe = NULL;
+        size_t i;
+
+        buckets = malloc(size * sizeof(struct list_head));
+        if(buckets == NULL)
+        {
+                log_debug("Unable to grow hash table to %zu buckets", size);
+                return;
+        }
+
+        for(i = 0; i < size; ++i)
+        {
+                INIT_LIST_HEAD(&(buckets[i]));
+        }
+
+        tab->buckets = buckets;
+        tab->size = size;
+
+        for(i = 0; i < old_size; ++i)
+        {
+                list_for_each_entry_safe(node, safe, &(old_buckets[i]), list)
+                {
+                        list_move(&(node->list),
+                                  hashtab_bucket(tab, node->hash));
+                }
+        }
+
+        if(old_buckets != &(tab->fallback))
+        {
+                free(old_buckets);
+        }
+}
+
+/*
+ * decs API functions
+ */
+uint32_t hashtab_strhash(const char *s)
+{
+        uint32_t hash = 2166136261U;
+
+        while(*s != '\0')
+        {
+                hash ^= (uint32_t)(unsigned char)*s++;
+                hash *= 16777619U;
+        }
+
+        return hash;
+}
+
+void hashtab_init(struct hashtab *tab)
+{
+        INIT_LIST_HEAD(&(tab->fallback));
+        tab->buckets = &(tab->fallback);
+        tab->size = 1;
+        tab->count = 0;
+
+        hashtab_resize(tab, HASHTAB_MIN_SIZE);
+}
+
+void hashtab_free(struct hashtab *tab)
+{
+        if(tab->buckets != &(tab->fallback))
+        {
+                free(tab->buckets);
+        }
+
+        INIT_LIST_HEAD(&(tab->fallback));
+        tab->buckets = &(tab->fallback);
+        tab->size = 1;
+        tab->count = 0;
+}
+
+void hashtab_add(struct hashtab *tab, struct hashtab_node *node,
+                 uint32_t hash)
+{
+        if(tab->count >= tab->size)
+        {
+                hashtab_resize(tab, tab->size * 2);
+        }
+
+        node->hash = hash;
+        list_add(&(node->list), hashtab_bucket(tab, hash));
+        ++tab->count;
+}
+
+void hashtab_del(struct hashtab *tab, struct hashtab_node *node)
+{
+        list_del(&(node->list));
+        --tab->count;
+}
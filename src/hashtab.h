@@ -0,0 +1,95 @@
+/*
+ *  Yaddns - Yet Another ddns client
+ *  Copyright (C) 2008 Anthony Viallard <anthony.viallard@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _YADDNS_HASHTAB_H_
+#define _YADDNS_HASHTAB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "list.h"
+
+/*
+ * This module is an intrusive hash table: the indexed structures
+ * embed a struct hashtab_node, and keep their key. The table only
+ * sorts the nodes by hash in buckets (chained lists), the caller
+ * compares the keys of a bucket.
+ *
+ * The buckets are doubled when the table holds more nodes than
+ * buckets, so that a lookup stays O(1). Out of memory, the table
+ * keeps working with its buckets (or a single one), only slower.
+ */
+
+/* first count of buckets */
+#define HASHTAB_MIN_SIZE 16
+
+struct hashtab_node {
+        struct list_head list;      /* in a bucket */
+        uint32_t hash;
+};
+
+struct hashtab {
+        struct list_head *buckets;
+        size_t size;                /* count of buckets, a power of 2 */
+        size_t count;               /* count of nodes */
+        struct list_head fallback;  /* the bucket if out of memory */
+};
+
+/*
+ * Iterate over the entries whose hash is hash (the possible matches)
+ */
+#define hashtab_for_each_entry(pos, tab, h, member)                     \
+        list_for_each_entry(pos, hashtab_bucket(tab, h), member.list)  \
+                if((pos)->member.hash == (h))
+
+/*
+ * Hash of a string (FNV-1a)
+ */
+extern uint32_t hashtab_strhash(const char *s);
+
+/*
+ * Init an empty table
+ */
+extern void hashtab_init(struct hashtab *tab);
+
+/*
+ * Free the buckets (the nodes are the caller's business)
+ */
+extern void hashtab_free(struct hashtab *tab);
+
+/*
+ * Add node with hash
+ */
+extern void hashtab_add(struct hashtab *tab, struct hashtab_node *node,
+                        uint32_t hash);
+
+/*
+ * Remove node of the table
+ */
+extern void hashtab_del(struct hashtab *tab, struct hashtab_node *node);
+
+/*
+ * Bucket of hash
+ */
+static inline struct list_head *hashtab_bucket(const struct hashtab *tab,
+                                               uint32_t hash)
+{
+        return &(tab->buckets[hash & (tab->size - 1)]);
+}
+
+#endif
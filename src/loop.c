@@ -0,0 +1,488 @@
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/select.h>
+
+#if defined(USE_EPOLL)
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#endif
+
+#include "loop.h"
+#include "log.h"
+#include "util.h"
+
+/* max events fetched by one epoll_wait() */
+#define LOOP_EPOLL_MAXEVENTS 64
+
+/* decs static variables */
+static LIST_HEAD_DECL(loop_watch_list); /* empty before loop_init() too */
+static LIST_HEAD_DECL(loop_ready_list);
+static void (*loop_sig_cb)(int signum) = NULL;
+static sigset_t loop_sig_set;
+
+#if defined(USE_EPOLL)
+static int loop_epfd = -1;
+static int loop_sigfd = -1;
+static struct loop_watch loop_sig_watch;
+#else
+static sigset_t loop_sig_waitmask;
+static volatile sig_atomic_t loop_sig_pending[NSIG];
+#endif
+
+/*
+ * decs static functions
+ */
+static void loop_ready(struct loop_watch *watch, unsigned int revents)
+{
+        watch->revents |= revents;
+
+        if(list_empty(&(watch->ready)))
+        {
+                list_add_tail(&(watch->ready), &loop_ready_list);
+        }
+}
+
+static void loop_dispatch(void)
+{
+        struct loop_watch *watch = NULL;
+        unsigned int revents;
+
+        /* a callback can remove any watch (itself or another one
+         * ready in this pass), so always pick the head of the list
+         */
+        while(!list_empty(&loop_ready_list))
+        {
+                watch = list_entry(loop_ready_list.next,
+                                   struct loop_watch, ready);
+                list_del_init(&(watch->ready));
+
+                revents = watch->revents & watch->events;
+                watch->revents = 0;
+
+                if(revents != 0)
+                {
+                        watch->cb(watch, revents);
+                }
+        }
+}
+
+#if defined(USE_EPOLL)
+
+static uint32_t loop_epoll_events(unsigned int events)
+{
+        uint32_t ev = 0;
+
+        if(events & LOOP_READ)
+        {
+                ev |= EPOLLIN;
+        }
+
+        if(events & LOOP_WRITE)
+        {
+                ev |= EPOLLOUT;
+        }
+
+        return ev;
+}
+
+static void loop_sig_read(struct loop_watch *watch, unsigned int revents)
+{
+        struct signalfd_siginfo si;
+        ssize_t n;
+
+        UNUSED(revents);
+
+        while((n = read(watch->fd, &si, sizeof(si))) == sizeof(si))
+        {
+                if(loop_sig_cb != NULL)
+                {
+                        loop_sig_cb((int)si.ssi_signo);
+                }
+        }
+
+        if(n < 0 && errno != EAGAIN)
+        {
+                log_error("read(signalfd): %s", strerror(errno));
+        }
+}
+
+#else
+
+static void loop_sig_handler(int signum)
+{
+        loop_sig_pending[signum] = 1;
+}
+
+static void loop_sig_dispatch(void)
+{
+        int signum;
+
+        for(signum = 1; signum < NSIG; ++signum)
+        {
+                if(loop_sig_pending[signum])
+                {
+                        loop_sig_pending[signum] = 0;
+
+                        if(loop_sig_cb != NULL)
+                        {
+                                loop_sig_cb(signum);
+                        }
+                }
+        }
+}
+
+#endif
+
+/*
+ * decs API functions
+ */
+int loop_init(void)
+{
+        INIT_LIST_HEAD(&loop_watch_list);
+        INIT_LIST_HEAD(&loop_ready_list);
+        sigemptyset(&loop_sig_set);
+
+#if defined(USE_EPOLL)
+        loop_epfd = epoll_create1(EPOLL_CLOEXEC);
+        if(loop_epfd < 0)
+        {
+                log_error("epoll_create1(): %s", strerror(errno));
+                return -1;
+        }
+#else
+        /* the mask before the signals of the loop are blocked */
+        sigprocmask(SIG_SETMASK, NULL, &loop_sig_waitmask);
+#endif
+
+        return 0;
+}
+
+void loop_cleanup(void)
+{
+        struct loop_watch *watch = NULL,
+                *safe = NULL;
+
+        list_for_each_entry_safe(watch, safe,
+                                 &loop_watch_list, list)
+        {
+                loop_watch_del(watch);
+        }
+
+#if defined(USE_EPOLL)
+        if(loop_sigfd >= 0)
+        {
+                close(loop_sigfd);
+                loop_sigfd = -1;
+        }
+
+        if(loop_epfd >= 0)
+        {
+                close(loop_epfd);
+                loop_epfd = -1;
+        }
+#endif
+
+        loop_sig_cb = NULL;
+}
+
+const char *loop_backend(void)
+{
+#if defined(USE_EPOLL)
+        return "epoll";
+#else
+        return "select";
+#endif
+}
+
+void loop_watch_init(struct loop_watch *watch,
+                     loop_watch_cb cb, void *data)
+{
+        memset(watch, 0, sizeof(struct loop_watch));
+
+        watch->fd = -1;
+        watch->cb = cb;
+        watch->data = data;
+        INIT_LIST_HEAD(&(watch->list));
+        INIT_LIST_HEAD(&(watch->ready));
+}
+
+int loop_watch_add(struct loop_watch *watch,
+                   int fd, unsigned int events)
+{
+#if defined(USE_EPOLL)
+        struct epoll_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = loop_epoll_events(events);
+        ev.data.ptr = watch;
+
+        if(epoll_ctl(loop_epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+                log_error("epoll_ctl(ADD, %d): %s", fd, strerror(errno));
+                return -1;
+        }
+#else
+        if(fd >= FD_SETSIZE)
+        {
+                log_error("fd %d is out of the select() range (%d)",
+                          fd, FD_SETSIZE);
+                return -1;
+        }
+#endif
+
+        watch->fd = fd;
+        watch->events = events;
+        watch->revents = 0;
+        watch->registered = 1;
+        list_add_tail(&(watch->list), &loop_watch_list);
+
+        log_debug("&watch:%p, watch fd %d (events 0x%x)",
+                  watch, fd, events);
+
+        return 0;
+}
+
+int loop_watch_mod(struct loop_watch *watch, unsigned int events)
+{
+#if defined(USE_EPOLL)
+        struct epoll_event ev;
+#endif
+
+        if(!watch->registered)
+        {
+                return -1;
+        }
+
+        if(watch->events == events)
+        {
+                return 0;
+        }
+
+#if defined(USE_EPOLL)
+        memset(&ev, 0, sizeof(ev));
+        ev.events = loop_epoll_events(events);
+        ev.data.ptr = watch;
+
+        if(epoll_ctl(loop_epfd, EPOLL_CTL_MOD, watch->fd, &ev) != 0)
+        {
+                log_error("epoll_ctl(MOD, %d): %s",
+                          watch->fd, strerror(errno));
+                return -1;
+        }
+#endif
+
+        watch->events = events;
+
+        return 0;
+}
+
+void loop_watch_del(struct loop_watch *watch)
+{
+        if(!watch->registered)
+        {
+                return;
+        }
+
+#if defined(USE_EPOLL)
+        if(epoll_ctl(loop_epfd, EPOLL_CTL_DEL, watch->fd, NULL) != 0)
+        {
+                log_debug("epoll_ctl(DEL, %d): %s",
+                          watch->fd, strerror(errno));
+        }
+#endif
+
+        list_del_init(&(watch->list));
+        list_del_init(&(watch->ready));
+
+        watch->registered = 0;
+        watch->events = 0;
+        watch->revents = 0;
+        watch->fd = -1;
+}
+
+int loop_signal_setup(const int *signums, size_t count,
+                      void (*sig_cb)(int signum))
+{
+        size_t i;
+#if !defined(USE_EPOLL)
+        struct sigaction sa;
+
+        memset(&sa, 0, sizeof(struct sigaction));
+        sa.sa_handler = loop_sig_handler;
+        sigfillset(&(sa.sa_mask));
+#endif
+
+        loop_sig_cb = sig_cb;
+
+        for(i = 0; i < count; ++i)
+        {
+                sigaddset(&loop_sig_set, signums[i]);
+
+#if !defined(USE_EPOLL)
+                if(sigaction(signums[i], &sa, NULL) != 0)
+                {
+                        log_error("Failed to install signal handler"
+                                  " for signal %d: %s",
+                                  signums[i], strerror(errno));
+                        return -1;
+                }
+#endif
+        }
+
+        /* signals are handled in the loop, nowhere else */
+        if(sigprocmask(SIG_BLOCK, &loop_sig_set, NULL) != 0)
+        {
+                log_error("sigprocmask(): %s", strerror(errno));
+                return -1;
+        }
+
+#if !defined(USE_EPOLL)
+        /* only unblocked while waiting in pselect() */
+        for(i = 0; i < count; ++i)
+        {
+                sigdelset(&loop_sig_waitmask, signums[i]);
+        }
+#endif
+
+#if defined(USE_EPOLL)
+        loop_sigfd = signalfd(loop_sigfd, &loop_sig_set,
+                              SFD_NONBLOCK | SFD_CLOEXEC);
+        if(loop_sigfd < 0)
+        {
+                log_error("signalfd(): %s", strerror(errno));
+                return -1;
+        }
+
+        if(!loop_sig_watch.registered)
+        {
+                loop_watch_init(&loop_sig_watch, loop_sig_read, NULL);
+
+                if(loop_watch_add(&loop_sig_watch,
+                                  loop_sigfd, LOOP_READ) != 0)
+                {
+                        return -1;
+                }
+        }
+#endif
+
+        return 0;
+}
+
+int loop_run_once(int timeout_ms)
+{
+#if defined(USE_EPOLL)
+        struct epoll_event events[LOOP_EPOLL_MAXEVENTS];
+        struct loop_watch *watch = NULL;
+        unsigned int revents;
+        int n, i;
+
+        n = epoll_wait(loop_epfd, events, LOOP_EPOLL_MAXEVENTS, timeout_ms);
+        if(n < 0)
+        {
+                if(errno == EINTR)
+                {
+                        return 0;
+                }
+
+                log_critical("epoll_wait failed ! %s", strerror(errno));
+                return -1;
+        }
+
+        for(i = 0; i < n; ++i)
+        {
+                watch = events[i].data.ptr;
+                revents = 0;
+
+                if(events[i].events & EPOLLIN)
+                {
+                        revents |= LOOP_READ;
+                }
+
+                if(events[i].events & EPOLLOUT)
+                {
+                        revents |= LOOP_WRITE;
+                }
+
+                /* let the owner see the error on its next io */
+                if(events[i].events & (EPOLLERR | EPOLLHUP))
+                {
+                        revents |= watch->events;
+                }
+
+                loop_ready(watch, revents);
+        }
+#else
+        fd_set readset, writeset;
+        struct timespec timeout;
+        struct loop_watch *watch = NULL;
+        unsigned int revents;
+        int max_fd = -1;
+        int n;
+
+        FD_ZERO(&readset);
+        FD_ZERO(&writeset);
+
+        list_for_each_entry(watch, &loop_watch_list, list)
+        {
+                if(watch->events & LOOP_READ)
+                {
+                        FD_SET(watch->fd, &readset);
+                        max_fd = MAX(watch->fd, max_fd);
+                }
+
+                if(watch->events & LOOP_WRITE)
+                {
+                        FD_SET(watch->fd, &writeset);
+                        max_fd = MAX(watch->fd, max_fd);
+                }
+        }
+
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+        n = pselect(max_fd + 1, &readset, &writeset, NULL,
+                    (timeout_ms < 0 ? NULL : &timeout),
+                    &loop_sig_waitmask);
+        if(n < 0 && errno != EINTR)
+        {
+                log_critical("select failed ! %s", strerror(errno));
+                return -1;
+        }
+
+        loop_sig_dispatch();
+
+        if(n > 0)
+        {
+                list_for_each_entry(watch, &loop_watch_list, list)
+                {
+                        revents = 0;
+
+                        if(FD_ISSET(watch->fd, &readset))
+                        {
+                                revents |= LOOP_READ;
+                        }
+
+                        if(FD_ISSET(watch->fd, &writeset))
+                        {
+                                revents |= LOOP_WRITE;
+                        }
+
+                        if(revents != 0)
+                        {
+                                loop_ready(watch, revents);
+                        }
+                }
+        }
+#endif
+
+        loop_dispatch();
+
+        return 0;
+}
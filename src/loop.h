@@ -0,0 +1,122 @@
+/*
+ *  Yaddns - Yet Another ddns client
+ *  Copyright (C) 2008 Anthony Viallard <anthony.viallard@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _YADDNS_LOOP_H_
+#define _YADDNS_LOOP_H_
+
+#include <stddef.h>
+
+#include "list.h"
+
+/*
+ * This module is the yaddns event loop.
+ *
+ * A file descriptor is watched by registering a loop_watch once with
+ * loop_watch_add(). When the interest changes (for example a request
+ * going from sending to waiting response), the watch is re-armed with
+ * loop_watch_mod() instead of being rebuilt on each iteration.
+ *
+ * Two backends are availables:
+ * - epoll (default on linux)     => persistent interest set, signals
+ *                                   are received through a signalfd
+ * - select (--disable-epoll)     => fd_set are rebuilt from the watch
+ *                                   list, signals interrupt pselect()
+ */
+
+#define LOOP_READ       0x01 << 0
+#define LOOP_WRITE      0x01 << 1
+
+struct loop_watch;
+
+typedef void (*loop_watch_cb)(struct loop_watch *watch,
+                              unsigned int revents);
+
+struct loop_watch {
+        int fd;
+        unsigned int events;  /* LOOP_* mask to watch */
+        unsigned int revents; /* LOOP_* mask ready (during dispatch) */
+        loop_watch_cb cb;
+        void *data;           /* free to use by the watch owner */
+        int registered;
+        struct list_head list;  /* all registered watches */
+        struct list_head ready; /* watches to dispatch */
+};
+
+/*
+ * init the loop backend
+ *
+ * @return 0 if success, -1 otherwise
+ */
+extern int loop_init(void);
+
+/*
+ * cleanup the loop backend (registered watches are forgotten)
+ */
+extern void loop_cleanup(void);
+
+/*
+ * Return the name of the compiled backend
+ */
+extern const char *loop_backend(void);
+
+/*
+ * init a watch structure. Must be called before any other
+ * loop_watch_* call on it.
+ */
+extern void loop_watch_init(struct loop_watch *watch,
+                            loop_watch_cb cb, void *data);
+
+/*
+ * Start watching fd for events (LOOP_READ and/or LOOP_WRITE)
+ *
+ * @return 0 if success, -1 otherwise
+ */
+extern int loop_watch_add(struct loop_watch *watch,
+                          int fd, unsigned int events);
+
+/*
+ * Change the watched events of a registered watch
+ *
+ * @return 0 if success, -1 otherwise
+ */
+extern int loop_watch_mod(struct loop_watch *watch, unsigned int events);
+
+/*
+ * Stop watching. Safe to call on a not registered watch and from a
+ * watch callback (even for another watch ready in the same pass).
+ */
+extern void loop_watch_del(struct loop_watch *watch);
+
+/*
+ * Deliver signums to sig_cb from the loop (and not from a signal
+ * handler context). Signals are blocked outside of the loop wait.
+ *
+ * @return 0 if success, -1 otherwise
+ */
+extern int loop_signal_setup(const int *signums, size_t count,
+                             void (*sig_cb)(int signum));
+
+/*
+ * Wait at most timeout_ms milliseconds (-1 = infinite) for events,
+ * then dispatch signals and ready watches.
+ *
+ * @return 0 if success, -1 on fatal error
+ */
+extern int loop_run_once(int timeout_ms);
+
+#endif
@@ -9,30 +9,77 @@
 #include "myip.h"
 
 #include "request.h"
-#include "yaddns.h"
+#include "timer.h"
+#include "util.h"
 #include "log.h"
 
-/* sleep REQ_SLEEPTIME_ON_ERROR when got an request error */
-#define REQ_SLEEPTIME_ON_ERROR 60
-
-static struct myip_ctl {
-        enum {
-                MISError = -1,
-                MISNeedUpdate = 0,
-                MISHaveIp = 1,
-                MISWorking,
-        } status;
-        struct in_addr wanaddr;
-        struct timeval timelasterror;
-        struct timeval timelastok;
-} myip_ctl = {
-        .status = MISNeedUpdate,
-        .wanaddr = {0},
-        .timelasterror = {0, 0},
-        .timelastok = {0, 0},
-};
+/*
+ * no provider gave the address in this round: retry later, no sooner
+ * than the retry-after asked
+ */
+static void myip_error(struct myip *myip)
+{
+        wanip_error(&(myip->src), myip->retry_after);
+}
+
+/*
+ * sort the providers, the ones which failed the less in a row then
+ * the fastest first (the not measured ones are tried first)
+ */
+static void myip_order(struct myip *myip)
+{
+        const struct myip_provider *a = NULL,
+                *b = NULL;
+        unsigned int i, j, idx;
+
+        for(i = 0; i < myip->count; ++i)
+        {
+                idx = i;
+                a = &(myip->provider[idx]);
+
+                for(j = i; j > 0; --j)
+                {
+                        b = &(myip->provider[myip->order[j - 1]]);
+                        if(b->failures < a->failures
+                           || (b->failures == a->failures
+                               && b->latency <= a->latency))
+                        {
+                                break;
+                        }
 
-static void myip_reqhook_recv(struct request_buff *buff)
+                        myip->order[j] = myip->order[j - 1];
+                }
+
+                myip->order[j] = idx;
+        }
+}
+
+static void myip_stat(struct myip_provider *provider, int success)
+{
+        uint64_t latency = timer_now() - provider->sent;
+
+        ++(provider->requests);
+
+        if(!success)
+        {
+                ++(provider->errors);
+                ++(provider->failures);
+                return;
+        }
+
+        provider->failures = 0;
+        provider->latency = (provider->latency == 0
+                             ? latency
+                             : (provider->latency * 3 + latency) / 4);
+}
+
+/*
+ * find the wan ip address in the response of a provider
+ *
+ * @return 0 if found, -1 otherwise
+ */
+static int myip_parse(struct request_response *response,
+                      struct in_addr *addr)
 {
 	int ip1 = 0,
                 ip2 = 0,
@@ -42,20 +89,16 @@ static void myip_reqhook_recv(struct request_buff *buff)
 	char *p_digit = NULL;
         const char *data = NULL;
         char ip[16];
-        struct in_addr inp;
         int count;
 
-        data = buff->data;
+        data = response->body;
 
         /* check http response */
-        if(!(strstr(data, "HTTP/1.1 200 OK") ||
-             strstr(data, "HTTP/1.0 200 OK")))
+        if(response->status != 200)
 	{
-                log_error("HTTP code different to 200 in myip response");
+                log_error("HTTP code %d in myip response", response->status);
                 log_debug("PACKET: %s", data);
-                myip_ctl.status = MISError;
-                myip_ctl.timelasterror.tv_sec = util_getuptime();
-                return;
+                return -1;
         }
 
         /* try to find wan ip address */
@@ -85,76 +128,157 @@ static void myip_reqhook_recv(struct request_buff *buff)
         {
                 log_error("No found wan ip address in myip response");
                 log_debug("PACKET: %s", data);
-                myip_ctl.status = MISError;
-                myip_ctl.timelasterror.tv_sec = util_getuptime();
-                return;
+                return -1;
         }
 
         snprintf(ip, sizeof(ip),
                  "%d.%d.%d.%d", ip1, ip2, ip3, ip4);
-        if(inet_aton(ip, &inp) == 0)
+        if(inet_aton(ip, addr) == 0)
         {
                 log_error("inet_aton(%s) failed: %s",
                           ip, strerror(errno));
-                myip_ctl.status = MISError;
-                myip_ctl.timelasterror.tv_sec = util_getuptime();
+                return -1;
+        }
+
+        return 0;
+}
+
+/*
+ * an answer of the round: the first one is taken, but in quorum mode
+ * where quorum answers must agree
+ */
+static void myip_answer(struct myip *myip, struct myip_provider *provider,
+                        const struct in_addr *addr)
+{
+        unsigned int i, votes = 0;
+
+        if(myip->mode != cfg_myip_quorum)
+        {
+                wanip_accept(&(myip->src), addr);
                 return;
         }
 
-        /* update myip_ctl structure */
-        myip_ctl.status = MISHaveIp;
-        myip_ctl.wanaddr.s_addr = inp.s_addr;
-        myip_ctl.timelastok.tv_sec = util_getuptime();
+        provider->answered = 1;
+        provider->answer = *addr;
+
+        for(i = 0; i < myip->count; ++i)
+        {
+                if(myip->provider[i].round == myip->round
+                   && myip->provider[i].answered
+                   && myip->provider[i].answer.s_addr == addr->s_addr)
+                {
+                        ++votes;
+                }
+        }
+
+        if(votes >= myip->quorum)
+        {
+                wanip_accept(&(myip->src), addr);
+        }
+        else if(myip->pending == 0)
+        {
+                log_error("No quorum of %u myip providers on the wan ip"
+                          " address", myip->quorum);
+                myip_error(myip);
+        }
 }
 
-static void myip_reqhook_error(struct request *request)
+/*
+ * a failure of the round: the next provider is asked in failover
+ * mode, the round fails once all of them failed
+ */
+static void myip_failure(struct myip *myip)
 {
-        log_error("myip failed to retrieve wan ip address from %s:%u (%s)",
-                  request->host.addr, request->host.port,
-                  strreqerr(request->errcode));
+        if(myip->pending > 0)
+        {
+                return;
+        }
 
-        /* update myip_ctl structure */
-        if(request->errcode == REQ_ERR_CONNECT_TIMEOUT
-           || request->errcode == REQ_ERR_RESPONSE_TIMEOUT
-           || request->errcode == REQ_ERR_SENDING_TIMEOUT)
+        if(myip->mode == cfg_myip_failover && myip->src.next < myip->count)
         {
-                /* try again immediatly */
-                myip_ctl.status = MISNeedUpdate;
+                wanip_next(&(myip->src));
+                return;
         }
-        else
+
+        if(myip->mode == cfg_myip_quorum)
         {
-                myip_ctl.status = MISError;
-                myip_ctl.timelasterror.tv_sec = util_getuptime();
+                log_error("No quorum of %u myip providers on the wan ip"
+                          " address", myip->quorum);
         }
+
+        myip_error(myip);
 }
 
 static void myip_reqhook(struct request *request, void *data)
 {
-        (void)data;
+        struct myip_provider *provider = data;
+        struct myip *myip = provider->myip;
+        struct in_addr addr;
+        int ret = -1;
 
         if(request->state == FSResponseReceived)
         {
-                myip_reqhook_recv(&(request->buff));
+                ret = myip_parse(&(request->response), &addr);
+                if(ret != 0)
+                {
+                        myip->retry_after = MAX(myip->retry_after,
+                                                request_response_retry_after(
+                                                        &(request->response)));
+                }
         }
         else if(request->state == FSError)
         {
-                myip_reqhook_error(request);
+                log_error("myip failed to retrieve wan ip address from"
+                          " %s:%u (%s)",
+                          request->host.addr, request->host.port,
+                          strreqerr(request->errcode));
+        }
+        else
+        {
+                return;
+        }
+
+        provider->inflight = 0;
+        myip_stat(provider, (ret == 0));
+
+        /* a late answer of a round over */
+        if(provider->round != myip->round
+           || myip->src.status != WISWorking)
+        {
+                return;
+        }
+
+        --(myip->pending);
+
+        if(ret == 0)
+        {
+                myip_answer(myip, provider, &addr);
+        }
+        else
+        {
+                /* the timeouts too: retrying at once in a network
+                 * outage only loads the link
+                 */
+                myip_failure(myip);
         }
 }
 
-static int myip_sendrequest(const char *host,
-                            unsigned short int port, const char *path)
+static int myip_sendrequest(struct myip_provider *provider,
+                            const struct cfg_myip_provider *cfg,
+                            const struct in_addr *bind_addr)
 {
+        const char *host = cfgstr_get(&(cfg->host));
+        const char *path = cfgstr_get(&(cfg->path));
+        unsigned short int port = cfg->port;
         struct request_host req_host;
         struct request_ctl req_ctl = {
                 .hook_func = myip_reqhook,
-                .hook_data = NULL,
+                .hook_data = provider,
         };
         struct request_buff req_buff;
         struct request_opt req_opt = {
                 .mask = 0,
         };
-        int n;
 
         /* req_host structure */
         snprintf(req_host.addr, sizeof(req_host.addr),
@@ -164,17 +288,21 @@ static int myip_sendrequest(const char *host,
         /* req_buff structure, tell to service to fill it */
         memset(&req_buff, 0, sizeof(req_buff));
 
-        n = snprintf(req_buff.data, sizeof(req_buff.data),
-                     "GET %s HTTP/1.0\r\n"
-                     "Host: %s\r\n\r\n",
-                     path, host);
-        if(n < 0)
+        if(request_buff_printf(&req_buff,
+                               "GET %s HTTP/1.0\r\n"
+                               "Host: %s\r\n\r\n",
+                               path, host) != 0)
         {
                 log_error("Unable to write data buffer");
                 return -1;
         }
 
-        req_buff.data_size = (size_t)n;
+        /* from the address of its wan */
+        if(bind_addr != NULL)
+        {
+                req_opt.mask |= REQ_OPT_BIND_ADDR;
+                req_opt.bind_addr = *bind_addr;
+        }
 
         /* send request */
         if(request_send(&req_host, &req_ctl,
@@ -185,55 +313,101 @@ static int myip_sendrequest(const char *host,
                 return -1;
         }
 
+        provider->round = provider->myip->round;
+        provider->inflight = 1;
+        provider->answered = 0;
+        provider->sent = timer_now();
+
         return 0;
 }
 
 /*
- * An first call, we don't have wan ip address yet. We need to wait.
+ * ask the providers of a round: the next one in failover mode, all of
+ * them otherwise (but the ones whose request is still on the way)
  */
-int myip_getwanipaddr(const struct cfg_myip *cfg_myip, struct in_addr *wanaddr)
+static void myip_sendround(struct myip *myip, const struct cfg_myip *cfg_myip,
+                           const struct in_addr *bind_addr)
 {
-        int ret = -1;
-        time_t uptime = util_getuptime();
+        struct myip_provider *provider = NULL;
+        unsigned int i, idx;
 
-        if(myip_ctl.timelastok.tv_sec != 0)
+        if(myip->src.next == 0)
         {
-                /* return the last wan ip address got */
-                *wanaddr = myip_ctl.wanaddr;
-                ret = 0;
+                ++(myip->round);
+                myip->count = MIN(cfg_myip->count, (unsigned int)CFG_MYIP_MAX);
+                myip->mode = cfg_myip->mode;
+                myip->quorum = cfg_myip->quorum;
+                myip->pending = 0;
+                myip->retry_after = 0;
+                myip_order(myip);
         }
 
-        if((myip_ctl.status == MISHaveIp
-            && (uptime - myip_ctl.timelastok.tv_sec
-                >= cfg_myip->upint))
-           || (myip_ctl.status == MISError
-               && (uptime - myip_ctl.timelasterror.tv_sec
-                   >= REQ_SLEEPTIME_ON_ERROR)))
+        for(i = myip->src.next; i < myip->count; ++i)
         {
-                /* timeout, need update */
-                myip_ctl.status = MISNeedUpdate;
-        }
+                idx = myip->order[i];
+                provider = &(myip->provider[idx]);
+                myip->src.next = i + 1;
 
-        if(myip_ctl.status == MISNeedUpdate)
-        {
-                /* send a request */
-                if(myip_sendrequest(cfgstr_get(&(cfg_myip->host)),
-                                    cfg_myip->port,
-                                    cfgstr_get(&(cfg_myip->path))) == 0)
+                if(provider->inflight
+                   || myip_sendrequest(provider, &(cfg_myip->provider[idx]),
+                                       bind_addr) != 0)
                 {
-                        myip_ctl.status = MISWorking;
+                        continue;
                 }
-                else
+
+                ++(myip->pending);
+
+                if(myip->mode == cfg_myip_failover)
                 {
-                        myip_ctl.status = MISError;
-                        myip_ctl.timelasterror.tv_sec = uptime;
+                        break;
                 }
         }
 
-        return ret;
+        if(myip->pending == 0)
+        {
+                myip_error(myip);
+        }
 }
 
-void myip_needupdate(void)
+static void myip_send(struct wanip *wanip, const void *cfg,
+                      const struct in_addr *bind_addr)
 {
-        myip_ctl.status = MISNeedUpdate;
+        struct myip *myip = CONTAINER_OF(wanip, struct myip, src);
+        const struct cfg_myip *cfg_myip = cfg;
+
+        wanip->upint = (myip->followed
+                        ? MAX(cfg_myip->upint, cfg_myip->safety_upint)
+                        : cfg_myip->upint);
+
+        myip_sendround(myip, cfg_myip, bind_addr);
+}
+
+static void myip_cancel(struct wanip *wanip)
+{
+        struct myip *myip = CONTAINER_OF(wanip, struct myip, src);
+        unsigned int i;
+
+        for(i = 0; i < CFG_MYIP_MAX; ++i)
+        {
+                request_ctl_remove_by_hook_data(&(myip->provider[i]));
+                myip->provider[i].inflight = 0;
+        }
+}
+
+static const struct wanip_ops myip_ops = {
+        .send = myip_send,
+        .cancel = myip_cancel,
+};
+
+void myip_init(struct myip *myip)
+{
+        unsigned int i;
+
+        memset(myip, 0, sizeof(struct myip));
+        wanip_init(&(myip->src), &myip_ops);
+
+        for(i = 0; i < CFG_MYIP_MAX; ++i)
+        {
+                myip->provider[i].myip = myip;
+        }
 }
@@ -1,10 +1,46 @@
 #ifndef _YADDNS_MYIP_H_
 #define _YADDNS_MYIP_H_
 
+#include <netinet/in.h>
+
 #include "config.h"
+#include "wanip.h"
+
+struct myip;
+
+/* a provider of the myip service, and its statistics which order them */
+struct myip_provider {
+        struct myip *myip;          /* its service */
+        unsigned int round;         /* of its last request */
+        int inflight;               /* its request is on the way */
+        uint64_t sent;              /* time of its request (ms) */
+        int answered;               /* in its last round */
+        struct in_addr answer;
+        unsigned long requests;
+        unsigned long errors;
+        unsigned int failures;      /* in a row */
+        uint64_t latency;           /* smoothed, in ms */
+};
 
-int myip_getwanipaddr(const struct cfg_myip *cfg_myip, struct in_addr *wanaddr);
+/* wan ip address given by a myip service (one by wan source) */
+struct myip {
+        struct wanip src;           /* its address and its updates */
+        int followed; /* the changes of its wan trigger the requests,
+                       * the safety upint applies */
+        struct myip_provider provider[CFG_MYIP_MAX]; /* as in the cfg */
+        unsigned int order[CFG_MYIP_MAX]; /* best providers first */
+        unsigned int count;
+        enum cfg_myip_mode mode;
+        unsigned int quorum;
+        unsigned int round; /* requests of the current update */
+        unsigned int pending; /* requests of the round on the way */
+        unsigned int retry_after; /* asked by the providers in the
+                                   * round */
+};
 
-void myip_needupdate(void);
+/* init it, then it's used as a wan ip source (see wanip.h) with the
+ * cfg_myip settings: the providers are asked as the mode says
+ */
+void myip_init(struct myip *myip);
 
 #endif
@@ -0,0 +1,560 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#if defined(USE_NETLINK)
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_addr.h>
+#endif
+
+#include "netlink.h"
+#include "loop.h"
+#include "log.h"
+#include "util.h"
+
+#if defined(USE_NETLINK)
+
+/* a read gets at most NETLINK_BUFSIZE bytes of messages */
+#define NETLINK_BUFSIZE 16384
+
+#define NETLINK_ALIGN(len) (((size_t)(len) + 3) & ~(size_t)3)
+
+static struct netlink_ctl {
+        int fd;
+        struct loop_watch watch;
+        netlink_cb cb;
+        void *data;
+        uint32_t seq;               /* of the last dump */
+        int dumping;                /* a dump is running */
+        int dump_wanted;            /* asked while dumping */
+} netlink_ctl = {
+        .fd = -1,
+};
+
+/*
+ * index the attributes of buf by type (up to max) in tb
+ *
+ * @return 0 if success, -1 if an attribute is malformed
+ */
+static int netlink_attrs(const unsigned char *buf, size_t len,
+                         const struct rtattr **tb, unsigned short max)
+{
+        const struct rtattr *rta = NULL;
+        size_t step;
+
+        memset(tb, 0, sizeof(*tb) * ((size_t)max + 1));
+
+        while(len >= sizeof(struct rtattr))
+        {
+                rta = (const struct rtattr *)(const void *)buf;
+                if(rta->rta_len < sizeof(struct rtattr)
+                   || rta->rta_len > len)
+                {
+                        return -1;
+                }
+
+                if(rta->rta_type <= max)
+                {
+                        tb[rta->rta_type] = rta;
+                }
+
+                step = NETLINK_ALIGN(rta->rta_len);
+                if(step >= len)
+                {
+                        break;
+                }
+
+                buf += step;
+                len -= step;
+        }
+
+        return 0;
+}
+
+static size_t netlink_attr_len(const struct rtattr *rta)
+{
+        return rta->rta_len - sizeof(struct rtattr);
+}
+
+static const void *netlink_attr_data(const struct rtattr *rta)
+{
+        return (const unsigned char *)rta + sizeof(struct rtattr);
+}
+
+static int netlink_addr(const struct nlmsghdr *nlh,
+                        netlink_cb cb, void *data)
+{
+        const unsigned char *payload = (const unsigned char *)nlh
+                + NETLINK_ALIGN(sizeof(struct nlmsghdr));
+        size_t len = nlh->nlmsg_len - NETLINK_ALIGN(sizeof(struct nlmsghdr));
+        const struct ifaddrmsg *ifa = NULL;
+        const struct rtattr *tb[IFA_MAX + 1];
+        const struct rtattr *rta = NULL;
+        struct netlink_event event;
+        uint32_t flags;
+        size_t size;
+
+        if(len < sizeof(struct ifaddrmsg))
+        {
+                return -1;
+        }
+
+        ifa = (const struct ifaddrmsg *)(const void *)payload;
+        if(netlink_attrs(payload + NETLINK_ALIGN(sizeof(struct ifaddrmsg)),
+                         len - NETLINK_ALIGN(sizeof(struct ifaddrmsg)),
+                         tb, IFA_MAX) != 0)
+        {
+                return -1;
+        }
+
+        if(ifa->ifa_family == AF_INET)
+        {
+                size = sizeof(struct in_addr);
+        }
+        else if(ifa->ifa_family == AF_INET6)
+        {
+                size = sizeof(struct in6_addr);
+        }
+        else
+        {
+                return 0;
+        }
+
+        /* the peer is IFA_ADDRESS on a point to point link */
+        rta = (tb[IFA_LOCAL] != NULL ? tb[IFA_LOCAL] : tb[IFA_ADDRESS]);
+        if(rta == NULL)
+        {
+                return 0;
+        }
+
+        if(netlink_attr_len(rta) < size)
+        {
+                return -1;
+        }
+
+        /* the flags over 8 bits are only in IFA_FLAGS */
+        flags = ifa->ifa_flags;
+        if(tb[IFA_FLAGS] != NULL
+           && netlink_attr_len(tb[IFA_FLAGS]) >= sizeof(uint32_t))
+        {
+                memcpy(&flags, netlink_attr_data(tb[IFA_FLAGS]),
+                       sizeof(uint32_t));
+        }
+
+        memset(&event, 0, sizeof(event));
+        event.type = (nlh->nlmsg_type == RTM_NEWADDR
+                      ? NETLINK_ADDR_NEW : NETLINK_ADDR_DEL);
+        event.ifindex = (int)ifa->ifa_index;
+        event.family = ifa->ifa_family;
+        memcpy(&(event.addr), netlink_attr_data(rta), size);
+
+        if(ifa->ifa_family == AF_INET && (flags & IFA_F_SECONDARY))
+        {
+                event.flags |= NETLINK_F_SECONDARY;
+        }
+
+        if(ifa->ifa_family == AF_INET6
+           && (flags & (IFA_F_TEMPORARY | IFA_F_DEPRECATED
+                        | IFA_F_TENTATIVE | IFA_F_DADFAILED)))
+        {
+                event.flags |= NETLINK_F_UNSTABLE;
+        }
+
+        if(ifa->ifa_scope != RT_SCOPE_UNIVERSE)
+        {
+                event.flags |= NETLINK_F_LOCAL;
+        }
+
+        cb(&event, data);
+
+        return 0;
+}
+
+static int netlink_link(const struct nlmsghdr *nlh,
+                        netlink_cb cb, void *data)
+{
+        const unsigned char *payload = (const unsigned char *)nlh
+                + NETLINK_ALIGN(sizeof(struct nlmsghdr));
+        size_t len = nlh->nlmsg_len - NETLINK_ALIGN(sizeof(struct nlmsghdr));
+        const struct ifinfomsg *ifi = NULL;
+        const struct rtattr *tb[IFLA_MAX + 1];
+        struct netlink_event event;
+        size_t size;
+
+        if(len < sizeof(struct ifinfomsg))
+        {
+                return -1;
+        }
+
+        ifi = (const struct ifinfomsg *)(const void *)payload;
+        if(netlink_attrs(payload + NETLINK_ALIGN(sizeof(struct ifinfomsg)),
+                         len - NETLINK_ALIGN(sizeof(struct ifinfomsg)),
+                         tb, IFLA_MAX) != 0)
+        {
+                return -1;
+        }
+
+        memset(&event, 0, sizeof(event));
+        event.type = (nlh->nlmsg_type == RTM_NEWLINK
+                      ? NETLINK_LINK_NEW : NETLINK_LINK_DEL);
+        event.ifindex = ifi->ifi_index;
+        event.flags = ifi->ifi_flags;
+
+        if(tb[IFLA_IFNAME] != NULL)
+        {
+                size = MIN(netlink_attr_len(tb[IFLA_IFNAME]),
+                           sizeof(event.ifname) - 1);
+                memcpy(event.ifname, netlink_attr_data(tb[IFLA_IFNAME]),
+                       size);
+                event.ifname[size] = '\0';
+        }
+
+        cb(&event, data);
+
+        return 0;
+}
+
+static int netlink_route(const struct nlmsghdr *nlh,
+                         netlink_cb cb, void *data)
+{
+        const unsigned char *payload = (const unsigned char *)nlh
+                + NETLINK_ALIGN(sizeof(struct nlmsghdr));
+        size_t len = nlh->nlmsg_len - NETLINK_ALIGN(sizeof(struct nlmsghdr));
+        const struct rtmsg *rtm = NULL;
+        const struct rtattr *tb[RTA_MAX + 1];
+        struct netlink_event event;
+        uint32_t table, oif = 0;
+
+        if(len < sizeof(struct rtmsg))
+        {
+                return -1;
+        }
+
+        rtm = (const struct rtmsg *)(const void *)payload;
+        if(netlink_attrs(payload + NETLINK_ALIGN(sizeof(struct rtmsg)),
+                         len - NETLINK_ALIGN(sizeof(struct rtmsg)),
+                         tb, RTA_MAX) != 0)
+        {
+                return -1;
+        }
+
+        /* the tables over 255 are only in RTA_TABLE */
+        table = rtm->rtm_table;
+        if(tb[RTA_TABLE] != NULL
+           && netlink_attr_len(tb[RTA_TABLE]) >= sizeof(uint32_t))
+        {
+                memcpy(&table, netlink_attr_data(tb[RTA_TABLE]),
+                       sizeof(uint32_t));
+        }
+
+        if(rtm->rtm_family != AF_INET || rtm->rtm_dst_len != 0
+           || rtm->rtm_type != RTN_UNICAST || table != RT_TABLE_MAIN)
+        {
+                return 0;
+        }
+
+        if(tb[RTA_OIF] != NULL
+           && netlink_attr_len(tb[RTA_OIF]) >= sizeof(uint32_t))
+        {
+                memcpy(&oif, netlink_attr_data(tb[RTA_OIF]),
+                       sizeof(uint32_t));
+        }
+
+        memset(&event, 0, sizeof(event));
+        event.type = (nlh->nlmsg_type == RTM_NEWROUTE
+                      ? NETLINK_ROUTE_NEW : NETLINK_ROUTE_DEL);
+        event.ifindex = (int)oif;
+        event.family = AF_INET;
+
+        cb(&event, data);
+
+        return 0;
+}
+
+int netlink_parse(const void *buf, size_t len,
+                  netlink_cb cb, void *data)
+{
+        const unsigned char *p = buf;
+        const struct nlmsghdr *nlh = NULL;
+        size_t step;
+        int ret = 0;
+
+        while(len >= sizeof(struct nlmsghdr))
+        {
+                nlh = (const struct nlmsghdr *)(const void *)p;
+                if(nlh->nlmsg_len < sizeof(struct nlmsghdr)
+                   || nlh->nlmsg_len > len)
+                {
+                        return -1;
+                }
+
+                switch(nlh->nlmsg_type)
+                {
+                case NLMSG_DONE:
+                case NLMSG_ERROR:
+                        /* end (or failure) of a dump */
+                        ret = 1;
+                        break;
+
+                case RTM_NEWADDR:
+                case RTM_DELADDR:
+                        if(netlink_addr(nlh, cb, data) != 0)
+                        {
+                                return -1;
+                        }
+                        break;
+
+                case RTM_NEWLINK:
+                case RTM_DELLINK:
+                        if(netlink_link(nlh, cb, data) != 0)
+                        {
+                                return -1;
+                        }
+                        break;
+
+                case RTM_NEWROUTE:
+                case RTM_DELROUTE:
+                        if(netlink_route(nlh, cb, data) != 0)
+                        {
+                                return -1;
+                        }
+                        break;
+
+                default:
+                        break;
+                }
+
+                step = NETLINK_ALIGN(nlh->nlmsg_len);
+                if(step >= len)
+                {
+                        break;
+                }
+
+                p += step;
+                len -= step;
+        }
+
+        return ret;
+}
+
+static void netlink_resync(void)
+{
+        struct netlink_event event;
+
+        memset(&event, 0, sizeof(event));
+        event.type = NETLINK_RESYNC;
+
+        netlink_ctl.cb(&event, netlink_ctl.data);
+}
+
+static void netlink_read_cb(struct loop_watch *watch, unsigned int revents)
+{
+        uint32_t buf[NETLINK_BUFSIZE / sizeof(uint32_t)];
+        struct sockaddr_nl from;
+        socklen_t fromlen;
+        ssize_t len;
+        int ret;
+
+        UNUSED(revents);
+
+        for(;;)
+        {
+                fromlen = sizeof(from);
+                len = recvfrom(watch->fd, buf, sizeof(buf), 0,
+                               (struct sockaddr *)&from, &fromlen);
+                if(len < 0)
+                {
+                        if(errno == EINTR)
+                        {
+                                continue;
+                        }
+
+                        if(errno == ENOBUFS)
+                        {
+                                /* the dump messages aren't lost, the
+                                 * kernel waits for the room
+                                 */
+                                log_warning("rtnetlink events lost,"
+                                            " read the state again");
+                                netlink_resync();
+                                continue;
+                        }
+
+                        if(errno != EAGAIN && errno != EWOULDBLOCK)
+                        {
+                                log_error("recvfrom(rtnetlink): %s",
+                                          strerror(errno));
+                        }
+
+                        break;
+                }
+
+                if(from.nl_pid != 0)
+                {
+                        /* not sent by the kernel */
+                        continue;
+                }
+
+                ret = netlink_parse(buf, (size_t)len,
+                                    netlink_ctl.cb, netlink_ctl.data);
+                if(ret < 0)
+                {
+                        log_warning("Malformed rtnetlink message");
+                }
+                else if(ret == 1 && netlink_ctl.dumping)
+                {
+                        netlink_ctl.dumping = 0;
+
+                        if(netlink_ctl.dump_wanted)
+                        {
+                                netlink_ctl_dump();
+                        }
+                }
+        }
+}
+
+int netlink_ctl_init(netlink_cb cb, void *data)
+{
+        struct sockaddr_nl local;
+        int fd;
+
+        fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+        if(fd < 0)
+        {
+                log_error("socket(AF_NETLINK): %s", strerror(errno));
+                return -1;
+        }
+
+        memset(&local, 0, sizeof(local));
+        local.nl_family = AF_NETLINK;
+        local.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR
+                | RTMGRP_IPV6_IFADDR | RTMGRP_IPV4_ROUTE;
+
+        if(fcntl(fd, F_SETFL, O_NONBLOCK) < 0
+           || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0
+           || bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0)
+        {
+                log_error("Unable to bind the rtnetlink socket: %s",
+                          strerror(errno));
+                close(fd);
+                return -1;
+        }
+
+        netlink_ctl.cb = cb;
+        netlink_ctl.data = data;
+        netlink_ctl.dumping = 0;
+        netlink_ctl.dump_wanted = 0;
+
+        loop_watch_init(&(netlink_ctl.watch), netlink_read_cb, NULL);
+        if(loop_watch_add(&(netlink_ctl.watch), fd, LOOP_READ) != 0)
+        {
+                close(fd);
+                return -1;
+        }
+
+        netlink_ctl.fd = fd;
+
+        return 0;
+}
+
+void netlink_ctl_cleanup(void)
+{
+        if(netlink_ctl.fd < 0)
+        {
+                return;
+        }
+
+        loop_watch_del(&(netlink_ctl.watch));
+        close(netlink_ctl.fd);
+        netlink_ctl.fd = -1;
+}
+
+int netlink_ctl_available(void)
+{
+        return (netlink_ctl.fd >= 0);
+}
+
+int netlink_ctl_dump(void)
+{
+        struct {
+                struct nlmsghdr nlh;
+                struct ifaddrmsg ifa;
+        } req;
+        struct sockaddr_nl kernel;
+
+        if(netlink_ctl.fd < 0)
+        {
+                return -1;
+        }
+
+        if(netlink_ctl.dumping)
+        {
+                netlink_ctl.dump_wanted = 1;
+                return 0;
+        }
+
+        memset(&req, 0, sizeof(req));
+        req.nlh.nlmsg_len = sizeof(req);
+        req.nlh.nlmsg_type = RTM_GETADDR;
+        req.nlh.nlmsg_flags = (unsigned short)(NLM_F_REQUEST | NLM_F_DUMP);
+        req.nlh.nlmsg_seq = ++netlink_ctl.seq;
+        req.ifa.ifa_family = AF_UNSPEC;
+
+        memset(&kernel, 0, sizeof(kernel));
+        kernel.nl_family = AF_NETLINK;
+
+        if(sendto(netlink_ctl.fd, &req, sizeof(req), 0,
+                  (struct sockaddr *)&kernel, sizeof(kernel)) < 0)
+        {
+                log_error("Unable to dump the addresses: %s",
+                          strerror(errno));
+                return -1;
+        }
+
+        netlink_ctl.dumping = 1;
+        netlink_ctl.dump_wanted = 0;
+
+        return 0;
+}
+
+#else /* no netlink */
+
+int netlink_parse(const void *buf, size_t len,
+                  netlink_cb cb, void *data)
+{
+        UNUSED(buf);
+        UNUSED(len);
+        UNUSED(cb);
+        UNUSED(data);
+
+        return -1;
+}
+
+int netlink_ctl_init(netlink_cb cb, void *data)
+{
+        UNUSED(cb);
+        UNUSED(data);
+
+        return -1;
+}
+
+void netlink_ctl_cleanup(void)
+{
+}
+
+int netlink_ctl_available(void)
+{
+        return 0;
+}
+
+int netlink_ctl_dump(void)
+{
+        return -1;
+}
+
+#endif
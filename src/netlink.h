@@ -0,0 +1,107 @@
+/*
+ *  Yaddns - Yet Another ddns client
+ *  Copyright (C) 2008 Anthony Viallard <anthony.viallard@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _YADDNS_NETLINK_H_
+#define _YADDNS_NETLINK_H_
+
+#include <stddef.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+/*
+ * This module watches the kernel network events (rtnetlink) from the
+ * event loop: the addresses, the links and the ipv4 default routes
+ * added or removed. They are
+ * given to a callback as soon as the kernel reports them, nothing is
+ * polled.
+ *
+ * The current addresses are reported by a dump (netlink_ctl_dump()),
+ * as if they were just added. When the kernel had to drop events (the
+ * socket buffer overflowed), a NETLINK_RESYNC event asks to read the
+ * state again.
+ *
+ * Only on linux (--disable-netlink to not use it), netlink_ctl_init()
+ * fails otherwise.
+ */
+
+enum netlink_type {
+        NETLINK_ADDR_NEW = 0,
+        NETLINK_ADDR_DEL,
+        NETLINK_LINK_NEW,           /* added or changed */
+        NETLINK_LINK_DEL,
+        NETLINK_ROUTE_NEW,          /* ipv4 default route of the main
+                                     * table, ifindex is its output */
+        NETLINK_ROUTE_DEL,
+        NETLINK_RESYNC,             /* events lost */
+};
+
+/* flags of an address */
+#define NETLINK_F_SECONDARY     0x01 << 0 /* ipv4, not the primary one */
+#define NETLINK_F_UNSTABLE      0x01 << 1 /* ipv6 temporary (privacy),
+                                           * deprecated, tentative or
+                                           * duplicated */
+#define NETLINK_F_LOCAL         0x01 << 2 /* not of global scope */
+
+struct netlink_event {
+        enum netlink_type type;
+        int ifindex;
+        char ifname[IF_NAMESIZE];   /* of a link, "" for an address */
+        unsigned int flags;         /* NETLINK_F_* of an address, IFF_*
+                                     * of a link */
+        int family;                 /* AF_INET or AF_INET6 address */
+        union {
+                struct in_addr v4;
+                struct in6_addr v6;
+        } addr;                     /* the local one */
+};
+
+typedef void (*netlink_cb)(const struct netlink_event *event, void *data);
+
+/*
+ * open the rtnetlink socket and watch it in the loop, the events are
+ * given to cb
+ *
+ * @return 0 if success, -1 otherwise
+ */
+extern int netlink_ctl_init(netlink_cb cb, void *data);
+
+extern void netlink_ctl_cleanup(void);
+
+/*
+ * @return 1 if the events are watched, 0 otherwise
+ */
+extern int netlink_ctl_available(void);
+
+/*
+ * ask the current addresses, they are reported as NETLINK_ADDR_NEW
+ * events. A dump asked while one is running is done after it.
+ *
+ * @return 0 if success, -1 otherwise
+ */
+extern int netlink_ctl_dump(void);
+
+/*
+ * give the events of the rtnetlink messages of buf to cb
+ *
+ * @return 1 if they end a dump, 0 otherwise, -1 if a message is
+ * malformed
+ */
+extern int netlink_parse(const void *buf, size_t len,
+                         netlink_cb cb, void *data);
+
+#endif
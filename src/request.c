@@ -2,8 +2,10 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <strings.h>
 
 #include <sys/ioctl.h>
 #include <sys/types.h>
@@ -11,65 +13,185 @@
 #include <netinet/in.h>
 #include <net/if.h>
 #include <arpa/inet.h>
-#include <netdb.h>
 
 #include "request.h"
+#include "loop.h"
+#include "timer.h"
+#include "resolv.h"
 #include "log.h"
 #include "util.h"
 
+/* connections to a host:port (from a bind address) */
+struct request_pool {
+        struct list_head list;      /* in request_pools */
+        char addr[128];
+        unsigned short int port;
+        in_addr_t bind_addr;        /* INADDR_ANY if not bound */
+        struct list_head conns;     /* opening, busy or idle */
+        unsigned int conns_count;
+        struct list_head waiting;   /* requests waiting for a connection */
+};
+
+struct request_attempt {
+        int s;                      /* -1 if not in progress */
+        struct loop_watch watch;
+};
+
+/* the response being received on a connection */
+struct request_parser {
+        enum {
+                PSStatus,
+                PSHeader,
+                PSBody,                 /* content_length bytes */
+                PSBodyClose,            /* until the server closes */
+                PSChunkSize,
+                PSChunkData,
+                PSChunkEnd,             /* the CRLF after a chunk */
+                PSTrailer,
+                PSDone,
+        } state;
+        struct request_response *response; /* NULL if not started */
+        char line[REQUEST_LINE_MAX_SIZE]; /* status, header or chunk size */
+        size_t line_size;
+        int chunked;
+        long long content_length;   /* -1 if not given */
+        unsigned long long remain;  /* of the body or the chunk */
+        int keepalive;
+};
+
+/* requests allocated together for the reserve */
+struct request_slab {
+        struct list_head list;      /* in request_slabs */
+        struct request *requests;
+        unsigned int count;
+};
+
+/* a connection of a pool, carrying one request or pipelined ones */
+struct request_conn {
+        struct list_head list;      /* in pool conns */
+        struct request_pool *pool;
+        enum {
+                CSResolving,
+                CSConnecting,
+                CSConnected,
+                CSClosed,
+        } state;
+        int s;
+        struct loop_watch watch;
+        struct resolv_query resolv;
+        struct resolv_result addrs; /* addresses to try, in order */
+        size_t addrs_next;          /* next address to try */
+        struct request_attempt attempts[RESOLV_ADDRS_MAX];
+        struct timer attempt_timer; /* delay before the next attempt */
+        struct timer idle_timer;
+        struct list_head sending;   /* requests to send, in order */
+        struct list_head waiting;   /* requests sent, in order */
+        unsigned int count;         /* requests sending or waiting */
+        int keepalive;              /* the last response kept it open */
+        int in_cb;                  /* freed at the end of the callback */
+        struct request_parser parser;
+};
+
 /* decs public variables */
 struct list_head request_list;
 
+/* decs static variables */
+static struct list_head request_pools;
+static struct list_head request_slabs;
+static struct list_head request_reserve; /* free requests of the slabs */
+static struct request_stats request_stats;
+
 /* defs static functions */
-static int request_open_socket(struct request *request);
-static void request_connect(struct request *request);
-static void request_process(struct request *request);
-static void request_process_send(struct request *request);
-static void request_process_recv(struct request *request);
+static int request_open_socket(struct request_conn *conn, int family);
+static void request_connect_order(struct request_conn *conn,
+                                  const struct resolv_result *result);
+static void request_attempt_close(struct request_attempt *attempt);
+static void request_connect_won(struct request_conn *conn,
+                                struct request_attempt *attempt);
+static int request_connect(struct request_conn *conn);
+static void request_attempt_cb(struct loop_watch *watch, unsigned int revents);
+static void request_attempt_timer_cb(struct timer *timer, void *data);
+static void request_resolv_cb(struct resolv_query *query,
+                              const struct resolv_result *result,
+                              void *data);
+static void request_parser_init(struct request_parser *parser,
+                                struct request_response *response);
+static void request_parser_body(struct request_parser *parser,
+                                const char *data, size_t size);
+static int request_header_has(const char *value, const char *token);
+static int request_parser_header(struct request_parser *parser);
+static int request_parser_line(struct request_parser *parser);
+static ssize_t request_parser_feed(struct request_parser *parser,
+                                   const char *data, size_t size);
+static int request_parser_eof(struct request_parser *parser);
+static int request_conn_deliver(struct request_conn *conn,
+                                struct request *request);
+static void request_conn_eof(struct request_conn *conn);
+static int request_buff_iov(const struct request_buff *buff,
+                            struct iovec *iov);
+static void request_conn_send(struct request_conn *conn);
+static void request_conn_recv(struct request_conn *conn);
+static void request_conn_update(struct request_conn *conn);
+static void request_conn_cb(struct loop_watch *watch, unsigned int revents);
+static void request_conn_idle_cb(struct timer *timer, void *data);
+static struct request_conn *request_conn_new(struct request_pool *pool);
+static void request_conn_abort(struct request_conn *conn,
+                               unsigned int errcode, int retry);
+static void request_conn_detach(struct request *request);
+static void request_timeout_cb(struct timer *timer, void *data);
+static void request_done(struct request *request);
+static struct request *request_alloc(void);
+static void request_free(struct request *request);
+static struct request_pool *request_pool_get(const struct request_host *host,
+                                             const struct request_opt *opt);
+static int request_pool_place(struct request *request);
+static void request_pool_kick(struct request_pool *pool);
+static void request_dispatch(struct request *request);
 
 /*
  * decs static functions
  */
-static int request_open_socket(struct request *request)
+static int request_open_socket(struct request_conn *conn, int family)
 {
 	int flags;
+        int s = -1;
 	struct sockaddr_in sockname;
 
         /* create socket */
-        request->s = socket(PF_INET, SOCK_STREAM, 0);
-        if(request->s < 0)
+        s = socket(family, SOCK_STREAM, 0);
+        if(s < 0)
         {
                 log_error("socket(): %s", strerror(errno));
                 goto exit_error;
         }
 
-        log_debug("&request: %p, open socket %d",
-                  request, request->s);
+        log_debug("&conn: %p, open socket %d",
+                  conn, s);
 
-        if((flags = fcntl(request->s, F_GETFL, 0)) < 0)
+        if((flags = fcntl(s, F_GETFL, 0)) < 0)
         {
 		log_error("fcntl(..F_GETFL..): %s", strerror(errno));
 		goto exit_error;
 	}
 
         /* no blockant */
-	if(fcntl(request->s, F_SETFL, flags | O_NONBLOCK) < 0)
+	if(fcntl(s, F_SETFL, flags | O_NONBLOCK) < 0)
         {
 		log_error("fcntl(..F_SETFL..): %s", strerror(errno));
 		goto exit_error;
         }
 
-        /* bind ? */
-        if(request->opt.mask & REQ_OPT_BIND_ADDR)
+        /* bind ? (only ipv4 addresses are resolved then) */
+        if(conn->pool->bind_addr != INADDR_ANY)
         {
                 memset(&sockname, 0, sizeof(struct sockaddr_in));
                 sockname.sin_family = AF_INET;
-                sockname.sin_addr.s_addr = request->opt.bind_addr.s_addr;
+                sockname.sin_addr.s_addr = conn->pool->bind_addr;
 
-                log_debug("&request: %p, bind to %s",
-                          request, inet_ntoa(sockname.sin_addr));
+                log_debug("&conn: %p, bind to %s",
+                          conn, inet_ntoa(sockname.sin_addr));
 
-                if(bind(request->s,
+                if(bind(s,
                         (struct sockaddr *)&sockname,
                         (socklen_t)sizeof(struct sockaddr_in)) < 0)
                 {
@@ -78,444 +200,1664 @@ static int request_open_socket(struct request *request)
                 }
         }
 
-        return 0;
+        return s;
 
 exit_error:
-        if(request->s >= 0)
+        if(s >= 0)
         {
-                close(request->s);
-                request->s = -1;
+                close(s);
         }
 
         return -1;
 }
 
-static void request_connect(struct request *request)
+/*
+ * copy the resolved addresses in conn->addrs, alternating the
+ * families and starting with ipv6
+ */
+static void request_connect_order(struct request_conn *conn,
+                                  const struct resolv_result *result)
 {
-        struct addrinfo hints;
-        struct addrinfo *res = NULL, *rp = NULL;
-        int e;
-        char serv[6];
-        int ret;
-
-        snprintf(serv, sizeof(serv),
-                 "%u", request->host.port);
-
-        memset(&hints, '\0', sizeof(hints));
-        hints.ai_socktype = SOCK_STREAM;
-#if defined(AI_ADDRCONFIG)
-	/* some OS (like netbsd) doesn't have AI_ADDRCONFIG flag */
-        hints.ai_flags = AI_ADDRCONFIG;
-#endif
-
-        e = getaddrinfo(request->host.addr,
-                        serv,
-                        &hints,
-                        &res);
-        if(e != 0)
-        {
-                log_error("getaddrinfo(%s, %u) failed: %s\n",
-                          request->host.addr,
-                          request->host.port,
-                          gai_strerror(e));
-                request->state = FSError;
-                request->errcode = REQ_ERR_SYSTEM;
-                return;
-        }
+        size_t i6 = 0, i4 = 0;
+        int family = AF_INET6;
 
-        log_debug("&request:%p, connecting to %s:%u",
-                  request,
-                  request->host.addr,
-                  request->host.port);
+        memset(&(conn->addrs), 0, sizeof(conn->addrs));
+        conn->addrs_next = 0;
 
-        for (rp = res; rp != NULL; rp = rp->ai_next)
+        while(conn->addrs.count < result->count)
         {
-                log_debug("&request:%p, try to connect to %s:%u ...",
-                          request,
-                          inet_ntoa(((struct sockaddr_in*)rp->ai_addr)->sin_addr),
-                          ntohs(((struct sockaddr_in*)rp->ai_addr)->sin_port));
+                size_t *i = (family == AF_INET6 ? &i6 : &i4);
 
-                ret = connect(request->s,
-                              rp->ai_addr, rp->ai_addrlen);
-                if(ret == 0)
+                while(*i < result->count
+                      && result->addrs[*i].ss_family != family)
                 {
-                        request->state = FSConnected;
-                        break;
+                        ++(*i);
                 }
-                else if(ret < 0)
-                {
-                        if(errno == EINPROGRESS)
-                        {
-                                request->state = FSConnecting;
-                                request->last_pending_action.tv_sec =
-                                        util_getuptime();
-                                break;
-                        }
 
-                        /* big error */
-                        log_notice("connect(%s:%u) failed: %s",
-                                   inet_ntoa(((struct sockaddr_in*)rp->ai_addr)->sin_addr),
-                                   ntohs(((struct sockaddr_in*)rp->ai_addr)->sin_port),
-                                   strerror(errno));
+                if(*i < result->count)
+                {
+                        memcpy(&(conn->addrs.addrs[conn->addrs.count++]),
+                               &(result->addrs[*i]),
+                               sizeof(struct sockaddr_storage));
+                        ++(*i);
+                }
+                else if(i6 >= result->count && i4 >= result->count)
+                {
+                        break;
                 }
+
+                family = (family == AF_INET6 ? AF_INET : AF_INET6);
         }
+}
 
-        freeaddrinfo(res);
+static void request_attempt_close(struct request_attempt *attempt)
+{
+        loop_watch_del(&(attempt->watch));
 
-        if(request->state != FSConnecting && request->state != FSConnected)
+        if(attempt->s >= 0)
         {
-                log_error("Unable to connect !");
-                request->state = FSError;
-                request->errcode = REQ_ERR_CONNECT_FAILED;
+                close(attempt->s);
+                attempt->s = -1;
         }
 }
 
-static void request_process(struct request *request)
+/*
+ * the socket of attempt is connected: it becomes the connection
+ * socket and the other attempts are cancelled
+ */
+static void request_connect_won(struct request_conn *conn,
+                                struct request_attempt *attempt)
 {
-        int err;
-        socklen_t errsize = sizeof(int);
+        struct request *request = NULL;
+        size_t i;
+
+        loop_watch_del(&(attempt->watch));
+        conn->s = attempt->s;
+        attempt->s = -1;
+
+        timer_stop(&(conn->attempt_timer));
+        for(i = 0; i < ARRAY_SIZE(conn->attempts); ++i)
+        {
+                request_attempt_close(&(conn->attempts[i]));
+        }
+
+        log_debug("&conn:%p, connected on %d !", conn, conn->s);
+
+        conn->state = CSConnected;
+
+        list_for_each_entry(request, &(conn->sending), queue)
+        {
+                request->state = FSConnected;
+        }
+}
 
-        /* first, process FSConnecting request state */
-        if(request->state == FSConnecting)
+/*
+ * start the attempt on the next address (and the following ones while
+ * connect() fails at once). Return -1 if conn failed (and is freed
+ * unless in its callback), 0 otherwise.
+ */
+static int request_connect(struct request_conn *conn)
+{
+        struct request_attempt *attempt = NULL;
+        const struct sockaddr *sa = NULL;
+        char addrstr[UTIL_SOCKADDR_STRLEN];
+        size_t i;
+        int ret;
+
+        timer_stop(&(conn->attempt_timer));
+
+        while(conn->addrs_next < conn->addrs.count)
         {
-                log_debug("&request:%p, FSConnecting - check connect status",
-                          request);
+                i = conn->addrs_next++;
+                sa = (const struct sockaddr *)&(conn->addrs.addrs[i]);
+                attempt = &(conn->attempts[i]);
 
-                if(getsockopt(request->s, SOL_SOCKET,
-                              SO_ERROR, &err, &errsize) != 0)
+                util_sockaddr_ntop(sa, addrstr, sizeof(addrstr));
+                log_debug("&conn:%p, try to connect to %s ...",
+                          conn, addrstr);
+
+                attempt->s = request_open_socket(conn, sa->sa_family);
+                if(attempt->s < 0)
                 {
-                        log_error("getsockopt(%d, SO_ERROR) failed: %s",
-                                  request->s,
-                                  strerror(errno));
-                        request->state = FSError;
-                        request->errcode = REQ_ERR_SYSTEM;
-                        return;
+                        continue;
                 }
 
-                if(err != 0)
+                ret = connect(attempt->s, sa, util_sockaddr_len(sa));
+                if(ret == 0)
                 {
-                        log_error("connect(): %s", strerror(err));
-                        request->state = FSError;
-                        request->errcode = REQ_ERR_CONNECT_FAILED;
-                        return;
+                        request_connect_won(conn, attempt);
+                        return 0;
                 }
 
-                /* yes, we are connected ! */
-                log_debug("&request:%p, connected !", request);
-                request->state = FSConnected;
-        }
+                if(errno == EINPROGRESS)
+                {
+                        if(loop_watch_add(&(attempt->watch),
+                                          attempt->s, LOOP_WRITE) != 0)
+                        {
+                                request_attempt_close(attempt);
+                                continue;
+                        }
 
-        /* next, process the other states */
-        if(request->state == FSConnected
-           || request->state == FSSending)
-        {
-                log_debug("&request:%p, FSConnected or FSSending"
-                          " - perform send",
-                          request);
-		request_process_send(request);
+                        /* don't wait for it to try the next address */
+                        if(conn->addrs_next < conn->addrs.count)
+                        {
+                                timer_start(&(conn->attempt_timer),
+                                            REQUEST_CONNECT_ATTEMPT_DELAY);
+                        }
+
+                        return 0;
+                }
+
+                /* big error */
+                log_notice("connect(%s) failed: %s",
+                           addrstr, strerror(errno));
+                request_attempt_close(attempt);
         }
-        else if(request->state == FSFinished)
+
+        /* no more address, are some attempts still in progress ? */
+        for(i = 0; i < ARRAY_SIZE(conn->attempts); ++i)
         {
-                log_debug("&request:%p, FSFinished - close socket.",
-                          request);
-		close(request->s);
-		request->s = -1;
+                if(conn->attempts[i].s >= 0)
+                {
+                        return 0;
+                }
         }
-        else if(request->state == FSWaitingResponse)
-        {
-                log_debug("&request:%p, FSWaitingResponse"
-                          " - perform recv",
-                          request);
-		request_process_recv(request);
-	}
-        else
-        {
-		log_critical("Unknown state");
-	}
+
+        log_error("Unable to connect to %s:%u !",
+                  conn->pool->addr, conn->pool->port);
+        request_conn_abort(conn, REQ_ERR_CONNECT_FAILED, 0);
+
+        return -1;
 }
 
-static void request_process_send(struct request *request)
+static void request_attempt_cb(struct loop_watch *watch, unsigned int revents)
 {
-        ssize_t i;
-        size_t remain = (size_t)(request->buff.data_size
-                                 - request->buff.data_ack);
+        struct request_conn *conn = watch->data;
+        struct request_attempt *attempt = NULL;
+        int err;
+        socklen_t errsize = sizeof(int);
+        size_t i;
 
-        log_debug("&request:%p, send on %d: %.*s",
-                  request,
-                  request->s,
-                  remain,
-                  request->buff.data + request->buff.data_ack);
+        UNUSED(revents);
 
-        i = send(request->s,
-                 request->buff.data + request->buff.data_ack,
-                 remain,
-                 0);
-        if(i < 0)
+        for(i = 0; i < ARRAY_SIZE(conn->attempts); ++i)
         {
-                log_error("send(): %s", strerror(errno));
-                request->state = FSError;
-                request->errcode = REQ_ERR_SYSTEM;
-                return;
+                if(&(conn->attempts[i].watch) == watch)
+                {
+                        attempt = &(conn->attempts[i]);
+                }
         }
 
-        if((size_t)i != remain)
+        if(getsockopt(attempt->s, SOL_SOCKET,
+                      SO_ERROR, &err, &errsize) != 0)
         {
-                log_notice("%zi bytes send out of %zu",
-                           i, remain);
+                err = errno;
         }
 
-        log_debug("&request:%p, sent %zi bytes", request, i);
-
-        request->buff.data_ack += (size_t)i;
-        if(request->buff.data_ack == request->buff.data_size)
+        if(err != 0)
         {
-                request->state = FSWaitingResponse;
+                log_notice("connect(%s:%u): %s",
+                           conn->pool->addr, conn->pool->port,
+                           strerror(err));
+                request_attempt_close(attempt);
+
+                /* try the next address now */
+                if(request_connect(conn) == 0
+                   && conn->state == CSConnected)
+                {
+                        request_conn_update(conn);
+                }
+                return;
         }
-        else
+
+        request_connect_won(conn, attempt);
+        request_conn_update(conn);
+}
+
+static void request_attempt_timer_cb(struct timer *timer, void *data)
+{
+        struct request_conn *conn = data;
+
+        UNUSED(timer);
+
+        if(conn->state == CSResolving)
         {
-                request->state = FSSending;
+                /* the resolution couldn't start */
+                request_conn_abort(conn, REQ_ERR_RESOLVE_FAILED, 0);
+                return;
         }
 
-        request->last_pending_action.tv_sec = util_getuptime();
-
-        return;
+        if(request_connect(conn) == 0 && conn->state == CSConnected)
+        {
+                request_conn_update(conn);
+        }
 }
 
-static void request_process_recv(struct request *request)
+static void request_resolv_cb(struct resolv_query *query,
+                              const struct resolv_result *result,
+                              void *data)
 {
-        ssize_t n;
+        struct request_conn *conn = data;
+        struct request *request = NULL;
 
-        n = recv(request->s,
-                 request->buff.data,
-                 sizeof(request->buff.data) - 1,
-                 0);
-        if(n < 0)
+        UNUSED(query);
+
+        if(result->err != RESOLV_ERR_OK)
         {
-                log_error("Error when reading socket %d: %s",
-                          request->s,
-                          strerror(errno));
-                request->state = FSError;
-                request->errcode = REQ_ERR_SYSTEM;
+                log_error("Unable to resolve %s: %s",
+                          conn->pool->addr,
+                          strresolverr(result->err));
+                request_conn_abort(conn, REQ_ERR_RESOLVE_FAILED, 0);
                 return;
         }
 
-        /* put the \0 at end */
-        request->buff.data[n] = '\0';
-        log_debug("&request:%p, recv on %d (%zi bytes): %s",
-                  request, request->s, n, request->buff.data);
+        log_debug("&conn:%p, connecting to %s:%u (%zu addresses)",
+                  conn,
+                  conn->pool->addr,
+                  conn->pool->port,
+                  result->count);
 
-        request->buff.data_size = (size_t)n;
-        request->buff.data_ack = (size_t)n;
+        request_connect_order(conn, result);
 
-        request->state = FSResponseReceived;
+        conn->state = CSConnecting;
+        list_for_each_entry(request, &(conn->sending), queue)
+        {
+                request->state = FSConnecting;
+        }
 
-        /* call hook func */
-        request->ctl.hook_func(request, request->ctl.hook_data);
+        if(request_connect(conn) == 0 && conn->state == CSConnected)
+        {
+                request_conn_update(conn);
+        }
+}
 
-        request->state = FSFinished;
+static void request_parser_init(struct request_parser *parser,
+                                struct request_response *response)
+{
+        memset(parser, 0, sizeof(struct request_parser));
+        parser->state = PSStatus;
+        parser->response = response;
+        parser->content_length = -1;
 
-        return;
+        memset(response, 0, sizeof(struct request_response));
 }
 
 /*
- * decs API functions
+ * keep what fits of the body, the rest is only counted out
  */
-void request_ctl_init(void)
+static void request_parser_body(struct request_parser *parser,
+                                const char *data, size_t size)
 {
-        INIT_LIST_HEAD(&request_list);
+        struct request_response *response = parser->response;
+        size_t room = sizeof(response->body) - 1 - response->body_size;
+
+        if(size > room)
+        {
+                response->body_truncated = 1;
+                size = room;
+        }
+
+        memcpy(response->body + response->body_size, data, size);
+        response->body_size += size;
+        response->body[response->body_size] = '\0';
 }
 
-void request_ctl_cleanup(void)
+/*
+ * tell if the comma separated header value lists token
+ */
+static int request_header_has(const char *value, const char *token)
 {
-        struct request *request = NULL,
-                *safe_request = NULL;
+        size_t len = strlen(token);
+        size_t n;
 
-        list_for_each_entry_safe(request, safe_request,
-                                 &(request_list), list)
+        while(*value != '\0')
         {
-                list_del(&(request->list));
-                free(request);
+                value += strspn(value, " \t,");
+                n = strcspn(value, " \t,;");
+
+                if(n == len && strncasecmp(value, token, len) == 0)
+                {
+                        return 1;
+                }
+
+                value += strcspn(value, ",");
         }
+
+        return 0;
 }
 
-int request_send(struct request_host *host,
-                 struct request_ctl *ctl,
-                 struct request_buff *buff,
-                 struct request_opt *opt)
+static int request_parser_header(struct request_parser *parser)
 {
-        struct request *request = NULL;
-
-        request = calloc(1, sizeof(struct request));
-
-        /* fill host structure */
-        snprintf(request->host.addr, sizeof(request->host.addr),
-                 "%s", host->addr);
-        request->host.port = host->port;
+        struct request_response *response = parser->response;
+        struct request_header *header = NULL;
+        char *name = parser->line, *value = NULL, *end = NULL;
+        size_t name_size, value_size;
 
-        /* fill ctl structure */
-        request->ctl.hook_func = ctl->hook_func;
-        request->ctl.hook_data = ctl->hook_data;
+        value = strchr(name, ':');
+        if(value == NULL || value == name)
+        {
+                return -1;
+        }
 
-        /* fill buf */
-        snprintf(request->buff.data, sizeof(request->buff.data),
-                 "%s", buff->data);
-        request->buff.data_size = buff->data_size;
-        request->buff.data_ack = 0;
+        name_size = (size_t)(value - name);
+        value += 1 + strspn(value + 1, " \t");
+        value_size = strlen(value);
+        while(value_size > 0
+              && (value[value_size - 1] == ' '
+                  || value[value_size - 1] == '\t'))
+        {
+                --value_size;
+        }
+        value[value_size] = '\0';
 
-        /* request options */
-        if(opt != NULL)
+        if(name_size == 14 && strncasecmp(name, "Content-Length", 14) == 0)
         {
-                memcpy(&(request->opt), opt, sizeof(request->opt));
+                errno = 0;
+                parser->content_length = strtoll(value, &end, 10);
+                if(errno != 0 || end == value || *end != '\0'
+                   || parser->content_length < 0)
+                {
+                        return -1;
+                }
+        }
+        else if(name_size == 17
+                && strncasecmp(name, "Transfer-Encoding", 17) == 0)
+        {
+                parser->chunked = request_header_has(value, "chunked");
+        }
+        else if(name_size == 10 && strncasecmp(name, "Connection", 10) == 0)
+        {
+                if(request_header_has(value, "close"))
+                {
+                        parser->keepalive = 0;
+                }
+                else if(request_header_has(value, "keep-alive"))
+                {
+                        parser->keepalive = 1;
+                }
         }
 
-        /* open socket */
-        if(request_open_socket(request) != 0)
+        /* keep it if there is room */
+        if(response->headers_count >= ARRAY_SIZE(response->headers)
+           || response->hdata_size + name_size + value_size + 2
+           > sizeof(response->hdata))
         {
-                log_error("Error opening socket. Abort request.");
-                free(request);
-                return -1;
+                log_debug("response header '%.*s' dropped",
+                          (int)name_size, name);
+                return 0;
         }
 
-        /* all is ok, add to request list */
-        request->state = FSCreated;
-        list_add(&(request->list), &request_list);
+        header = &(response->headers[response->headers_count++]);
+
+        header->name = response->hdata + response->hdata_size;
+        memcpy(response->hdata + response->hdata_size, name, name_size);
+        response->hdata_size += name_size;
+        response->hdata[response->hdata_size++] = '\0';
+
+        header->value = response->hdata + response->hdata_size;
+        memcpy(response->hdata + response->hdata_size, value, value_size);
+        response->hdata_size += value_size;
+        response->hdata[response->hdata_size++] = '\0';
 
         return 0;
 }
 
-void request_ctl_selectfds(fd_set *readset, fd_set *writeset, int *max_fd)
+/*
+ * a whole line (without its CRLF) is in parser->line
+ */
+static int request_parser_line(struct request_parser *parser)
 {
-        struct request *request = NULL;
+        struct request_response *response = parser->response;
+        char *line = parser->line, *end = NULL;
 
-        log_debug("--------------------- selectfds ---------------------");
-
-        list_for_each_entry(request, &(request_list), list)
+        switch(parser->state)
         {
-                if(request->state == FSCreated)
+        case PSStatus:
+                /* HTTP/1.x SP 3DIGIT [SP reason] */
+                if(strncmp(line, "HTTP/1.", 7) != 0
+                   || line[7] < '0' || line[7] > '9'
+                   || line[8] != ' '
+                   || strspn(line + 9, "0123456789") != 3
+                   || (line[12] != ' ' && line[12] != '\0'))
                 {
-                        log_debug("&request:%p, FSCreated - execute connect",
-                                  request);
-
-                        request_connect(request);
+                        return -1;
                 }
 
-                if(request->state == FSConnecting
-                   || request->state == FSConnected
-                   || request->state == FSSending)
+                response->status = (int)strtol(line + 9, NULL, 10);
+                snprintf(response->reason, sizeof(response->reason),
+                         "%s", (line[12] == ' ' ? line + 13 : ""));
+
+                /* HTTP/1.1 connections are kept alive by default */
+                parser->keepalive = (line[7] != '0');
+                parser->state = PSHeader;
+                break;
+
+        case PSHeader:
+                if(*line != '\0')
                 {
-                        log_debug("&request:%p, FSConnect(ing|ed)|FSSending"
-                                  " - FD_SET(%d, writeset)",
-                                  request, request->s);
+                        return request_parser_header(parser);
+                }
 
-                        FD_SET(request->s, writeset);
-                        *max_fd = MAX(request->s, *max_fd);
+                /* end of headers, how is the body delimited ? */
+                if(response->status / 100 == 1)
+                {
+                        /* interim response, the real one follows */
+                        request_parser_init(parser, response);
+                }
+                else if(response->status == 204
+                        || response->status == 304)
+                {
+                        parser->state = PSDone;
+                }
+                else if(parser->chunked)
+                {
+                        parser->state = PSChunkSize;
+                }
+                else if(parser->content_length >= 0)
+                {
+                        parser->remain =
+                                (unsigned long long)parser->content_length;
+                        parser->state = (parser->remain > 0
+                                         ? PSBody : PSDone);
+                }
+                else
+                {
+                        parser->keepalive = 0;
+                        parser->state = PSBodyClose;
+                }
+                break;
+
+        case PSChunkSize:
+                /* chunk-size [; extensions] */
+                errno = 0;
+                parser->remain = strtoull(line, &end, 16);
+                if(errno != 0 || end == line
+                   || (*end != '\0' && *end != ';'
+                       && *end != ' ' && *end != '\t'))
+                {
+                        return -1;
                 }
-                else if(request->state == FSWaitingResponse)
+
+                parser->state = (parser->remain > 0
+                                 ? PSChunkData : PSTrailer);
+                break;
+
+        case PSChunkEnd:
+                if(*line != '\0')
                 {
-                        log_debug("&request:%p, FSWaitingForResponse"
-                                  " - FD_SET(%d, readset)",
-                                  request, request->s);
+                        return -1;
+                }
 
-                        FD_SET(request->s, readset);
-                        *max_fd = MAX(request->s, *max_fd);
+                parser->state = PSChunkSize;
+                break;
+
+        case PSTrailer:
+                if(*line == '\0')
+                {
+                        parser->state = PSDone;
                 }
+                break;
+
+        default:
+                return -1;
         }
+
+        return 0;
 }
 
-void request_ctl_processfds(fd_set *readset, fd_set *writeset)
+/*
+ * parse the size bytes of data, stopping at the end of the response
+ *
+ * @return count of bytes used (the next ones belong to the following
+ *         response), -1 if the response is malformed
+ */
+static ssize_t request_parser_feed(struct request_parser *parser,
+                                   const char *data, size_t size)
 {
-        struct request *request = NULL,
-                *safe = NULL;
-        time_t uptime = util_getuptime();
+        size_t i = 0, n;
 
-        log_debug("--------------------- processfds ---------------------");
-
-        list_for_each_entry_safe(request, safe,
-                                 &request_list, list)
+        while(i < size && parser->state != PSDone)
         {
-                /* process request with fd marked*/
-                if(FD_ISSET(request->s, readset)
-                   || FD_ISSET(request->s, writeset))
-                {
-                        log_debug("&request:%p, FD_ISSET(%d) == 1",
-                                  request, request->s);
-
-                        request_process(request);
-                }
-
-                /* remove finished, error or timeout request */
-                if((request->state == FSConnecting
-                    || request->state == FSWaitingResponse
-                    || request->state == FSSending)
-                   && (uptime - request->last_pending_action.tv_sec
-                       >= REQUEST_PENDING_ACTION_TIMEOUT))
+                if(parser->state == PSBody
+                   || parser->state == PSChunkData
+                   || parser->state == PSBodyClose)
                 {
-                        log_debug("Pending request on %s:%d timeout (> %d sec)",
-                                   request->host.addr, request->host.port,
-                                   REQUEST_PENDING_ACTION_TIMEOUT);
-
-                        /* set appropriated errcode */
-                        switch(request->state)
+                        n = size - i;
+                        if(parser->state != PSBodyClose
+                           && parser->remain < n)
                         {
-                        case FSConnecting:
-                                request->errcode = REQ_ERR_CONNECT_TIMEOUT;
-                                break;
+                                n = (size_t)parser->remain;
+                        }
 
-                        case FSWaitingResponse:
-                                request->errcode = REQ_ERR_RESPONSE_TIMEOUT;
-                                break;
+                        request_parser_body(parser, data + i, n);
+                        i += n;
 
-                        case FSSending:
-                                request->errcode = REQ_ERR_SENDING_TIMEOUT;
-                                break;
+                        if(parser->state == PSBodyClose)
+                        {
+                                continue;
+                        }
 
-                        default:
-                                request->errcode = REQ_ERR_UNKNOWN;
-                                break;
+                        parser->remain -= n;
+                        if(parser->remain == 0)
+                        {
+                                parser->state = (parser->state == PSBody
+                                                 ? PSDone : PSChunkEnd);
                         }
+                        continue;
+                }
 
-                        request->state = FSError;
+                if(data[i] != '\n')
+                {
+                        /* a too long line is cut */
+                        if(parser->line_size < sizeof(parser->line) - 1)
+                        {
+                                parser->line[parser->line_size++] = data[i];
+                        }
+                        ++i;
+                        continue;
                 }
 
-                if(request->state == FSError
-                   || request->state == FSFinished)
+                ++i;
+                if(parser->line_size > 0
+                   && parser->line[parser->line_size - 1] == '\r')
                 {
-                        log_debug("&request:%p, FSFinished|FSError|timeout"
-                                  " - remove it", request);
+                        --parser->line_size;
+                }
+                parser->line[parser->line_size] = '\0';
+                parser->line_size = 0;
 
-                        /* call hook func */
-                        request->ctl.hook_func(request, request->ctl.hook_data);
+                if(request_parser_line(parser) != 0)
+                {
+                        return -1;
+                }
+        }
 
-                        close(request->s);
-                        request->s = -1;
+        return (ssize_t)i;
+}
 
-                        list_del(&(request->list));
-                        free(request);
-                }
+/*
+ * the server closed the connection
+ *
+ * @return 0 if it ends the response, -1 if the response is cut
+ */
+static int request_parser_eof(struct request_parser *parser)
+{
+        if(parser->state != PSBodyClose)
+        {
+                return -1;
         }
+
+        parser->state = PSDone;
+
+        return 0;
 }
 
-int request_ctl_remove_by_hook_data(const void *hook_data)
+/*
+ * fill iov with the bytes of buff not written yet
+ *
+ * @return the count of iov
+ */
+static int request_buff_iov(const struct request_buff *buff,
+                            struct iovec *iov)
 {
-        struct request *request = NULL,
-                *safe = NULL;
-        int i = 0;
+        size_t skip = buff->data_ack;
+        unsigned int i;
+        int n = 0;
 
-        list_for_each_entry_safe(request, safe,
-                                 &request_list, list)
+        for(i = 0; i < buff->segs_count; ++i)
         {
-                if(request->ctl.hook_data == hook_data)
+                if(skip >= buff->segs[i].iov_len)
                 {
-                        ++i;
+                        skip -= buff->segs[i].iov_len;
+                        continue;
+                }
 
-                        log_debug("&request:%p, remove it",
-                                  request);
+                iov[n].iov_base = (char *)buff->segs[i].iov_base + skip;
+                iov[n].iov_len = buff->segs[i].iov_len - skip;
+                skip = 0;
+                ++n;
+        }
+
+        return n;
+}
 
-                        close(request->s);
-                        request->s = -1;
+/*
+ * send the queries in order, the sent ones wait for their response
+ */
+static void request_conn_send(struct request_conn *conn)
+{
+        struct request *request = NULL;
+        struct iovec iov[REQUEST_BUFF_SEGS_MAX];
+        struct msghdr msg;
+        ssize_t i;
+        size_t remain;
+
+        while(!list_empty(&(conn->sending)))
+        {
+                request = list_entry(conn->sending.next,
+                                     struct request, queue);
+                remain = request->buff.data_size - request->buff.data_ack;
+
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov;
+                msg.msg_iovlen = (size_t)request_buff_iov(&(request->buff),
+                                                          iov);
+
+                log_debug("&request:%p, send %zu bytes in %zu segments"
+                          " on %d",
+                          request, remain, (size_t)msg.msg_iovlen, conn->s);
+
+                i = sendmsg(conn->s, &msg, MSG_NOSIGNAL);
+                if(i < 0)
+                {
+                        if(errno == EAGAIN)
+                        {
+                                return;
+                        }
+
+                        log_error("sendmsg(): %s", strerror(errno));
+                        request_conn_abort(conn,
+                                           (errno == EPIPE
+                                            || errno == ECONNRESET
+                                            ? REQ_ERR_CONNECTION_CLOSED
+                                            : REQ_ERR_SYSTEM),
+                                           1);
+                        return;
+                }
+
+                log_debug("&request:%p, sent %zi bytes", request, i);
+
+                request->buff.data_ack += (size_t)i;
+                timer_start(&(request->timeout),
+                            REQUEST_PENDING_ACTION_TIMEOUT * 1000);
+
+                if(request->buff.data_ack != request->buff.data_size)
+                {
+                        log_notice("%zi bytes send out of %zu",
+                                   i, remain);
+                        request->state = FSSending;
+                        return;
+                }
+
+                request->state = FSWaitingResponse;
+                list_move_tail(&(request->queue), &(conn->waiting));
+        }
+}
+
+/*
+ * give its response to the request at the head of the connection
+ *
+ * @return 0 if the connection is still usable, -1 if it's closed
+ */
+static int request_conn_deliver(struct request_conn *conn,
+                                struct request *request)
+{
+        conn->keepalive = conn->parser.keepalive;
+        conn->parser.response = NULL;
+
+        log_debug("&request:%p, response %d (%zu bytes of body)",
+                  request,
+                  request->response.status,
+                  request->response.body_size);
+
+        request->state = FSResponseReceived;
+        request_conn_detach(request);
+
+        /* call hook func */
+        request->ctl.hook_func(request, request->ctl.hook_data);
+
+        request->state = FSFinished;
+        request_done(request);
+
+        if(conn->state == CSClosed)
+        {
+                /* aborted by a hook */
+                return -1;
+        }
+
+        if(!conn->keepalive)
+        {
+                /* the server will close, the next pipelined requests
+                 * are sent again
+                 */
+                request_conn_abort(conn, REQ_ERR_CONNECTION_CLOSED, 1);
+                return -1;
+        }
+
+        return 0;
+}
+
+static void request_conn_eof(struct request_conn *conn)
+{
+        /* a body delimited by the close ends here */
+        if(conn->parser.response != NULL
+           && request_parser_eof(&(conn->parser)) == 0)
+        {
+                if(request_conn_deliver(conn,
+                                        list_entry(conn->waiting.next,
+                                                   struct request,
+                                                   queue)) != 0)
+                {
+                        return;
+                }
+        }
+
+        if(conn->count > 0)
+        {
+                log_notice("Connection to %s:%u closed by the server",
+                           conn->pool->addr, conn->pool->port);
+        }
+
+        request_conn_abort(conn, REQ_ERR_CONNECTION_CLOSED, 1);
+}
+
+/*
+ * parse the responses and give them to their requests in order
+ */
+static void request_conn_recv(struct request_conn *conn)
+{
+        struct request *request = NULL;
+        char buf[REQUEST_DATA_MAX_SIZE];
+        size_t off = 0;
+        ssize_t n, used;
+
+        n = recv(conn->s, buf, sizeof(buf), 0);
+        if(n < 0)
+        {
+                if(errno == EAGAIN)
+                {
+                        return;
+                }
+
+                log_error("Error when reading socket %d: %s",
+                          conn->s,
+                          strerror(errno));
+                request_conn_abort(conn,
+                                   (errno == ECONNRESET
+                                    ? REQ_ERR_CONNECTION_CLOSED
+                                    : REQ_ERR_SYSTEM),
+                                   1);
+                return;
+        }
+
+        if(n == 0)
+        {
+                request_conn_eof(conn);
+                return;
+        }
+
+        log_debug("&conn:%p, recv on %d (%zi bytes): %.*s",
+                  conn, conn->s, n, (int)n, buf);
+
+        while(off < (size_t)n)
+        {
+                if(list_empty(&(conn->waiting)))
+                {
+                        log_notice("Unexpected data from %s:%u",
+                                   conn->pool->addr, conn->pool->port);
+                        request_conn_abort(conn, REQ_ERR_BAD_RESPONSE, 1);
+                        return;
+                }
+
+                request = list_entry(conn->waiting.next,
+                                     struct request, queue);
+
+                if(conn->parser.response == NULL)
+                {
+                        request_parser_init(&(conn->parser),
+                                            &(request->response));
+                }
+
+                used = request_parser_feed(&(conn->parser),
+                                           buf + off, (size_t)n - off);
+                if(used < 0)
+                {
+                        log_error("Malformed response from %s:%u",
+                                  conn->pool->addr, conn->pool->port);
+                        request_conn_abort(conn, REQ_ERR_BAD_RESPONSE, 1);
+                        return;
+                }
+
+                off += (size_t)used;
+
+                if(conn->parser.state != PSDone)
+                {
+                        /* wait for the rest */
+                        break;
+                }
+
+                if(request_conn_deliver(conn, request) != 0)
+                {
+                        return;
+                }
+        }
+}
+
+/*
+ * (re)arm the watch of a connected conn, and its idle timeout
+ */
+static void request_conn_update(struct request_conn *conn)
+{
+        unsigned int events = LOOP_READ; /* responses or server close */
+        int ret;
+
+        if(conn->state != CSConnected)
+        {
+                return;
+        }
+
+        if(!list_empty(&(conn->sending)))
+        {
+                events |= LOOP_WRITE;
+        }
+
+        if(conn->watch.registered)
+        {
+                ret = loop_watch_mod(&(conn->watch), events);
+        }
+        else
+        {
+                ret = loop_watch_add(&(conn->watch), conn->s, events);
+        }
+
+        if(ret != 0)
+        {
+                request_conn_abort(conn, REQ_ERR_SYSTEM, 0);
+                return;
+        }
+
+        if(conn->count == 0)
+        {
+                if(!timer_pending(&(conn->idle_timer)))
+                {
+                        log_debug("&conn:%p, idle", conn);
+                        timer_start(&(conn->idle_timer),
+                                    REQUEST_POOL_IDLE_TIMEOUT * 1000);
+                }
+        }
+        else
+        {
+                timer_stop(&(conn->idle_timer));
+        }
+}
+
+static void request_conn_cb(struct loop_watch *watch, unsigned int revents)
+{
+        struct request_conn *conn = watch->data;
+        struct request_pool *pool = conn->pool;
+
+        conn->in_cb = 1;
+
+        if(revents & LOOP_WRITE)
+        {
+                request_conn_send(conn);
+        }
+
+        if(conn->state == CSConnected && (revents & LOOP_READ))
+        {
+                request_conn_recv(conn);
+        }
+
+        conn->in_cb = 0;
+
+        if(conn->state == CSClosed)
+        {
+                free(conn);
+        }
+        else
+        {
+                request_conn_update(conn);
+        }
+
+        /* answered requests made room for the waiting ones */
+        request_pool_kick(pool);
+}
+
+static void request_conn_idle_cb(struct timer *timer, void *data)
+{
+        struct request_conn *conn = data;
+
+        UNUSED(timer);
+
+        log_debug("&conn:%p, close idle connection to %s:%u",
+                  conn, conn->pool->addr, conn->pool->port);
+
+        request_conn_abort(conn, REQ_ERR_UNKNOWN, 0);
+}
+
+/*
+ * open a new connection of pool: resolve then connect its host
+ */
+static struct request_conn *request_conn_new(struct request_pool *pool)
+{
+        struct request_conn *conn = NULL;
+        size_t i;
+
+        conn = calloc(1, sizeof(struct request_conn));
+        if(conn == NULL)
+        {
+                log_error("Unable to allocate a connection");
+                return NULL;
+        }
+
+        conn->pool = pool;
+        conn->s = -1;
+        conn->state = CSResolving;
+        INIT_LIST_HEAD(&(conn->sending));
+        INIT_LIST_HEAD(&(conn->waiting));
+        loop_watch_init(&(conn->watch), request_conn_cb, conn);
+        timer_init(&(conn->attempt_timer), request_attempt_timer_cb, conn);
+        timer_init(&(conn->idle_timer), request_conn_idle_cb, conn);
+
+        for(i = 0; i < ARRAY_SIZE(conn->attempts); ++i)
+        {
+                conn->attempts[i].s = -1;
+                loop_watch_init(&(conn->attempts[i].watch),
+                                request_attempt_cb, conn);
+        }
+
+        list_add(&(conn->list), &(pool->conns));
+        ++pool->conns_count;
+
+        log_debug("&conn:%p, resolve %s", conn, pool->addr);
+
+        if(resolv_query_start(&(conn->resolv),
+                              pool->addr, pool->port,
+                              (pool->bind_addr != INADDR_ANY
+                               ? AF_INET : AF_UNSPEC),
+                              request_resolv_cb, conn) != 0)
+        {
+                /* report the error from the loop, not from the
+                 * caller context
+                 */
+                timer_start(&(conn->attempt_timer), 0);
+        }
+
+        return conn;
+}
+
+/*
+ * close conn. Its requests without response are sent again on a new
+ * connection if retry (once), or fail with errcode.
+ */
+static void request_conn_abort(struct request_conn *conn,
+                               unsigned int errcode, int retry)
+{
+        struct request_pool *pool = conn->pool;
+        struct request *request = NULL;
+        LIST_HEAD_DECL(requests);
+        LIST_HEAD_DECL(retries);
+        size_t i;
+
+        resolv_query_cancel(&(conn->resolv));
+        timer_stop(&(conn->attempt_timer));
+        timer_stop(&(conn->idle_timer));
+        loop_watch_del(&(conn->watch));
+
+        for(i = 0; i < ARRAY_SIZE(conn->attempts); ++i)
+        {
+                request_attempt_close(&(conn->attempts[i]));
+        }
+
+        if(conn->s >= 0)
+        {
+                close(conn->s);
+                conn->s = -1;
+        }
+
+        list_del(&(conn->list));
+        --pool->conns_count;
+        conn->state = CSClosed;
+
+        /* requests sent first */
+        list_splice_init(&(conn->sending), &requests);
+        list_splice_init(&(conn->waiting), &requests);
+        conn->count = 0;
+
+        while(!list_empty(&requests))
+        {
+                request = list_entry(requests.next, struct request, queue);
+                list_del_init(&(request->queue));
+                request->conn = NULL;
+
+                if(retry && !request->retried)
+                {
+                        log_notice("&request:%p, send it again on a"
+                                   " new connection", request);
+
+                        request->retried = 1;
+                        request->buff.data_ack = 0;
+                        request->state = FSCreated;
+                        timer_stop(&(request->timeout));
+                        list_add_tail(&(request->queue), &retries);
+                        continue;
+                }
+
+                /* report the error to the hook from the timer */
+                request->state = FSError;
+                request->errcode = errcode;
+                timer_start(&(request->timeout), 0);
+        }
+
+        /* the retries go first */
+        list_splice(&retries, &(pool->waiting));
+
+        if(!conn->in_cb)
+        {
+                free(conn);
+        }
+
+        request_pool_kick(pool);
+}
+
+/*
+ * remove the request from its connection. A connection in the middle
+ * of its exchange can't be used anymore.
+ */
+static void request_conn_detach(struct request *request)
+{
+        struct request_conn *conn = request->conn;
+        int desync;
+
+        if(conn == NULL)
+        {
+                return;
+        }
+
+        desync = (conn->state == CSConnected
+                  && (request->state == FSSending
+                      || request->state == FSWaitingResponse));
+
+        list_del_init(&(request->queue));
+        request->conn = NULL;
+        --conn->count;
+
+        if(desync || (conn->state != CSConnected && conn->count == 0))
+        {
+                request_conn_abort(conn, REQ_ERR_CONNECTION_CLOSED, 1);
+        }
+}
+
+static void request_timeout_cb(struct timer *timer, void *data)
+{
+        struct request *request = data;
+
+        UNUSED(timer);
+
+        if(request->state == FSResolving
+           || request->state == FSConnecting
+           || request->state == FSConnected
+           || request->state == FSWaitingResponse
+           || request->state == FSSending)
+        {
+                log_debug("Pending request on %s:%d timeout (> %d sec)",
+                          request->host.addr, request->host.port,
+                          REQUEST_PENDING_ACTION_TIMEOUT);
+
+                /* set appropriated errcode */
+                switch(request->state)
+                {
+                case FSResolving:
+                        request->errcode = REQ_ERR_RESOLVE_TIMEOUT;
+                        break;
+
+                case FSConnecting:
+                        request->errcode = REQ_ERR_CONNECT_TIMEOUT;
+                        break;
+
+                case FSWaitingResponse:
+                        request->errcode = REQ_ERR_RESPONSE_TIMEOUT;
+                        break;
+
+                case FSConnected:
+                case FSSending:
+                        request->errcode = REQ_ERR_SENDING_TIMEOUT;
+                        break;
+
+                default:
+                        request->errcode = REQ_ERR_UNKNOWN;
+                        break;
+                }
+
+                request_conn_detach(request);
+                request->state = FSError;
+        }
+
+        request_done(request);
+}
+
+/*
+ * call the hook and remove the request
+ */
+static void request_done(struct request *request)
+{
+        log_debug("&request:%p, FSFinished|FSError|timeout"
+                  " - remove it", request);
+
+        /* call hook func */
+        request->ctl.hook_func(request, request->ctl.hook_data);
+
+        list_del(&(request->list));
+        request_free(request);
+}
+
+static struct request *request_alloc(void)
+{
+        struct request *request = NULL;
+
+        if(!list_empty(&request_reserve))
+        {
+                request = list_entry(request_reserve.next,
+                                     struct request, list);
+                list_del(&(request->list));
+
+                memset(request, 0, sizeof(struct request));
+                request->reserved = 1;
+        }
+        else
+        {
+                request = calloc(1, sizeof(struct request));
+                if(request == NULL)
+                {
+                        return NULL;
+                }
+
+                ++request_stats.heap_allocs;
+        }
+
+        if(++request_stats.in_use > request_stats.high_water)
+        {
+                request_stats.high_water = request_stats.in_use;
+        }
+
+        return request;
+}
+
+static void request_free(struct request *request)
+{
+        timer_stop(&(request->timeout));
+
+        if(request->conn != NULL)
+        {
+                request_conn_detach(request);
+        }
+        else if(request->pool != NULL)
+        {
+                /* maybe waiting for a connection */
+                list_del_init(&(request->queue));
+        }
+
+        request_buff_free(&(request->buff));
+
+        if(request_stats.in_use > 0)
+        {
+                --request_stats.in_use;
+        }
+
+        if(request->reserved)
+        {
+                list_add(&(request->list), &request_reserve);
+        }
+        else
+        {
+                free(request);
+        }
+}
+
+static struct request_pool *request_pool_get(const struct request_host *host,
+                                             const struct request_opt *opt)
+{
+        struct request_pool *pool = NULL;
+        in_addr_t bind_addr = INADDR_ANY;
+
+        if(opt->mask & REQ_OPT_BIND_ADDR)
+        {
+                bind_addr = opt->bind_addr.s_addr;
+        }
+
+        list_for_each_entry(pool, &request_pools, list)
+        {
+                if(pool->port == host->port
+                   && pool->bind_addr == bind_addr
+                   && strcasecmp(pool->addr, host->addr) == 0)
+                {
+                        return pool;
+                }
+        }
+
+        pool = calloc(1, sizeof(struct request_pool));
+        if(pool == NULL)
+        {
+                log_error("Unable to allocate a connection pool");
+                return NULL;
+        }
+
+        snprintf(pool->addr, sizeof(pool->addr), "%s", host->addr);
+        pool->port = host->port;
+        pool->bind_addr = bind_addr;
+        INIT_LIST_HEAD(&(pool->conns));
+        INIT_LIST_HEAD(&(pool->waiting));
+        list_add(&(pool->list), &request_pools);
+
+        return pool;
+}
+
+/*
+ * give a connection of its pool to the request: an idle one, a
+ * kept-alive one with room in its pipeline, or a new one
+ *
+ * @return 0 if success, -1 if the request has to wait
+ */
+static int request_pool_place(struct request *request)
+{
+        struct request_pool *pool = request->pool;
+        struct request_conn *conn = NULL, *best = NULL;
+        unsigned int depth = 1;
+
+        if((request->opt.mask & REQ_OPT_PIPELINE)
+           && request->opt.pipeline_depth > 1)
+        {
+                depth = request->opt.pipeline_depth;
+        }
+
+        list_for_each_entry(conn, &(pool->conns), list)
+        {
+                if(conn->state != CSConnected)
+                {
+                        continue;
+                }
+
+                if(conn->count == 0)
+                {
+                        best = conn;
+                        break;
+                }
+
+                if(conn->keepalive
+                   && conn->count < depth
+                   && (best == NULL || conn->count < best->count))
+                {
+                        best = conn;
+                }
+        }
+
+        if(best == NULL)
+        {
+                if(pool->conns_count >= REQUEST_POOL_HOST_MAX_CONNS)
+                {
+                        return -1;
+                }
+
+                best = request_conn_new(pool);
+                if(best == NULL)
+                {
+                        return -1;
+                }
+
+                request->state = FSResolving;
+        }
+        else
+        {
+                log_debug("&request:%p, reuse connection %d to %s:%u"
+                          " (%u requests in flight)",
+                          request, best->s, pool->addr, pool->port,
+                          best->count);
+
+                request->state = FSConnected;
+        }
+
+        request->conn = best;
+        list_add_tail(&(request->queue), &(best->sending));
+        ++best->count;
+
+        timer_start(&(request->timeout),
+                    REQUEST_PENDING_ACTION_TIMEOUT * 1000);
+        request_conn_update(best);
+
+        return 0;
+}
+
+static void request_pool_kick(struct request_pool *pool)
+{
+        struct request *request = NULL;
+
+        while(!list_empty(&(pool->waiting)))
+        {
+                request = list_entry(pool->waiting.next,
+                                     struct request, queue);
+                list_del_init(&(request->queue));
+
+                if(request_pool_place(request) != 0)
+                {
+                        list_add(&(request->queue), &(pool->waiting));
+                        break;
+                }
+        }
+}
+
+static void request_dispatch(struct request *request)
+{
+        struct request_pool *pool = request->pool;
+
+        if(list_empty(&(pool->waiting))
+           && request_pool_place(request) == 0)
+        {
+                return;
+        }
+
+        log_debug("&request:%p, wait for a connection to %s:%u",
+                  request, pool->addr, pool->port);
+
+        request->state = FSCreated;
+        list_add_tail(&(request->queue), &(pool->waiting));
+}
+
+/*
+ * decs API functions
+ */
+void request_ctl_init(void)
+{
+        INIT_LIST_HEAD(&request_list);
+        INIT_LIST_HEAD(&request_pools);
+        INIT_LIST_HEAD(&request_slabs);
+        INIT_LIST_HEAD(&request_reserve);
+        memset(&request_stats, 0, sizeof(request_stats));
+}
+
+void request_ctl_cleanup(void)
+{
+        struct request *request = NULL,
+                *safe_request = NULL;
+        struct request_pool *pool = NULL,
+                *safe_pool = NULL;
+        struct request_conn *conn = NULL;
+        struct request_slab *slab = NULL,
+                *safe_slab = NULL;
+
+        /* close the connections, nobody waits for them anymore */
+        list_for_each_entry(pool, &request_pools, list)
+        {
+                while(!list_empty(&(pool->waiting)))
+                {
+                        list_del_init(pool->waiting.next);
+                }
+
+                while(!list_empty(&(pool->conns)))
+                {
+                        conn = list_entry(pool->conns.next,
+                                          struct request_conn, list);
+
+                        while(!list_empty(&(conn->sending)))
+                        {
+                                list_del_init(conn->sending.next);
+                        }
+
+                        while(!list_empty(&(conn->waiting)))
+                        {
+                                list_del_init(conn->waiting.next);
+                        }
+
+                        request_conn_abort(conn, REQ_ERR_UNKNOWN, 0);
+                }
+        }
+
+        list_for_each_entry_safe(request, safe_request,
+                                 &(request_list), list)
+        {
+                request->conn = NULL;
+                list_del(&(request->list));
+                request_free(request);
+        }
+
+        list_for_each_entry_safe(pool, safe_pool,
+                                 &request_pools, list)
+        {
+                list_del(&(pool->list));
+                free(pool);
+        }
+
+        log_debug("requests: %u reserved, high water %u, %lu allocated"
+                  " out of the reserve",
+                  request_stats.reserved,
+                  request_stats.high_water,
+                  request_stats.heap_allocs);
+
+        list_for_each_entry_safe(slab, safe_slab,
+                                 &request_slabs, list)
+        {
+                list_del(&(slab->list));
+                free(slab->requests);
+                free(slab);
+        }
+
+        INIT_LIST_HEAD(&request_reserve);
+        memset(&request_stats, 0, sizeof(request_stats));
+}
+
+int request_ctl_reserve(unsigned int count)
+{
+        struct request_slab *slab = NULL;
+        unsigned int i;
+
+        if(count <= request_stats.reserved)
+        {
+                return 0;
+        }
+
+        slab = calloc(1, sizeof(struct request_slab));
+        if(slab == NULL)
+        {
+                log_error("Unable to allocate the request reserve");
+                return -1;
+        }
+
+        slab->count = count - request_stats.reserved;
+        slab->requests = calloc(slab->count, sizeof(struct request));
+        if(slab->requests == NULL)
+        {
+                log_error("Unable to allocate the request reserve");
+                free(slab);
+                return -1;
+        }
+
+        for(i = 0; i < slab->count; ++i)
+        {
+                list_add_tail(&(slab->requests[i].list), &request_reserve);
+        }
+
+        list_add(&(slab->list), &request_slabs);
+        request_stats.reserved = count;
+
+        log_debug("%u requests in reserve", count);
+
+        return 0;
+}
+
+void request_ctl_stats(struct request_stats *stats)
+{
+        memcpy(stats, &request_stats, sizeof(struct request_stats));
+}
+
+int request_buff_add(struct request_buff *buff,
+                     const void *data, size_t size, int owned)
+{
+        if(buff->segs_count >= ARRAY_SIZE(buff->segs))
+        {
+                log_error("Too many segments in the query");
+                if(owned)
+                {
+                        free((void *)(uintptr_t)data);
+                }
+                return -1;
+        }
+
+        if(owned)
+        {
+                buff->owned |= 1U << buff->segs_count;
+        }
+
+        buff->segs[buff->segs_count].iov_base = (void *)(uintptr_t)data;
+        buff->segs[buff->segs_count].iov_len = size;
+        ++buff->segs_count;
+        buff->data_size += size;
+
+        return 0;
+}
+
+int request_buff_printf(struct request_buff *buff, const char *fmt, ...)
+{
+        va_list ap;
+        char *data = NULL;
+        int n;
+
+        va_start(ap, fmt);
+        n = vsnprintf(NULL, 0, fmt, ap);
+        va_end(ap);
+
+        if(n < 0)
+        {
+                return -1;
+        }
+
+        data = malloc((size_t)n + 1);
+        if(data == NULL)
+        {
+                return -1;
+        }
+
+        va_start(ap, fmt);
+        vsnprintf(data, (size_t)n + 1, fmt, ap);
+        va_end(ap);
+
+        return request_buff_add(buff, data, (size_t)n, 1);
+}
+
+void request_buff_free(struct request_buff *buff)
+{
+        unsigned int i;
+
+        for(i = 0; i < buff->segs_count; ++i)
+        {
+                if(buff->owned & (1U << i))
+                {
+                        free(buff->segs[i].iov_base);
+                }
+        }
+
+        memset(buff, 0, sizeof(struct request_buff));
+}
+
+int request_send(struct request_host *host,
+                 struct request_ctl *ctl,
+                 struct request_buff *buff,
+                 struct request_opt *opt)
+{
+        struct request *request = NULL;
+
+        request = request_alloc();
+        if(request == NULL)
+        {
+                log_error("Unable to allocate a request");
+                request_buff_free(buff);
+                return -1;
+        }
+
+        INIT_LIST_HEAD(&(request->queue));
+        timer_init(&(request->timeout), request_timeout_cb, request);
+
+        /* fill host structure */
+        snprintf(request->host.addr, sizeof(request->host.addr),
+                 "%s", host->addr);
+        request->host.port = host->port;
+
+        /* fill ctl structure */
+        request->ctl.hook_func = ctl->hook_func;
+        request->ctl.hook_data = ctl->hook_data;
+
+        /* take the segments of buf */
+        memcpy(&(request->buff), buff, sizeof(request->buff));
+        request->buff.data_ack = 0;
+        memset(buff, 0, sizeof(struct request_buff));
+
+        /* request options */
+        if(opt != NULL)
+        {
+                memcpy(&(request->opt), opt, sizeof(request->opt));
+        }
+
+        request->pool = request_pool_get(&(request->host),
+                                         &(request->opt));
+        if(request->pool == NULL)
+        {
+                request_free(request);
+                return -1;
+        }
+
+        /* all is ok, add to request list */
+        request->state = FSCreated;
+        list_add(&(request->list), &request_list);
+
+        log_debug("&request:%p, FSCreated", request);
+
+        request_dispatch(request);
+
+        return 0;
+}
+
+const char *request_response_header(const struct request_response *response,
+                                    const char *name)
+{
+        size_t i;
+
+        for(i = 0; i < response->headers_count; ++i)
+        {
+                if(strcasecmp(response->headers[i].name, name) == 0)
+                {
+                        return response->headers[i].value;
+                }
+        }
+
+        return NULL;
+}
+
+unsigned int request_response_retry_after(const struct request_response *response)
+{
+        const char *value = request_response_header(response, "Retry-After");
+        long n;
+
+        if(value == NULL)
+        {
+                return 0;
+        }
+
+        /* delay-seconds only, a HTTP-date isn't a count */
+        n = strtol_safe(value, 0);
+        if(n <= 0)
+        {
+                return 0;
+        }
+
+        return (unsigned int)MIN(n, (long)REQUEST_RETRY_AFTER_MAX);
+}
+
+int request_ctl_remove_by_hook_data(const void *hook_data)
+{
+        struct request *request = NULL,
+                *safe = NULL;
+        int i = 0;
+
+        list_for_each_entry_safe(request, safe,
+                                 &request_list, list)
+        {
+                if(request->ctl.hook_data == hook_data)
+                {
+                        ++i;
+
+                        log_debug("&request:%p, remove it",
+                                  request);
 
                         list_del(&(request->list));
-                        free(request);
+                        request_free(request);
                 }
         }
 
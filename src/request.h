@@ -20,16 +20,41 @@
 #define _YADDNS_REQUEST_H_
 
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 
 #include "list.h"
+#include "loop.h"
+#include "timer.h"
+#include "resolv.h"
 #include "util.h"
 
+/* size of a read on a connection */
 #define REQUEST_DATA_MAX_SIZE       512
 
+/* segments of a query */
+#define REQUEST_BUFF_SEGS_MAX       8
+
+/* parsed response limits, larger parts are read but not kept */
+#define REQUEST_LINE_MAX_SIZE       256
+#define REQUEST_HEADERS_MAX         16
+#define REQUEST_HEADERS_MAX_SIZE    512
+#define REQUEST_BODY_MAX_SIZE       2048
+
 #define REQUEST_PENDING_ACTION_TIMEOUT     30
 
+/* delay before trying the next address while connecting (RFC 8305) */
+#define REQUEST_CONNECT_ATTEMPT_DELAY      250 /* in ms */
+
+/* connections kept to each host:port */
+#define REQUEST_POOL_HOST_MAX_CONNS        4
+#define REQUEST_POOL_IDLE_TIMEOUT          10 /* in sec */
+
+/* longest Retry-After honored */
+#define REQUEST_RETRY_AFTER_MAX            86400 /* in sec */
+
 #define REQ_OPT_BIND_ADDR           0x01 << 0
+#define REQ_OPT_PIPELINE            0x01 << 1
 
 #define REQ_ERR_UNKNOWN             0
 #define REQ_ERR_SYSTEM              1
@@ -37,6 +62,10 @@
 #define REQ_ERR_CONNECT_TIMEOUT     3
 #define REQ_ERR_RESPONSE_TIMEOUT    4
 #define REQ_ERR_SENDING_TIMEOUT     5
+#define REQ_ERR_RESOLVE_FAILED      6
+#define REQ_ERR_RESOLVE_TIMEOUT     7
+#define REQ_ERR_CONNECTION_CLOSED   8
+#define REQ_ERR_BAD_RESPONSE        9
 
 static inline const char *strreqerr(unsigned int req_err)
 {
@@ -47,6 +76,10 @@ static inline const char *strreqerr(unsigned int req_err)
                 "Connection timeout",
                 "Receive timeout",
                 "Send timeout",
+                "Name resolution has failed",
+                "Name resolution timeout",
+                "Connection closed by the server",
+                "Malformed response",
         };
 
         if(req_err >= ARRAY_SIZE(req_err_str))
@@ -61,11 +94,12 @@ static inline const char *strreqerr(unsigned int req_err)
  * This module is for helping send an request and receive
  * response.
  *
- * A request has 8 flow states availables:
+ * A request has 9 flow states availables:
  * - FSError                     => An error occur (view errcode for more info)
  * - FSCreated                   => The request is created
- * - FSConnecting                => The request has a connecting
- *                                    socket to request_host
+ * - FSResolving                 => Waiting the resolution of request_host
+ * - FSConnecting                => The request has connecting sockets to
+ *                                    the addresses of request_host
  * - FSConnected                 => The request has a connection
  * - FSSending                   => The request is sent
  * - FSWaitingResponse           => Waiting request response
@@ -74,9 +108,37 @@ static inline const char *strreqerr(unsigned int req_err)
  *
  * A request with FSError is along of errcode variable which detail
  * the error (view REQ_ERR_* macro def).
+ *
+ * The response is parsed as it arrives, whatever the TCP segments:
+ * status line, headers, then a body delimited by Content-Length,
+ * chunked transfer encoding or the server close. In FSResponseReceived,
+ * request->response holds the status code, the headers and the
+ * (decoded) body.
+ *
+ * The requests are carried by connections pooled by host:port (and
+ * bind address): at most REQUEST_POOL_HOST_MAX_CONNS are opened, the
+ * other requests wait in FSCreated for one of them. A connection
+ * whose response allows it (keep-alive and known length) is kept
+ * REQUEST_POOL_IDLE_TIMEOUT seconds for the next request, which skips
+ * FSResolving and FSConnecting.
+ *
+ * With REQ_OPT_PIPELINE, up to pipeline_depth requests are sent on a
+ * kept-alive connection without waiting for the responses, which
+ * are given back in order.
+ *
+ * The requests not answered when the server closes a connection are
+ * sent again once on a new connection.
+ *
+ * While connecting, the resolved addresses are tried in turn
+ * (IPv6 and IPv4 interleaved), starting a new attempt every
+ * REQUEST_CONNECT_ATTEMPT_DELAY ms or as soon as one fails, without
+ * stopping the previous ones. The first connected socket wins and
+ * the other attempts are cancelled.
  */
 
 struct request;
+struct request_pool;
+struct request_conn;
 
 struct request_ctl {
         void (*hook_func)(struct request *request, void *hook_data);
@@ -89,26 +151,52 @@ struct request_host {
         unsigned short int port;
 };
 
+/*
+ * The query, in segments written at once (writev-like). The segments
+ * flagged owned were allocated with malloc() and are freed with the
+ * buff, the other ones must outlive it (string literals, ...).
+ */
 struct request_buff {
-        char data[REQUEST_DATA_MAX_SIZE];
-        size_t data_size; /* total count of chars in buf */
-        size_t data_ack;  /* count of chars read or write yet */
+        struct iovec segs[REQUEST_BUFF_SEGS_MAX];
+        unsigned int segs_count;
+        unsigned int owned; /* mask of the segs to free */
+        size_t data_size; /* total count of chars in segs */
+        size_t data_ack;  /* count of chars written yet */
+};
+
+struct request_header {
+        const char *name;           /* in request_response hdata */
+        const char *value;
+};
+
+struct request_response {
+        int status;                 /* status code */
+        char reason[64];            /* reason phrase */
+        struct request_header headers[REQUEST_HEADERS_MAX];
+        size_t headers_count;
+        char hdata[REQUEST_HEADERS_MAX_SIZE];
+        size_t hdata_size;
+        char body[REQUEST_BODY_MAX_SIZE]; /* \0 ended */
+        size_t body_size;           /* count of chars in body */
+        int body_truncated;         /* the body didn't fit in body */
 };
 
 struct request_opt {
         unsigned long mask;
         struct in_addr bind_addr;
+        unsigned int pipeline_depth; /* requests in flight on a conn */
 };
 
 struct request {
-        int s;
         struct request_host host;
         struct request_ctl ctl;
         struct request_buff buff;
+        struct request_response response;
         struct request_opt opt;
         enum {
                 FSError = -1,
                 FSCreated,
+                FSResolving,
                 FSConnecting,
                 FSConnected,
                 FSSending,
@@ -117,10 +205,23 @@ struct request {
                 FSFinished,
         } state;
         unsigned int errcode;
-	struct timeval last_pending_action;
+        struct timer timeout;       /* pending action timeout */
+        struct request_pool *pool;  /* connections to host */
+        struct request_conn *conn;  /* connection carrying the request */
+        struct list_head queue;     /* in pool waiting, conn sending or
+                                     * conn waiting list */
+        int retried;                /* sent again on a new connection */
+        int reserved;               /* from the reserve, not the heap */
         struct list_head list;
 };
 
+struct request_stats {
+        unsigned int reserved;      /* requests allocated in reserve */
+        unsigned int in_use;
+        unsigned int high_water;    /* max of in_use */
+        unsigned long heap_allocs;  /* allocated out of the reserve */
+};
+
 /*
  * init request list
  */
@@ -131,8 +232,49 @@ void request_ctl_init(void);
  */
 void request_ctl_cleanup(void);
 
+/*
+ * Grow the reserve of requests to count. The requests are taken from
+ * it, the heap is only used when it's exhausted.
+ *
+ * @return 0 if success, -1 if the allocation failed
+ */
+int request_ctl_reserve(unsigned int count);
+
+/*
+ * Get the allocation statistics
+ */
+void request_ctl_stats(struct request_stats *stats);
+
+/*
+ * Append a segment of size bytes to the query. If owned, data was
+ * allocated with malloc() and belongs to buff now, even on failure.
+ *
+ * @return 0 if success, -1 if buff is full
+ */
+int request_buff_add(struct request_buff *buff,
+                     const void *data, size_t size, int owned);
+
+/*
+ * Append a formatted segment to the query (no size limit)
+ *
+ * @return 0 if success, -1 otherwise
+ */
+int request_buff_printf(struct request_buff *buff, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+
+/*
+ * Free the owned segments of a query not given to request_send()
+ */
+void request_buff_free(struct request_buff *buff);
+
 /*
  * Send a request
+ *
+ * The request takes the segments of buff (they are not copied), buff
+ * is emptied whatever the result.
+ *
+ * The host is resolved then connected from the event loop, the
+ * hook is always called from the loop.
  */
 int request_send(struct request_host *host,
                  struct request_ctl *ctl,
@@ -140,23 +282,21 @@ int request_send(struct request_host *host,
                  struct request_opt *opt);
 
 /*
- * request_ctl_selectfds
- *
- * - fill fd_set with fd to watch
- * - set max_fd
+ * Remove all current requests
  */
-void request_ctl_selectfds(fd_set *readset, fd_set *writeset, int *max_fd);
+int request_ctl_remove_by_hook_data(const void *hook_data);
 
 /*
- * request_processfds
- *
- * - following fd_set, manage request flow
+ * Value of the response header name (case insensitive), NULL if the
+ * response hasn't it
  */
-void request_ctl_processfds(fd_set *readset, fd_set *writeset);
+const char *request_response_header(const struct request_response *response,
+                                    const char *name);
 
 /*
- * Remove all current requests
+ * Seconds of the Retry-After response header (capped to
+ * REQUEST_RETRY_AFTER_MAX), 0 if the response hasn't it
  */
-int request_ctl_remove_by_hook_data(const void *hook_data);
+unsigned int request_response_retry_after(const struct request_response *response);
 
 #endif
@@ -0,0 +1,1573 @@
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ctype.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "resolv.h"
+#include "log.h"
+#include "util.h"
+
+/* default timeout of one try and tries per nameserver (as libc) */
+#define RESOLV_DEFAULT_TIMEOUT_MS   5000
+#define RESOLV_DEFAULT_ATTEMPTS     2
+
+#define RESOLV_UDP_MAX_SIZE         512
+#define RESOLV_TCP_MAX_SIZE         65535
+
+#define RESOLV_TYPE_A               1
+#define RESOLV_TYPE_CNAME           5
+#define RESOLV_TYPE_AAAA            28
+#define RESOLV_CLASS_IN             1
+
+#define RESOLV_RCODE_NOERROR        0
+#define RESOLV_RCODE_NXDOMAIN       3
+
+/* max CNAME followed in an answer */
+#define RESOLV_CNAME_MAX            8
+
+static struct {
+        struct sockaddr_storage addrs[RESOLV_NAMESERVERS_MAX];
+        socklen_t addrlens[RESOLV_NAMESERVERS_MAX];
+        unsigned int count;
+        unsigned int timeout_ms;
+        unsigned int attempts;
+        uint32_t rand_state;
+} resolv_conf;
+
+/* an answer of the network, shared by all the queries of a host */
+struct resolv_cache_entry {
+        struct list_head list;      /* in resolv_cache, most recent first */
+        char host[RESOLV_HOST_MAX_SIZE];
+        int family;
+        int pending;                /* lookup in progress */
+        uint64_t expire;            /* on the timer clock */
+        struct resolv_query lookup; /* the network query (port 0) */
+        struct resolv_result result;
+        struct list_head waiters;   /* queries waiting for lookup */
+};
+
+static LIST_HEAD_DECL(resolv_cache);
+static size_t resolv_cache_count = 0;
+
+/* defs static functions */
+static void resolv_udp_cb(struct loop_watch *watch, unsigned int revents);
+static void resolv_tcp_cb(struct loop_watch *watch, unsigned int revents);
+static void resolv_timer_cb(struct timer *timer, void *data);
+static void resolv_send(struct resolv_query *query);
+static int resolv_bind(const struct resolv_query *query, int s, int family);
+
+/*
+ * decs static functions
+ */
+static uint16_t resolv_rand16(void)
+{
+        /* xorshift32, seeded at init */
+        uint32_t x = resolv_conf.rand_state;
+
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        resolv_conf.rand_state = x;
+
+        return (uint16_t)(x >> 8);
+}
+
+static void resolv_seed(void)
+{
+        int fd;
+        uint32_t seed = 0;
+
+        fd = open("/dev/urandom", O_RDONLY);
+        if(fd >= 0)
+        {
+                if(read(fd, &seed, sizeof(seed)) != sizeof(seed))
+                {
+                        seed = 0;
+                }
+                close(fd);
+        }
+
+        if(seed == 0)
+        {
+                seed = (uint32_t)util_getuptime_ms() ^ (uint32_t)getpid();
+        }
+
+        resolv_conf.rand_state = (seed != 0 ? seed : 0x2545f491);
+}
+
+static int resolv_sockaddr(const char *addr, unsigned short int port,
+                           struct sockaddr_storage *ss, socklen_t *sslen)
+{
+        struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+
+        memset(ss, 0, sizeof(struct sockaddr_storage));
+
+        if(inet_pton(AF_INET, addr, &(sin->sin_addr)) == 1)
+        {
+                sin->sin_family = AF_INET;
+                sin->sin_port = htons(port);
+                *sslen = sizeof(struct sockaddr_in);
+                return 0;
+        }
+
+        if(inet_pton(AF_INET6, addr, &(sin6->sin6_addr)) == 1)
+        {
+                sin6->sin6_family = AF_INET6;
+                sin6->sin6_port = htons(port);
+                *sslen = sizeof(struct sockaddr_in6);
+                return 0;
+        }
+
+        return -1;
+}
+
+/*
+ * nameserver asked by query at this try
+ */
+static const struct sockaddr_storage *resolv_server(
+        const struct resolv_query *query, socklen_t *serverlen)
+{
+        unsigned int ns;
+
+        if(query->direct)
+        {
+                *serverlen = query->serverlen;
+                return &(query->server);
+        }
+
+        ns = query->try % resolv_conf.count;
+        *serverlen = resolv_conf.addrlens[ns];
+
+        return &(resolv_conf.addrs[ns]);
+}
+
+static void resolv_result_add(struct resolv_result *result, int family,
+                              const void *addr, unsigned short int port)
+{
+        struct sockaddr_in *sin = NULL;
+        struct sockaddr_in6 *sin6 = NULL;
+
+        if(result->count >= RESOLV_ADDRS_MAX)
+        {
+                return;
+        }
+
+        memset(&(result->addrs[result->count]), 0,
+               sizeof(struct sockaddr_storage));
+
+        if(family == AF_INET)
+        {
+                sin = (struct sockaddr_in *)&(result->addrs[result->count]);
+                sin->sin_family = AF_INET;
+                sin->sin_port = htons(port);
+                memcpy(&(sin->sin_addr), addr, sizeof(struct in_addr));
+        }
+        else
+        {
+                sin6 = (struct sockaddr_in6 *)&(result->addrs[result->count]);
+                sin6->sin6_family = AF_INET6;
+                sin6->sin6_port = htons(port);
+                memcpy(&(sin6->sin6_addr), addr, sizeof(struct in6_addr));
+        }
+
+        ++result->count;
+}
+
+/*
+ * try to answer with a numeric host or /etc/hosts
+ *
+ * @return 1 if answered, 0 otherwise
+ */
+static int resolv_local(struct resolv_query *query)
+{
+        FILE *file = NULL;
+        char line[512];
+        char *p = NULL, *name = NULL, *saveptr = NULL;
+        unsigned char addr[sizeof(struct in6_addr)];
+        int family, match;
+
+        /* numeric host */
+        if((query->family != AF_INET6
+            && inet_pton(AF_INET, query->host, addr) == 1))
+        {
+                resolv_result_add(&(query->result), AF_INET,
+                                  addr, query->port);
+                return 1;
+        }
+
+        if((query->family != AF_INET
+            && inet_pton(AF_INET6, query->host, addr) == 1))
+        {
+                resolv_result_add(&(query->result), AF_INET6,
+                                  addr, query->port);
+                return 1;
+        }
+
+        /* hosts file */
+        if((file = fopen(RESOLV_HOSTS_PATH, "r")) == NULL)
+        {
+                return 0;
+        }
+
+        while(fgets(line, sizeof(line), file) != NULL)
+        {
+                if((p = strchr(line, '#')) != NULL)
+                {
+                        *p = '\0';
+                }
+
+                p = strtok_r(line, " \t\r\n", &saveptr);
+                if(p == NULL)
+                {
+                        continue;
+                }
+
+                if(inet_pton(AF_INET, p, addr) == 1)
+                {
+                        family = AF_INET;
+                }
+                else if(inet_pton(AF_INET6, p, addr) == 1)
+                {
+                        family = AF_INET6;
+                }
+                else
+                {
+                        continue;
+                }
+
+                if(query->family != AF_UNSPEC && query->family != family)
+                {
+                        continue;
+                }
+
+                match = 0;
+                while((name = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL)
+                {
+                        if(strcasecmp(name, query->host) == 0)
+                        {
+                                match = 1;
+                                break;
+                        }
+                }
+
+                if(match)
+                {
+                        resolv_result_add(&(query->result), family,
+                                          addr, query->port);
+                }
+        }
+
+        fclose(file);
+
+        return (query->result.count > 0);
+}
+
+/*
+ * write a dns query for the question in buf
+ *
+ * @return the size of the query, -1 on error
+ */
+static int resolv_make_query(const struct resolv_query *query,
+                             const struct resolv_question *question,
+                             unsigned char *buf, size_t buf_size)
+{
+        const char *label = NULL, *dot = NULL;
+        size_t n = 12, label_len;
+
+        memset(buf, 0, 12);
+        buf[0] = (unsigned char)(question->id >> 8);
+        buf[1] = (unsigned char)(question->id & 0xff);
+        buf[2] = 0x01;        /* RD */
+        buf[5] = 1;           /* QDCOUNT */
+
+        for(label = query->qname; *label != '\0'; label = dot + 1)
+        {
+                dot = strchr(label, '.');
+                if(dot == NULL)
+                {
+                        dot = label + strlen(label);
+                }
+
+                label_len = (size_t)(dot - label);
+                if(label_len == 0 || label_len > 63
+                   || n + 1 + label_len + 5 > buf_size)
+                {
+                        return -1;
+                }
+
+                buf[n++] = (unsigned char)label_len;
+                memcpy(buf + n, label, label_len);
+                n += label_len;
+
+                if(*dot == '\0')
+                {
+                        break;
+                }
+        }
+
+        buf[n++] = 0;
+        buf[n++] = (unsigned char)(question->qtype >> 8);
+        buf[n++] = (unsigned char)(question->qtype & 0xff);
+        buf[n++] = 0;
+        buf[n++] = RESOLV_CLASS_IN;
+
+        return (int)n;
+}
+
+/*
+ * read the (maybe compressed) name at *off in name (dotted, without
+ * the final dot) and move *off after it
+ *
+ * @return 0 if success, -1 if malformed
+ */
+static int resolv_read_name(const unsigned char *pkt, size_t len,
+                            size_t *off, char *name, size_t name_size)
+{
+        size_t pos = *off, n = 0, label_len;
+        int jumps = 0, jumped = 0;
+
+        for(;;)
+        {
+                if(pos >= len)
+                {
+                        return -1;
+                }
+
+                label_len = pkt[pos];
+
+                if((label_len & 0xc0) == 0xc0)
+                {
+                        if(pos + 1 >= len || ++jumps > 16)
+                        {
+                                return -1;
+                        }
+
+                        if(!jumped)
+                        {
+                                *off = pos + 2;
+                                jumped = 1;
+                        }
+
+                        pos = ((label_len & 0x3f) << 8) | pkt[pos + 1];
+                        continue;
+                }
+
+                if(label_len == 0)
+                {
+                        if(!jumped)
+                        {
+                                *off = pos + 1;
+                        }
+                        break;
+                }
+
+                if(label_len > 63 || pos + 1 + label_len > len
+                   || n + label_len + 2 > name_size)
+                {
+                        return -1;
+                }
+
+                if(n > 0)
+                {
+                        name[n++] = '.';
+                }
+
+                memcpy(name + n, pkt + pos + 1, label_len);
+                n += label_len;
+                pos += 1 + label_len;
+        }
+
+        name[n] = '\0';
+
+        return 0;
+}
+
+static int resolv_name_equal(const char *a, const char *b)
+{
+        size_t alen = strlen(a), blen = strlen(b);
+
+        /* ignore a final dot */
+        if(alen > 0 && a[alen - 1] == '.')
+        {
+                --alen;
+        }
+
+        if(blen > 0 && b[blen - 1] == '.')
+        {
+                --blen;
+        }
+
+        return (alen == blen && strncasecmp(a, b, alen) == 0);
+}
+
+/*
+ * with RESOLV_OPT_0X20, the question of the answer has the random
+ * case of ours (a spoofer has to guess it)
+ */
+static int resolv_name_echoed(const struct resolv_query *query,
+                              const char *name)
+{
+        if(!(query->opt.mask & RESOLV_OPT_0X20)
+           || strncmp(name, query->qname, strlen(name)) == 0)
+        {
+                return 1;
+        }
+
+        log_warning("Answer of %s in another case (%s), ignored",
+                    query->qname, name);
+
+        return 0;
+}
+
+/*
+ * randomize the case of the letters of the name asked by query
+ */
+static void resolv_mixcase(struct resolv_query *query)
+{
+        uint16_t bits = 0;
+        unsigned char c;
+        size_t i;
+
+        for(i = 0; query->qname[i] != '\0'; ++i)
+        {
+                c = (unsigned char)query->qname[i];
+                if(!isalpha(c))
+                {
+                        continue;
+                }
+
+                if(bits <= 1)
+                {
+                        /* a sentinel bit above 15 random ones */
+                        bits = (uint16_t)(resolv_rand16() | 0x8000);
+                }
+
+                query->qname[i] = (char)((bits & 0x01)
+                                         ? toupper(c) : tolower(c));
+                bits >>= 1;
+        }
+}
+
+static uint16_t resolv_get16(const unsigned char *p)
+{
+        return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t resolv_get32(const unsigned char *p)
+{
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+                | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+/*
+ * Parse the answer of a question.
+ *
+ * @return -1 if the packet isn't an answer to the question, the
+ * rcode otherwise (*tc is set if the answer is truncated)
+ */
+static int resolv_parse(struct resolv_query *query,
+                        struct resolv_question *question,
+                        const unsigned char *pkt, size_t len,
+                        int *tc)
+{
+        char name[RESOLV_HOST_MAX_SIZE];
+        char target[RESOLV_HOST_MAX_SIZE];
+        size_t off, rr_off;
+        uint16_t qdcount, ancount, type, rdlen;
+        uint32_t ttl;
+        unsigned int i, pass;
+        int rcode;
+
+        if(len < 12
+           || resolv_get16(pkt) != question->id
+           || !(pkt[2] & 0x80))
+        {
+                return -1;
+        }
+
+        *tc = ((pkt[2] & 0x02) != 0);
+        rcode = pkt[3] & 0x0f;
+        qdcount = resolv_get16(pkt + 4);
+        ancount = resolv_get16(pkt + 6);
+
+        /* the question must be ours */
+        off = 12;
+        if(qdcount != 1
+           || resolv_read_name(pkt, len, &off, name, sizeof(name)) != 0
+           || off + 4 > len
+           || !resolv_name_equal(name, query->host)
+           || !resolv_name_echoed(query, name)
+           || resolv_get16(pkt + off) != question->qtype)
+        {
+                return -1;
+        }
+        off += 4;
+
+        if(*tc || rcode != RESOLV_RCODE_NOERROR)
+        {
+                return rcode;
+        }
+
+        /* follow the CNAME chain, then collect the addresses of the
+         * final name
+         */
+        snprintf(target, sizeof(target), "%s", query->host);
+        rr_off = off;
+
+        for(pass = 0; pass <= RESOLV_CNAME_MAX; ++pass)
+        {
+                int followed = 0;
+
+                off = rr_off;
+                for(i = 0; i < ancount; ++i)
+                {
+                        if(resolv_read_name(pkt, len, &off,
+                                            name, sizeof(name)) != 0
+                           || off + 10 > len)
+                        {
+                                return -1;
+                        }
+
+                        type = resolv_get16(pkt + off);
+                        ttl = resolv_get32(pkt + off + 4);
+                        rdlen = resolv_get16(pkt + off + 8);
+                        off += 10;
+
+                        if(off + rdlen > len)
+                        {
+                                return -1;
+                        }
+
+                        if(resolv_name_equal(name, target))
+                        {
+                                if(type == RESOLV_TYPE_CNAME)
+                                {
+                                        size_t cname_off = off;
+
+                                        if(resolv_read_name(pkt, len,
+                                                            &cname_off,
+                                                            target,
+                                                            sizeof(target)) != 0)
+                                        {
+                                                return -1;
+                                        }
+
+                                        query->result.ttl =
+                                                MIN(query->result.ttl, ttl);
+                                        followed = 1;
+                                        break;
+                                }
+
+                                if(type == question->qtype
+                                   && type == RESOLV_TYPE_A
+                                   && rdlen == 4)
+                                {
+                                        resolv_result_add(&(query->result),
+                                                          AF_INET,
+                                                          pkt + off,
+                                                          query->port);
+                                        query->result.ttl =
+                                                MIN(query->result.ttl, ttl);
+                                }
+                                else if(type == question->qtype
+                                        && type == RESOLV_TYPE_AAAA
+                                        && rdlen == 16)
+                                {
+                                        resolv_result_add(&(query->result),
+                                                          AF_INET6,
+                                                          pkt + off,
+                                                          query->port);
+                                        query->result.ttl =
+                                                MIN(query->result.ttl, ttl);
+                                }
+                        }
+
+                        off += rdlen;
+                }
+
+                if(!followed)
+                {
+                        break;
+                }
+        }
+
+        return rcode;
+}
+
+static void resolv_tcp_close(struct resolv_question *question)
+{
+        loop_watch_del(&(question->tcp_watch));
+
+        if(question->tcp_s >= 0)
+        {
+                close(question->tcp_s);
+                question->tcp_s = -1;
+        }
+
+        free(question->tcp_buf);
+        question->tcp_buf = NULL;
+        question->tcp_size = 0;
+        question->tcp_ack = 0;
+}
+
+static void resolv_close(struct resolv_query *query)
+{
+        size_t i;
+
+        timer_stop(&(query->timer));
+        loop_watch_del(&(query->watch));
+
+        if(query->s >= 0)
+        {
+                close(query->s);
+                query->s = -1;
+        }
+
+        for(i = 0; i < query->questions_count; ++i)
+        {
+                resolv_tcp_close(&(query->questions[i]));
+        }
+
+        query->active = 0;
+}
+
+static void resolv_finish(struct resolv_query *query, int err)
+{
+        resolv_close(query);
+
+        query->result.err = (query->result.count > 0 ? RESOLV_ERR_OK : err);
+
+        log_debug("&query:%p, %s resolved: %s (%zu addresses)",
+                  query, query->host,
+                  strresolverr(query->result.err),
+                  query->result.count);
+
+        /* query is inactive, cb can start it again */
+        query->cb(query, &(query->result), query->data);
+}
+
+static void resolv_check_done(struct resolv_query *query)
+{
+        size_t i;
+
+        for(i = 0; i < query->questions_count; ++i)
+        {
+                if(!query->questions[i].done)
+                {
+                        return;
+                }
+        }
+
+        /* nxdomain or no record of the asked type(s) */
+        resolv_finish(query, RESOLV_ERR_NOT_FOUND);
+}
+
+/*
+ * handle the answer (udp or tcp) of a question
+ */
+static void resolv_answer(struct resolv_query *query,
+                          struct resolv_question *question,
+                          const unsigned char *pkt, size_t len,
+                          int is_tcp)
+{
+        int rcode, tc = 0;
+
+        rcode = resolv_parse(query, question, pkt, len, &tc);
+        if(rcode < 0)
+        {
+                log_debug("&query:%p, ignore invalid answer", query);
+                return;
+        }
+
+        if(tc && !is_tcp)
+        {
+                socklen_t serverlen;
+                const struct sockaddr_storage *server =
+                        resolv_server(query, &serverlen);
+                int n;
+
+                log_debug("&query:%p, truncated answer, retry with tcp",
+                          query);
+
+                question->tcp_buf = malloc(2 + RESOLV_TCP_MAX_SIZE);
+                if(question->tcp_buf == NULL)
+                {
+                        question->done = 1;
+                        return;
+                }
+
+                n = resolv_make_query(query, question,
+                                      question->tcp_buf + 2,
+                                      RESOLV_UDP_MAX_SIZE);
+                if(n < 0)
+                {
+                        resolv_tcp_close(question);
+                        question->done = 1;
+                        return;
+                }
+
+                question->tcp_buf[0] = (unsigned char)(n >> 8);
+                question->tcp_buf[1] = (unsigned char)(n & 0xff);
+                question->tcp_size = (size_t)n + 2;
+                question->tcp_ack = 0;
+
+                question->tcp_s = socket(server->ss_family,
+                                         SOCK_STREAM, 0);
+                if(question->tcp_s < 0
+                   || fcntl(question->tcp_s, F_SETFL, O_NONBLOCK) < 0
+                   || resolv_bind(query, question->tcp_s,
+                                  server->ss_family) != 0
+                   || (connect(question->tcp_s,
+                               (const struct sockaddr *)server,
+                               serverlen) < 0
+                       && errno != EINPROGRESS)
+                   || loop_watch_add(&(question->tcp_watch),
+                                     question->tcp_s, LOOP_WRITE) != 0)
+                {
+                        log_error("Unable to query %s over tcp: %s",
+                                  query->host, strerror(errno));
+                        resolv_tcp_close(question);
+                        question->done = 1;
+                }
+
+                return;
+        }
+
+        if(rcode != RESOLV_RCODE_NOERROR
+           && rcode != RESOLV_RCODE_NXDOMAIN)
+        {
+                /* this server failed, ask the next one */
+                log_debug("&query:%p, server failure (rcode %d)",
+                          query, rcode);
+                query->servfail = 1;
+                return;
+        }
+
+        question->done = 1;
+}
+
+static int resolv_sockaddr_equal(const struct sockaddr_storage *a,
+                                 const struct sockaddr_storage *b)
+{
+        if(a->ss_family != b->ss_family)
+        {
+                return 0;
+        }
+
+        if(a->ss_family == AF_INET)
+        {
+                return (memcmp(&(((const struct sockaddr_in *)a)->sin_addr),
+                               &(((const struct sockaddr_in *)b)->sin_addr),
+                               sizeof(struct in_addr)) == 0
+                        && ((const struct sockaddr_in *)a)->sin_port
+                        == ((const struct sockaddr_in *)b)->sin_port);
+        }
+
+        if(a->ss_family == AF_INET6)
+        {
+                return (memcmp(&(((const struct sockaddr_in6 *)a)->sin6_addr),
+                               &(((const struct sockaddr_in6 *)b)->sin6_addr),
+                               sizeof(struct in6_addr)) == 0
+                        && ((const struct sockaddr_in6 *)a)->sin6_port
+                        == ((const struct sockaddr_in6 *)b)->sin6_port);
+        }
+
+        return 0;
+}
+
+static int resolv_from_nameserver(const struct resolv_query *query,
+                                  const struct sockaddr_storage *from)
+{
+        unsigned int i;
+
+        if(query->direct)
+        {
+                return resolv_sockaddr_equal(&(query->server), from);
+        }
+
+        for(i = 0; i < resolv_conf.count; ++i)
+        {
+                if(resolv_sockaddr_equal(&(resolv_conf.addrs[i]), from))
+                {
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+static void resolv_udp_cb(struct loop_watch *watch, unsigned int revents)
+{
+        struct resolv_query *query = watch->data;
+        unsigned char pkt[RESOLV_UDP_MAX_SIZE];
+        struct sockaddr_storage from;
+        socklen_t fromlen;
+        ssize_t n;
+        size_t i;
+
+        UNUSED(revents);
+
+        for(;;)
+        {
+                fromlen = sizeof(from);
+                n = recvfrom(query->s, pkt, sizeof(pkt), 0,
+                             (struct sockaddr *)&from, &fromlen);
+                if(n < 0)
+                {
+                        if(errno != EAGAIN && errno != EWOULDBLOCK)
+                        {
+                                log_debug("recvfrom(): %s", strerror(errno));
+                        }
+                        break;
+                }
+
+                if(!resolv_from_nameserver(query, &from))
+                {
+                        log_debug("&query:%p, ignore answer from a"
+                                  " stranger", query);
+                        continue;
+                }
+
+                for(i = 0; i < query->questions_count; ++i)
+                {
+                        if(!query->questions[i].done
+                           && query->questions[i].tcp_s < 0)
+                        {
+                                resolv_answer(query, &(query->questions[i]),
+                                              pkt, (size_t)n, 0);
+                        }
+                }
+        }
+
+        if(query->servfail)
+        {
+                /* retry now with the next nameserver */
+                query->servfail = 0;
+                query->failed = 1;
+                timer_start(&(query->timer), 0);
+                return;
+        }
+
+        resolv_check_done(query);
+}
+
+static void resolv_tcp_cb(struct loop_watch *watch, unsigned int revents)
+{
+        struct resolv_query *query = watch->data;
+        struct resolv_question *question = NULL;
+        size_t want;
+        ssize_t n;
+        size_t i;
+
+        UNUSED(revents);
+
+        for(i = 0; i < query->questions_count; ++i)
+        {
+                if(&(query->questions[i].tcp_watch) == watch)
+                {
+                        question = &(query->questions[i]);
+                }
+        }
+
+        if(watch->events & LOOP_WRITE)
+        {
+                n = send(question->tcp_s,
+                         question->tcp_buf + question->tcp_ack,
+                         question->tcp_size - question->tcp_ack, 0);
+                if(n < 0)
+                {
+                        if(errno == EAGAIN)
+                        {
+                                return;
+                        }
+
+                        goto tcp_failed;
+                }
+
+                question->tcp_ack += (size_t)n;
+                if(question->tcp_ack == question->tcp_size)
+                {
+                        /* now read the length prefixed answer */
+                        question->tcp_size = 0;
+                        question->tcp_ack = 0;
+                        loop_watch_mod(watch, LOOP_READ);
+                }
+
+                return;
+        }
+
+        want = (question->tcp_ack < 2
+                ? 2
+                : 2 + (size_t)resolv_get16(question->tcp_buf));
+
+        n = recv(question->tcp_s,
+                 question->tcp_buf + question->tcp_ack,
+                 want - question->tcp_ack, 0);
+        if(n <= 0)
+        {
+                if(n < 0 && errno == EAGAIN)
+                {
+                        return;
+                }
+
+                goto tcp_failed;
+        }
+
+        question->tcp_ack += (size_t)n;
+        if(question->tcp_ack < 2
+           || question->tcp_ack < 2 + (size_t)resolv_get16(question->tcp_buf))
+        {
+                return;
+        }
+
+        resolv_answer(query, question,
+                      question->tcp_buf + 2, question->tcp_ack - 2, 1);
+        resolv_tcp_close(question);
+        question->done = 1;
+        resolv_check_done(query);
+        return;
+
+tcp_failed:
+        log_error("dns query of %s over tcp failed: %s",
+                  query->host, (n < 0 ? strerror(errno) : "connection closed"));
+        resolv_tcp_close(question);
+        question->done = 1;
+        resolv_check_done(query);
+}
+
+static void resolv_timer_cb(struct timer *timer, void *data)
+{
+        struct resolv_query *query = data;
+        size_t i;
+
+        UNUSED(timer);
+
+        /* answered without network (or from the cache) */
+        if(query->answered)
+        {
+                resolv_finish(query, query->result.err);
+                return;
+        }
+
+        /* no answer, try the next nameserver */
+        ++query->try;
+        if(query->try >= (query->direct ? 1 : resolv_conf.count)
+           * resolv_conf.attempts)
+        {
+                log_error("Unable to resolve %s: %s", query->host,
+                          (query->failed ? "server failure" : "timeout"));
+                resolv_finish(query, (query->failed
+                                      ? RESOLV_ERR_SERVER
+                                      : RESOLV_ERR_TIMEOUT));
+                return;
+        }
+
+        for(i = 0; i < query->questions_count; ++i)
+        {
+                if(query->questions[i].tcp_s >= 0)
+                {
+                        resolv_tcp_close(&(query->questions[i]));
+                }
+        }
+
+        resolv_send(query);
+}
+
+/*
+ * bind the socket s of query to its address (if any), the questions
+ * leave by its interface
+ */
+static int resolv_bind(const struct resolv_query *query, int s, int family)
+{
+        struct sockaddr_in addr;
+
+        if(!(query->opt.mask & RESOLV_OPT_BIND_ADDR) || family != AF_INET)
+        {
+                return 0;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr = query->opt.bind_addr;
+
+        return bind(s, (struct sockaddr *)&addr, sizeof(addr));
+}
+
+/*
+ * send all the pending questions to the nameserver of this try
+ */
+static void resolv_send(struct resolv_query *query)
+{
+        unsigned char pkt[RESOLV_UDP_MAX_SIZE];
+        socklen_t serverlen;
+        const struct sockaddr_storage *server = resolv_server(query,
+                                                              &serverlen);
+        int family = server->ss_family;
+        struct resolv_question *question = NULL;
+        size_t i;
+        int n;
+
+        timer_start(&(query->timer), resolv_conf.timeout_ms);
+
+        /* one udp socket by nameserver family */
+        if(query->s >= 0 && query->s_family != family)
+        {
+                loop_watch_del(&(query->watch));
+                close(query->s);
+                query->s = -1;
+        }
+
+        if(query->s < 0)
+        {
+                query->s = socket(family, SOCK_DGRAM, 0);
+                if(query->s < 0
+                   || fcntl(query->s, F_SETFL, O_NONBLOCK) < 0
+                   || resolv_bind(query, query->s, family) != 0
+                   || loop_watch_add(&(query->watch),
+                                     query->s, LOOP_READ) != 0)
+                {
+                        log_error("Unable to open dns socket: %s",
+                                  strerror(errno));
+                        if(query->s >= 0)
+                        {
+                                close(query->s);
+                                query->s = -1;
+                        }
+                        return;
+                }
+
+                query->s_family = family;
+        }
+
+        for(i = 0; i < query->questions_count; ++i)
+        {
+                question = &(query->questions[i]);
+                if(question->done)
+                {
+                        continue;
+                }
+
+                n = resolv_make_query(query, question, pkt, sizeof(pkt));
+                if(n < 0)
+                {
+                        question->done = 1;
+                        continue;
+                }
+
+                log_debug("&query:%p, ask %s (type %u), try %u",
+                          query, query->host, question->qtype,
+                          query->try);
+
+                if(sendto(query->s, pkt, (size_t)n, 0,
+                          (const struct sockaddr *)server, serverlen) < 0)
+                {
+                        log_debug("sendto(): %s", strerror(errno));
+                }
+        }
+}
+
+static void resolv_query_setup(struct resolv_query *query,
+                               const char *host,
+                               unsigned short int port,
+                               int family,
+                               resolv_cb cb, void *data)
+{
+        size_t i;
+
+        memset(query, 0, sizeof(struct resolv_query));
+        snprintf(query->host, sizeof(query->host), "%s", host);
+        snprintf(query->qname, sizeof(query->qname), "%s", host);
+        query->port = port;
+        query->family = family;
+        query->cb = cb;
+        query->data = data;
+        query->s = -1;
+        query->result.ttl = UINT32_MAX;
+        INIT_LIST_HEAD(&(query->waiter));
+        loop_watch_init(&(query->watch), resolv_udp_cb, query);
+        timer_init(&(query->timer), resolv_timer_cb, query);
+
+        if(family != AF_INET6)
+        {
+                query->questions[query->questions_count++].qtype =
+                        RESOLV_TYPE_A;
+        }
+
+        if(family != AF_INET)
+        {
+                query->questions[query->questions_count++].qtype =
+                        RESOLV_TYPE_AAAA;
+        }
+
+        for(i = 0; i < query->questions_count; ++i)
+        {
+                query->questions[i].id = resolv_rand16();
+                query->questions[i].tcp_s = -1;
+                loop_watch_init(&(query->questions[i].tcp_watch),
+                                resolv_tcp_cb, query);
+        }
+
+        query->active = 1;
+}
+
+static void resolv_cache_remove(struct resolv_cache_entry *entry)
+{
+        list_del(&(entry->list));
+        --resolv_cache_count;
+        free(entry);
+}
+
+/*
+ * drop the cached answers, and the lookups in progress too if all
+ * (their waiters are forgotten)
+ */
+static void resolv_cache_flush(int all)
+{
+        struct resolv_cache_entry *entry = NULL, *safe = NULL;
+        struct resolv_query *query = NULL, *qsafe = NULL;
+
+        list_for_each_entry_safe(entry, safe, &resolv_cache, list)
+        {
+                if(entry->pending)
+                {
+                        if(!all)
+                        {
+                                continue;
+                        }
+
+                        list_for_each_entry_safe(query, qsafe,
+                                                 &(entry->waiters), waiter)
+                        {
+                                list_del_init(&(query->waiter));
+                                query->entry = NULL;
+                                query->active = 0;
+                        }
+
+                        resolv_close(&(entry->lookup));
+                }
+
+                resolv_cache_remove(entry);
+        }
+}
+
+/*
+ * find the entry of (host, family), the expired answers met are
+ * dropped
+ */
+static struct resolv_cache_entry *resolv_cache_find(const char *host,
+                                                    int family)
+{
+        struct resolv_cache_entry *entry = NULL, *safe = NULL;
+        uint64_t now = timer_now();
+
+        list_for_each_entry_safe(entry, safe, &resolv_cache, list)
+        {
+                if(!entry->pending && entry->expire <= now)
+                {
+                        resolv_cache_remove(entry);
+                        continue;
+                }
+
+                if(entry->family == family
+                   && strcasecmp(entry->host, host) == 0)
+                {
+                        return entry;
+                }
+        }
+
+        return NULL;
+}
+
+static struct resolv_cache_entry *resolv_cache_new(const char *host,
+                                                   int family)
+{
+        struct resolv_cache_entry *entry = NULL, *lru = NULL;
+
+        if(resolv_cache_count >= RESOLV_CACHE_MAX)
+        {
+                /* evict the least recently used answer */
+                list_for_each_entry(entry, &resolv_cache, list)
+                {
+                        if(!entry->pending)
+                        {
+                                lru = entry;
+                        }
+                }
+
+                if(lru != NULL)
+                {
+                        resolv_cache_remove(lru);
+                }
+        }
+
+        entry = calloc(1, sizeof(struct resolv_cache_entry));
+        if(entry == NULL)
+        {
+                log_error("Unable to allocate a dns cache entry");
+                return NULL;
+        }
+
+        snprintf(entry->host, sizeof(entry->host), "%s", host);
+        entry->family = family;
+        entry->pending = 1;
+        INIT_LIST_HEAD(&(entry->waiters));
+        list_add(&(entry->list), &resolv_cache);
+        ++resolv_cache_count;
+
+        return entry;
+}
+
+/*
+ * give the answer of entry to query, with the query port and the
+ * remaining ttl
+ */
+static void resolv_cache_copy(struct resolv_query *query,
+                              const struct resolv_cache_entry *entry)
+{
+        struct resolv_result *result = &(query->result);
+        uint64_t now = timer_now();
+        size_t i;
+
+        memcpy(result, &(entry->result), sizeof(struct resolv_result));
+
+        result->ttl = (entry->expire > now
+                       ? (uint32_t)((entry->expire - now) / 1000)
+                       : 0);
+
+        for(i = 0; i < result->count; ++i)
+        {
+                if(result->addrs[i].ss_family == AF_INET6)
+                {
+                        ((struct sockaddr_in6 *)&(result->addrs[i]))->sin6_port
+                                = htons(query->port);
+                }
+                else
+                {
+                        ((struct sockaddr_in *)&(result->addrs[i]))->sin_port
+                                = htons(query->port);
+                }
+        }
+}
+
+static void resolv_cache_cb(struct resolv_query *lookup,
+                            const struct resolv_result *result,
+                            void *data)
+{
+        struct resolv_cache_entry *entry = data;
+        struct resolv_query *query = NULL;
+        LIST_HEAD_DECL(waiters);
+        uint32_t ttl = 0;
+
+        UNUSED(lookup);
+
+        if(result->err == RESOLV_ERR_OK)
+        {
+                ttl = MIN(result->ttl, (uint32_t)RESOLV_CACHE_MAX_TTL);
+        }
+        else if(result->err == RESOLV_ERR_NOT_FOUND)
+        {
+                ttl = RESOLV_CACHE_NEGATIVE_TTL;
+        }
+
+        memcpy(&(entry->result), result, sizeof(struct resolv_result));
+        entry->expire = timer_now() + (uint64_t)ttl * 1000;
+        entry->pending = 0;
+
+        /* the waiters callbacks can start or cancel any query */
+        list_splice_init(&(entry->waiters), &waiters);
+        if(ttl == 0)
+        {
+                /* not cacheable, but still given to the waiters */
+                list_del(&(entry->list));
+                --resolv_cache_count;
+        }
+
+        while(!list_empty(&waiters))
+        {
+                query = list_entry(waiters.next, struct resolv_query, waiter);
+                list_del_init(&(query->waiter));
+                query->entry = NULL;
+
+                resolv_cache_copy(query, entry);
+                resolv_finish(query, query->result.err);
+        }
+
+        if(ttl == 0)
+        {
+                free(entry);
+        }
+}
+
+/*
+ * answer query from the cache or wait for the lookup of its host
+ *
+ * @return 0 if success, -1 otherwise
+ */
+static int resolv_cache_attach(struct resolv_query *query)
+{
+        struct resolv_cache_entry *entry = NULL;
+
+        entry = resolv_cache_find(query->host, query->family);
+        if(entry != NULL && !entry->pending)
+        {
+                log_debug("&query:%p, %s found in cache",
+                          query, query->host);
+
+                list_move(&(entry->list), &resolv_cache);
+                resolv_cache_copy(query, entry);
+                query->answered = 1;
+                timer_start(&(query->timer), 0);
+                return 0;
+        }
+
+        if(entry != NULL)
+        {
+                log_debug("&query:%p, %s is already being resolved",
+                          query, query->host);
+        }
+        else
+        {
+                if(resolv_conf.count == 0)
+                {
+                        log_error("No nameserver to resolve '%s'",
+                                  query->host);
+                        query->active = 0;
+                        return -1;
+                }
+
+                entry = resolv_cache_new(query->host, query->family);
+                if(entry == NULL)
+                {
+                        query->active = 0;
+                        return -1;
+                }
+
+                resolv_query_setup(&(entry->lookup),
+                                   query->host, 0, query->family,
+                                   resolv_cache_cb, entry);
+                resolv_send(&(entry->lookup));
+        }
+
+        list_add_tail(&(query->waiter), &(entry->waiters));
+        query->entry = entry;
+
+        return 0;
+}
+
+/*
+ * decs API functions
+ */
+int resolv_ctl_init(const char *resolvconf)
+{
+        FILE *file = NULL;
+        char line[256];
+        char *p = NULL, *saveptr = NULL;
+        long n;
+
+        resolv_cache_flush(0);
+
+        memset(&resolv_conf, 0, sizeof(resolv_conf));
+        resolv_conf.timeout_ms = RESOLV_DEFAULT_TIMEOUT_MS;
+        resolv_conf.attempts = RESOLV_DEFAULT_ATTEMPTS;
+        resolv_seed();
+
+        if(resolvconf == NULL)
+        {
+                resolvconf = RESOLV_CONF_PATH;
+        }
+
+        if((file = fopen(resolvconf, "r")) != NULL)
+        {
+                while(fgets(line, sizeof(line), file) != NULL)
+                {
+                        p = strtok_r(line, " \t\r\n", &saveptr);
+                        if(p == NULL || *p == '#' || *p == ';')
+                        {
+                                continue;
+                        }
+
+                        if(strcmp(p, "nameserver") == 0)
+                        {
+                                p = strtok_r(NULL, " \t\r\n", &saveptr);
+                                if(p == NULL
+                                   || resolv_conf.count >= RESOLV_NAMESERVERS_MAX)
+                                {
+                                        continue;
+                                }
+
+                                if(resolv_sockaddr(p, 53,
+                                                   &(resolv_conf.addrs[resolv_conf.count]),
+                                                   &(resolv_conf.addrlens[resolv_conf.count])) == 0)
+                                {
+                                        ++resolv_conf.count;
+                                }
+                        }
+                        else if(strcmp(p, "options") == 0)
+                        {
+                                while((p = strtok_r(NULL, " \t\r\n",
+                                                    &saveptr)) != NULL)
+                                {
+                                        if(strncmp(p, "timeout:", 8) == 0
+                                           && (n = strtol_safe(p + 8, -1)) > 0)
+                                        {
+                                                resolv_conf.timeout_ms =
+                                                        (unsigned int)n * 1000;
+                                        }
+                                        else if(strncmp(p, "attempts:", 9) == 0
+                                                && (n = strtol_safe(p + 9, -1)) > 0)
+                                        {
+                                                resolv_conf.attempts =
+                                                        (unsigned int)n;
+                                        }
+                                }
+                        }
+                }
+
+                fclose(file);
+        }
+
+        if(resolv_conf.count == 0)
+        {
+                return resolv_ctl_set_nameserver("127.0.0.1", 53);
+        }
+
+        return 0;
+}
+
+void resolv_ctl_cleanup(void)
+{
+        resolv_cache_flush(1);
+        resolv_conf.count = 0;
+}
+
+int resolv_ctl_set_nameserver(const char *addr, unsigned short int port)
+{
+        if(resolv_sockaddr(addr, port,
+                           &(resolv_conf.addrs[0]),
+                           &(resolv_conf.addrlens[0])) != 0)
+        {
+                log_error("Invalid nameserver address %s", addr);
+                return -1;
+        }
+
+        resolv_conf.count = 1;
+
+        return 0;
+}
+
+void resolv_ctl_set_options(unsigned int timeout_ms, unsigned int attempts)
+{
+        resolv_conf.timeout_ms = timeout_ms;
+        resolv_conf.attempts = (attempts > 0 ? attempts : 1);
+}
+
+int resolv_query_start(struct resolv_query *query,
+                       const char *host,
+                       unsigned short int port,
+                       int family,
+                       resolv_cb cb, void *data)
+{
+        if(strlen(host) >= sizeof(query->host) || host[0] == '\0')
+        {
+                log_error("Invalid host name '%s'", host);
+                return -1;
+        }
+
+        resolv_query_setup(query, host, port, family, cb, data);
+
+        if(resolv_local(query))
+        {
+                /* answer from the loop */
+                query->result.ttl = 0;
+                query->answered = 1;
+                timer_start(&(query->timer), 0);
+                return 0;
+        }
+
+        return resolv_cache_attach(query);
+}
+
+int resolv_query_start_fresh(struct resolv_query *query,
+                             const char *host,
+                             int family,
+                             const char *addr,
+                             unsigned short int port,
+                             const struct resolv_opt *opt,
+                             resolv_cb cb, void *data)
+{
+        if(strlen(host) >= sizeof(query->host) || host[0] == '\0')
+        {
+                log_error("Invalid host name '%s'", host);
+                return -1;
+        }
+
+        resolv_query_setup(query, host, 0, family, cb, data);
+
+        if(opt != NULL)
+        {
+                query->opt = *opt;
+        }
+
+        if(query->opt.mask & RESOLV_OPT_0X20)
+        {
+                resolv_mixcase(query);
+        }
+
+        if(addr != NULL)
+        {
+                if(resolv_sockaddr(addr, port, &(query->server),
+                                   &(query->serverlen)) != 0)
+                {
+                        log_error("Invalid nameserver address %s", addr);
+                        query->active = 0;
+                        return -1;
+                }
+
+                query->direct = 1;
+        }
+        else if(resolv_conf.count == 0)
+        {
+                log_error("No nameserver to resolve '%s'", host);
+                query->active = 0;
+                return -1;
+        }
+
+        resolv_send(query);
+
+        return 0;
+}
+
+void resolv_query_cancel(struct resolv_query *query)
+{
+        struct resolv_cache_entry *entry = query->entry;
+
+        if(!query->active)
+        {
+                return;
+        }
+
+        if(entry != NULL)
+        {
+                list_del_init(&(query->waiter));
+                query->entry = NULL;
+
+                /* nobody waits for this lookup anymore */
+                if(entry->pending && list_empty(&(entry->waiters)))
+                {
+                        resolv_close(&(entry->lookup));
+                        resolv_cache_remove(entry);
+                }
+        }
+
+        resolv_close(query);
+}
@@ -0,0 +1,215 @@
+/*
+ *  Yaddns - Yet Another ddns client
+ *  Copyright (C) 2008 Anthony Viallard <anthony.viallard@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _YADDNS_RESOLV_H_
+#define _YADDNS_RESOLV_H_
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "list.h"
+#include "loop.h"
+#include "timer.h"
+#include "util.h"
+
+/*
+ * This module is an asynchronous stub resolver running in the
+ * event loop (getaddrinfo() blocks the whole daemon).
+ *
+ * - numeric addresses and /etc/hosts entries are answered directly;
+ * - otherwise A and/or AAAA questions are sent over UDP to the
+ *   nameservers of resolv.conf, with retries and timeouts, and the
+ *   question is asked again over TCP if the answer is truncated.
+ *
+ * The answers from the network are kept in a process-wide cache
+ * keyed by (host, family) until their TTL expires (a missing name is
+ * remembered RESOLV_CACHE_NEGATIVE_TTL seconds), and the queries of a
+ * host already being resolved wait for the same lookup.
+ *
+ * The result is always given to the query callback from the loop,
+ * never from resolv_query_start().
+ */
+
+#define RESOLV_CONF_PATH            "/etc/resolv.conf"
+#define RESOLV_HOSTS_PATH           "/etc/hosts"
+
+#define RESOLV_HOST_MAX_SIZE        256
+#define RESOLV_ADDRS_MAX            8
+#define RESOLV_NAMESERVERS_MAX      3
+
+#define RESOLV_CACHE_MAX            64     /* entries */
+#define RESOLV_CACHE_MAX_TTL        86400  /* in sec */
+#define RESOLV_CACHE_NEGATIVE_TTL   30     /* in sec */
+
+#define RESOLV_OPT_BIND_ADDR        0x01 << 0
+#define RESOLV_OPT_0X20             0x01 << 1
+
+#define RESOLV_ERR_OK               0
+#define RESOLV_ERR_SYSTEM           1
+#define RESOLV_ERR_NOT_FOUND        2
+#define RESOLV_ERR_TIMEOUT          3
+#define RESOLV_ERR_SERVER           4
+
+static inline const char *strresolverr(int resolv_err)
+{
+        const char *resolv_err_str[] = {
+                "Success",
+                "System error",
+                "Host not found",
+                "Timeout",
+                "Server failure",
+        };
+
+        if(resolv_err < 0 || (size_t)resolv_err >= ARRAY_SIZE(resolv_err_str))
+        {
+                resolv_err = RESOLV_ERR_SYSTEM;
+        }
+
+        return resolv_err_str[resolv_err];
+}
+
+struct resolv_result {
+        int err;          /* RESOLV_ERR_* */
+        uint32_t ttl;     /* lowest (remaining) ttl of the answer records */
+        size_t count;
+        struct sockaddr_storage addrs[RESOLV_ADDRS_MAX]; /* with port */
+};
+
+/* options of a fresh query */
+struct resolv_opt {
+        unsigned long mask;         /* RESOLV_OPT_* */
+        struct in_addr bind_addr;   /* source of the questions to an
+                                     * ipv4 nameserver */
+};
+
+struct resolv_query;
+struct resolv_cache_entry;
+
+typedef void (*resolv_cb)(struct resolv_query *query,
+                          const struct resolv_result *result,
+                          void *data);
+
+struct resolv_question {
+        uint16_t qtype;
+        uint16_t id;
+        int done;
+        int tcp_s;                  /* -1 if asked over udp */
+        struct loop_watch tcp_watch;
+        unsigned char *tcp_buf;     /* query then response (len prefixed) */
+        size_t tcp_size;
+        size_t tcp_ack;
+};
+
+struct resolv_query {
+        char host[RESOLV_HOST_MAX_SIZE];
+        unsigned short int port;
+        int family;                 /* AF_INET, AF_INET6 or AF_UNSPEC */
+        resolv_cb cb;
+        void *data;                 /* data given in arg to cb */
+        /* private */
+        struct resolv_opt opt;
+        char qname[RESOLV_HOST_MAX_SIZE]; /* host as asked, the case of
+                                           * its letters is random with
+                                           * RESOLV_OPT_0X20 */
+        int active;
+        int answered;               /* result is ready, given by timer */
+        struct resolv_cache_entry *entry; /* lookup waited for */
+        struct list_head waiter;    /* in entry waiters */
+        int s;                      /* udp socket */
+        int s_family;
+        struct loop_watch watch;
+        struct timer timer;         /* retry timeout or direct answer */
+        unsigned int try;
+        struct resolv_question questions[2];
+        size_t questions_count;
+        int direct;                 /* asks server, not the nameservers */
+        struct sockaddr_storage server;
+        socklen_t serverlen;
+        int servfail;               /* a server failed in this try */
+        int failed;                 /* a server failed in a try */
+        struct resolv_result result;
+};
+
+/*
+ * Read nameservers and options from resolvconf (RESOLV_CONF_PATH if
+ * NULL). Without nameserver, 127.0.0.1 is used. The cached answers
+ * are dropped (the lookups in progress are kept).
+ *
+ * @return 0 if success, -1 otherwise
+ */
+extern int resolv_ctl_init(const char *resolvconf);
+
+/*
+ * Forget the configuration and the cache. Queries should be
+ * cancelled by their owners before.
+ */
+extern void resolv_ctl_cleanup(void);
+
+/*
+ * Replace the nameservers by a single one
+ *
+ * @return 0 if success, -1 otherwise
+ */
+extern int resolv_ctl_set_nameserver(const char *addr,
+                                     unsigned short int port);
+
+/*
+ * Set the timeout of one try and the count of tries per nameserver
+ */
+extern void resolv_ctl_set_options(unsigned int timeout_ms,
+                                   unsigned int attempts);
+
+/*
+ * Resolve host. family is AF_INET, AF_INET6 or AF_UNSPEC (both).
+ * The port is set in the returned addresses.
+ *
+ * @return 0 if success (cb will be called), -1 otherwise
+ */
+extern int resolv_query_start(struct resolv_query *query,
+                              const char *host,
+                              unsigned short int port,
+                              int family,
+                              resolv_cb cb, void *data);
+
+/*
+ * Resolve host asking the network now, without the hosts file nor
+ * the cache: the nameserver addr (numeric) on port if addr isn't
+ * NULL, the nameservers of resolv.conf otherwise. To know what a
+ * zone serves (its authoritative servers) at this very moment.
+ * opt (may be NULL) binds the questions to an address, or asks host
+ * in a random case the answer must echo (dns 0x20, against the
+ * spoofed answers).
+ *
+ * @return 0 if success (cb will be called), -1 otherwise
+ */
+extern int resolv_query_start_fresh(struct resolv_query *query,
+                                    const char *host,
+                                    int family,
+                                    const char *addr,
+                                    unsigned short int port,
+                                    const struct resolv_opt *opt,
+                                    resolv_cb cb, void *data);
+
+/*
+ * Abort a query. cb won't be called. Safe to call on an inactive
+ * query (but the query must have been zeroed or started once).
+ */
+extern void resolv_query_cancel(struct resolv_query *query);
+
+#endif
@@ -25,6 +25,9 @@
 #include "config.h"
 #include "request.h"
 
+/* max accounts updated by a query */
+#define SERVICE_BATCH_MAX 20
+
 struct rc_report {
 	enum {
 		up_success,
@@ -38,19 +41,33 @@ struct rc_report {
 	} code;
 	char proprio_return[16];      /* proprietary return code */
 	char proprio_return_info[64]; /* explanation about proprio return */
+        unsigned int retry_after;     /* s the service asks to wait
+                                       * before retrying, 0 if none */
 };
 
 struct service {
 	const char * const name;
 	const char * const ipserv;
         short unsigned int portserv;
+        unsigned int pipeline; /* max requests in flight on a
+                                * connection, 0 = 1 (pipelining needs
+                                * HTTP/1.1 queries) */
+        unsigned int batch_max; /* max accounts by query, 0 = 1 */
 	int (*ctor) (void);
 	int (*dtor) (void);
 	int (*make_query) (const struct cfg_account *cfg,
                            const char * const newwanip,
                            struct request_buff *buff);
-	int (*read_resp) (struct request_buff *buff,
+	int (*read_resp) (struct request_response *response,
                           struct rc_report *report);
+        /* with batch_max > 1, the accounts with the same username and
+         * password are updated by a single make_query(), whose cfg
+         * hostname is their hostnames separated by commas. read_batch
+         * fills the report of each hostname, in the same order.
+         */
+	int (*read_batch) (struct request_response *response,
+                           struct rc_report *reports,
+                           unsigned int count);
 	struct list_head list;
 };
 
@@ -1,7 +1,11 @@
+#include <string.h>
+
 #include "services.h"
 
 #include "service.h"
 #include "list.h"
+#include "util.h"
+#include "log.h"
 
 extern struct service changeip_service;
 extern struct service dyndns_service;
@@ -11,16 +15,80 @@ extern struct service ovh_service;
 extern struct service sitelutions_service;
 extern struct service duckdns_service;
 
+/* the registry: a new service is added here only */
+static struct service * const services_registry[] = {
+        &changeip_service,
+        &dyndns_service,
+        &dyndnsit_service,
+        &noip_service,
+        &ovh_service,
+        &sitelutions_service,
+        &duckdns_service,
+};
+
 struct list_head service_list;
 
-void services_populate_list(void)
+/*
+ * Perfect hash table of the services: services_hash() puts each name
+ * in its own slot, so a lookup is one hash and one strcmp(). It's
+ * filled from the registry, a new service whose slot is already used
+ * makes services_populate_list() fail until the hash is changed.
+ */
+static struct service *services_table[SERVICES_TABLE_SIZE];
+
+int services_populate_list(void)
+{
+        struct service *service = NULL;
+        unsigned int slot;
+        size_t i;
+
+        INIT_LIST_HEAD(&service_list);
+        memset(services_table, 0, sizeof(services_table));
+
+        for(i = 0; i < ARRAY_SIZE(services_registry); ++i)
+        {
+                service = services_registry[i];
+                slot = services_hash(service->name);
+
+                if(services_table[slot] != NULL)
+                {
+                        log_critical("Services %s and %s have the same slot"
+                                     " %u in the service table",
+                                     services_table[slot]->name,
+                                     service->name, slot);
+                        return -1;
+                }
+
+                services_table[slot] = service;
+                list_add_tail(&(service->list), &service_list);
+        }
+
+        return 0;
+}
+
+unsigned int services_hash(const char *name)
 {
-	INIT_LIST_HEAD(&service_list);
-	list_add_tail( &changeip_service.list, &service_list );
-	list_add_tail( &dyndns_service.list, &service_list );
-	list_add_tail( &dyndnsit_service.list, &service_list );
-	list_add_tail( &noip_service.list, &service_list );
-	list_add_tail( &ovh_service.list, &service_list );
-	list_add_tail( &sitelutions_service.list, &service_list );
-        list_add_tail( &duckdns_service.list, &service_list );
+        size_t len = strlen(name);
+
+        if(len == 0)
+        {
+                return 0;
+        }
+
+        return (unsigned int)(len
+                              + (unsigned char)name[0]
+                              + (unsigned char)name[len - 1])
+                & (SERVICES_TABLE_SIZE - 1);
+}
+
+struct service *services_get(const char *name)
+{
+        struct service *service = services_table[services_hash(name)];
+
+        if(service != NULL && strcmp(service->name, name) == 0)
+        {
+                return service;
+        }
+
+        return NULL;
 }
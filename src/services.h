@@ -19,8 +19,28 @@
 #ifndef _YADDNS_SERVICES_H_
 #define _YADDNS_SERVICES_H_
 
+#include "list.h"
+
+/* size of the service table (a power of 2) */
+#define SERVICES_TABLE_SIZE 16
+
 extern struct list_head service_list;
 
-void services_populate_list(void);
+/*
+ * Fill the service list and table from the registry
+ *
+ * @return 0 if success, -1 if two services have the same slot
+ */
+int services_populate_list(void);
+
+/*
+ * Get the service named name, NULL if there is no such service
+ */
+struct service *services_get(const char *name);
+
+/*
+ * Slot of a service name in the service table
+ */
+unsigned int services_hash(const char *name);
 
 #endif
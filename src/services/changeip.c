@@ -25,6 +25,7 @@
 #include <netdb.h>
 
 #include "../service.h"
+#include "dyndns2.h"
 #include "../request.h"
 #include "../util.h"
 #include "../log.h"
@@ -41,7 +42,7 @@ static int ddns_write(const struct cfg_account *cfg,
                       const char * const newwanip,
                       struct request_buff *buff);
 
-static int ddns_read(struct request_buff *buff,
+static int ddns_read(struct request_response *response,
                      struct rc_report *report);
 
 struct service changeip_service = {
@@ -56,51 +57,28 @@ static int ddns_write(const struct cfg_account *cfg,
                       const char * const newwanip,
                       struct request_buff *buff)
 {
-	char buf[256];
-	char *b64_loginpass = NULL;
-	size_t b64_loginpass_size;
-	int n;
-
-	/* make the update packet */
-	snprintf(buf, sizeof(buf), "%s:%s",
-                 cfgstr_get(&(cfg->username)), cfgstr_get(&(cfg->passwd)));
-
-	if (util_base64_encode(buf, &b64_loginpass, &b64_loginpass_size) != 0)
-	{
-		/* publish_error_status ?? */
-		log_error("Unable to encode in base64");
-		return -1;
-	}
-
-	n = snprintf(buff->data, sizeof(buff->data),
-                     "GET /nic/update?hostname=%s"
-                     "&myip=%s"
-                     " HTTP/1.0\r\n"
-                     "Host: " DDNS_HOST "\r\n"
-                     "Authorization: Basic %s\r\n"
-                     "User-Agent: " PACKAGE "/" VERSION "\r\n"
-                     "Connection: close\r\n"
-                     "Pragma: no-cache\r\n\r\n",
-                     cfgstr_get(&(cfg->hostname)),
-                     newwanip,
-                     b64_loginpass);
-        if(n < 0)
+	/* make the update packet, the query line then the headers */
+	if(request_buff_printf(buff,
+                               "GET /nic/update?hostname=%s"
+                               "&myip=%s"
+                               " HTTP/1.1\r\n"
+                               "Host: " DDNS_HOST "\r\n"
+                               "Authorization: Basic ",
+                               cfgstr_get(&(cfg->hostname)),
+                               newwanip) != 0)
         {
                 log_error("Unable to write data buffer");
                 return -1;
         }
 
-	buff->data_size = (size_t)n;
-
-	free(b64_loginpass);
-
-	return 0;
+	return dyndns2_write_auth(cfg, buff);
 }
 
-static int ddns_read(struct request_buff *buff,
+static int ddns_read(struct request_response *response,
                      struct rc_report *report)
 {
-        if(strstr(buff->data, "200 Successful Update"))
+        if(response->status == 200
+           && strstr(response->reason, "Successful Update") != NULL)
 	{
                 report->code = up_success;
 
@@ -112,8 +90,7 @@ static int ddns_read(struct request_buff *buff,
                          sizeof(report->proprio_return_info),
                          "Update good and successful, IP updated.");
         }
-        else if(strstr(buff->data, "401 Access Denied")
-                || strstr(buff->data, "401 Unauthorized"))
+        else if(response->status == 401)
         {
                 report->code = up_account_error;
 
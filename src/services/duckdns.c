@@ -36,20 +36,31 @@
 #define DDNS_NAME "duckdns"
 #define DDNS_HOST "duckdns.org"
 #define DDNS_PORT 80
+#define DDNS_BATCH 20
+
+static const char ddns_headers[] =
+        "User-Agent: " PACKAGE "/" VERSION "\r\n"
+        "Pragma: no-cache\r\n\r\n";
 
 static int ddns_write(const struct cfg_account *cfg,
                       const char * const newwanip,
                       struct request_buff *buff);
 
-static int ddns_read(struct request_buff *buff,
+static int ddns_read(struct request_response *response,
                      struct rc_report *report);
 
+static int ddns_read_batch(struct request_response *response,
+                           struct rc_report *reports,
+                           unsigned int count);
+
 struct service duckdns_service = {
 	.name = DDNS_NAME,
 	.ipserv = DDNS_HOST,
 	.portserv = DDNS_PORT,
+	.batch_max = DDNS_BATCH,
 	.make_query = ddns_write,
-	.read_resp = ddns_read
+	.read_resp = ddns_read,
+	.read_batch = ddns_read_batch
 };
 
 static struct {
@@ -72,40 +83,59 @@ static int ddns_write(const struct cfg_account *cfg,
                       const char * const newwanip,
                       struct request_buff *buff)
 {
-    int n;
-
-    n = snprintf(buff->data, sizeof(buff->data),
-                 "GET /update"
-                 "?domains=%s"
-                 "&token=%s"
-                 "&ip=%s"
-                 " HTTP/1.0\r\n"
-                 "Host: " DDNS_HOST "\r\n"
-                 "User-Agent: " PACKAGE "/" VERSION "\r\n"
-                 "Connection: close\r\n"
-                 "Pragma: no-cache\r\n\r\n",
-                 cfgstr_get(&(cfg->hostname)),
-                 cfgstr_get(&(cfg->passwd)),
-                 newwanip);
-    if(n < 0)
+    /* the constant headers are given as they are */
+    if(request_buff_printf(buff,
+                           "GET /update"
+                           "?domains=%s"
+                           "&token=%s"
+                           "&ip=%s"
+                           " HTTP/1.1\r\n"
+                           "Host: " DDNS_HOST "\r\n",
+                           cfgstr_get(&(cfg->hostname)),
+                           cfgstr_get(&(cfg->passwd)),
+                           newwanip) != 0
+       || request_buff_add(buff, ddns_headers,
+                           sizeof(ddns_headers) - 1, 0) != 0)
     {
             log_error("Unable to write data buffer");
             return -1;
     }
 
-    buff->data_size = (size_t)n;
-
     return 0;
 }
 
-static int ddns_read(struct request_buff *buff,
+static int ddns_read_line(const char *line, struct rc_report *report)
+{
+	int n = 0;
+
+        for (n = 0; rc_map[n].propcode != NULL; ++n)
+        {
+                if (strstr(line, rc_map[n].propcode) != NULL)
+                {
+                        report->code = rc_map[n].code;
+
+                        snprintf(report->proprio_return,
+                                 sizeof(report->proprio_return),
+                                 "%s", rc_map[n].propcode);
+
+                        snprintf(report->proprio_return_info,
+                                 sizeof(report->proprio_return_info),
+                                 "%s", rc_map[n].propcode_info);
+
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+static int ddns_read(struct request_response *response,
                      struct rc_report *report)
 {
         char *str = NULL, *token = NULL, *saveptr = NULL;
 	int found = 0;
-	int n = 0;
 
-        for(str = buff->data;; str = NULL)
+        for(str = response->body;; str = NULL)
         {
                token = strtok_r(str, "\n", &saveptr);
                if(token == NULL)
@@ -113,23 +143,9 @@ static int ddns_read(struct request_buff *buff,
                        break;
                }
 
-               for (n = 0; rc_map[n].propcode != NULL; ++n)
+               if(ddns_read_line(token, report))
                {
-                       if (strstr(token, rc_map[n].propcode) != NULL)
-                       {
-                               report->code = rc_map[n].code;
-
-                               snprintf(report->proprio_return,
-                                        sizeof(report->proprio_return),
-                                        "%s", rc_map[n].propcode);
-
-                               snprintf(report->proprio_return_info,
-                                        sizeof(report->proprio_return_info),
-                                        "%s", rc_map[n].propcode_info);
-
-                               found = 1;
-                               break;
-                       }
+                       found = 1;
                }
         }
 
@@ -150,3 +166,20 @@ static int ddns_read(struct request_buff *buff,
 
 	return 0;
 }
+
+static int ddns_read_batch(struct request_response *response,
+                           struct rc_report *reports,
+                           unsigned int count)
+{
+        unsigned int i;
+
+        /* a single OK or KO for all the domains */
+        ddns_read(response, &(reports[0]));
+
+        for(i = 1; i < count; ++i)
+        {
+                memcpy(&(reports[i]), &(reports[0]), sizeof(reports[0]));
+        }
+
+	return 0;
+}
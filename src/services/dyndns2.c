@@ -0,0 +1,191 @@
+/*
+ *  Yaddns - Yet Another ddns client
+ *  Copyright (C) 2008 Anthony Viallard <anthony.viallard@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dyndns2.h"
+#include "../util.h"
+#include "../log.h"
+
+static const char dyndns2_headers[] =
+        "\r\n" /* end of the Authorization header */
+        "User-Agent: " PACKAGE "/" VERSION "\r\n"
+        "Pragma: no-cache\r\n\r\n";
+
+static void dyndns2_unknown(struct rc_report *report, const char *info)
+{
+        report->code = up_unknown_error;
+        report->retry_after = 0;
+
+        snprintf(report->proprio_return,
+                 sizeof(report->proprio_return),
+                 "unknown");
+
+        snprintf(report->proprio_return_info,
+                 sizeof(report->proprio_return_info),
+                 "%s", info);
+}
+
+static const struct dyndns2_rc *dyndns2_read_line(const struct dyndns2_rc *map,
+                                                  const char *line,
+                                                  struct rc_report *report)
+{
+	int n = 0;
+
+        for (n = 0; map[n].propcode != NULL; ++n)
+        {
+                if (strstr(line, map[n].propcode) != NULL)
+                {
+                        report->code = map[n].code;
+                        report->retry_after = map[n].wait;
+
+                        snprintf(report->proprio_return,
+                                 sizeof(report->proprio_return),
+                                 "%s", map[n].propcode);
+
+                        snprintf(report->proprio_return_info,
+                                 sizeof(report->proprio_return_info),
+                                 "%s", map[n].propcode_info);
+
+                        return &(map[n]);
+                }
+        }
+
+        return NULL;
+}
+
+int dyndns2_write_auth(const struct cfg_account *cfg,
+                       struct request_buff *buff)
+{
+	char buf[256];
+	char *b64_loginpass = NULL;
+	size_t b64_loginpass_size;
+
+	snprintf(buf, sizeof(buf), "%s:%s",
+                 cfgstr_get(&(cfg->username)), cfgstr_get(&(cfg->passwd)));
+
+	if (util_base64_encode(buf, &b64_loginpass, &b64_loginpass_size) != 0)
+	{
+		log_error("Unable to encode in base64");
+		return -1;
+	}
+
+	/* the credentials encoded above and the constant headers are
+	 * given as they are
+	 */
+	if(request_buff_add(buff, b64_loginpass,
+                            strlen(b64_loginpass), 1) != 0
+           || request_buff_add(buff, dyndns2_headers,
+                               sizeof(dyndns2_headers) - 1, 0) != 0)
+        {
+                log_error("Unable to write data buffer");
+                return -1;
+        }
+
+	return 0;
+}
+
+int dyndns2_read(const struct dyndns2_rc *map,
+                 struct request_response *response,
+                 struct rc_report *report)
+{
+        char *str = NULL, *token = NULL, *saveptr = NULL;
+	int found = 0;
+
+        for(str = response->body;; str = NULL)
+        {
+               token = strtok_r(str, "\n", &saveptr);
+               if(token == NULL)
+               {
+                       break;
+               }
+
+               if(dyndns2_read_line(map, token, report) != NULL)
+               {
+                       found = 1;
+               }
+        }
+
+        if(!found)
+        {
+                log_error("Unknown return message received.");
+                dyndns2_unknown(report, "Unknown return message received");
+        }
+
+	return 0;
+}
+
+int dyndns2_read_batch(const struct dyndns2_rc *map,
+                       struct request_response *response,
+                       struct rc_report *reports,
+                       unsigned int count)
+{
+        const struct dyndns2_rc *first = NULL, *match = NULL;
+        char *str = NULL, *token = NULL, *saveptr = NULL;
+        unsigned int i = 0;
+
+        /* a line by hostname, in the order of the query */
+        for(str = response->body; i < count; str = NULL)
+        {
+               token = strtok_r(str, "\n", &saveptr);
+               if(token == NULL)
+               {
+                       break;
+               }
+
+               match = dyndns2_read_line(map, token, &(reports[i]));
+               if(match == NULL)
+               {
+                       log_error("Unknown return message received.");
+                       dyndns2_unknown(&(reports[i]),
+                                       "Unknown return message received");
+               }
+
+               if(i == 0)
+               {
+                       first = match;
+               }
+
+               ++i;
+        }
+
+        /* a single line of a whole query code is for all the hostnames */
+        if(i == 1 && first != NULL && first->whole)
+        {
+                for(; i < count; ++i)
+                {
+                        memcpy(&(reports[i]), &(reports[0]),
+                               sizeof(reports[0]));
+                }
+        }
+
+        if(i < count)
+        {
+                log_error("No return message for %u of %u hostnames.",
+                          count - i, count);
+        }
+
+        for(; i < count; ++i)
+        {
+                dyndns2_unknown(&(reports[i]), "No return message received");
+        }
+
+	return 0;
+}
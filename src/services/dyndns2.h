@@ -0,0 +1,68 @@
+/*
+ *  Yaddns - Yet Another ddns client
+ *  Copyright (C) 2008 Anthony Viallard <anthony.viallard@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _YADDNS_SERVICES_DYNDNS2_H_
+#define _YADDNS_SERVICES_DYNDNS2_H_
+
+#include "../service.h"
+#include "../request.h"
+
+/*
+ * The dyndns2 protocol (/nic/update) shared by several services:
+ * a return code by line, a line by hostname of the query.
+ */
+
+struct dyndns2_rc {
+	const char *propcode;
+	const char *propcode_info;
+	int code;
+	unsigned int wait; /* s before retrying */
+	int whole; /* answered once for the whole query (badauth, ...) */
+};
+
+/*
+ * Add the credentials of cfg and the constant headers to buff, after
+ * the query line and headers ending with "Authorization: Basic "
+ *
+ * @return 0 if success, -1 otherwise
+ */
+int dyndns2_write_auth(const struct cfg_account *cfg,
+                       struct request_buff *buff);
+
+/*
+ * Fill report from the return codes of map found in response
+ *
+ * @return 0
+ */
+int dyndns2_read(const struct dyndns2_rc *map,
+                 struct request_response *response,
+                 struct rc_report *report);
+
+/*
+ * Fill the report of each hostname of the query from its line. A single
+ * line of a whole query code is for all the hostnames, the hostnames
+ * without a line have an unknown error.
+ *
+ * @return 0
+ */
+int dyndns2_read_batch(const struct dyndns2_rc *map,
+                       struct request_response *response,
+                       struct rc_report *reports,
+                       unsigned int count);
+
+#endif
@@ -25,6 +25,7 @@
 #include <netdb.h>
 
 #include "../service.h"
+#include "dyndns2.h"
 #include "../request.h"
 #include "../util.h"
 #include "../log.h"
@@ -36,30 +37,35 @@
 #define DDNS_NAME "dyndnsit"
 #define DDNS_HOST "streamer.net"
 #define DDNS_PORT 80
+#define DDNS_BATCH 20
+#define DDNS_WAIT 1800 /* after a server error */
 
 static int ddns_write(const struct cfg_account *cfg,
                       const char * const newwanip,
                       struct request_buff *buff);
 
-static int ddns_read(struct request_buff *buff,
+static int ddns_read(struct request_response *response,
                      struct rc_report *report);
 
+static int ddns_read_batch(struct request_response *response,
+                           struct rc_report *reports,
+                           unsigned int count);
+
 struct service dyndnsit_service = {
 	.name = DDNS_NAME,
 	.ipserv = DDNS_HOST,
 	.portserv = DDNS_PORT,
+	.batch_max = DDNS_BATCH,
 	.make_query = ddns_write,
-	.read_resp = ddns_read
+	.read_resp = ddns_read,
+	.read_batch = ddns_read_batch
 };
 
-static struct {
-	const char *propcode;
-	const char *propcode_info;
-	int code;
-} rc_map[] = {
+static const struct dyndns2_rc rc_map[] = {
 	{ .propcode = "badauth",
 	  .propcode_info = "Bad authorization (username or password).",
 	  .code = up_account_loginpass_error,
+          .whole = 1,
         },
 	{ .propcode = "badsys",
           .propcode_info = "The system parameter given was not valid.",
@@ -84,6 +90,7 @@ static struct {
 	{ .propcode = "!donator",
           .propcode_info = "The offline setting was set, when the user is not a donator.",
           .code = up_account_error,
+          .whole = 1,
         },
 	{ .propcode = "!yours",
           .propcode_info = "The hostname specified exists, but not under the username currently being used.",
@@ -92,6 +99,7 @@ static struct {
 	{ .propcode = "abuse",
           .propcode_info = "The hostname specified is blocked for abuse",
 	  .code = up_account_abuse_error,
+          .whole = 1,
         },
 	{ .propcode = "notfqdn",
           .propcode_info = "No hosts are given.",
@@ -104,109 +112,48 @@ static struct {
 	{ .propcode = "dnserr",
           .propcode_info = "DNS error encountered.",
           .code = up_server_error,
+          .wait = DDNS_WAIT,
         },
 	{ .propcode = "911",
           .propcode_info = "911 error encountered.",
           .code = up_server_error,
+          .wait = DDNS_WAIT,
+          .whole = 1,
         },
-	{ NULL,	NULL, 0, }
+	{ NULL,	NULL, 0, 0, 0, }
 };
 
 static int ddns_write(const struct cfg_account *cfg,
                       const char * const newwanip,
                       struct request_buff *buff)
 {
-	char buf[256];
-	char *b64_loginpass = NULL;
-	size_t b64_loginpass_size;
-	int n;
-
-	/* make the update packet */
-	snprintf(buf, sizeof(buf), "%s:%s",
-                 cfgstr_get(&(cfg->username)), cfgstr_get(&(cfg->passwd)));
-
-	if (util_base64_encode(buf, &b64_loginpass, &b64_loginpass_size) != 0)
-	{
-		/* publish_error_status ?? */
-		log_error("Unable to encode in base64");
-		return -1;
-	}
-
-	n = snprintf(buff->data, sizeof(buff->data),
-                     "GET /nic/update?system=dyndns"
-                     "&hostname=%s"
-                     "&myip=%s"
-                     " HTTP/1.0\r\n"
-                     "Host: " DDNS_HOST "\r\n"
-                     "Authorization: Basic %s\r\n"
-                     "User-Agent: " PACKAGE "/" VERSION "\r\n"
-                     "Connection: close\r\n"
-                     "Pragma: no-cache\r\n\r\n",
-                     cfgstr_get(&(cfg->hostname)),
-                     newwanip,
-                     b64_loginpass);
-        if(n < 0)
+	/* make the update packet, the query line then the headers */
+	if(request_buff_printf(buff,
+                               "GET /nic/update?system=dyndns"
+                               "&hostname=%s"
+                               "&myip=%s"
+                               " HTTP/1.1\r\n"
+                               "Host: " DDNS_HOST "\r\n"
+                               "Authorization: Basic ",
+                               cfgstr_get(&(cfg->hostname)),
+                               newwanip) != 0)
         {
                 log_error("Unable to write data buffer");
                 return -1;
         }
 
-	buff->data_size = (size_t)n;
-
-	free(b64_loginpass);
-
-	return 0;
+	return dyndns2_write_auth(cfg, buff);
 }
 
-static int ddns_read(struct request_buff *buff,
+static int ddns_read(struct request_response *response,
                      struct rc_report *report)
 {
-        char *str = NULL, *token = NULL, *saveptr = NULL;
-	int found = 0;
-	int n = 0;
-
-        for(str = buff->data;; str = NULL)
-        {
-               token = strtok_r(str, "\n", &saveptr);
-               if(token == NULL)
-               {
-                       break;
-               }
-
-               for (n = 0; rc_map[n].propcode != NULL; ++n)
-               {
-                       if (strstr(token, rc_map[n].propcode) != NULL)
-                       {
-                               report->code = rc_map[n].code;
-
-                               snprintf(report->proprio_return,
-                                        sizeof(report->proprio_return),
-                                        "%s", rc_map[n].propcode);
-
-                               snprintf(report->proprio_return_info,
-                                        sizeof(report->proprio_return_info),
-                                        "%s", rc_map[n].propcode_info);
-
-                               found = 1;
-                               break;
-                       }
-               }
-        }
-
-        if(!found)
-        {
-                log_error("Unknown return message received.");
-
-                report->code = up_unknown_error;
-
-                snprintf(report->proprio_return,
-                         sizeof(report->proprio_return),
-                         "unknown");
-
-                snprintf(report->proprio_return_info,
-                         sizeof(report->proprio_return_info),
-                         "Unknown return message received");
-        }
+        return dyndns2_read(rc_map, response, report);
+}
 
-	return 0;
+static int ddns_read_batch(struct request_response *response,
+                           struct rc_report *reports,
+                           unsigned int count)
+{
+        return dyndns2_read_batch(rc_map, response, reports, count);
 }
@@ -37,11 +37,15 @@
 #define DDNS_HOST "www.sitelutions.com"
 #define DDNS_PORT 80
 
+static const char ddns_headers[] =
+        "User-Agent: " PACKAGE "/" VERSION "\r\n"
+        "Pragma: no-cache\r\n\r\n";
+
 static int ddns_write(const struct cfg_account *cfg,
                       const char * const newwanip,
                       struct request_buff *buff);
 
-static int ddns_read(struct request_buff *buff,
+static int ddns_read(struct request_response *response,
                      struct rc_report *report);
 
 struct service sitelutions_service = {
@@ -92,42 +96,38 @@ static int ddns_write(const struct cfg_account *cfg,
                       const char * const newwanip,
                       struct request_buff *buff)
 {
-	int n;
-
-	/* make the update packet */
-	n = snprintf(buff->data, sizeof(buff->data),
-                     "GET /dnsup?id=%s"
-                     "&user=%s"
-                     "&pass=%s"
-                     "&ip=%s"
-                     " HTTP/1.0\r\n"
-                     "Host: " DDNS_HOST "\r\n"
-                     "User-Agent: " PACKAGE "/" VERSION "\r\n"
-                     "Connection: close\r\n"
-                     "Pragma: no-cache\r\n\r\n",
-                     cfgstr_get(&(cfg->hostname)),
-                     cfgstr_get(&(cfg->username)),
-                     cfgstr_get(&(cfg->passwd)),
-                     newwanip);
-        if(n < 0)
+	/* make the update packet, the constant headers are given as
+	 * they are
+	 */
+	if(request_buff_printf(buff,
+                               "GET /dnsup?id=%s"
+                               "&user=%s"
+                               "&pass=%s"
+                               "&ip=%s"
+                               " HTTP/1.1\r\n"
+                               "Host: " DDNS_HOST "\r\n",
+                               cfgstr_get(&(cfg->hostname)),
+                               cfgstr_get(&(cfg->username)),
+                               cfgstr_get(&(cfg->passwd)),
+                               newwanip) != 0
+           || request_buff_add(buff, ddns_headers,
+                               sizeof(ddns_headers) - 1, 0) != 0)
         {
                 log_error("Unable to write data buffer");
                 return -1;
         }
 
-	buff->data_size = (size_t)n;
-
 	return 0;
 }
 
-static int ddns_read(struct request_buff *buff,
+static int ddns_read(struct request_response *response,
                      struct rc_report *report)
 {
         char *str = NULL, *token = NULL, *saveptr = NULL;
 	int found = 0;
 	int n = 0;
 
-        for(str = buff->data;; str = NULL)
+        for(str = response->body;; str = NULL)
         {
                token = strtok_r(str, "\n", &saveptr);
                if(token == NULL)
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include "state.h"
+#include "account.h"
+#include "log.h"
+
+#define STATE_VERSION "yaddns-state 1"
+
+/*
+ * sync the directory of file, so that a rename in it survives a power
+ * loss
+ */
+static int state_sync_dir(const char *file)
+{
+        char dir[1024];
+        const char *slash = strrchr(file, '/');
+        int fd, ret = 0;
+
+        if(slash == NULL)
+        {
+                strcpy(dir, ".");
+        }
+        else if(slash == file)
+        {
+                strcpy(dir, "/");
+        }
+        else
+        {
+                snprintf(dir, sizeof(dir), "%.*s", (int)(slash - file), file);
+        }
+
+        fd = open(dir, O_RDONLY | O_DIRECTORY);
+        if(fd < 0)
+        {
+                log_error("Unable to open directory %s: %s",
+                          dir, strerror(errno));
+                return -1;
+        }
+
+        /* not every file system can sync a directory */
+        if(fsync(fd) != 0 && errno != EINVAL)
+        {
+                log_error("Unable to sync directory %s: %s",
+                          dir, strerror(errno));
+                ret = -1;
+        }
+
+        close(fd);
+
+        return ret;
+}
+
+int state_save(const char *file)
+{
+        struct account_state state;
+        struct account *account = NULL;
+        char tmpfile[1024];
+        char buf_ip[INET_ADDRSTRLEN];
+        FILE *fp = NULL;
+        int ret = 0;
+
+        if(snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", file)
+           >= (int)sizeof(tmpfile))
+        {
+                log_error("State file name %s too long", file);
+                return -1;
+        }
+
+        fp = fopen(tmpfile, "w");
+        if(fp == NULL)
+        {
+                log_error("Unable to write state file %s: %s",
+                          tmpfile, strerror(errno));
+                return -1;
+        }
+
+        fprintf(fp, STATE_VERSION "\n");
+
+        list_for_each_entry(account, &account_list, list)
+        {
+                account_getstate(account, &state);
+                inet_ntop(AF_INET, &(state.ip), buf_ip, sizeof(buf_ip));
+
+                fprintf(fp, "%016" PRIx64 " %s %lld %lld %u %d %s\n",
+                        state.fingerprint, buf_ip,
+                        (long long)state.updated_at,
+                        (long long)state.freezed_until,
+                        state.attempts, state.locked,
+                        cfgstr_get(&(account->cfg->name)));
+        }
+
+        if(fflush(fp) != 0 || fsync(fileno(fp)) != 0 || ferror(fp))
+        {
+                log_error("Unable to write state file %s: %s",
+                          tmpfile, strerror(errno));
+                ret = -1;
+        }
+
+        if(fclose(fp) != 0)
+        {
+                ret = -1;
+        }
+
+        if(ret == 0 && rename(tmpfile, file) != 0)
+        {
+                log_error("Unable to rename %s to %s: %s",
+                          tmpfile, file, strerror(errno));
+                ret = -1;
+        }
+
+        if(ret != 0)
+        {
+                unlink(tmpfile);
+        }
+        else
+        {
+                ret = state_sync_dir(file);
+        }
+
+        return ret;
+}
+
+int state_load(const char *file)
+{
+        struct account_state state;
+        struct account *account = NULL;
+        char buffer[1024];
+        char buf_ip[INET_ADDRSTRLEN];
+        long long updated_at, freezed_until;
+        char *name = NULL, *end = NULL;
+        FILE *fp = NULL;
+        int count = 0;
+        int linenum = 1;
+        int n = 0;
+
+        fp = fopen(file, "r");
+        if(fp == NULL)
+        {
+                if(errno != ENOENT)
+                {
+                        log_error("Unable to read state file %s: %s",
+                                  file, strerror(errno));
+                }
+                return -1;
+        }
+
+        if(fgets(buffer, sizeof(buffer), fp) == NULL
+           || strcmp(buffer, STATE_VERSION "\n") != 0)
+        {
+                log_warning("State file %s of an unknown version, ignored",
+                            file);
+                fclose(fp);
+                return -1;
+        }
+
+        while(fgets(buffer, sizeof(buffer), fp) != NULL)
+        {
+                ++linenum;
+
+                end = strchr(buffer, '\n');
+                if(end != NULL)
+                {
+                        *end = '\0';
+                }
+
+                memset(&state, 0, sizeof(state));
+                n = 0;
+                if(sscanf(buffer, "%" SCNx64 " %15s %lld %lld %u %d %n",
+                          &(state.fingerprint), buf_ip,
+                          &updated_at, &freezed_until,
+                          &(state.attempts), &(state.locked), &n) != 6
+                   || n == 0
+                   || inet_pton(AF_INET, buf_ip, &(state.ip)) != 1)
+                {
+                        log_warning("Invalid line %d of state file %s",
+                                    linenum, file);
+                        continue;
+                }
+
+                name = buffer + n;
+                account = account_ctl_get(name);
+                if(account == NULL
+                   || account->cfg->fingerprint != state.fingerprint)
+                {
+                        /* removed or changed since */
+                        continue;
+                }
+
+                state.updated_at = (time_t)updated_at;
+                state.freezed_until = (time_t)freezed_until;
+                account_setstate(account, &state);
+                ++count;
+        }
+
+        fclose(fp);
+
+        log_notice("State of %d accounts restored from %s", count, file);
+
+        return count;
+}
@@ -0,0 +1,51 @@
+/*
+ *  Yaddns - Yet Another ddns client
+ *  Copyright (C) 2008 Anthony Viallard <anthony.viallard@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _YADDNS_STATE_H_
+#define _YADDNS_STATE_H_
+
+/*
+ * This module keeps the state of the accounts across restarts, so
+ * that a restart doesn't update again all the accounts. The state
+ * file has a version line then a line by account:
+ *
+ *   <fingerprint> <ip> <updated_at> <freezed_until> <attempts> <locked> <name>
+ *
+ * The fingerprint (hex) is the one of the account cfg: the state of
+ * an account whose cfg has changed is ignored. The times are unix
+ * times, 0 if none.
+ *
+ * The file is written in a temporary file, synced then renamed over
+ * the old one: a crash leaves either the old or the new state.
+ */
+
+/*
+ * Write the state of the accounts in file
+ *
+ * @return 0 if success, -1 otherwise
+ */
+extern int state_save(const char *file);
+
+/*
+ * Restore the state of the mapped accounts from file
+ *
+ * @return count of accounts restored, -1 if file can't be read
+ */
+extern int state_load(const char *file);
+
+#endif
@@ -0,0 +1,546 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "stun.h"
+
+#include "util.h"
+#include "log.h"
+
+/* RFC 5389 */
+#define STUN_MAGIC_COOKIE 0x2112A442U
+#define STUN_BINDING_REQUEST 0x0001
+#define STUN_BINDING_SUCCESS 0x0101
+#define STUN_BINDING_ERROR 0x0111
+#define STUN_ATTR_MAPPED_ADDRESS 0x0001
+#define STUN_ATTR_ERROR_CODE 0x0009
+#define STUN_ATTR_XOR_MAPPED_ADDRESS 0x0020
+#define STUN_FAMILY_IPV4 0x01
+#define STUN_FAMILY_IPV6 0x02
+
+/* transmissions of a request, and wait after the last one (in first
+ * rto) before the server is given up (RFC 5389 7.2.1)
+ */
+#define STUN_RC 7
+#define STUN_RM 16
+
+/* a response over udp without fragmentation */
+#define STUN_MSG_MAX 576
+
+static uint16_t stun_get16(const uint8_t *p)
+{
+        return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t stun_get32(const uint8_t *p)
+{
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+                | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void stun_put16(uint8_t *p, uint16_t v)
+{
+        p[0] = (uint8_t)(v >> 8);
+        p[1] = (uint8_t)v;
+}
+
+static void stun_put32(uint8_t *p, uint32_t v)
+{
+        p[0] = (uint8_t)(v >> 24);
+        p[1] = (uint8_t)(v >> 16);
+        p[2] = (uint8_t)(v >> 8);
+        p[3] = (uint8_t)v;
+}
+
+/*
+ * a new transaction id, random so that the answers can't be guessed
+ */
+static void stun_tid(uint8_t tid[STUN_TID_SIZE])
+{
+        static uint32_t state = 0;
+        size_t i;
+        int fd;
+
+        fd = open("/dev/urandom", O_RDONLY);
+        if(fd >= 0)
+        {
+                if(read(fd, tid, STUN_TID_SIZE) == STUN_TID_SIZE)
+                {
+                        close(fd);
+                        return;
+                }
+                close(fd);
+        }
+
+        /* xorshift32 */
+        if(state == 0)
+        {
+                state = ((uint32_t)util_getuptime_ms() ^ (uint32_t)getpid());
+                state = (state != 0 ? state : 0x2545f491);
+        }
+
+        for(i = 0; i < STUN_TID_SIZE; ++i)
+        {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                tid[i] = (uint8_t)(state >> 8);
+        }
+}
+
+/*
+ * read a (xor) mapped address, key is the magic cookie then the
+ * transaction id if xored
+ */
+static int stun_address(const uint8_t *value, size_t len,
+                        const uint8_t *key, struct stun_mapped *mapped)
+{
+        uint8_t addr[16];
+        size_t addrlen, i;
+
+        if(len < 4)
+        {
+                return -1;
+        }
+
+        switch(value[1])
+        {
+        case STUN_FAMILY_IPV4:
+                mapped->family = AF_INET;
+                addrlen = 4;
+                break;
+        case STUN_FAMILY_IPV6:
+                mapped->family = AF_INET6;
+                addrlen = 16;
+                break;
+        default:
+                return -1;
+        }
+
+        if(len != 4 + addrlen)
+        {
+                return -1;
+        }
+
+        mapped->port = stun_get16(value + 2);
+
+        for(i = 0; i < addrlen; ++i)
+        {
+                addr[i] = (uint8_t)(value[4 + i] ^ (key != NULL ? key[i] : 0));
+        }
+
+        if(key != NULL)
+        {
+                mapped->port = (unsigned short int)
+                        (mapped->port ^ (STUN_MAGIC_COOKIE >> 16));
+        }
+
+        if(mapped->family == AF_INET)
+        {
+                memcpy(&(mapped->v4), addr, addrlen);
+        }
+        else
+        {
+                memcpy(&(mapped->v6), addr, addrlen);
+        }
+
+        return 0;
+}
+
+size_t stun_request(uint8_t *buf, size_t size,
+                    const uint8_t tid[STUN_TID_SIZE])
+{
+        if(size < STUN_HEADER_SIZE)
+        {
+                return 0;
+        }
+
+        /* no attribute */
+        stun_put16(buf, STUN_BINDING_REQUEST);
+        stun_put16(buf + 2, 0);
+        stun_put32(buf + 4, STUN_MAGIC_COOKIE);
+        memcpy(buf + 8, tid, STUN_TID_SIZE);
+
+        return STUN_HEADER_SIZE;
+}
+
+int stun_parse(const uint8_t *buf, size_t len,
+               const uint8_t tid[STUN_TID_SIZE],
+               struct stun_mapped *mapped)
+{
+        const uint8_t *value = NULL;
+        uint16_t type, attr_type;
+        size_t off, attr_len;
+        int found = 0;              /* 1: mapped, 2: xor mapped */
+
+        /* a response of the transaction */
+        if(len < STUN_HEADER_SIZE
+           || (buf[0] & 0xc0) != 0
+           || stun_get32(buf + 4) != STUN_MAGIC_COOKIE
+           || memcmp(buf + 8, tid, STUN_TID_SIZE) != 0
+           || (size_t)stun_get16(buf + 2) + STUN_HEADER_SIZE != len
+           || (len & 0x03) != 0)
+        {
+                return -1;
+        }
+
+        type = stun_get16(buf);
+        if(type != STUN_BINDING_SUCCESS && type != STUN_BINDING_ERROR)
+        {
+                return -1;
+        }
+
+        for(off = STUN_HEADER_SIZE; off + 4 <= len;
+            off += 4 + ((attr_len + 3) & ~(size_t)3))
+        {
+                attr_type = stun_get16(buf + off);
+                attr_len = stun_get16(buf + off + 2);
+                value = buf + off + 4;
+
+                if(off + 4 + attr_len > len)
+                {
+                        return -1;
+                }
+
+                if(type == STUN_BINDING_ERROR)
+                {
+                        if(attr_type == STUN_ATTR_ERROR_CODE && attr_len >= 4)
+                        {
+                                log_error("Stun error %d: %.*s",
+                                          (value[2] & 0x07) * 100 + value[3],
+                                          (int)(attr_len - 4),
+                                          (const char *)(value + 4));
+                                return 1;
+                        }
+
+                        continue;
+                }
+
+                switch(attr_type)
+                {
+                case STUN_ATTR_XOR_MAPPED_ADDRESS:
+                        /* xored with the cookie and the transaction id */
+                        if(stun_address(value, attr_len, buf + 4,
+                                        mapped) != 0)
+                        {
+                                return 1;
+                        }
+                        found = 2;
+                        break;
+                case STUN_ATTR_MAPPED_ADDRESS:
+                        /* an old server (RFC 3489), unless there is a
+                         * xored one
+                         */
+                        if(found == 0)
+                        {
+                                if(stun_address(value, attr_len, NULL,
+                                                mapped) != 0)
+                                {
+                                        return 1;
+                                }
+                                found = 1;
+                        }
+                        break;
+                default:
+                        /* the comprehension-required ones must be
+                         * understood
+                         */
+                        if(attr_type < 0x8000)
+                        {
+                                log_error("Unknown attribute 0x%04x in"
+                                          " stun response", attr_type);
+                                return 1;
+                        }
+                        break;
+                }
+        }
+
+        if(type == STUN_BINDING_ERROR)
+        {
+                log_error("Stun error without code");
+                return 1;
+        }
+
+        if(!found)
+        {
+                log_error("No mapped address in stun response");
+                return 1;
+        }
+
+        return 0;
+}
+
+static void stun_close(struct stun *stun)
+{
+        resolv_query_cancel(&(stun->query));
+        timer_stop(&(stun->rtx));
+
+        if(stun->s >= 0)
+        {
+                loop_watch_del(&(stun->watch));
+                close(stun->s);
+                stun->s = -1;
+        }
+}
+
+/*
+ * the server asked failed: the next one is asked, the round fails
+ * once all of them failed
+ */
+static void stun_fail(struct stun *stun)
+{
+        stun_close(stun);
+
+        if(stun->src.next < stun->count)
+        {
+                wanip_next(&(stun->src));
+                return;
+        }
+
+        wanip_error(&(stun->src), 0);
+}
+
+static void stun_accept(struct stun *stun, const struct stun_mapped *mapped)
+{
+        int nat = (mapped->v4.s_addr != stun->local.sin_addr.s_addr
+                   || mapped->port != ntohs(stun->local.sin_port));
+
+        if(nat != stun->nat)
+        {
+                log_info("The wan is %s a NAT (stun server %s)",
+                         (nat ? "behind" : "not behind"), stun->query.host);
+                stun->nat = nat;
+        }
+
+        stun_close(stun);
+
+        wanip_accept(&(stun->src), &(mapped->v4));
+}
+
+static void stun_transmit(struct stun *stun)
+{
+        uint8_t buf[STUN_HEADER_SIZE];
+        size_t len = stun_request(buf, sizeof(buf), stun->tid);
+
+        if(send(stun->s, buf, len, 0) < 0)
+        {
+                log_error("Unable to send to stun server %s: %s",
+                          stun->query.host, strerror(errno));
+                stun_fail(stun);
+                return;
+        }
+
+        /* the rto doubles at each transmission */
+        ++(stun->transmits);
+        timer_start(&(stun->rtx),
+                    (stun->transmits < STUN_RC
+                     ? stun->rto << (stun->transmits - 1)
+                     : stun->rto * STUN_RM));
+}
+
+static void stun_rtx_cb(struct timer *timer, void *data)
+{
+        struct stun *stun = data;
+
+        UNUSED(timer);
+
+        if(stun->transmits >= STUN_RC)
+        {
+                log_error("No answer of stun server %s", stun->query.host);
+                stun_fail(stun);
+                return;
+        }
+
+        stun_transmit(stun);
+}
+
+static void stun_watch_cb(struct loop_watch *watch, unsigned int revents)
+{
+        struct stun *stun = watch->data;
+        struct stun_mapped mapped;
+        uint8_t buf[STUN_MSG_MAX];
+        ssize_t n;
+        int ret;
+
+        UNUSED(revents);
+
+        for(;;)
+        {
+                n = recv(stun->s, buf, sizeof(buf), 0);
+                if(n < 0)
+                {
+                        if(errno == EAGAIN || errno == EWOULDBLOCK
+                           || errno == EINTR)
+                        {
+                                return;
+                        }
+
+                        /* port unreachable */
+                        log_error("Unable to reach stun server %s: %s",
+                                  stun->query.host, strerror(errno));
+                        stun_fail(stun);
+                        return;
+                }
+
+                /* the strays are ignored */
+                ret = stun_parse(buf, (size_t)n, stun->tid, &mapped);
+                if(ret < 0)
+                {
+                        continue;
+                }
+
+                if(ret == 0 && mapped.family != AF_INET)
+                {
+                        /* the services take ipv4 */
+                        log_error("Stun server %s gave an ipv6 address",
+                                  stun->query.host);
+                        ret = 1;
+                }
+
+                if(ret != 0)
+                {
+                        stun_fail(stun);
+                }
+                else
+                {
+                        stun_accept(stun, &mapped);
+                }
+
+                return;
+        }
+}
+
+/*
+ * the udp socket to the server, from bind_addr if set
+ */
+static int stun_open(struct stun *stun, const struct sockaddr_in *server)
+{
+        struct sockaddr_in addr;
+        socklen_t addrlen = sizeof(addr);
+
+        stun->s = socket(AF_INET, SOCK_DGRAM, 0);
+        if(stun->s < 0)
+        {
+                log_error("Unable to open stun socket: %s", strerror(errno));
+                return -1;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr = stun->bind_addr;
+
+        if(fcntl(stun->s, F_SETFL, O_NONBLOCK) < 0
+           || (stun->bind_addr.s_addr != INADDR_ANY
+               && bind(stun->s, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+           || connect(stun->s, (const struct sockaddr *)server,
+                      sizeof(struct sockaddr_in)) < 0
+           || getsockname(stun->s, (struct sockaddr *)&(stun->local),
+                          &addrlen) < 0
+           || loop_watch_add(&(stun->watch), stun->s, LOOP_READ) != 0)
+        {
+                log_error("Unable to open stun socket to %s: %s",
+                          stun->query.host, strerror(errno));
+                close(stun->s);
+                stun->s = -1;
+                return -1;
+        }
+
+        return 0;
+}
+
+static void stun_resolv_cb(struct resolv_query *query,
+                           const struct resolv_result *result,
+                           void *data)
+{
+        struct stun *stun = data;
+        size_t i;
+
+        if(result->err != RESOLV_ERR_OK)
+        {
+                log_error("Unable to resolve stun server %s: %s",
+                          query->host, strresolverr(result->err));
+                stun_fail(stun);
+                return;
+        }
+
+        for(i = 0; i < result->count; ++i)
+        {
+                if(result->addrs[i].ss_family == AF_INET)
+                {
+                        break;
+                }
+        }
+
+        if(i == result->count
+           || stun_open(stun,
+                        (const struct sockaddr_in *)&(result->addrs[i])) != 0)
+        {
+                stun_fail(stun);
+                return;
+        }
+
+        stun_transmit(stun);
+}
+
+/*
+ * ask the next server of the round
+ */
+static void stun_send(struct wanip *wanip, const void *cfg,
+                      const struct in_addr *bind_addr)
+{
+        struct stun *stun = CONTAINER_OF(wanip, struct stun, src);
+        const struct cfg_stun *cfg_stun = cfg;
+        const struct cfg_stun_server *server = NULL;
+
+        if(wanip->next == 0)
+        {
+                stun->count = MIN(cfg_stun->count, (unsigned int)CFG_STUN_MAX);
+                stun->rto = cfg_stun->rto;
+                wanip->upint = cfg_stun->upint;
+        }
+
+        if(stun->count == 0)
+        {
+                wanip_error(wanip, 0);
+                return;
+        }
+
+        server = &(cfg_stun->server[wanip->next++]);
+
+        stun->bind_addr.s_addr = (bind_addr != NULL
+                                  ? bind_addr->s_addr : INADDR_ANY);
+        stun->transmits = 0;
+        stun_tid(stun->tid);
+
+        if(resolv_query_start(&(stun->query), cfgstr_get(&(server->host)),
+                              server->port, AF_INET, stun_resolv_cb,
+                              stun) != 0)
+        {
+                stun_fail(stun);
+        }
+}
+
+static void stun_cancel(struct wanip *wanip)
+{
+        stun_close(CONTAINER_OF(wanip, struct stun, src));
+}
+
+static const struct wanip_ops stun_ops = {
+        .send = stun_send,
+        .cancel = stun_cancel,
+};
+
+void stun_init(struct stun *stun)
+{
+        memset(stun, 0, sizeof(struct stun));
+        wanip_init(&(stun->src), &stun_ops);
+        stun->nat = -1;
+        stun->s = -1;
+        timer_init(&(stun->rtx), stun_rtx_cb, stun);
+        loop_watch_init(&(stun->watch), stun_watch_cb, stun);
+}
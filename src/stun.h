@@ -0,0 +1,86 @@
+/*
+ *  Yaddns - Yet Another ddns client
+ *  Copyright (C) 2008 Anthony Viallard <anthony.viallard@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _YADDNS_STUN_H_
+#define _YADDNS_STUN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "config.h"
+#include "loop.h"
+#include "timer.h"
+#include "resolv.h"
+#include "wanip.h"
+
+#define STUN_HEADER_SIZE 20
+#define STUN_TID_SIZE 12
+
+/* the address of a client seen by a stun server */
+struct stun_mapped {
+        int family;                 /* AF_INET or AF_INET6 */
+        struct in_addr v4;
+        struct in6_addr v6;
+        unsigned short int port;
+};
+
+/* wan ip address given by a stun server (one by wan source): a
+ * binding request is sent to the servers in turn, until one answers
+ */
+struct stun {
+        struct wanip src;           /* its address and its updates */
+        int nat;                    /* the mapped address isn't the
+                                     * local one, -1 if unknown */
+        unsigned int count;         /* servers of the round */
+        struct in_addr bind_addr;   /* INADDR_ANY if not bound */
+        struct resolv_query query;  /* of the server asked */
+        int s;                      /* udp socket, -1 if none */
+        struct loop_watch watch;
+        struct timer rtx;           /* retransmission */
+        unsigned int transmits;     /* of the request */
+        uint64_t rto;               /* ms, first retransmission
+                                     * timeout */
+        uint8_t tid[STUN_TID_SIZE]; /* of the transaction */
+        struct sockaddr_in local;   /* source of the request */
+};
+
+/* init it, then it's used as a wan ip source (see wanip.h) with the
+ * cfg_stun settings: the servers are asked in turn
+ */
+void stun_init(struct stun *stun);
+
+/* write a binding request of transaction tid in buf
+ *
+ * @return its size
+ */
+size_t stun_request(uint8_t *buf, size_t size,
+                    const uint8_t tid[STUN_TID_SIZE]);
+
+/* read the mapped address in the binding response buf of
+ * transaction tid (XOR-MAPPED-ADDRESS, or MAPPED-ADDRESS of the old
+ * servers)
+ *
+ * @return 0 if found, 1 if the transaction failed, -1 if buf isn't
+ *         a response of it
+ */
+int stun_parse(const uint8_t *buf, size_t len,
+               const uint8_t tid[STUN_TID_SIZE],
+               struct stun_mapped *mapped);
+
+#endif
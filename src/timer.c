@@ -0,0 +1,233 @@
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "timer.h"
+#include "log.h"
+#include "util.h"
+
+/* first heap allocation (grows by doubling) */
+#define TIMER_HEAP_MIN_ALLOC 16
+
+/* decs static variables */
+static struct timer **timer_heap = NULL;
+static size_t timer_heap_size = 0;
+static size_t timer_heap_alloc = 0;
+static uint64_t (*timer_clock)(void) = util_getuptime_ms;
+
+/*
+ * decs static functions
+ */
+static void timer_heap_set(size_t idx, struct timer *timer)
+{
+        timer_heap[idx] = timer;
+        timer->heap_idx = idx + 1;
+}
+
+static void timer_heap_up(size_t idx)
+{
+        struct timer *timer = timer_heap[idx];
+        size_t parent;
+
+        while(idx > 0)
+        {
+                parent = (idx - 1) / 2;
+                if(timer_heap[parent]->expire <= timer->expire)
+                {
+                        break;
+                }
+
+                timer_heap_set(idx, timer_heap[parent]);
+                idx = parent;
+        }
+
+        timer_heap_set(idx, timer);
+}
+
+static void timer_heap_down(size_t idx)
+{
+        struct timer *timer = timer_heap[idx];
+        size_t child;
+
+        for(;;)
+        {
+                child = 2 * idx + 1;
+                if(child >= timer_heap_size)
+                {
+                        break;
+                }
+
+                if(child + 1 < timer_heap_size
+                   && timer_heap[child + 1]->expire < timer_heap[child]->expire)
+                {
+                        ++child;
+                }
+
+                if(timer->expire <= timer_heap[child]->expire)
+                {
+                        break;
+                }
+
+                timer_heap_set(idx, timer_heap[child]);
+                idx = child;
+        }
+
+        timer_heap_set(idx, timer);
+}
+
+static void timer_heap_remove(size_t idx)
+{
+        struct timer *last = NULL;
+
+        timer_heap[idx]->heap_idx = 0;
+
+        --timer_heap_size;
+        if(idx == timer_heap_size)
+        {
+                return;
+        }
+
+        /* fill the hole with the last timer and restore heap order */
+        last = timer_heap[timer_heap_size];
+        timer_heap_set(idx, last);
+
+        if(idx > 0 && timer_heap[(idx - 1) / 2]->expire > last->expire)
+        {
+                timer_heap_up(idx);
+        }
+        else
+        {
+                timer_heap_down(idx);
+        }
+}
+
+/*
+ * decs API functions
+ */
+void timer_ctl_init(void)
+{
+        timer_heap = NULL;
+        timer_heap_size = 0;
+        timer_heap_alloc = 0;
+}
+
+void timer_ctl_cleanup(void)
+{
+        size_t i;
+
+        for(i = 0; i < timer_heap_size; ++i)
+        {
+                timer_heap[i]->heap_idx = 0;
+        }
+
+        free(timer_heap);
+        timer_heap = NULL;
+        timer_heap_size = 0;
+        timer_heap_alloc = 0;
+}
+
+void timer_ctl_set_clock(uint64_t (*clock)(void))
+{
+        timer_clock = (clock != NULL ? clock : util_getuptime_ms);
+}
+
+uint64_t timer_now(void)
+{
+        return timer_clock();
+}
+
+int timer_ctl_next_timeout(void)
+{
+        uint64_t now;
+
+        if(timer_heap_size == 0)
+        {
+                return -1;
+        }
+
+        now = timer_now();
+        if(timer_heap[0]->expire <= now)
+        {
+                return 0;
+        }
+
+        if(timer_heap[0]->expire - now > INT_MAX)
+        {
+                return INT_MAX;
+        }
+
+        return (int)(timer_heap[0]->expire - now);
+}
+
+int timer_ctl_run(void)
+{
+        struct timer *timer = NULL;
+        uint64_t now = timer_now();
+        int count = 0;
+
+        /* a callback can (re)arm or stop any timer, so always look
+         * at the root of the heap
+         */
+        while(timer_heap_size > 0 && timer_heap[0]->expire <= now)
+        {
+                timer = timer_heap[0];
+                timer_heap_remove(0);
+
+                ++count;
+                timer->cb(timer, timer->data);
+        }
+
+        return count;
+}
+
+void timer_init(struct timer *timer, timer_cb cb, void *data)
+{
+        memset(timer, 0, sizeof(struct timer));
+
+        timer->cb = cb;
+        timer->data = data;
+}
+
+int timer_start(struct timer *timer, uint64_t delay_ms)
+{
+        struct timer **heap = NULL;
+        size_t alloc;
+
+        if(timer_pending(timer))
+        {
+                timer_heap_remove(timer->heap_idx - 1);
+        }
+
+        if(timer_heap_size == timer_heap_alloc)
+        {
+                alloc = (timer_heap_alloc == 0
+                         ? TIMER_HEAP_MIN_ALLOC : 2 * timer_heap_alloc);
+
+                heap = realloc(timer_heap, alloc * sizeof(struct timer *));
+                if(heap == NULL)
+                {
+                        log_error("Unable to grow the timer heap to %zu",
+                                  alloc);
+                        return -1;
+                }
+
+                timer_heap = heap;
+                timer_heap_alloc = alloc;
+        }
+
+        timer->expire = timer_now() + delay_ms;
+
+        timer_heap_set(timer_heap_size, timer);
+        ++timer_heap_size;
+        timer_heap_up(timer_heap_size - 1);
+
+        return 0;
+}
+
+void timer_stop(struct timer *timer)
+{
+        if(timer_pending(timer))
+        {
+                timer_heap_remove(timer->heap_idx - 1);
+        }
+}
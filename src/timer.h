@@ -0,0 +1,106 @@
+/*
+ *  Yaddns - Yet Another ddns client
+ *  Copyright (C) 2008 Anthony Viallard <anthony.viallard@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _YADDNS_TIMER_H_
+#define _YADDNS_TIMER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * This module keeps all the yaddns deadlines (request timeouts,
+ * account freezes, refreshes, wan ip polls...) in a min-heap with
+ * a millisecond resolution.
+ *
+ * The event loop sleeps until the earliest deadline
+ * (timer_ctl_next_timeout()) and only the expired timers are
+ * touched by timer_ctl_run().
+ */
+
+struct timer;
+
+typedef void (*timer_cb)(struct timer *timer, void *data);
+
+struct timer {
+        uint64_t expire; /* in ms, on the timer clock */
+        size_t heap_idx; /* position in heap + 1, 0 if not pending */
+        timer_cb cb;
+        void *data;      /* data given in arg to cb when is called */
+};
+
+/*
+ * init the timer heap
+ */
+extern void timer_ctl_init(void);
+
+/*
+ * free the timer heap (pending timers are forgotten)
+ */
+extern void timer_ctl_cleanup(void);
+
+/*
+ * Replace the clock used by the timers (monotonic uptime in ms by
+ * default). Give NULL to restore the default clock.
+ */
+extern void timer_ctl_set_clock(uint64_t (*clock)(void));
+
+/*
+ * Return the current time of the timer clock in ms
+ */
+extern uint64_t timer_now(void);
+
+/*
+ * Return the time in ms before the earliest deadline, 0 if a timer
+ * has expired, -1 if no timer is pending.
+ */
+extern int timer_ctl_next_timeout(void);
+
+/*
+ * Call the callback of every expired timer
+ *
+ * @return the count of expired timers
+ */
+extern int timer_ctl_run(void);
+
+/*
+ * init a timer structure. Must be called before any other timer_*
+ * call on it.
+ */
+extern void timer_init(struct timer *timer, timer_cb cb, void *data);
+
+/*
+ * (re)arm the timer to expire in delay_ms
+ *
+ * @return 0 if success, -1 otherwise
+ */
+extern int timer_start(struct timer *timer, uint64_t delay_ms);
+
+/*
+ * disarm the timer. Safe to call on a not pending timer.
+ */
+extern void timer_stop(struct timer *timer);
+
+/*
+ * Return 1 if the timer is armed, 0 otherwise
+ */
+static inline int timer_pending(const struct timer *timer)
+{
+        return (timer->heap_idx != 0);
+}
+
+#endif
@@ -4,6 +4,8 @@
 
 #include <net/if.h>
 #include <sys/ioctl.h>
+#include <arpa/inet.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <errno.h>
@@ -88,6 +90,20 @@ time_t util_getuptime(void)
 	return tp.tv_sec;
 }
 
+uint64_t util_getuptime_ms(void)
+{
+	struct timespec tp;
+
+        if (clock_gettime(CLOCK_MONOTONIC, &tp) != 0)
+	{
+		log_error("Error getting clock %s !",
+                          strerror(errno));
+		return 0;
+	}
+
+	return (uint64_t)tp.tv_sec * 1000 + (uint64_t)tp.tv_nsec / 1000000;
+}
+
 int util_getifaddr(const char *ifname, struct in_addr *addr)
 {
         /* SIOCGIFADDR struct ifreq *  */
@@ -128,6 +144,36 @@ int util_getifaddr(const char *ifname, struct in_addr *addr)
 	return 0;
 }
 
+socklen_t util_sockaddr_len(const struct sockaddr *sa)
+{
+        return (sa->sa_family == AF_INET6
+                ? sizeof(struct sockaddr_in6)
+                : sizeof(struct sockaddr_in));
+}
+
+const char *util_sockaddr_ntop(const struct sockaddr *sa,
+                               char *buf, size_t buf_size)
+{
+        char addr[INET6_ADDRSTRLEN];
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)sa;
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)sa;
+
+        if(sa->sa_family == AF_INET6)
+        {
+                inet_ntop(AF_INET6, &(sin6->sin6_addr), addr, sizeof(addr));
+                snprintf(buf, buf_size, "[%s]:%u",
+                         addr, ntohs(sin6->sin6_port));
+        }
+        else
+        {
+                inet_ntop(AF_INET, &(sin->sin_addr), addr, sizeof(addr));
+                snprintf(buf, buf_size, "%s:%u",
+                         addr, ntohs(sin->sin_port));
+        }
+
+        return buf;
+}
+
 char *strdup_trim(const char *s)
 {
         size_t begin, end, len;
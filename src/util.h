@@ -19,14 +19,21 @@
 #ifndef _YADDNS_UTIL_H_
 #define _YADDNS_UTIL_H_
 
+#include <stddef.h>
 #include <string.h>
+#include <stdint.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
 #include <sys/time.h>
 
 #define UNUSED(x) ( (void)(x) )
 
 #define ARRAY_SIZE(x) (sizeof (x) / sizeof ((x) [0]))
 
+/* the structure of type whose member is at ptr */
+#define CONTAINER_OF(ptr, type, member)                                 \
+        ((type *)(void *)((char *)(ptr) - offsetof(type, member)))
+
 #define MIN(x, y)                               \
         ({                                      \
                 typeof(x) _x = (x);             \
@@ -55,11 +62,35 @@ extern int util_base64_encode(const char *src, char **output, size_t *output_siz
  */
 extern time_t util_getuptime(void);
 
+/*
+ * Get system uptime in milliseconds
+ */
+extern uint64_t util_getuptime_ms(void);
+
 /*
  * Get ip address of an interface
  */
 int util_getifaddr(const char *ifname, struct in_addr *addr);
 
+/*
+ * Size of the buffer given to util_sockaddr_ntop()
+ * ("[" INET6_ADDRSTRLEN "]:" port)
+ */
+#define UTIL_SOCKADDR_STRLEN 56
+
+/*
+ * Return the length of an AF_INET or AF_INET6 sockaddr
+ */
+socklen_t util_sockaddr_len(const struct sockaddr *sa);
+
+/*
+ * Write "addr:port" (or "[addr6]:port") of sa in buf
+ *
+ * @return buf
+ */
+const char *util_sockaddr_ntop(const struct sockaddr *sa,
+                               char *buf, size_t buf_size);
+
 /*
  * Allocate new string with trimming spaces, tabs, ", ' and \n in input string
  */
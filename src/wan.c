@@ -0,0 +1,633 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include "wan.h"
+
+#include "account.h"
+#include "util.h"
+#include "log.h"
+
+/* without rtnetlink, poll the address of a wan interface every
+ * WAN_IFADDR_UPINT seconds
+ */
+#define WAN_IFADDR_UPINT 15
+
+/* delay of the myip (stun or dns) request after a change of the links
+ * or routes: the events of a reconnection come in a burst
+ */
+#define WAN_TRIGGER_DELAY 2
+
+static void wan_timer_cb(struct timer *timer, void *data);
+
+/* decs public variables */
+struct wan wan_default = {
+        .accounts = LIST_HEAD_INIT(wan_default.accounts),
+};
+
+/* decs static variables */
+static struct list_head wan_list; /* named sources */
+static unsigned int wan_generation = 0; /* of the last remap */
+static int wan_dump = 0; /* the addresses of the interfaces have to be
+                          * read again from rtnetlink */
+
+static void wan_timer_cb(struct timer *timer, void *data)
+{
+        struct wan *wan = data;
+
+        UNUSED(timer);
+
+        wan->outdated = 1;
+}
+
+/*
+ * ask the ip address of wan again (but in direct mode)
+ */
+static void wan_ask(struct wan *wan)
+{
+        if(wan->src != NULL)
+        {
+                wanip_needupdate(wan->src);
+        }
+}
+
+static void wan_trigger_cb(struct timer *timer, void *data)
+{
+        struct wan *wan = data;
+
+        UNUSED(timer);
+
+        /* unless a request is on the way */
+        if(wan->src != NULL && wanip_idle(wan->src))
+        {
+                log_info("Wan '%s' changed, ask its ip address again",
+                         wan_name(wan));
+                wan_ask(wan);
+        }
+}
+
+/*
+ * the source of the ip address of wan as its mode says (none in
+ * direct mode), from scratch
+ */
+static void wan_setsrc(struct wan *wan)
+{
+        if(wan->src != NULL)
+        {
+                wanip_cleanup(wan->src);
+                wan->src = NULL;
+                wan->src_cfg = NULL;
+        }
+
+        switch(wan->cfg.type)
+        {
+        case wan_cnt_indirect:
+                myip_init(&(wan->myip));
+                wan->myip.followed = netlink_ctl_available();
+                wan->src = &(wan->myip.src);
+                wan->src_cfg = &(wan->cfg.myip);
+                break;
+        case wan_cnt_stun:
+                stun_init(&(wan->stun));
+                wan->src = &(wan->stun.src);
+                wan->src_cfg = &(wan->cfg.stun);
+                break;
+        case wan_cnt_dns:
+                dnsip_init(&(wan->dnsip));
+                wan->src = &(wan->dnsip.src);
+                wan->src_cfg = &(wan->cfg.dnsip);
+                break;
+        case wan_cnt_direct:
+        default:
+                break;
+        }
+}
+
+static void wan_init(struct wan *wan)
+{
+        memset(wan, 0, sizeof(struct wan));
+        timer_init(&(wan->timer), wan_timer_cb, wan);
+        timer_init(&(wan->trigger), wan_trigger_cb, wan);
+        INIT_LIST_HEAD(&(wan->accounts));
+        INIT_LIST_HEAD(&(wan->list));
+}
+
+static void wan_release(struct wan *wan)
+{
+        timer_stop(&(wan->timer));
+        timer_stop(&(wan->trigger));
+        if(wan->src != NULL)
+        {
+                wanip_cleanup(wan->src);
+        }
+        cfgstr_unset(&(wan->cfg.name));
+        cfgstr_unset(&(wan->cfg.ifname));
+        config_myip_free(&(wan->cfg.myip));
+        config_stun_free(&(wan->cfg.stun));
+        config_dnsip_free(&(wan->cfg.dnsip));
+}
+
+/*
+ * read again the address of the interface of wan (if any): from a
+ * rtnetlink dump, or by polling it without rtnetlink
+ */
+static void wan_refresh(struct wan *wan)
+{
+        if(!cfgstr_is_set(&(wan->cfg.ifname)))
+        {
+                return;
+        }
+
+        if(netlink_ctl_available())
+        {
+                /* a ppp interface gets a new index at each connection */
+                wan->ifindex =
+                        (int)if_nametoindex(cfgstr_get(&(wan->cfg.ifname)));
+                wan->running = (wan->ifindex != 0);
+                wan->bind_stale = 1;
+                wan_dump = 1;
+        }
+        else
+        {
+                wan->outdated = 1;
+        }
+}
+
+/*
+ * ask the myip service (stun or dns servers) of wan again, after the
+ * burst of events
+ */
+static void wan_trigger(struct wan *wan)
+{
+        if(wan->src == NULL || timer_pending(&(wan->trigger)))
+        {
+                return;
+        }
+
+        timer_start(&(wan->trigger), WAN_TRIGGER_DELAY * 1000);
+}
+
+/*
+ * set the ip of wan (NULL if it has none), its accounts are set not
+ * updated if it changed
+ */
+static void wan_setip(struct wan *wan, const struct in_addr *addr)
+{
+        if(addr == NULL)
+        {
+                wan->have_ip = 0;
+                return;
+        }
+
+        wan->have_ip = 1;
+
+        if(addr->s_addr == wan->ip.s_addr)
+        {
+                return;
+        }
+
+        wan->ip.s_addr = addr->s_addr;
+
+        log_notice("We have a new wan ip = %s (wan '%s') !",
+                   inet_ntoa(wan->ip), wan_name(wan));
+
+        /* its accounts need to be updated (unless they pushed it
+         * before a restart)
+         */
+        account_ctl_wanipchanged(wan);
+}
+
+/*
+ * the address of the interface of wan changed (NULL if it has none):
+ * the updates are sent from it, and it's the wan ip in direct mode
+ */
+static void wan_setifaddr(struct wan *wan, const struct in_addr *addr)
+{
+        wan->bind_addr.s_addr = (addr != NULL ? addr->s_addr : INADDR_ANY);
+
+        if(wan->cfg.type == wan_cnt_direct)
+        {
+                wan_setip(wan, addr);
+        }
+}
+
+static void wan_setip6(struct wan *wan, const struct in6_addr *addr)
+{
+        char buf[INET6_ADDRSTRLEN];
+
+        if(addr == NULL)
+        {
+                wan->have_ip6 = 0;
+                return;
+        }
+
+        wan->have_ip6 = 1;
+        wan->ip6 = *addr;
+
+        log_info("Wan '%s' has the ipv6 address %s", wan_name(wan),
+                 inet_ntop(AF_INET6, addr, buf, sizeof(buf)));
+}
+
+/*
+ * copy the settings of cfg (but the name) in wan, its address is got
+ * again if they changed
+ */
+static void wan_setcfg(struct wan *wan, const struct cfg_wan *cfg)
+{
+        if(wan->cfg.type == cfg->type
+           && cfgstr_equal(&(wan->cfg.ifname), &(cfg->ifname))
+           && config_myip_equal(&(wan->cfg.myip), &(cfg->myip))
+           && config_stun_equal(&(wan->cfg.stun), &(cfg->stun))
+           && config_dnsip_equal(&(wan->cfg.dnsip), &(cfg->dnsip)))
+        {
+                return;
+        }
+
+        log_debug("wan '%s' cfg has changed", wan_name(wan));
+
+        wan->cfg.type = cfg->type;
+        cfgstr_copy(&(cfg->ifname), &(wan->cfg.ifname));
+        config_myip_copy(&(cfg->myip), &(wan->cfg.myip));
+        config_stun_copy(&(cfg->stun), &(wan->cfg.stun));
+        config_dnsip_copy(&(cfg->dnsip), &(wan->cfg.dnsip));
+
+        /* the accounts are updated if the new address differs */
+        wan->have_ip = 0;
+        wan->outdated = 0;
+        wan->ifindex = 0;
+        wan->bind_addr.s_addr = INADDR_ANY;
+        wan->have_ip6 = 0;
+        timer_stop(&(wan->timer));
+        timer_stop(&(wan->trigger));
+        wan_setsrc(wan);
+
+        wan_refresh(wan);
+}
+
+static void wan_manage(struct wan *wan)
+{
+        const struct in_addr *bind_addr = NULL;
+        struct in_addr fresh_ip;
+        int ret;
+
+        if(wan->outdated)
+        {
+                wan->outdated = 0;
+                timer_start(&(wan->timer), WAN_IFADDR_UPINT * 1000);
+
+                wan_setifaddr(wan,
+                              (util_getifaddr(cfgstr_get(&(wan->cfg.ifname)),
+                                              &fresh_ip) == 0
+                               ? &fresh_ip : NULL));
+        }
+
+        if(wan->src == NULL)
+        {
+                return;
+        }
+
+        /* the myip (stun or dns) requests leave by its interface
+         * (if any)
+         */
+        if(cfgstr_is_set(&(wan->cfg.ifname))
+           && wan->bind_addr.s_addr == INADDR_ANY)
+        {
+                wan_setip(wan, NULL);
+                return;
+        }
+
+        if(wan->bind_addr.s_addr != INADDR_ANY)
+        {
+                bind_addr = &(wan->bind_addr);
+        }
+
+        ret = wanip_getwanipaddr(wan->src, wan->src_cfg,
+                                 bind_addr, &fresh_ip);
+
+        wan_setip(wan, (ret == 0 ? &fresh_ip : NULL));
+}
+
+static void wan_needupdate(struct wan *wan)
+{
+        wan_refresh(wan);
+        wan_ask(wan);
+}
+
+static void wan_addr_event(struct wan *wan, const struct netlink_event *event)
+{
+        int usable = (event->type == NETLINK_ADDR_NEW);
+
+        if(event->family == AF_INET)
+        {
+                /* a primary address, kept until it's removed */
+                if(event->flags & NETLINK_F_SECONDARY)
+                {
+                        return;
+                }
+
+                if(usable && (wan->bind_addr.s_addr == INADDR_ANY
+                              || wan->bind_stale))
+                {
+                        wan->bind_stale = 0;
+                        wan_setifaddr(wan, &(event->addr.v4));
+                }
+                else if(!usable
+                        && event->addr.v4.s_addr == wan->bind_addr.s_addr)
+                {
+                        /* a secondary one may be promoted */
+                        wan_setifaddr(wan, NULL);
+                        wan_dump = 1;
+                }
+
+                return;
+        }
+
+        usable = (usable
+                  && !(event->flags & (NETLINK_F_UNSTABLE | NETLINK_F_LOCAL)));
+
+        if(usable && !wan->have_ip6)
+        {
+                wan_setip6(wan, &(event->addr.v6));
+        }
+        else if(!usable && wan->have_ip6
+                && memcmp(&(event->addr.v6), &(wan->ip6),
+                          sizeof(struct in6_addr)) == 0)
+        {
+                /* another one may be usable */
+                wan_setip6(wan, NULL);
+                wan_dump = 1;
+        }
+}
+
+static void wan_event(struct wan *wan, const struct netlink_event *event)
+{
+        int bound = cfgstr_is_set(&(wan->cfg.ifname));
+        int running;
+
+        switch(event->type)
+        {
+        case NETLINK_ADDR_NEW:
+        case NETLINK_ADDR_DEL:
+                if(bound && event->ifindex != 0
+                   && event->ifindex == wan->ifindex)
+                {
+                        wan_addr_event(wan, event);
+                }
+                break;
+        case NETLINK_LINK_NEW:
+                running = ((event->flags & (IFF_UP | IFF_RUNNING))
+                           == (IFF_UP | IFF_RUNNING));
+                if(!bound)
+                {
+                        /* a ppp link (re)connected */
+                        if(running && (event->flags & IFF_POINTOPOINT))
+                        {
+                                wan_trigger(wan);
+                        }
+                }
+                else if(strcmp(event->ifname,
+                               cfgstr_get(&(wan->cfg.ifname))) == 0)
+                {
+                        wan->ifindex = event->ifindex;
+                        if(running && !wan->running)
+                        {
+                                wan_trigger(wan);
+                        }
+                        wan->running = (short int)running;
+                }
+                break;
+        case NETLINK_LINK_DEL:
+                if(bound && event->ifindex != 0
+                   && event->ifindex == wan->ifindex)
+                {
+                        wan->ifindex = 0;
+                        wan->running = 0;
+                        wan_setifaddr(wan, NULL);
+                        wan_setip6(wan, NULL);
+                }
+                break;
+        case NETLINK_ROUTE_NEW:
+                /* the wan reconnected, or the traffic left by another
+                 * one
+                 */
+                if(!bound || event->ifindex == wan->ifindex)
+                {
+                        wan_trigger(wan);
+                }
+                break;
+        case NETLINK_RESYNC:
+                wan_refresh(wan);
+                wan_trigger(wan);
+                break;
+        default:
+                break;
+        }
+}
+
+/*
+ * rtnetlink failed: poll the interface of wan, and its myip service
+ * every upint
+ */
+static void wan_poll(struct wan *wan)
+{
+        wan->outdated = cfgstr_is_set(&(wan->cfg.ifname));
+        wan->myip.followed = 0;
+}
+
+void wan_ctl_init(void)
+{
+        wan_init(&wan_default);
+        INIT_LIST_HEAD(&wan_list);
+}
+
+void wan_ctl_cleanup(void)
+{
+        struct wan *wan = NULL,
+                *safe = NULL;
+
+        list_for_each_entry_safe(wan, safe, &wan_list, list)
+        {
+                list_del(&(wan->list));
+                wan_release(wan);
+                free(wan);
+        }
+
+        wan_release(&wan_default);
+}
+
+int wan_ctl_mapcfg(const struct cfg *cfg)
+{
+        struct cfg_wan defcfg;
+        struct cfg_wan *wancfg = NULL;
+        struct wan *wan = NULL;
+
+        ++wan_generation;
+
+        /* the global settings (read only) */
+        memset(&defcfg, 0, sizeof(defcfg));
+        defcfg.type = cfg->wan_cnt_type;
+        if(cfg->wan_cnt_type == wan_cnt_direct)
+        {
+                defcfg.ifname = cfg->wan_ifname;
+        }
+        defcfg.myip = cfg->myip;
+        defcfg.stun = cfg->stun;
+        defcfg.dnsip = cfg->dnsip;
+
+        wan_setcfg(&wan_default, &defcfg);
+
+        list_for_each_entry(wancfg, &(cfg->wan_list), list)
+        {
+                wan = wan_ctl_get(cfgstr_get(&(wancfg->name)));
+                if(wan == NULL)
+                {
+                        log_debug("New wan '%s'",
+                                  cfgstr_get(&(wancfg->name)));
+
+                        wan = malloc(sizeof(struct wan));
+                        if(wan == NULL)
+                        {
+                                log_error("Unable to allocate wan '%s'",
+                                          cfgstr_get(&(wancfg->name)));
+                                return -1;
+                        }
+
+                        wan_init(wan);
+                        cfgstr_copy(&(wancfg->name), &(wan->cfg.name));
+                        list_add_tail(&(wan->list), &wan_list);
+                }
+
+                wan_setcfg(wan, wancfg);
+                wan->generation = wan_generation;
+        }
+
+        return 0;
+}
+
+void wan_ctl_prune(void)
+{
+        struct wan *wan = NULL,
+                *safe = NULL;
+
+        list_for_each_entry_safe(wan, safe, &wan_list, list)
+        {
+                if(wan->generation == wan_generation
+                   || !list_empty(&(wan->accounts)))
+                {
+                        continue;
+                }
+
+                log_debug("Remove unused wan '%s'", wan_name(wan));
+
+                list_del(&(wan->list));
+                wan_release(wan);
+                free(wan);
+        }
+}
+
+void wan_ctl_manage(void)
+{
+        struct wan *wan = NULL;
+
+        /* one dump for all the sources */
+        if(wan_dump)
+        {
+                wan_dump = 0;
+
+                if(netlink_ctl_dump() != 0)
+                {
+                        log_warning("Unable to read the addresses from "
+                                    "rtnetlink, the interfaces are polled");
+
+                        wan_poll(&wan_default);
+                        list_for_each_entry(wan, &wan_list, list)
+                        {
+                                wan_poll(wan);
+                        }
+                }
+        }
+
+        wan_manage(&wan_default);
+
+        list_for_each_entry(wan, &wan_list, list)
+        {
+                wan_manage(wan);
+        }
+}
+
+void wan_ctl_needupdate(void)
+{
+        struct wan *wan = NULL;
+
+        wan_needupdate(&wan_default);
+
+        list_for_each_entry(wan, &wan_list, list)
+        {
+                wan_needupdate(wan);
+        }
+}
+
+void wan_ctl_event(const struct netlink_event *event, void *data)
+{
+        struct wan *wan = NULL;
+
+        UNUSED(data);
+
+        wan_event(&wan_default, event);
+
+        list_for_each_entry(wan, &wan_list, list)
+        {
+                wan_event(wan, event);
+        }
+}
+
+struct wan *wan_ctl_get(const char *name)
+{
+        struct wan *wan = NULL;
+
+        if(name[0] == '\0')
+        {
+                return &wan_default;
+        }
+
+        list_for_each_entry(wan, &wan_list, list)
+        {
+                if(strcmp(cfgstr_get(&(wan->cfg.name)), name) == 0)
+                {
+                        return wan;
+                }
+        }
+
+        return NULL;
+}
+
+const char *wan_name(const struct wan *wan)
+{
+        return (cfgstr_is_set(&(wan->cfg.name))
+                ? cfgstr_get(&(wan->cfg.name)) : "default");
+}
+
+const char *wan_ipstr(struct wan *wan)
+{
+        if(wan->ipstr[0] != '\0'
+           && wan->ipstr_addr.s_addr == wan->ip.s_addr)
+        {
+                return wan->ipstr;
+        }
+
+        if(!inet_ntop(AF_INET, &(wan->ip), wan->ipstr,
+                      sizeof(wan->ipstr)))
+        {
+                log_error("inet_ntop(): %s", strerror(errno));
+                wan->ipstr[0] = '\0';
+                return NULL;
+        }
+
+        wan->ipstr_addr.s_addr = wan->ip.s_addr;
+
+        return wan->ipstr;
+}
@@ -0,0 +1,123 @@
+/*
+ *  Yaddns - Yet Another ddns client
+ *  Copyright (C) 2008 Anthony Viallard <anthony.viallard@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _YADDNS_WAN_H_
+#define _YADDNS_WAN_H_
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "list.h"
+#include "config.h"
+#include "timer.h"
+#include "myip.h"
+#include "stun.h"
+#include "dnsip.h"
+#include "netlink.h"
+
+/* a wan source: how its ip address is got, and the accounts updated
+ * with it
+ */
+struct wan {
+        struct cfg_wan cfg;         /* copy of its settings (no name
+                                     * for the default one) */
+        struct in_addr ip;
+        short int have_ip;
+        struct in_addr bind_addr;   /* of its interface, the updates
+                                     * are sent from it, INADDR_ANY if
+                                     * not bound */
+        short int bind_stale;       /* bind_addr may be gone (events
+                                     * lost), replaced by the next
+                                     * primary address reported */
+        int ifindex;                /* of its interface, 0 if unknown */
+        short int running;          /* its interface is up and running */
+        struct in6_addr ip6;        /* stable global address of its
+                                     * interface (not pushed, the
+                                     * services take ipv4) */
+        short int have_ip6;
+        struct timer timer;         /* next poll of its interface
+                                     * (without rtnetlink) */
+        int outdated;               /* interface to poll */
+        struct timer trigger;       /* myip, stun or dns request
+                                     * after a change of the links or
+                                     * routes */
+        struct wanip *src;          /* of its ip address, the one of
+                                     * its mode (NULL in direct mode) */
+        const void *src_cfg;        /* settings of src */
+        struct myip myip;           /* indirect mode */
+        struct stun stun;           /* stun mode */
+        struct dnsip dnsip;         /* dns mode */
+        struct in_addr ipstr_addr;  /* ip of ipstr */
+        char ipstr[INET_ADDRSTRLEN]; /* "" if not converted */
+        struct list_head accounts;  /* attached to it */
+        unsigned int generation;    /* remap which kept it */
+        struct list_head list;
+};
+
+/* the source of the global settings, for the accounts without wan */
+extern struct wan wan_default;
+
+/* init the allocated structures */
+extern void wan_ctl_init(void);
+
+/* free the allocated structures */
+extern void wan_ctl_cleanup(void);
+
+/* after reading cfg, create or update the sources of its wan blocks
+ * (and the default one). A source whose settings changed gets its ip
+ * address again. The sources not in cfg are kept until
+ * wan_ctl_prune().
+ */
+extern int wan_ctl_mapcfg(const struct cfg *cfg);
+
+/* free the sources not in the last mapped cfg which have no account
+ * attached anymore
+ */
+extern void wan_ctl_prune(void);
+
+/* get the ip address of each source when it's time. The accounts of
+ * a source whose address changed are set not updated (unless they
+ * pushed it).
+ */
+extern void wan_ctl_manage(void);
+
+/* get again the ip address of all sources */
+extern void wan_ctl_needupdate(void);
+
+/* netlink_cb: follow the addresses of the interfaces of the sources,
+ * instead of polling them. A link coming up or a new default route
+ * asks the myip service (stun or dns servers) of the sources again.
+ */
+extern void wan_ctl_event(const struct netlink_event *event, void *data);
+
+/* source named name, the default one for ""
+ *
+ * @return NULL if not found
+ */
+extern struct wan *wan_ctl_get(const char *name);
+
+/* name of wan for the logs */
+extern const char *wan_name(const struct wan *wan);
+
+/* ip of wan in ascii, converted again only when it has changed
+ *
+ * @return NULL if error
+ */
+extern const char *wan_ipstr(struct wan *wan);
+
+#endif
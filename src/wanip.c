@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wanip.h"
+
+#include "util.h"
+
+/* retry delays after an error (see backoff.h) */
+#define WANIP_RETRY_MIN 10
+#define WANIP_RETRY_MAX 900
+
+static const struct backoff_policy wanip_retry = {
+        .min = WANIP_RETRY_MIN * 1000,
+        .max = WANIP_RETRY_MAX * 1000,
+};
+
+static void wanip_timer_cb(struct timer *timer, void *data)
+{
+        struct wanip *wanip = data;
+
+        UNUSED(timer);
+
+        /* timeout, need update */
+        wanip->status = WISNeedUpdate;
+        wanip->next = 0;
+}
+
+void wanip_init(struct wanip *wanip, const struct wanip_ops *ops)
+{
+        memset(wanip, 0, sizeof(struct wanip));
+        wanip->status = WISNeedUpdate;
+        wanip->ops = ops;
+        timer_init(&(wanip->timer), wanip_timer_cb, wanip);
+}
+
+void wanip_cleanup(struct wanip *wanip)
+{
+        timer_stop(&(wanip->timer));
+        wanip->ops->cancel(wanip);
+}
+
+int wanip_getwanipaddr(struct wanip *wanip, const void *cfg,
+                       const struct in_addr *bind_addr,
+                       struct in_addr *wanaddr)
+{
+        int ret = -1;
+
+        if(wanip->have_wanaddr)
+        {
+                /* return the last wan ip address got */
+                *wanaddr = wanip->wanaddr;
+                ret = 0;
+        }
+
+        if(wanip->status == WISNeedUpdate)
+        {
+                /* unless the send callback ends it at once */
+                wanip->status = WISWorking;
+                wanip->ops->send(wanip, cfg, bind_addr);
+        }
+
+        return ret;
+}
+
+void wanip_needupdate(struct wanip *wanip)
+{
+        if(wanip->status == WISWorking)
+        {
+                return;
+        }
+
+        timer_stop(&(wanip->timer));
+        wanip->status = WISNeedUpdate;
+        wanip->next = 0;
+}
+
+int wanip_idle(const struct wanip *wanip)
+{
+        return (wanip->status == WISHaveIp || wanip->status == WISError);
+}
+
+void wanip_accept(struct wanip *wanip, const struct in_addr *addr)
+{
+        wanip->status = WISHaveIp;
+        wanip->wanaddr = *addr;
+        wanip->have_wanaddr = 1;
+        wanip->next = 0;
+        backoff_reset(&(wanip->backoff));
+        timer_start(&(wanip->timer), (uint64_t)wanip->upint * 1000);
+}
+
+void wanip_error(struct wanip *wanip, unsigned int retry_after)
+{
+        uint64_t delay = backoff_next(&(wanip->backoff), &wanip_retry);
+
+        wanip->status = WISError;
+        wanip->next = 0;
+        timer_start(&(wanip->timer),
+                    MAX(delay, (uint64_t)retry_after * 1000));
+}
+
+void wanip_next(struct wanip *wanip)
+{
+        wanip->status = WISNeedUpdate;
+}
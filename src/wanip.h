@@ -0,0 +1,102 @@
+/*
+ *  Yaddns - Yet Another ddns client
+ *  Copyright (C) 2008 Anthony Viallard <anthony.viallard@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _YADDNS_WANIP_H_
+#define _YADDNS_WANIP_H_
+
+#include <netinet/in.h>
+
+#include "timer.h"
+#include "backoff.h"
+
+/*
+ * This module is the part shared by the sources of a wan ip address
+ * which ask it to servers (myip, stun, dns): the last address got,
+ * when to ask it again, and the retries after an error.
+ *
+ * A mode embeds a struct wanip and gives its send and cancel
+ * callbacks. The send callback starts a request, whose end is given
+ * back with wanip_accept(), wanip_error() or wanip_next().
+ */
+
+struct wanip;
+
+struct wanip_ops {
+        /* ask the address as cfg (the settings of the mode) says,
+         * from bind_addr if not NULL
+         */
+        void (*send)(struct wanip *wanip, const void *cfg,
+                     const struct in_addr *bind_addr);
+
+        /* drop the request on the way (if any) */
+        void (*cancel)(struct wanip *wanip);
+};
+
+struct wanip {
+        enum {
+                WISError = -1,
+                WISNeedUpdate = 0,
+                WISHaveIp = 1,
+                WISWorking,
+        } status;
+        struct in_addr wanaddr;     /* the last one got */
+        int have_wanaddr;
+        int upint;                  /* s, set by the send callback */
+        unsigned int next;          /* the next server of the round to
+                                     * ask, 0 to start a new round */
+        struct timer timer;         /* next update */
+        struct backoff backoff;     /* failures since the last address */
+        const struct wanip_ops *ops;
+};
+
+void wanip_init(struct wanip *wanip, const struct wanip_ops *ops);
+
+/* stop it, its request on the way is dropped */
+void wanip_cleanup(struct wanip *wanip);
+
+/* the last wan ip address got, a new one is asked when it's time as
+ * cfg says, from bind_addr if not NULL
+ *
+ * @return 0 if there is one, -1 otherwise
+ */
+int wanip_getwanipaddr(struct wanip *wanip, const void *cfg,
+                       const struct in_addr *bind_addr,
+                       struct in_addr *wanaddr);
+
+/* ask a new address at once, unless a request is on the way (it
+ * gives a fresh one)
+ */
+void wanip_needupdate(struct wanip *wanip);
+
+/* it has an address or failed, no request is on the way */
+int wanip_idle(const struct wanip *wanip);
+
+/* the request gave addr, asked again in upint */
+void wanip_accept(struct wanip *wanip, const struct in_addr *addr);
+
+/* the round failed, retried after a backoff delay (no sooner than
+ * retry_after seconds)
+ */
+void wanip_error(struct wanip *wanip, unsigned int retry_after);
+
+/* the server asked failed, the next one of the round is asked at the
+ * next call
+ */
+void wanip_next(struct wanip *wanip);
+
+#endif
@@ -8,6 +8,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <time.h>
 
 #include "yaddns.h"
 #include "services.h"
@@ -16,17 +17,28 @@
 #include "log.h"
 #include "account.h"
 #include "util.h"
-#include "myip.h"
+#include "wan.h"
+#include "netlink.h"
+#include "loop.h"
+#include "timer.h"
+#include "resolv.h"
+#include "backoff.h"
+#include "state.h"
+
+/* save the state of the accounts (if changed) every STATE_SAVE_INT
+ * seconds
+ */
+#define STATE_SAVE_INT 60
 
 static volatile sig_atomic_t keep_going = 0;
 static volatile sig_atomic_t reloadconf = 0;
 static volatile sig_atomic_t wakeup = 0;
 static volatile sig_atomic_t unfreeze = 0;
 
-struct in_addr wanip;
-short int have_wanip = 0;
+static struct timer state_timer;
+static unsigned int state_generation = 0; /* of the saved states */
 
-static void sig_handler(int signum)
+static void sig_cb(int signum)
 {
 	if(signum == SIGTERM || signum == SIGINT)
 	{
@@ -52,43 +64,13 @@ static void sig_handler(int signum)
 
 static int sig_setup(void)
 {
-	struct sigaction sa;
+        const int signums[] = {
+                SIGTERM, SIGINT, SIGHUP, SIGUSR1, SIGUSR2,
+        };
 
-	memset(&sa, 0, sizeof(struct sigaction));
-	sa.sa_handler = sig_handler;
-
-	if(sigaction(SIGTERM, &sa, NULL) != 0)
-	{
-		log_error("Failed to install signal handler for SIGTERM: %s",
-                          strerror(errno));
-		return -1;
-	}
-
-	if(sigaction(SIGINT, &sa, NULL) != 0)
-	{
-		log_error("Failed to install signal handler for SIGINT: %s",
-                          strerror(errno));
-		return -1;
-	}
-
-        if(sigaction(SIGHUP, &sa, NULL) != 0)
-	{
-		log_error("Failed to install signal handler for SIGHUP: %s",
-                          strerror(errno));
-		return -1;
-	}
-
-        if(sigaction(SIGUSR1, &sa, NULL) != 0)
-	{
-		log_error("Failed to install signal handler for SIGUSR1: %s",
-                          strerror(errno));
-		return -1;
-	}
-
-        if(sigaction(SIGUSR2, &sa, NULL) != 0)
+        if(loop_signal_setup(signums, ARRAY_SIZE(signums), sig_cb) != 0)
 	{
-		log_error("Failed to install signal handler for SIGUSR2: %s",
-                          strerror(errno));
+		log_error("Failed to install signal handlers");
 		return -1;
 	}
 
@@ -111,49 +93,28 @@ static void sig_unblockall(void)
 	sigprocmask(SIG_UNBLOCK, &set, NULL);
 }
 
-static void wanip_manage(const struct cfg *cfg)
+static void state_sync(const struct cfg *cfg)
 {
-        int ret;
-        struct in_addr fresh_wanip;
+        unsigned int generation = account_ctl_state_generation();
 
-        /* get the current system wan ip address */
-        if(cfg->wan_cnt_type == wan_cnt_direct)
+        if(!cfgstr_is_set(&(cfg->statefile))
+           || generation == state_generation)
         {
-                ret = util_getifaddr(cfgstr_get(&(cfg->wan_ifname)),
-                                     &fresh_wanip);
-        }
-        else
-        {
-                ret = myip_getwanipaddr(&(cfg->myip), &fresh_wanip);
+                return;
         }
 
-        if(ret != 0)
+        if(state_save(cfgstr_get(&(cfg->statefile))) == 0)
         {
-                have_wanip = 0;
-        }
-        else
-        {
-                have_wanip = 1;
-
-                if(fresh_wanip.s_addr != wanip.s_addr)
-                {
-                        wanip.s_addr = fresh_wanip.s_addr;
-
-                        log_notice("We have a new wan ip = %s !",
-                                  inet_ntoa(wanip));
-
-                        /* account need to be updated */
-                        account_ctl_needupdate();
-                }
+                state_generation = generation;
         }
 }
 
-static void wanip_needupdate(const struct cfg *cfg)
+static void state_timer_cb(struct timer *timer, void *data)
 {
-        if(cfg->wan_cnt_type == wan_cnt_indirect)
-        {
-                myip_needupdate();
-        }
+        const struct cfg *cfg = data;
+
+        state_sync(cfg);
+        timer_start(timer, STATE_SAVE_INT * 1000);
 }
 
 static int reload_conf(struct cfg *cfg)
@@ -170,27 +131,22 @@ static int reload_conf(struct cfg *cfg)
                 return -1;
         }
 
-        if(account_ctl_mapnewcfg(&cfgre) == 0)
+        /* the wans first, the accounts are attached to them */
+        if(wan_ctl_mapcfg(&cfgre) == 0
+           && account_ctl_mapnewcfg(&cfgre, NULL) == 0)
         {
-                if(cfgre.wan_cnt_type == wan_cnt_direct)
-                {
-                        if(strcmp(cfgstr_get(&(cfgre.wan_ifname)),
-                                  cfgstr_get(&(cfg->wan_ifname))) != 0)
-                        {
-                                /* if wan ifname change, reupdate all
-                                 * accounts
-                                 */
-                                account_ctl_needupdate();
-                        }
-                }
-                else if(cfgre.wan_cnt_type == wan_cnt_indirect)
-                {
-                        myip_needupdate();
-                }
+                /* get the wan ips again, only the accounts of a wan
+                 * whose ip differs are updated
+                 */
+                wan_ctl_prune();
+                wan_ctl_needupdate();
 
                 /* update configuration */
                 config_move(&cfgre, cfg);
 
+                /* it can only grow, a failure keeps the old one */
+                request_ctl_reserve(cfg->request_reserve);
+
                 ret = 0;
         }
         else
@@ -208,31 +164,26 @@ static int reload_conf(struct cfg *cfg)
 int main(int argc, char **argv)
 {
 	int ret = 0;
-        sigset_t unblocked;
         struct cfg cfg;
-        struct timespec timeout = {0, 0};
-	fd_set readset, writeset;
-	int max_fd = -1;
 	FILE *fpid = NULL;
 
         /* init */
+        timer_ctl_init();
+        timer_init(&state_timer, state_timer_cb, &cfg);
+        wan_ctl_init();
         account_ctl_init();
         request_ctl_init();
-        services_populate_list();
-        inet_aton("0.0.0.0", &wanip);
         config_init(&cfg);
 
-        /* sig setup */
-        if(sig_setup() != 0)
+        if(services_populate_list() != 0)
         {
                 ret = 1;
                 goto exit_clean;
         }
 
+        /* signals are handled by the loop only */
         sig_blockall();
 
-        sigemptyset(&unblocked);
-
 	/* config */
 	if(config_parse(&cfg, argc, argv) != 0)
 	{
@@ -247,7 +198,9 @@ int main(int argc, char **argv)
 	/* open log */
 	log_open(&cfg);
 
-        /* daemonize ? */
+        /* daemonize ? before creating the loop fds, a signalfd
+         * only wakes up the process having set it up
+         */
         if(cfg.daemonize)
         {
                 if(daemon(0, 0) < 0)
@@ -258,6 +211,29 @@ int main(int argc, char **argv)
                 }
         }
 
+        /* event loop */
+        if(loop_init() != 0)
+        {
+                ret = 1;
+                goto exit_clean;
+        }
+
+        /* resolver (nameservers of resolv.conf) */
+        resolv_ctl_init(NULL);
+
+        /* sig setup */
+        if(sig_setup() != 0)
+        {
+                ret = 1;
+                goto exit_clean;
+        }
+
+        /* addresses of the wan interfaces */
+        if(netlink_ctl_init(wan_ctl_event, NULL) != 0)
+        {
+                log_warning("No rtnetlink, the wan interfaces are polled");
+        }
+
         /* create pid file ? */
         if(cfgstr_is_set(&(cfg.pidfile)))
         {
@@ -277,87 +253,93 @@ int main(int argc, char **argv)
                 }
         }
 
-        /* create account ctls */
-        if(account_ctl_mapcfg(&cfg) != 0)
+        /* the retry delays differ from a client to another */
+        backoff_ctl_seed((uint32_t)getpid() ^ (uint32_t)time(NULL));
+
+        /* requests allocated once for all */
+        if(request_ctl_reserve(cfg.request_reserve) != 0)
+        {
+                ret = 1;
+                goto exit_clean;
+        }
+
+        /* create wan then account ctls */
+        if(wan_ctl_mapcfg(&cfg) != 0
+           || account_ctl_mapcfg(&cfg) != 0)
         {
                 ret = 1;
                 goto exit_clean;
         }
 
+        /* don't update again the accounts updated before a restart */
+        if(cfgstr_is_set(&(cfg.statefile)))
+        {
+                state_load(cfgstr_get(&(cfg.statefile)));
+        }
+        state_generation = account_ctl_state_generation();
+        timer_start(&state_timer, STATE_SAVE_INT * 1000);
+
 	/* yaddns loop */
+        log_debug("Use %s event loop", loop_backend());
+
         keep_going = 1;
 	while(keep_going)
 	{
-                /* reinit variables for pselect() */
-                max_fd = 0;
-		FD_ZERO(&readset);
-                FD_ZERO(&writeset);
-
-                /* manage wan ip address */
-                wanip_manage(&cfg);
+                /* manage wan ip addresses */
+                wan_ctl_manage();
 
                 /* manage accounts */
                 account_ctl_manage(&cfg);
 
-                /* select request candidate fds */
-                request_ctl_selectfds(&readset, &writeset, &max_fd);
-
-                /* pselect */
-                timeout.tv_sec = 15;
-                if(pselect(max_fd + 1,
-                           &readset, &writeset, NULL,
-                           &timeout, &unblocked) < 0)
+                /* wait until the next deadline and process events */
+                if(loop_run_once(timer_ctl_next_timeout()) != 0)
                 {
-                        if(errno == EINTR)
-                        {
-                                /* signal was caught */
-                                log_debug("Signal was caught in pselect()");
+                        /* very serious cause of error */
+                        ret = 1;
+                        break;
+                }
 
-                                if(!keep_going)
-                                {
-                                        break;
-                                }
+                /* process expired deadlines */
+                timer_ctl_run();
 
-                                if(reloadconf)
-                                {
-                                        log_debug("reload configuration");
+                if(!keep_going)
+                {
+                        break;
+                }
 
-                                        reload_conf(&cfg);
+                if(reloadconf)
+                {
+                        log_debug("reload configuration");
 
-                                        reloadconf = 0;
-                                }
+                        /* the nameservers may have changed too */
+                        resolv_ctl_init(NULL);
 
-                                if(wakeup)
-                                {
-                                        log_debug("order retrieve wan ip addr");
+                        reload_conf(&cfg);
 
-                                        wanip_needupdate(&cfg);
+                        reloadconf = 0;
+                }
 
-                                        wakeup = 0;
-                                }
+                if(wakeup)
+                {
+                        log_debug("order retrieve wan ip addr");
 
-                                if(unfreeze)
-                                {
-                                        log_debug("unfreeze all accounts");
+                        wan_ctl_needupdate();
 
-                                        account_ctl_unfreeze_all();
+                        wakeup = 0;
+                }
 
-                                        unfreeze = 0;
-                                }
-                                continue;
-                        }
+                if(unfreeze)
+                {
+                        log_debug("unfreeze all accounts");
 
-                        /* very serious cause of error */
-                        log_critical("select failed ! %s",
-                                     strerror(errno));
-                        ret = 1;
-                        break;
-                }
+                        account_ctl_unfreeze_all();
 
-                /* process fds with have new state */
-                request_ctl_processfds(&readset, &writeset);
+                        unfreeze = 0;
+                }
 	}
 
+        state_sync(&cfg);
+
         log_debug("cleaning before exit");
 
 exit_clean:
@@ -372,6 +354,11 @@ exit_clean:
         /* free ctl */
         request_ctl_cleanup();
         account_ctl_cleanup();
+        wan_ctl_cleanup();
+        resolv_ctl_cleanup();
+        netlink_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
 
 	return ret;
 }
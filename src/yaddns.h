@@ -22,7 +22,4 @@
 #include <netinet/in.h>
 #include <sys/time.h>
 
-extern struct in_addr wanip;
-extern short int have_wanip;
-
 #endif
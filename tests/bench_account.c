@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../src/account.h"
+#include "../src/config.h"
+#include "../src/request.h"
+#include "../src/services.h"
+#include "../src/util.h"
+
+/*
+ * Time account_ctl_mapcfg(), account_ctl_get() and a reload of the
+ * same accounts (account_ctl_mapnewcfg()) with a growing count of
+ * accounts. Run by hand: ./bench_account [max accounts]
+ */
+
+static const char *services[] = {
+        "changeip", "duckdns", "dyndns", "dyndnsit",
+        "no-ip", "ovh", "sitelutions",
+};
+
+static double now_ms(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+static void cfg_fill(struct cfg *cfg, unsigned int count)
+{
+        struct cfg_account *accountcfg = NULL;
+        char name[32];
+        unsigned int i;
+
+        for(i = 0; i < count; ++i)
+        {
+                accountcfg = calloc(1, sizeof(struct cfg_account));
+                if(accountcfg == NULL)
+                {
+                        exit(1);
+                }
+
+                snprintf(name, sizeof(name), "account %u", i);
+                cfgstr_dup(&(accountcfg->name), name);
+                cfgstr_set(&(accountcfg->service),
+                           services[i % ARRAY_SIZE(services)]);
+                cfgstr_set(&(accountcfg->username), "user");
+                cfgstr_set(&(accountcfg->passwd), "passwd");
+                snprintf(name, sizeof(name), "host%u.example.org", i);
+                cfgstr_dup(&(accountcfg->hostname), name);
+
+                config_account_add(cfg, accountcfg);
+        }
+}
+
+int main(int argc, char **argv)
+{
+        struct account_mapreport report;
+        struct cfg cfg, cfgre;
+        unsigned int max = 100000;
+        unsigned int count, i;
+        char name[32];
+        double start, map_ms, get_ms, remap_ms;
+
+        if(argc > 1)
+        {
+                max = (unsigned int)strtoul(argv[1], NULL, 10);
+        }
+
+        if(services_populate_list() != 0)
+        {
+                return 1;
+        }
+        request_ctl_init();
+
+        printf("%10s %12s %16s %12s\n",
+               "accounts", "mapcfg (ms)", "get (ns/lookup)", "remap (ms)");
+
+        for(count = 1000; count <= max; count *= 10)
+        {
+                account_ctl_init();
+                config_init(&cfg);
+                cfg_fill(&cfg, count);
+
+                start = now_ms();
+                if(account_ctl_mapcfg(&cfg) != 0)
+                {
+                        return 1;
+                }
+                map_ms = now_ms() - start;
+
+                start = now_ms();
+                for(i = 0; i < count; ++i)
+                {
+                        snprintf(name, sizeof(name), "account %u", i);
+                        if(account_ctl_get(name) == NULL)
+                        {
+                                return 1;
+                        }
+                }
+                get_ms = now_ms() - start;
+
+                config_init(&cfgre);
+                cfg_fill(&cfgre, count);
+
+                start = now_ms();
+                if(account_ctl_mapnewcfg(&cfgre, &report) != 0
+                   || report.unchanged != count)
+                {
+                        return 1;
+                }
+                remap_ms = now_ms() - start;
+
+                config_move(&cfgre, &cfg);
+                config_free(&cfgre);
+
+                printf("%10u %12.2f %16.1f %12.2f\n",
+                       count, map_ms, get_ms * 1e6 / count, remap_ms);
+
+                account_ctl_cleanup();
+                config_free(&cfg);
+        }
+
+        request_ctl_cleanup();
+
+        return 0;
+}
@@ -1,12 +1,23 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "yatest.h"
+#include "yaserver.h"
+#include "yadns.h"
 
 #include "../src/account.h"
 #include "../src/config.h"
 #include "../src/util.h"
 #include "../src/services.h"
+#include "../src/wan.h"
+#include "../src/loop.h"
+#include "../src/timer.h"
+#include "../src/resolv.h"
 
 TEST_DEF(test_account_map)
 {
@@ -30,7 +41,11 @@ TEST_DEF(test_account_map)
 
 TEST_DEF(test_account_remap)
 {
+        struct account_mapreport report;
+        struct account *account = NULL;
+        struct cfg_account *accountcfg = NULL;
         struct cfg cfg, cfgre;
+        unsigned int count;
 
         request_ctl_init();
         account_ctl_init();
@@ -54,14 +69,32 @@ TEST_DEF(test_account_remap)
                     "config_parse_file(%s) failed",
                     cfgstr_get(&cfg.cfgfile));
 
-        TEST_ASSERT(account_ctl_mapnewcfg(&cfgre) == 0,
+        TEST_ASSERT(account_ctl_mapnewcfg(&cfgre, &report) == 0,
                     "account_ctl_mapnewcfg(%s) failed !",
                     cfgstr_get(&cfg.cfgfile));
 
+        /* the account was renamed: a new one */
+        TEST_ASSERT(report.added == 2 && report.removed == 1
+                    && report.changed == 0 && report.unchanged == 0,
+                    "%u added, %u removed, %u changed, %u unchanged",
+                    report.added, report.removed,
+                    report.changed, report.unchanged);
+
         /* update configuration */
         config_move(&cfgre, &cfg);
         config_free(&cfgre);
 
+        /* the old account cfgs are gone */
+        count = 0;
+        list_for_each_entry(accountcfg, &(cfg.account_list), list)
+        {
+                ++count;
+        }
+
+        TEST_ASSERT(count == 2 && cfg.account_index.count == 2
+                    && config_account_get(&cfg, "dyndns test") == NULL,
+                    "%u account cfgs after config_move()", count);
+
         /******* reload an another bad cfg file ********/
         config_init(&cfgre);
 
@@ -71,7 +104,7 @@ TEST_DEF(test_account_remap)
                     "config_parse_file(%s) failed !",
                     cfgstr_get(&cfg.cfgfile));
 
-        TEST_ASSERT(account_ctl_mapnewcfg(&cfgre) != 0,
+        TEST_ASSERT(account_ctl_mapnewcfg(&cfgre, NULL) != 0,
                     "account_ctl_mapnewcfg(%s) succeeded but we expected failed !",
                     cfgstr_get(&cfg.cfgfile));
 
@@ -85,7 +118,7 @@ TEST_DEF(test_account_remap)
                     "config_parse_file(%s) failed !",
                     cfgstr_get(&cfg.cfgfile));
 
-        TEST_ASSERT(account_ctl_mapnewcfg(&cfgre) != 0,
+        TEST_ASSERT(account_ctl_mapnewcfg(&cfgre, NULL) != 0,
                     "account_ctl_mapnewcfg(%s) succeeded but we expected failed !",
                     cfgstr_get(&cfg.cfgfile));
 
@@ -99,7 +132,7 @@ TEST_DEF(test_account_remap)
                     "config_parse_file(%s) failed !",
                     cfgstr_get(&cfg.cfgfile));
 
-        TEST_ASSERT(account_ctl_mapnewcfg(&cfgre) == 0,
+        TEST_ASSERT(account_ctl_mapnewcfg(&cfgre, NULL) == 0,
                     "account_ctl_mapnewcfg(%s) failed !",
                     cfgstr_get(&cfg.cfgfile));
 
@@ -107,19 +140,1382 @@ TEST_DEF(test_account_remap)
         config_move(&cfgre, &cfg);
         config_free(&cfgre);
 
+        /******* reload it again, nothing changes ********/
+        account = account_ctl_get("dyndns test");
+        account->updated = 1;
+
+        config_init(&cfgre);
+
+        cfgstr_set(&cfgre.cfgfile, "yaddns.good.conf");
+        TEST_ASSERT(config_parse_file(&cfgre) == 0,
+                    "config_parse_file(%s) failed !",
+                    cfgstr_get(&cfgre.cfgfile));
+
+        TEST_ASSERT(account_ctl_mapnewcfg(&cfgre, &report) == 0,
+                    "account_ctl_mapnewcfg(%s) failed !",
+                    cfgstr_get(&cfgre.cfgfile));
+
+        TEST_ASSERT(report.added == 0 && report.removed == 0
+                    && report.changed == 0 && report.unchanged == 1,
+                    "%u added, %u removed, %u changed, %u unchanged",
+                    report.added, report.removed,
+                    report.changed, report.unchanged);
+
+        TEST_ASSERT(account_ctl_get("dyndns test") == account
+                    && account->updated == 1,
+                    "unchanged account state lost");
+
+        config_move(&cfgre, &cfg);
+        config_free(&cfgre);
+
+        /******* a new password, the account is updated again ********/
+        config_init(&cfgre);
+
+        accountcfg = calloc(1, sizeof(struct cfg_account));
+        TEST_ASSERT(accountcfg != NULL, "calloc failed");
+        cfgstr_set(&(accountcfg->name), "dyndns test");
+        cfgstr_set(&(accountcfg->service), "dyndns");
+        cfgstr_set(&(accountcfg->username), "test");
+        cfgstr_set(&(accountcfg->passwd), "an other one");
+        cfgstr_set(&(accountcfg->hostname), "test.dyndns.org");
+        config_account_add(&cfgre, accountcfg);
+
+        TEST_ASSERT(account_ctl_mapnewcfg(&cfgre, &report) == 0,
+                    "account_ctl_mapnewcfg() failed !");
+
+        TEST_ASSERT(report.added == 0 && report.removed == 0
+                    && report.changed == 1 && report.unchanged == 0,
+                    "%u added, %u removed, %u changed, %u unchanged",
+                    report.added, report.removed,
+                    report.changed, report.unchanged);
+
+        TEST_ASSERT(account_ctl_get("dyndns test") == account
+                    && account->updated == 0,
+                    "changed account not reset");
+
+        config_move(&cfgre, &cfg);
+        config_free(&cfgre);
+
         /******* finish him ********/
         account_ctl_cleanup();
         config_free(&cfg);
 }
 
+/*
+ * read the batch answer body of the dyndns service
+ */
+static void dyndns2_read(const char *body, struct rc_report *reports,
+                         unsigned int count)
+{
+        static struct request_response response;
+        unsigned int i;
+
+        memset(&response, 0, sizeof(response));
+        response.status = 200;
+        snprintf(response.body, sizeof(response.body), "%s", body);
+        response.body_size = strlen(response.body);
+
+        for(i = 0; i < count; ++i)
+        {
+                memset(&(reports[i]), 0, sizeof(reports[i]));
+        }
+
+        services_get("dyndns")->read_batch(&response, reports, count);
+}
+
+TEST_DEF(test_account_dyndns2)
+{
+        struct rc_report reports[3];
+
+        /* a line by hostname */
+        dyndns2_read("good 192.0.2.1\nnohost\nnochg 192.0.2.1\n",
+                     reports, 3);
+        TEST_ASSERT(reports[0].code == up_success
+                    && reports[1].code == up_account_hostname_error
+                    && reports[2].code == up_success,
+                    "codes %d, %d, %d",
+                    reports[0].code, reports[1].code, reports[2].code);
+
+        /* a single line of a whole query code is for all */
+        dyndns2_read("badauth\n", reports, 3);
+        TEST_ASSERT(reports[1].code == up_account_loginpass_error
+                    && reports[2].code == up_account_loginpass_error,
+                    "codes %d, %d", reports[1].code, reports[2].code);
+
+        dyndns2_read("911\n", reports, 3);
+        TEST_ASSERT(reports[2].code == up_server_error
+                    && reports[2].retry_after > 0,
+                    "code %d, retry after %u",
+                    reports[2].code, reports[2].retry_after);
+
+        /* but not a single line of a hostname */
+        dyndns2_read("good 192.0.2.1\n", reports, 3);
+        TEST_ASSERT(reports[0].code == up_success
+                    && reports[1].code == up_unknown_error
+                    && reports[2].code == up_unknown_error,
+                    "codes %d, %d, %d",
+                    reports[0].code, reports[1].code, reports[2].code);
+
+        /* the hostnames without a line */
+        dyndns2_read("nochg 192.0.2.1\nnohost\n", reports, 3);
+        TEST_ASSERT(reports[1].code == up_account_hostname_error
+                    && reports[2].code == up_unknown_error,
+                    "codes %d, %d", reports[1].code, reports[2].code);
+
+        /* a line not understood */
+        dyndns2_read("good 192.0.2.1\nwhat ?\n", reports, 2);
+        TEST_ASSERT(reports[1].code == up_unknown_error,
+                    "code %d", reports[1].code);
+}
+
+TEST_DEF(test_account_lookup)
+{
+        struct service *service = NULL;
+        struct account *account = NULL;
+        struct cfg cfg;
+
+        /* the service table is perfect: every service has its slot */
+        list_for_each_entry(service, &service_list, list)
+        {
+                TEST_ASSERT(services_get(service->name) == service,
+                            "service '%s' not found (slot %u)",
+                            service->name, services_hash(service->name));
+        }
+
+        TEST_ASSERT(services_get("dyndn") == NULL
+                    && services_get("") == NULL,
+                    "found a missing service");
+
+        request_ctl_init();
+        account_ctl_init();
+        config_init(&cfg);
+
+        cfgstr_set(&cfg.cfgfile, "yaddns.good.conf");
+        TEST_ASSERT(config_parse_file(&cfg) == 0,
+                    "Failed to config_parse_file(%s)",
+                    cfgstr_get(&cfg.cfgfile));
+
+        TEST_ASSERT(config_account_get(&cfg, "dyndns test") != NULL
+                    && config_account_get(&cfg, "dyndns") == NULL,
+                    "config_account_get() failed !");
+
+        TEST_ASSERT(account_ctl_mapcfg(&cfg) == 0,
+                    "account_ctl_mapcfg() failed !");
+
+        account = account_ctl_get("dyndns test");
+        TEST_ASSERT(account != NULL
+                    && account->def == services_get("dyndns")
+                    && account_ctl_get("dyndns") == NULL,
+                    "account_ctl_get() failed !");
+
+        account_ctl_cleanup();
+        config_free(&cfg);
+}
+
+/*
+ * 4800 accounts updated at the same instant: their refreshes have to
+ * be in the last day of the period of their service, spread evenly
+ * by hour, and keep the same spread at the next period.
+ */
+TEST_DEF(test_account_refresh)
+{
+        static unsigned int buckets[24];
+        struct cfg_account *accountcfg = NULL;
+        struct cfg_service *servicecfg = NULL;
+        struct account *account = NULL;
+        struct cfg cfg;
+        char name[32];
+        const uint64_t now = 1000000;
+        const uint64_t period = (uint64_t)604800 * 1000;
+        const uint64_t window = (uint64_t)86400 * 1000;
+        uint64_t due, next;
+        unsigned int i, count = 4800;
+
+        request_ctl_init();
+        account_ctl_init();
+        config_init(&cfg);
+
+        /* dyndns accounts expire after 7 days */
+        servicecfg = calloc(1, sizeof(struct cfg_service));
+        TEST_ASSERT(servicecfg != NULL, "calloc failed");
+        cfgstr_set(&(servicecfg->name), "dyndns");
+        servicecfg->refresh = 604800;
+        list_add(&(servicecfg->list), &(cfg.service_list));
+
+        for(i = 0; i < count; ++i)
+        {
+                accountcfg = calloc(1, sizeof(struct cfg_account));
+                TEST_ASSERT(accountcfg != NULL, "calloc failed");
+                snprintf(name, sizeof(name), "account %u", i);
+                cfgstr_dup(&(accountcfg->name), name);
+                cfgstr_set(&(accountcfg->service), "dyndns");
+                snprintf(name, sizeof(name), "host%u.example.org", i);
+                cfgstr_dup(&(accountcfg->hostname), name);
+                config_account_add(&cfg, accountcfg);
+        }
+
+        TEST_ASSERT(account_ctl_mapcfg(&cfg) == 0,
+                    "account_ctl_mapcfg() failed !");
+
+        list_for_each_entry(account, &account_list, list)
+        {
+                due = account_refresh_at(account, now);
+                TEST_ASSERT(due > now + period - window
+                            && due <= now + period,
+                            "'%s' refreshed at %lu ms",
+                            cfgstr_get(&(account->cfg->name)),
+                            (unsigned long)(due - now));
+
+                ++buckets[(now + period - due) / (window / 24)];
+
+                /* refreshed on time, its next refresh is one period
+                 * later (the period is a multiple of the window)
+                 */
+                next = account_refresh_at(account, due);
+                TEST_ASSERT(next - due == period,
+                            "'%s' refreshed again after %lu ms",
+                            cfgstr_get(&(account->cfg->name)),
+                            (unsigned long)(next - due));
+        }
+
+        /* 200 by hour */
+        for(i = 0; i < ARRAY_SIZE(buckets); ++i)
+        {
+                TEST_ASSERT(buckets[i] >= 140 && buckets[i] <= 260,
+                            "%u refreshes in hour %u", buckets[i], i);
+        }
+
+        /* the other services keep the 28 days, no window no spread */
+        account_ctl_cleanup();
+        account_ctl_init();
+        cfg.refresh_window = 0;
+        cfgstr_set(&(accountcfg->service), "no-ip");
+        TEST_ASSERT(account_ctl_mapcfg(&cfg) == 0,
+                    "account_ctl_mapcfg() failed !");
+
+        account = account_ctl_get(cfgstr_get(&(accountcfg->name)));
+        TEST_ASSERT(account_refresh_at(account, now)
+                    == now + (uint64_t)2419200 * 1000,
+                    "no-ip refreshed at %lu ms",
+                    (unsigned long)(account_refresh_at(account, now) - now));
+
+        account_ctl_cleanup();
+        config_free(&cfg);
+        request_ctl_cleanup();
+}
+
+/*
+ * Two services on a http server on 127.0.0.1. The query is
+ * "/<service>?<hostnames>", the server answers a line by hostname,
+ * "good /<service>" or "nohost /<service>" for a hostname starting
+ * by "bad", and closes. A first hostname starting by "wait" gets a
+ * 503 with a Retry-After of 120 s and "wait /<service>" lines. The
+ * services count their queries in flight and keep the wan ip of the
+ * last one.
+ */
+static struct yaserver admit_server;
+static unsigned int admit_inflight[2];
+static unsigned int admit_inflight_max[2];
+static unsigned int admit_updates = 0;
+static char admit_wanip[INET_ADDRSTRLEN];
+
+static void admit_reset(void)
+{
+        memset(admit_inflight, 0, sizeof(admit_inflight));
+        memset(admit_inflight_max, 0, sizeof(admit_inflight_max));
+        admit_updates = 0;
+        admit_wanip[0] = '\0';
+}
+
+static int admit_make_query(const struct cfg_account *cfg,
+                            const char * const newwanip,
+                            struct request_buff *buff)
+{
+        int i = (strcmp(cfgstr_get(&(cfg->service)), "dyndns") == 0);
+
+        snprintf(admit_wanip, sizeof(admit_wanip), "%s", newwanip);
+
+        if(++admit_inflight[i] > admit_inflight_max[i])
+        {
+                admit_inflight_max[i] = admit_inflight[i];
+        }
+
+        return request_buff_printf(buff, "GET /%d?%s HTTP/1.0\r\n\r\n",
+                                   i, cfgstr_get(&(cfg->hostname)));
+}
+
+static int admit_read_resp(struct request_response *response,
+                           struct rc_report *report)
+{
+        const char *path = strchr(response->body, '/');
+
+        if(path == NULL)
+        {
+                return -1;
+        }
+
+        --admit_inflight[path[1] == '1'];
+        ++admit_updates;
+
+        if(strncmp(response->body, "wait", 4) == 0)
+        {
+                report->code = up_server_error;
+        }
+        else
+        {
+                report->code = (strncmp(response->body, "good", 4) == 0
+                                ? up_success : up_account_hostname_error);
+        }
+
+        return 0;
+}
+
+static int admit_read_batch(struct request_response *response,
+                            struct rc_report *reports,
+                            unsigned int count)
+{
+        const char *line = response->body;
+        unsigned int i;
+
+        if(strchr(line, '/') == NULL)
+        {
+                return -1;
+        }
+
+        --admit_inflight[strchr(line, '/')[1] == '1'];
+
+        for(i = 0; i < count && *line != '\0'; ++i)
+        {
+                ++admit_updates;
+                reports[i].code = (strncmp(line, "good", 4) == 0
+                                   ? up_success : up_account_hostname_error);
+                line += strcspn(line, "\n");
+                line += (*line == '\n');
+        }
+
+        return 0;
+}
+
+static struct service admit_services[] = {
+        {
+                .name = "no-ip",
+                .ipserv = "127.0.0.1",
+                .make_query = admit_make_query,
+                .read_resp = admit_read_resp,
+        },
+        {
+                .name = "dyndns",
+                .ipserv = "127.0.0.1",
+                .make_query = admit_make_query,
+                .read_resp = admit_read_resp,
+                .read_batch = admit_read_batch,
+        },
+};
+
+static size_t admit_answer(unsigned char *buf, size_t len, size_t size,
+                           const struct sockaddr_in *from)
+{
+        char *query = (char *)buf;
+        char response[512];
+        char *host = NULL;
+        size_t size_host;
+        size_t n;
+        int wait;
+
+        UNUSED(from);
+
+        if(len <= 7)
+        {
+                return 0;
+        }
+
+        query[4 + strcspn(query + 4, " ")] = '\0';
+
+        wait = (strncmp(query + 7, "wait", 4) == 0);
+        n = (size_t)snprintf(response, sizeof(response), "%s",
+                             (wait
+                              ? "HTTP/1.0 503 Service Unavailable\r\n"
+                              "Retry-After: 120\r\n\r\n"
+                              : "HTTP/1.0 200 OK\r\n\r\n"));
+        for(host = query + 7;; host += size_host + 1)
+        {
+                size_host = strcspn(host, ",");
+                n += (size_t)snprintf(response + n, sizeof(response) - n,
+                                      "%s /%c\n",
+                                      (wait ? "wait"
+                                       : strncmp(host, "bad", 3) == 0
+                                       ? "nohost" : "good"),
+                                      query[5]);
+                if(host[size_host] == '\0' || n >= sizeof(response))
+                {
+                        break;
+                }
+        }
+
+        return (size_t)snprintf(query, size, "%s", response);
+}
+
+static unsigned short int admit_server_start(void)
+{
+        return yaserver_start(&admit_server, SOCK_STREAM, admit_answer);
+}
+
+static void admit_server_stop(void)
+{
+        yaserver_stop(&admit_server);
+}
+
+TEST_DEF(test_account_admission)
+{
+        struct account_stats stats;
+        struct cfg_account *accountcfg = NULL;
+        struct account *account = NULL;
+        struct cfg cfg;
+        unsigned short int port;
+        char name[16];
+        uint64_t end;
+        unsigned int i;
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        resolv_ctl_init("/nonexistent");
+        request_ctl_init();
+        account_ctl_init();
+        config_init(&cfg);
+        admit_reset();
+
+        port = admit_server_start();
+        TEST_ASSERT(port != 0, "Unable to start the server");
+        admit_services[0].portserv = port;
+        admit_services[1].portserv = port;
+
+        /* 8 accounts, 4 by service, 3 in flight, 2 by service */
+        cfg.wan_cnt_type = wan_cnt_indirect;
+        cfg.inflight_max = 3;
+        cfg.service_inflight_max = 2;
+
+        for(i = 0; i < 8; ++i)
+        {
+                accountcfg = calloc(1, sizeof(struct cfg_account));
+                TEST_ASSERT(accountcfg != NULL, "calloc failed");
+                snprintf(name, sizeof(name), "account %u", i);
+                cfgstr_dup(&(accountcfg->name), name);
+                cfgstr_set(&(accountcfg->service),
+                           admit_services[i % 2].name);
+                config_account_add(&cfg, accountcfg);
+        }
+
+        TEST_ASSERT(account_ctl_mapcfg(&cfg) == 0,
+                    "account_ctl_mapcfg() failed !");
+
+        list_for_each_entry(account, &account_list, list)
+        {
+                account->def = &(admit_services[account->def
+                                                == services_get("dyndns")]);
+        }
+
+        wan_default.have_ip = 1;
+        account_ctl_manage(&cfg);
+
+        account_ctl_stats(&stats);
+        TEST_ASSERT(stats.inflight == 3 && stats.queued == 5,
+                    "%u in flight, %u queued", stats.inflight, stats.queued);
+
+        end = timer_now() + 5000;
+        while(admit_updates < 8 && timer_now() < end)
+        {
+                loop_run_once(100);
+                timer_ctl_run();
+                account_ctl_manage(&cfg);
+        }
+
+        account_ctl_stats(&stats);
+        TEST_ASSERT(admit_updates == 8 && stats.dispatched == 8
+                    && stats.queued == 0 && stats.inflight == 0,
+                    "%u updates, %lu dispatched, %u queued, %u in flight",
+                    admit_updates, stats.dispatched,
+                    stats.queued, stats.inflight);
+
+        TEST_ASSERT(stats.inflight_high_water == 3
+                    && stats.queued_high_water == 8,
+                    "in flight high water %u, queue high water %u",
+                    stats.inflight_high_water, stats.queued_high_water);
+
+        TEST_ASSERT(admit_inflight_max[0] <= 2 && admit_inflight_max[1] <= 2,
+                    "%u and %u updates in flight by service",
+                    admit_inflight_max[0], admit_inflight_max[1]);
+
+        list_for_each_entry(account, &account_list, list)
+        {
+                TEST_ASSERT(account->updated && account->status == ASOk,
+                            "account '%s' not updated",
+                            cfgstr_get(&(account->cfg->name)));
+        }
+
+        wan_default.have_ip = 0;
+        admit_server_stop();
+        account_ctl_cleanup();
+        config_free(&cfg);
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
+TEST_DEF(test_account_parked)
+{
+        struct account_stats stats;
+        struct cfg_account *accountcfg = NULL;
+        struct account *account = NULL;
+        struct cfg cfg;
+        char name[16];
+        uint64_t end;
+        unsigned int i;
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        resolv_ctl_init("/nonexistent");
+        request_ctl_init();
+        account_ctl_init();
+        config_init(&cfg);
+        admit_reset();
+
+        admit_services[0].portserv = admit_server_start();
+        TEST_ASSERT(admit_services[0].portserv != 0,
+                    "Unable to start the server");
+
+        /* 6 accounts of one service, 2 in flight by service */
+        cfg.wan_cnt_type = wan_cnt_indirect;
+        cfg.service_inflight_max = 2;
+
+        for(i = 0; i < 6; ++i)
+        {
+                accountcfg = calloc(1, sizeof(struct cfg_account));
+                TEST_ASSERT(accountcfg != NULL, "calloc failed");
+                snprintf(name, sizeof(name), "account %u", i);
+                cfgstr_dup(&(accountcfg->name), name);
+                cfgstr_set(&(accountcfg->service), "no-ip");
+                config_account_add(&cfg, accountcfg);
+        }
+
+        TEST_ASSERT(account_ctl_mapcfg(&cfg) == 0,
+                    "account_ctl_mapcfg() failed !");
+
+        list_for_each_entry(account, &account_list, list)
+        {
+                account->def = &(admit_services[0]);
+        }
+
+        /* the other ones aren't scanned again until one is done */
+        wan_default.have_ip = 1;
+        account_ctl_manage(&cfg);
+
+        account_ctl_stats(&stats);
+        TEST_ASSERT(stats.inflight == 2 && stats.queued == 4
+                    && stats.parked == 4,
+                    "%u in flight, %u queued, %u parked",
+                    stats.inflight, stats.queued, stats.parked);
+
+        end = timer_now() + 5000;
+        while(admit_updates < 6 && timer_now() < end)
+        {
+                loop_run_once(100);
+                timer_ctl_run();
+                account_ctl_manage(&cfg);
+        }
+
+        account_ctl_stats(&stats);
+        TEST_ASSERT(admit_updates == 6 && stats.dispatched == 6
+                    && stats.queued == 0 && stats.parked == 0,
+                    "%u updates, %lu dispatched, %u queued, %u parked",
+                    admit_updates, stats.dispatched,
+                    stats.queued, stats.parked);
+        TEST_ASSERT(admit_inflight_max[0] <= 2,
+                    "%u updates in flight", admit_inflight_max[0]);
+
+        wan_default.have_ip = 0;
+        admit_server_stop();
+        account_ctl_cleanup();
+        config_free(&cfg);
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
+TEST_DEF(test_account_batch)
+{
+        struct account_stats stats;
+        struct cfg_account *accountcfg = NULL;
+        struct account *account = NULL;
+        struct cfg cfg;
+        unsigned short int port;
+        char name[32];
+        uint64_t end;
+        unsigned int i;
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        resolv_ctl_init("/nonexistent");
+        request_ctl_init();
+        account_ctl_init();
+        config_init(&cfg);
+        admit_reset();
+
+        port = admit_server_start();
+        TEST_ASSERT(port != 0, "Unable to start the server");
+        admit_services[1].portserv = port;
+        admit_services[1].batch_max = 3;
+
+        /* 5 accounts of user a (one with a bad hostname), 2 of user b:
+         * 2 queries for a, 1 for b
+         */
+        cfg.wan_cnt_type = wan_cnt_indirect;
+
+        for(i = 0; i < 7; ++i)
+        {
+                accountcfg = calloc(1, sizeof(struct cfg_account));
+                TEST_ASSERT(accountcfg != NULL, "calloc failed");
+                snprintf(name, sizeof(name), "account %u", i);
+                cfgstr_dup(&(accountcfg->name), name);
+                cfgstr_set(&(accountcfg->service), "dyndns");
+                cfgstr_set(&(accountcfg->username), (i < 5 ? "a" : "b"));
+                cfgstr_set(&(accountcfg->passwd), "passwd");
+                snprintf(name, sizeof(name), "%s%u.example.org",
+                         (i == 3 ? "bad" : "host"), i);
+                cfgstr_dup(&(accountcfg->hostname), name);
+                config_account_add(&cfg, accountcfg);
+        }
+
+        TEST_ASSERT(account_ctl_mapcfg(&cfg) == 0,
+                    "account_ctl_mapcfg() failed !");
+
+        list_for_each_entry(account, &account_list, list)
+        {
+                account->def = &(admit_services[1]);
+        }
+
+        wan_default.have_ip = 1;
+
+        end = timer_now() + 5000;
+        while(admit_updates < 7 && timer_now() < end)
+        {
+                account_ctl_manage(&cfg);
+                loop_run_once(100);
+                timer_ctl_run();
+        }
+
+        account_ctl_stats(&stats);
+        TEST_ASSERT(admit_updates == 7 && stats.dispatched == 3
+                    && stats.batched == 4 && stats.inflight == 0,
+                    "%u updates, %lu queries, %lu batched, %u in flight",
+                    admit_updates, stats.dispatched, stats.batched,
+                    stats.inflight);
+
+        /* the result of each hostname went to its account */
+        list_for_each_entry(account, &account_list, list)
+        {
+                if(strncmp(cfgstr_get(&(account->cfg->hostname)),
+                           "bad", 3) == 0)
+                {
+                        TEST_ASSERT(!account->updated && account->locked,
+                                    "account '%s' not locked",
+                                    cfgstr_get(&(account->cfg->name)));
+                }
+                else
+                {
+                        TEST_ASSERT(account->updated
+                                    && account->status == ASOk,
+                                    "account '%s' not updated",
+                                    cfgstr_get(&(account->cfg->name)));
+                }
+
+                TEST_ASSERT(list_empty(&(account->batch)),
+                            "account '%s' still in a batch",
+                            cfgstr_get(&(account->cfg->name)));
+        }
+
+        wan_default.have_ip = 0;
+        admit_services[1].batch_max = 0;
+        admit_server_stop();
+        account_ctl_cleanup();
+        config_free(&cfg);
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
+/*
+ * the next account updated, one at a time
+ */
+static struct account *priority_next(const struct cfg *cfg)
+{
+        struct account *account = NULL;
+        uint64_t end = timer_now() + 5000;
+
+        while(timer_now() < end)
+        {
+                account_ctl_manage(cfg);
+
+                list_for_each_entry(account, &account_list, list)
+                {
+                        if(account->status == ASWorking)
+                        {
+                                return account;
+                        }
+                }
+
+                loop_run_once(100);
+                timer_ctl_run();
+        }
+
+        return NULL;
+}
+
+TEST_DEF(test_account_priority)
+{
+        /* the normal ones in the order of the cfg list (the last
+         * added first)
+         */
+        static const char *order[] = {
+                "account 3", "account 2", "account 1", "account 0",
+        };
+        struct account_stats stats;
+        struct cfg_account *accountcfg = NULL;
+        struct account *account = NULL;
+        struct cfg cfg;
+        char name[16];
+        uint64_t end;
+        unsigned int i;
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        resolv_ctl_init("/nonexistent");
+        request_ctl_init();
+        account_ctl_init();
+        config_init(&cfg);
+        admit_reset();
+
+        admit_services[0].portserv = admit_server_start();
+        TEST_ASSERT(admit_services[0].portserv != 0,
+                    "Unable to start the server");
+
+        /* one update at a time, account 3 is critical, account 0 not */
+        cfg.wan_cnt_type = wan_cnt_indirect;
+        cfg.inflight_max = 1;
+
+        for(i = 0; i < 4; ++i)
+        {
+                accountcfg = calloc(1, sizeof(struct cfg_account));
+                TEST_ASSERT(accountcfg != NULL, "calloc failed");
+                snprintf(name, sizeof(name), "account %u", i);
+                cfgstr_dup(&(accountcfg->name), name);
+                cfgstr_set(&(accountcfg->service), "no-ip");
+                accountcfg->priority = (i == 3 ? cfg_priority_high
+                                        : i == 0 ? cfg_priority_low
+                                        : cfg_priority_normal);
+                config_account_add(&cfg, accountcfg);
+        }
+
+        TEST_ASSERT(account_ctl_mapcfg(&cfg) == 0,
+                    "account_ctl_mapcfg() failed !");
+
+        list_for_each_entry(account, &account_list, list)
+        {
+                account->def = &(admit_services[0]);
+        }
+
+        wan_default.have_ip = 1;
+
+        for(i = 0; i < ARRAY_SIZE(order); ++i)
+        {
+                account = priority_next(&cfg);
+                TEST_ASSERT(account != NULL
+                            && strcmp(cfgstr_get(&(account->cfg->name)),
+                                      order[i]) == 0,
+                            "update %u for '%s' ('%s' expected)", i,
+                            (account != NULL
+                             ? cfgstr_get(&(account->cfg->name)) : "none"),
+                            order[i]);
+
+                end = timer_now() + 5000;
+                while(!account->updated && timer_now() < end)
+                {
+                        loop_run_once(100);
+                        timer_ctl_run();
+                }
+        }
+
+        /* nothing to do for updated accounts */
+        account_ctl_manage(&cfg);
+        account_ctl_stats(&stats);
+        TEST_ASSERT(admit_updates == 4 && stats.dispatched == 4
+                    && stats.queued == 0 && stats.inflight == 0,
+                    "%u updates, %lu dispatched, %u queued, %u in flight",
+                    admit_updates, stats.dispatched,
+                    stats.queued, stats.inflight);
+
+        /* the wan ip changes, the critical one goes first again */
+        account_ctl_needupdate();
+        account = priority_next(&cfg);
+        TEST_ASSERT(account != NULL
+                    && strcmp(cfgstr_get(&(account->cfg->name)),
+                              "account 3") == 0,
+                    "'%s' updated first after a wan ip change",
+                    (account != NULL
+                     ? cfgstr_get(&(account->cfg->name)) : "none"));
+
+        wan_default.have_ip = 0;
+        admit_server_stop();
+        account_ctl_cleanup();
+        config_free(&cfg);
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
+/*
+ * An authoritative dns stand-in on 127.0.0.1: the hostnames starting
+ * by "match" resolve to 192.0.2.1, the other ones to 198.51.100.1.
+ */
+static struct yaserver precheck_server;
+static unsigned int precheck_queries = 0;
+
+static size_t precheck_answer(unsigned char *pkt, size_t len, size_t size,
+                              const struct sockaddr_in *from)
+{
+        int match;
+
+        UNUSED(from);
+
+        if(len < 17)
+        {
+                return 0;
+        }
+
+        ++precheck_queries;
+        match = (memcmp(pkt + 13, "match", 5) == 0);
+
+        len = yadns_reply(pkt, len, YADNS_AA);
+
+        return yadns_put_a(pkt, len, size, YADNS_QNAME, 60,
+                           (match ? "192.0.2.1" : "198.51.100.1"));
+}
+
+static unsigned short int precheck_start(void)
+{
+        return yaserver_start(&precheck_server, SOCK_DGRAM, precheck_answer);
+}
+
+static void precheck_stop(void)
+{
+        yaserver_stop(&precheck_server);
+}
+
+/*
+ * run the loop until the accounts are updated (or 5 seconds)
+ */
+static void precheck_run(const struct cfg *cfg)
+{
+        struct account *account = NULL;
+        uint64_t end = timer_now() + 5000;
+        int pending = 1;
+
+        while(pending && timer_now() < end)
+        {
+                account_ctl_manage(cfg);
+                loop_run_once(50);
+                timer_ctl_run();
+
+                pending = 0;
+                list_for_each_entry(account, &account_list, list)
+                {
+                        pending |= !account->updated;
+                }
+        }
+}
+
+TEST_DEF(test_account_precheck)
+{
+        struct account_stats stats;
+        struct cfg_account *accountcfg = NULL;
+        struct cfg cfg;
+        unsigned short int port;
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        resolv_ctl_init("/nonexistent");
+        resolv_ctl_set_options(200, 1);
+        request_ctl_init();
+        account_ctl_init();
+        config_init(&cfg);
+        admit_reset();
+
+        admit_services[0].portserv = admit_server_start();
+        TEST_ASSERT(admit_services[0].portserv != 0,
+                    "Unable to start the server");
+        port = precheck_start();
+        TEST_ASSERT(port != 0, "Unable to start the dns server");
+
+        cfg.wan_cnt_type = wan_cnt_indirect;
+        cfg.precheck = 1;
+        cfgstr_set(&(cfg.precheck_server), "127.0.0.1");
+        cfg.precheck_port = port;
+
+        accountcfg = calloc(1, sizeof(struct cfg_account));
+        TEST_ASSERT(accountcfg != NULL, "calloc failed");
+        cfgstr_set(&(accountcfg->name), "in effect");
+        cfgstr_set(&(accountcfg->service), "no-ip");
+        cfgstr_set(&(accountcfg->hostname), "match.example.org");
+        config_account_add(&cfg, accountcfg);
+
+        accountcfg = calloc(1, sizeof(struct cfg_account));
+        TEST_ASSERT(accountcfg != NULL, "calloc failed");
+        cfgstr_set(&(accountcfg->name), "outdated");
+        cfgstr_set(&(accountcfg->service), "no-ip");
+        cfgstr_set(&(accountcfg->hostname), "host.example.org");
+        config_account_add(&cfg, accountcfg);
+
+        TEST_ASSERT(account_ctl_mapcfg(&cfg) == 0,
+                    "account_ctl_mapcfg() failed !");
+        account_ctl_get("in effect")->def = &(admit_services[0]);
+        account_ctl_get("outdated")->def = &(admit_services[0]);
+
+        inet_pton(AF_INET, "192.0.2.1", &(wan_default.ip));
+        wan_default.have_ip = 1;
+
+        /* only the outdated one is sent to the service */
+        precheck_run(&cfg);
+
+        account_ctl_stats(&stats);
+        TEST_ASSERT(precheck_queries == 2 && admit_updates == 1
+                    && stats.prechecked == 1 && stats.dispatched == 1,
+                    "%u dns queries, %u updates, %lu prechecked,"
+                    " %lu dispatched",
+                    precheck_queries, admit_updates,
+                    stats.prechecked, stats.dispatched);
+
+        TEST_ASSERT(account_ctl_get("in effect")->status == ASOk
+                    && account_ctl_get("in effect")->updated
+                    && account_ctl_get("outdated")->status == ASOk,
+                    "accounts not updated");
+
+        /* no answer of the dns, both are sent */
+        precheck_stop();
+        inet_pton(AF_INET, "192.0.2.2", &(wan_default.ip));
+        account_ctl_wanipchanged(&wan_default);
+        precheck_run(&cfg);
+
+        account_ctl_stats(&stats);
+        TEST_ASSERT(admit_updates == 3 && stats.prechecked == 1,
+                    "%u updates, %lu prechecked",
+                    admit_updates, stats.prechecked);
+
+        wan_default.have_ip = 0;
+        wan_default.ip.s_addr = 0;
+        admit_server_stop();
+        account_ctl_cleanup();
+        config_free(&cfg);
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
+/*
+ * manage the accounts until count updates are done
+ */
+static void wan_run(const struct cfg *cfg, unsigned int count)
+{
+        uint64_t end = timer_now() + 5000;
+
+        while(admit_updates < count && timer_now() < end)
+        {
+                account_ctl_manage(cfg);
+                loop_run_once(50);
+                timer_ctl_run();
+        }
+}
+
+static void wan_add_account(struct cfg *cfg, const char *name,
+                            const char *wan)
+{
+        struct cfg_account *accountcfg = calloc(1, sizeof(struct cfg_account));
+
+        cfgstr_set(&(accountcfg->name), name);
+        cfgstr_set(&(accountcfg->service), "no-ip");
+        cfgstr_set(&(accountcfg->hostname), "host.example.org");
+        if(wan != NULL)
+        {
+                cfgstr_set(&(accountcfg->wan), wan);
+        }
+        config_account_add(cfg, accountcfg);
+}
+
+TEST_DEF(test_account_wan)
+{
+        struct account_mapreport report;
+        struct cfg_wan *wancfg = NULL;
+        struct account *account = NULL;
+        struct wan *backup = NULL;
+        struct cfg cfg, cfgre;
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        resolv_ctl_init("/nonexistent");
+        request_ctl_init();
+        wan_ctl_init();
+        account_ctl_init();
+        config_init(&cfg);
+        config_init(&cfgre);
+        admit_reset();
+
+        admit_services[0].portserv = admit_server_start();
+        TEST_ASSERT(admit_services[0].portserv != 0,
+                    "Unable to start the server");
+
+        /* 2 accounts on the default wan, 2 on the backup one (its ip
+         * is set by hand, never asked to the myip service)
+         */
+        wancfg = calloc(1, sizeof(struct cfg_wan));
+        TEST_ASSERT(wancfg != NULL, "calloc failed");
+        cfgstr_set(&(wancfg->name), "backup");
+        wancfg->type = wan_cnt_indirect;
+        cfgstr_set(&(wancfg->myip.provider[0].host), "127.0.0.1");
+        cfgstr_set(&(wancfg->myip.provider[0].path), "/");
+        wancfg->myip.provider[0].port = 1;
+        wancfg->myip.count = 1;
+        wancfg->myip.upint = 60;
+        list_add_tail(&(wancfg->list), &(cfg.wan_list));
+
+        cfg.wan_cnt_type = wan_cnt_indirect;
+        wan_add_account(&cfg, "main 0", NULL);
+        wan_add_account(&cfg, "main 1", NULL);
+        wan_add_account(&cfg, "backup 0", "backup");
+        wan_add_account(&cfg, "backup 1", "backup");
+
+        TEST_ASSERT(wan_ctl_mapcfg(&cfg) == 0, "wan_ctl_mapcfg() failed !");
+        TEST_ASSERT(account_ctl_mapcfg(&cfg) == 0,
+                    "account_ctl_mapcfg() failed !");
+
+        backup = wan_ctl_get("backup");
+        TEST_ASSERT(backup != NULL && backup != &wan_default,
+                    "no backup wan");
+        TEST_ASSERT(account_ctl_get("main 0")->wan == &wan_default
+                    && account_ctl_get("backup 1")->wan == backup,
+                    "accounts not attached to their wan");
+
+        list_for_each_entry(account, &account_list, list)
+        {
+                account->def = &(admit_services[0]);
+        }
+
+        /* only the backup wan has an ip */
+        inet_pton(AF_INET, "192.0.2.2", &(backup->ip));
+        backup->have_ip = 1;
+        wan_run(&cfg, 2);
+
+        TEST_ASSERT(admit_updates == 2
+                    && strcmp(admit_wanip, "192.0.2.2") == 0,
+                    "%u updates, last with %s", admit_updates, admit_wanip);
+        TEST_ASSERT(account_ctl_get("backup 0")->updated
+                    && account_ctl_get("backup 1")->updated
+                    && !account_ctl_get("main 0")->updated
+                    && !account_ctl_get("main 1")->updated,
+                    "accounts updated without the ip of their wan");
+
+        inet_pton(AF_INET, "192.0.2.1", &(wan_default.ip));
+        wan_default.have_ip = 1;
+        wan_run(&cfg, 4);
+
+        TEST_ASSERT(admit_updates == 4
+                    && strcmp(admit_wanip, "192.0.2.1") == 0
+                    && account_ctl_get("main 0")->ip.s_addr
+                    == wan_default.ip.s_addr,
+                    "%u updates, last with %s", admit_updates, admit_wanip);
+
+        /* a new backup ip only dirties the backup accounts */
+        inet_pton(AF_INET, "192.0.2.3", &(backup->ip));
+        account_ctl_wanipchanged(backup);
+
+        TEST_ASSERT(account_ctl_get("main 0")->updated
+                    && account_ctl_get("main 1")->updated
+                    && !account_ctl_get("backup 0")->updated
+                    && !account_ctl_get("backup 1")->updated,
+                    "wan ip change not limited to its accounts");
+
+        wan_run(&cfg, 6);
+        TEST_ASSERT(admit_updates == 6
+                    && strcmp(admit_wanip, "192.0.2.3") == 0,
+                    "%u updates, last with %s", admit_updates, admit_wanip);
+
+        /* the backup wan is removed, its accounts move to the default
+         * one and are updated again
+         */
+        cfgre.wan_cnt_type = wan_cnt_indirect;
+        wan_add_account(&cfgre, "main 0", NULL);
+        wan_add_account(&cfgre, "main 1", NULL);
+        wan_add_account(&cfgre, "backup 0", NULL);
+        wan_add_account(&cfgre, "backup 1", NULL);
+
+        TEST_ASSERT(wan_ctl_mapcfg(&cfgre) == 0
+                    && account_ctl_mapnewcfg(&cfgre, &report) == 0,
+                    "remap failed !");
+        wan_ctl_prune();
+
+        TEST_ASSERT(report.changed == 2 && report.unchanged == 2,
+                    "%u changed, %u unchanged",
+                    report.changed, report.unchanged);
+        TEST_ASSERT(wan_ctl_get("backup") == NULL
+                    && account_ctl_get("backup 0")->wan == &wan_default,
+                    "backup wan not removed");
+
+        wan_default.have_ip = 0;
+        wan_default.ip.s_addr = 0;
+        admit_server_stop();
+        account_ctl_cleanup();
+        wan_ctl_cleanup();
+        config_free(&cfgre);
+        config_free(&cfg);
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
+TEST_DEF(test_account_remap_inflight)
+{
+        struct account_mapreport report;
+        struct cfg_account *accountcfg = NULL;
+        struct account *account = NULL;
+        struct cfg cfg, cfgre;
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        resolv_ctl_init("/nonexistent");
+        request_ctl_init();
+        account_ctl_init();
+        config_init(&cfg);
+        config_init(&cfgre);
+        admit_reset();
+
+        admit_services[0].portserv = admit_server_start();
+        TEST_ASSERT(admit_services[0].portserv != 0,
+                    "Unable to start the server");
+
+        /* the update of the bad hostname is in flight ... */
+        cfg.wan_cnt_type = wan_cnt_indirect;
+        accountcfg = calloc(1, sizeof(struct cfg_account));
+        TEST_ASSERT(accountcfg != NULL, "calloc failed");
+        cfgstr_set(&(accountcfg->name), "account");
+        cfgstr_set(&(accountcfg->service), "no-ip");
+        cfgstr_set(&(accountcfg->hostname), "bad.example.org");
+        config_account_add(&cfg, accountcfg);
+
+        TEST_ASSERT(account_ctl_mapcfg(&cfg) == 0,
+                    "account_ctl_mapcfg() failed !");
+
+        account = account_ctl_get("account");
+        account->def = &(admit_services[0]);
+        wan_default.have_ip = 1;
+        account_ctl_manage(&cfg);
+        TEST_ASSERT(account->status == ASWorking, "update not in flight");
+
+        /* ... when the hostname is fixed */
+        cfgre.wan_cnt_type = wan_cnt_indirect;
+        wan_add_account(&cfgre, "account", NULL);
+
+        TEST_ASSERT(account_ctl_mapnewcfg(&cfgre, &report) == 0,
+                    "account_ctl_mapnewcfg() failed !");
+        TEST_ASSERT(report.changed == 1, "%u changed", report.changed);
+        TEST_ASSERT(account->status != ASWorking && !account->inflight,
+                    "old update still in flight");
+
+        /* only the new hostname is updated */
+        account->def = &(admit_services[0]);
+        wan_run(&cfgre, 1);
+        loop_run_once(100);
+
+        TEST_ASSERT(admit_updates == 1 && account->updated
+                    && account->status == ASOk && !account->locked,
+                    "%u updates, new hostname not updated", admit_updates);
+
+        wan_default.have_ip = 0;
+        admit_server_stop();
+        account_ctl_cleanup();
+        config_free(&cfgre);
+        config_free(&cfg);
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
+static uint64_t vclock = 0;
+
+static uint64_t vclock_now(void)
+{
+        return vclock;
+}
+
+/*
+ * update account until it's freezed or updated
+ */
+static void backoff_run(const struct cfg *cfg, struct account *account)
+{
+        int i;
+
+        for(i = 0; i < 50 && !account->freezed && !account->updated; ++i)
+        {
+                account_ctl_manage(cfg);
+                loop_run_once(100);
+                timer_ctl_run();
+        }
+}
+
+TEST_DEF(test_account_backoff)
+{
+        struct cfg_account *accountcfg = NULL;
+        struct cfg_service *servicecfg = NULL;
+        struct account *account = NULL;
+        struct cfg cfg;
+        uint64_t delay, ceiling;
+        unsigned int i;
+
+        vclock = 1000000;
+        timer_ctl_set_clock(vclock_now);
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        resolv_ctl_init("/nonexistent");
+        request_ctl_init();
+        account_ctl_init();
+        config_init(&cfg);
+        admit_reset();
+        backoff_ctl_seed(42);
+
+        cfg.wan_cnt_type = wan_cnt_indirect;
+
+        /* retries of dyndns in [5, 10 s], [10, 20 s], ... up to 80 s */
+        servicecfg = calloc(1, sizeof(struct cfg_service));
+        TEST_ASSERT(servicecfg != NULL, "calloc failed");
+        cfgstr_set(&(servicecfg->name), "dyndns");
+        servicecfg->retry_min = 10;
+        servicecfg->retry_max = 80;
+        list_add(&(servicecfg->list), &(cfg.service_list));
+
+        accountcfg = calloc(1, sizeof(struct cfg_account));
+        TEST_ASSERT(accountcfg != NULL, "calloc failed");
+        cfgstr_set(&(accountcfg->name), "account");
+        cfgstr_set(&(accountcfg->service), "dyndns");
+        cfgstr_set(&(accountcfg->hostname), "host.example.org");
+        config_account_add(&cfg, accountcfg);
+
+        TEST_ASSERT(account_ctl_mapcfg(&cfg) == 0,
+                    "account_ctl_mapcfg() failed !");
+
+        account = account_ctl_get("account");
+        account->def = &(admit_services[1]);
+        TEST_ASSERT(account->retry.min == 10000 && account->retry.max == 80000,
+                    "retry policy [%lu, %lu] ms",
+                    (unsigned long)account->retry.min,
+                    (unsigned long)account->retry.max);
+
+        /* the connections are refused */
+        admit_services[1].portserv = yaserver_closed_port(SOCK_STREAM);
+        wan_default.have_ip = 1;
+
+        for(i = 0; i < 6; ++i)
+        {
+                ceiling = MIN((uint64_t)10000 << i, (uint64_t)80000);
+
+                backoff_run(&cfg, account);
+                TEST_ASSERT(account->freezed && account->status == ASError,
+                            "retry %u: account not freezed", i);
+
+                delay = account->freeze_timer.expire - vclock;
+                TEST_ASSERT(delay >= ceiling / 2 && delay <= ceiling,
+                            "retry %u: delay %lu ms out of [%lu, %lu] ms",
+                            i, (unsigned long)delay,
+                            (unsigned long)(ceiling / 2),
+                            (unsigned long)ceiling);
+
+                /* time flies */
+                vclock = account->freeze_timer.expire;
+                timer_ctl_run();
+                TEST_ASSERT(!account->freezed, "retry %u: still freezed", i);
+        }
+
+        /* the service asks to wait 120 s, its errors aren't retried
+         * before 30 min whatever the request errors before
+         */
+        admit_services[1].portserv = admit_server_start();
+        TEST_ASSERT(admit_services[1].portserv != 0,
+                    "Unable to start the server");
+        cfgstr_set(&(accountcfg->hostname), "wait.example.org");
+
+        backoff_run(&cfg, account);
+        delay = account->freeze_timer.expire - vclock;
+        TEST_ASSERT(account->freezed
+                    && delay >= 1800000 && delay <= 3600000,
+                    "service error retried in %lu ms",
+                    (unsigned long)delay);
+
+        vclock = account->freeze_timer.expire;
+        timer_ctl_run();
+
+        backoff_run(&cfg, account);
+        delay = account->freeze_timer.expire - vclock;
+        TEST_ASSERT(account->freezed
+                    && delay >= 3600000 && delay <= 7200000,
+                    "service error retried again in %lu ms",
+                    (unsigned long)delay);
+
+        /* a success resets the delays */
+        cfgstr_set(&(accountcfg->hostname), "host.example.org");
+        vclock = account->freeze_timer.expire;
+        timer_ctl_run();
+
+        backoff_run(&cfg, account);
+        TEST_ASSERT(account->updated && account->status == ASOk
+                    && backoff_ceiling(&(account->backoff),
+                                       &(account->retry)) == 10000,
+                    "backoff not reset by the update");
+
+        wan_default.have_ip = 0;
+        admit_server_stop();
+        account_ctl_cleanup();
+        config_free(&cfg);
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+        timer_ctl_set_clock(NULL);
+}
+
 int main(void)
 {
         TEST_INIT("account");
 
-        services_populate_list();
+        if(services_populate_list() != 0)
+        {
+                return RET_ERROR;
+        }
 
         TEST_RUN(test_account_map);
         TEST_RUN(test_account_remap);
+        TEST_RUN(test_account_lookup);
+        TEST_RUN(test_account_dyndns2);
+        TEST_RUN(test_account_refresh);
+        TEST_RUN(test_account_admission);
+        TEST_RUN(test_account_parked);
+        TEST_RUN(test_account_batch);
+        TEST_RUN(test_account_priority);
+        TEST_RUN(test_account_precheck);
+        TEST_RUN(test_account_wan);
+        TEST_RUN(test_account_remap_inflight);
+        TEST_RUN(test_account_backoff);
 
 	return TEST_RETURN;
 }
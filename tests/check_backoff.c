@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "yatest.h"
+
+#include "../src/backoff.h"
+#include "../src/util.h"
+
+TEST_DEF(test_backoff_growth)
+{
+        const struct backoff_policy policy = {
+                .min = 5000,
+                .max = 60000,
+        };
+        const uint64_t ceilings[] = {
+                5000, 10000, 20000, 40000, 60000, 60000, 60000,
+        };
+        struct backoff backoff;
+        uint64_t ceiling, delay;
+        size_t i;
+        int j;
+
+        backoff_ctl_seed(42);
+        backoff_reset(&backoff);
+
+        for(i = 0; i < ARRAY_SIZE(ceilings); ++i)
+        {
+                ceiling = backoff_ceiling(&backoff, &policy);
+                TEST_ASSERT(ceiling == ceilings[i],
+                            "retry %zu: ceiling %lu (%lu expected)",
+                            i, (unsigned long)ceiling,
+                            (unsigned long)ceilings[i]);
+
+                delay = backoff_next(&backoff, &policy);
+                TEST_ASSERT(delay >= ceiling / 2 && delay <= ceiling,
+                            "retry %zu: delay %lu out of [%lu, %lu]",
+                            i, (unsigned long)delay,
+                            (unsigned long)(ceiling / 2),
+                            (unsigned long)ceiling);
+        }
+
+        /* the failures are forgotten */
+        backoff_reset(&backoff);
+        TEST_ASSERT(backoff_ceiling(&backoff, &policy) == policy.min,
+                    "ceiling %lu after a reset",
+                    (unsigned long)backoff_ceiling(&backoff, &policy));
+
+        /* capped whatever the count of failures */
+        for(j = 0; j < 1000; ++j)
+        {
+                delay = backoff_next(&backoff, &policy);
+                TEST_ASSERT(delay > 0 && delay <= policy.max,
+                            "delay %lu out of the cap", (unsigned long)delay);
+        }
+}
+
+TEST_DEF(test_backoff_jitter)
+{
+        const struct backoff_policy policy = {
+                .min = 1000,
+                .max = 1000,
+        };
+        struct backoff backoff;
+        unsigned int buckets[10];
+        uint64_t delay;
+        size_t i;
+        int j;
+
+        /* equal jitter: the delays spread over [ceiling / 2, ceiling] */
+        memset(buckets, 0, sizeof(buckets));
+        backoff_ctl_seed(1234);
+        backoff_reset(&backoff);
+
+        for(j = 0; j < 10000; ++j)
+        {
+                delay = backoff_next(&backoff, &policy);
+                TEST_ASSERT(delay >= 500, "delay %lu under the half",
+                            (unsigned long)delay);
+                ++buckets[MIN((delay - 500) / 50, (uint64_t)9)];
+        }
+
+        for(i = 0; i < ARRAY_SIZE(buckets); ++i)
+        {
+                TEST_ASSERT(buckets[i] > 800 && buckets[i] < 1200,
+                            "%u delays in [%zu, %zu[ ms",
+                            buckets[i], 500 + i * 50, 550 + i * 50);
+        }
+
+        /* the same seed, the same delays */
+        backoff_ctl_seed(7);
+        backoff_reset(&backoff);
+        delay = backoff_next(&backoff, &policy);
+
+        backoff_ctl_seed(7);
+        backoff_reset(&backoff);
+        TEST_ASSERT(backoff_next(&backoff, &policy) == delay,
+                    "the delays aren't reproducible");
+}
+
+int main(void)
+{
+        TEST_INIT("backoff");
+
+        TEST_RUN(test_backoff_growth);
+        TEST_RUN(test_backoff_jitter);
+
+	return TEST_RETURN;
+}
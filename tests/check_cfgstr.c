@@ -94,6 +94,32 @@ TEST_DEF(test_cfgstr_move)
         cfgstr_unset(&cfgstrdst);
 }
 
+TEST_DEF(test_cfgstr_copy)
+{
+        struct cfgstr cfgstr,
+                cfgstrdst;
+
+        cfgstr_init(&cfgstr);
+        cfgstr_init(&cfgstrdst);
+
+        cfgstr_set(&cfgstr, "My cfgstr");
+        cfgstr_copy(&cfgstr, &cfgstrdst);
+
+        TEST_ASSERT(cfgstr_equal(&cfgstr, &cfgstrdst),
+                    "%s != %s (equal expect !)",
+                    cfgstr_get(&cfgstr), cfgstr_get(&cfgstrdst));
+
+        /* an unset one unsets the copy */
+        cfgstr_unset(&cfgstr);
+        TEST_ASSERT(!cfgstr_equal(&cfgstr, &cfgstrdst),
+                    "unset cfgstr equal to %s", cfgstr_get(&cfgstrdst));
+
+        cfgstr_copy(&cfgstr, &cfgstrdst);
+        TEST_ASSERT(!cfgstr_is_set(&cfgstrdst)
+                    && cfgstr_equal(&cfgstr, &cfgstrdst),
+                    "copy of an unset cfgstr is set");
+}
+
 int main(void)
 {
         TEST_INIT("cfgstr");
@@ -103,6 +129,7 @@ int main(void)
         TEST_RUN(test_cfgstr_dup);
         TEST_RUN(test_cfgstr_unset);
         TEST_RUN(test_cfgstr_move);
+        TEST_RUN(test_cfgstr_copy);
 
 	return TEST_RETURN;
 }
@@ -1,9 +1,11 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "yatest.h"
 
 #include "../src/config.h"
+#include "../src/services.h"
 #include "../src/util.h"
 
 TEST_DEF(test_config_parse)
@@ -28,13 +30,124 @@ TEST_DEF(test_config_parse)
                     cfgstr_get(&cfg.cfgfile));
 
         config_free(&cfg);
+        config_init(&cfg);
+
+        /* precheck without its nameserver */
+        cfgstr_set(&cfg.cfgfile, "yaddns.invalid.precheck_no_server.conf");
+        TEST_ASSERT(config_parse_file(&cfg) != 0,
+                    "config_parse_file(%s) succeeded but we expected failed !",
+                    cfgstr_get(&cfg.cfgfile));
+
+        config_free(&cfg);
+}
+
+TEST_DEF(test_config_wan)
+{
+        struct cfg cfg;
+        struct cfg_wan *wancfg = NULL;
+        struct cfg_account *accountcfg = NULL;
+
+        config_init(&cfg);
+
+        cfgstr_set(&cfg.cfgfile, "yaddns.good.wan.conf");
+        TEST_ASSERT(config_parse_file(&cfg) == 0,
+                    "config_parse_file(%s) failed !",
+                    cfgstr_get(&cfg.cfgfile));
+
+        wancfg = config_wan_get(&cfg, "lte");
+        TEST_ASSERT(wancfg != NULL
+                    && wancfg->type == wan_cnt_indirect
+                    && strcmp(cfgstr_get(&(wancfg->ifname)), "wwan0") == 0
+                    && wancfg->myip.provider[0].port == 80
+                    && wancfg->myip.upint == 60
+                    && wancfg->myip.safety_upint == 1800,
+                    "wan 'lte' not parsed");
+        TEST_ASSERT(wancfg->myip.count == 3
+                    && wancfg->myip.mode == cfg_myip_quorum
+                    && wancfg->myip.quorum == 2
+                    && strcmp(cfgstr_get(&(wancfg->myip.provider[0].host)),
+                              "www.regfish.com") == 0
+                    && strcmp(cfgstr_get(&(wancfg->myip.provider[1].host)),
+                              "ifconfig.example.net") == 0
+                    && wancfg->myip.provider[1].port == 8080
+                    && strcmp(cfgstr_get(&(wancfg->myip.provider[1].path)),
+                              "/ip") == 0
+                    && wancfg->myip.provider[2].port == 80
+                    && strcmp(cfgstr_get(&(wancfg->myip.provider[2].path)),
+                              "/") == 0,
+                    "myip providers of wan 'lte' not parsed");
+
+        /* 8 myip_provider lines without myip_host */
+        wancfg = config_wan_get(&cfg, "ftth");
+        TEST_ASSERT(wancfg != NULL
+                    && wancfg->myip.count == CFG_MYIP_MAX
+                    && wancfg->myip.quorum == CFG_MYIP_MAX
+                    && strcmp(cfgstr_get(&(wancfg->myip.provider[0].host)),
+                              "myip1.example.net") == 0
+                    && strcmp(cfgstr_get(&(wancfg->myip.provider[7].host)),
+                              "myip8.example.net") == 0,
+                    "myip providers of wan 'ftth' not parsed");
+
+        TEST_ASSERT(cfg.myip.safety_upint == 3600,
+                    "default myip safety upint %d", cfg.myip.safety_upint);
+
+        wancfg = config_wan_get(&cfg, "fiber");
+        TEST_ASSERT(wancfg != NULL
+                    && wancfg->type == wan_cnt_stun
+                    && wancfg->stun.count == 2
+                    && strcmp(cfgstr_get(&(wancfg->stun.server[0].host)),
+                              "stun.example.net") == 0
+                    && wancfg->stun.server[0].port == 3478
+                    && strcmp(cfgstr_get(&(wancfg->stun.server[1].host)),
+                              "stun.example.org") == 0
+                    && wancfg->stun.server[1].port == 19302
+                    && wancfg->stun.rto == 250
+                    && wancfg->stun.upint == 60,
+                    "stun servers of wan 'fiber' not parsed");
+
+        wancfg = config_wan_get(&cfg, "cable");
+        TEST_ASSERT(wancfg != NULL
+                    && wancfg->type == wan_cnt_dns
+                    && strcmp(cfgstr_get(&(wancfg->dnsip.name)),
+                              "myip.opendns.com") == 0
+                    && strcmp(cfgstr_get(&(wancfg->dnsip.server)),
+                              "208.67.222.222") == 0
+                    && wancfg->dnsip.port == 53
+                    && wancfg->dnsip.mixcase == 1
+                    && wancfg->dnsip.upint == 10,
+                    "dns query of wan 'cable' not parsed");
+
+        TEST_ASSERT(config_service_get(&cfg, "dyndns") != NULL,
+                    "service 'dyndns' not parsed");
+
+        accountcfg = config_account_get(&cfg, "backup");
+        TEST_ASSERT(accountcfg != NULL
+                    && strcmp(cfgstr_get(&(accountcfg->wan)), "lte") == 0
+                    && !cfgstr_is_set(&(config_account_get(&cfg, "main")->wan)),
+                    "wan of the accounts not parsed");
+
+        config_free(&cfg);
+        config_init(&cfg);
+
+        cfgstr_set(&cfg.cfgfile, "yaddns.invalid.unknown_wan.conf");
+        TEST_ASSERT(config_parse_file(&cfg) != 0,
+                    "config_parse_file(%s) succeeded but we expected failed !",
+                    cfgstr_get(&cfg.cfgfile));
+
+        config_free(&cfg);
 }
 
 int main(void)
 {
         TEST_INIT("config");
 
+        if(services_populate_list() != 0)
+        {
+                return RET_ERROR;
+        }
+
         TEST_RUN(test_config_parse);
+        TEST_RUN(test_config_wan);
 
 	return TEST_RETURN;
 }
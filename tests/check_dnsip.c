@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "yatest.h"
+#include "yaserver.h"
+#include "yadns.h"
+
+#include "../src/dnsip.h"
+#include "../src/config.h"
+#include "../src/resolv.h"
+#include "../src/loop.h"
+#include "../src/timer.h"
+#include "../src/util.h"
+
+/*
+ * a local stand-in of a resolver answering the address of its client
+ * (the A records of echo_addrs)
+ */
+static struct yaserver echo_server;
+static unsigned short int echo_port = 0;
+static const char *echo_addrs[2] = { NULL, NULL };
+static char echo_qname[RESOLV_HOST_MAX_SIZE];
+static unsigned int echo_queries = 0;
+static int echo_swapcase = 0;       /* answer the question in another case */
+
+static size_t echo_answer(unsigned char *buf, size_t len, size_t size,
+                          const struct sockaddr_in *from)
+{
+        size_t i;
+
+        UNUSED(from);
+
+        if(len < 17)
+        {
+                return 0;
+        }
+
+        ++echo_queries;
+
+        /* the name as asked */
+        yadns_qname(buf, len, echo_qname, sizeof(echo_qname));
+
+        if(echo_swapcase)
+        {
+                yadns_swapcase(buf, len);
+        }
+
+        len = yadns_reply(buf, len, YADNS_RA);
+
+        /* the name of the question, ttl 0 */
+        for(i = 0; i < 2 && echo_addrs[i] != NULL && len > 0; ++i)
+        {
+                len = yadns_put_a(buf, len, size, YADNS_QNAME, 0,
+                                  echo_addrs[i]);
+        }
+
+        return len;
+}
+
+/*
+ * until the query is done
+ */
+static void dnsip_run(struct dnsip *dnsip, const struct cfg_dnsip *cfg)
+{
+        uint64_t end = timer_now() + 5000;
+        struct in_addr addr;
+
+        do
+        {
+                wanip_getwanipaddr(&(dnsip->src), cfg, NULL, &addr);
+                loop_run_once(5);
+                timer_ctl_run();
+        } while((dnsip->src.status == WISWorking
+                 || dnsip->src.status == WISNeedUpdate)
+                && timer_now() < end);
+}
+
+TEST_DEF(test_dnsip_answer)
+{
+        struct cfg_dnsip cfg;
+        struct dnsip dnsip;
+        struct in_addr expected;
+
+        memset(&cfg, 0, sizeof(cfg));
+        cfgstr_set(&(cfg.name), "myip.example.test");
+        cfgstr_set(&(cfg.server), "127.0.0.1");
+        cfg.port = echo_port;
+        cfg.mixcase = 1;
+        cfg.upint = 5;
+
+        echo_addrs[0] = "203.0.113.9";
+        inet_pton(AF_INET, echo_addrs[0], &expected);
+
+        dnsip_init(&dnsip);
+        dnsip_run(&dnsip, &cfg);
+
+        TEST_ASSERT(dnsip.src.status == WISHaveIp
+                    && dnsip.src.wanaddr.s_addr == expected.s_addr,
+                    "no address (status %d)", dnsip.src.status);
+        TEST_ASSERT(strcasecmp(echo_qname, "myip.example.test") == 0,
+                    "asked %.64s", echo_qname);
+
+        /* asked again, without the cache */
+        wanip_needupdate(&(dnsip.src));
+        dnsip_run(&dnsip, &cfg);
+
+        TEST_ASSERT(dnsip.src.status == WISHaveIp && echo_queries == 2,
+                    "%u queries (status %d)", echo_queries, dnsip.src.status);
+
+        /* an answer not echoing the case of the question is ignored */
+        echo_addrs[0] = "198.51.100.7";
+        echo_swapcase = 1;
+        wanip_needupdate(&(dnsip.src));
+        dnsip_run(&dnsip, &cfg);
+
+        TEST_ASSERT(dnsip.src.status == WISError
+                    && dnsip.src.wanaddr.s_addr == expected.s_addr,
+                    "answer in another case accepted (status %d)",
+                    dnsip.src.status);
+
+        echo_swapcase = 0;
+
+        /* a sinkhole of a resolver without the service */
+        echo_addrs[0] = "127.0.0.1";
+        wanip_needupdate(&(dnsip.src));
+        dnsip_run(&dnsip, &cfg);
+
+        TEST_ASSERT(dnsip.src.status == WISError
+                    && dnsip.src.wanaddr.s_addr == expected.s_addr,
+                    "sinkhole accepted (status %d)", dnsip.src.status);
+
+        wanip_cleanup(&(dnsip.src));
+
+        /* the answers must agree */
+        echo_addrs[0] = "203.0.113.9";
+        echo_addrs[1] = "198.51.100.7";
+
+        dnsip_init(&dnsip);
+        dnsip_run(&dnsip, &cfg);
+
+        TEST_ASSERT(dnsip.src.status == WISError && !dnsip.src.have_wanaddr,
+                    "ambiguous answer accepted (status %d)", dnsip.src.status);
+
+        wanip_cleanup(&(dnsip.src));
+        config_dnsip_free(&cfg);
+        echo_addrs[1] = NULL;
+}
+
+int main(void)
+{
+        TEST_INIT("dnsip");
+
+        timer_ctl_init();
+        if(loop_init() != 0)
+        {
+                return RET_ERROR;
+        }
+        resolv_ctl_init("/nonexistent");
+        resolv_ctl_set_options(200, 2);
+
+        echo_port = yaserver_start(&echo_server, SOCK_DGRAM, echo_answer);
+        if(echo_port == 0)
+        {
+                return RET_ERROR;
+        }
+
+        TEST_RUN(test_dnsip_answer);
+
+        yaserver_stop(&echo_server);
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+
+	return TEST_RETURN;
+}
@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "yatest.h"
+
+#include "../src/hashtab.h"
+#include "../src/util.h"
+
+struct item {
+        char key[16];
+        struct hashtab_node hnode;
+};
+
+static struct item *item_get(struct hashtab *tab, const char *key)
+{
+        struct item *item = NULL;
+        uint32_t hash = hashtab_strhash(key);
+
+        hashtab_for_each_entry(item, tab, hash, hnode)
+        {
+                if(strcmp(item->key, key) == 0)
+                {
+                        return item;
+                }
+        }
+
+        return NULL;
+}
+
+TEST_DEF(test_hashtab_grow)
+{
+        static struct item items[1000];
+        struct hashtab tab;
+        char key[16];
+        size_t i;
+
+        hashtab_init(&tab);
+        TEST_ASSERT(tab.size == HASHTAB_MIN_SIZE,
+                    "%zu buckets (%d expected)", tab.size, HASHTAB_MIN_SIZE);
+
+        for(i = 0; i < ARRAY_SIZE(items); ++i)
+        {
+                snprintf(items[i].key, sizeof(items[i].key), "item%zu", i);
+                hashtab_add(&tab, &(items[i].hnode),
+                            hashtab_strhash(items[i].key));
+        }
+
+        TEST_ASSERT(tab.count == ARRAY_SIZE(items) && tab.size >= tab.count,
+                    "%zu nodes in %zu buckets", tab.count, tab.size);
+
+        /* all still found after the resizes */
+        for(i = 0; i < ARRAY_SIZE(items); ++i)
+        {
+                snprintf(key, sizeof(key), "item%zu", i);
+                TEST_ASSERT(item_get(&tab, key) == &(items[i]),
+                            "%s not found", key);
+        }
+
+        TEST_ASSERT(item_get(&tab, "item1000") == NULL,
+                    "found a missing item");
+
+        hashtab_del(&tab, &(items[42].hnode));
+        TEST_ASSERT(item_get(&tab, "item42") == NULL
+                    && item_get(&tab, "item43") == &(items[43])
+                    && tab.count == ARRAY_SIZE(items) - 1,
+                    "item42 not removed");
+
+        hashtab_free(&tab);
+}
+
+int main(void)
+{
+        TEST_INIT("hashtab");
+
+        TEST_RUN(test_hashtab_grow);
+
+	return TEST_RETURN;
+}
@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "yatest.h"
+
+#include "../src/loop.h"
+#include "../src/util.h"
+
+static int cb_count = 0;
+static unsigned int cb_revents = 0;
+static int sig_received = 0;
+
+static void watch_cb(struct loop_watch *watch, unsigned int revents)
+{
+        UNUSED(watch);
+
+        ++cb_count;
+        cb_revents = revents;
+}
+
+static void watch_del_other_cb(struct loop_watch *watch, unsigned int revents)
+{
+        UNUSED(revents);
+
+        ++cb_count;
+        loop_watch_del(watch->data);
+}
+
+static void sig_cb(int signum)
+{
+        sig_received = signum;
+}
+
+TEST_DEF(test_loop_watch)
+{
+        struct loop_watch watch;
+        int fds[2];
+
+        TEST_ASSERT(pipe(fds) == 0, "pipe() failed !");
+
+        loop_watch_init(&watch, watch_cb, NULL);
+        TEST_ASSERT(loop_watch_add(&watch, fds[0], LOOP_READ) == 0,
+                    "loop_watch_add(%d) failed !", fds[0]);
+
+        /* nothing to read */
+        cb_count = 0;
+        TEST_ASSERT(loop_run_once(0) == 0, "loop_run_once() failed !");
+        TEST_ASSERT(cb_count == 0, "cb called %d times (0 expected)",
+                    cb_count);
+
+        /* something to read */
+        TEST_ASSERT(write(fds[1], "x", 1) == 1, "write() failed !");
+        TEST_ASSERT(loop_run_once(1000) == 0, "loop_run_once() failed !");
+        TEST_ASSERT(cb_count == 1 && cb_revents == LOOP_READ,
+                    "cb called %d times with 0x%x (1, 0x%x expected)",
+                    cb_count, cb_revents, LOOP_READ);
+
+        /* re-armed without read interest */
+        TEST_ASSERT(loop_watch_mod(&watch, 0) == 0,
+                    "loop_watch_mod() failed !");
+        TEST_ASSERT(loop_run_once(0) == 0, "loop_run_once() failed !");
+        TEST_ASSERT(cb_count == 1, "cb called %d times (1 expected)",
+                    cb_count);
+
+        /* removed */
+        loop_watch_del(&watch);
+        TEST_ASSERT(!watch.registered, "watch is still registered !");
+        loop_watch_del(&watch);
+
+        close(fds[0]);
+        close(fds[1]);
+}
+
+TEST_DEF(test_loop_del_in_dispatch)
+{
+        struct loop_watch watch1, watch2;
+        int fds1[2], fds2[2];
+
+        TEST_ASSERT(pipe(fds1) == 0 && pipe(fds2) == 0, "pipe() failed !");
+        TEST_ASSERT(write(fds1[1], "x", 1) == 1, "write() failed !");
+        TEST_ASSERT(write(fds2[1], "x", 1) == 1, "write() failed !");
+
+        /* each watch removes the other one: only one cb is called */
+        loop_watch_init(&watch1, watch_del_other_cb, &watch2);
+        loop_watch_init(&watch2, watch_del_other_cb, &watch1);
+        TEST_ASSERT(loop_watch_add(&watch1, fds1[0], LOOP_READ) == 0
+                    && loop_watch_add(&watch2, fds2[0], LOOP_READ) == 0,
+                    "loop_watch_add() failed !");
+
+        cb_count = 0;
+        TEST_ASSERT(loop_run_once(1000) == 0, "loop_run_once() failed !");
+        TEST_ASSERT(cb_count == 1, "cb called %d times (1 expected)",
+                    cb_count);
+
+        loop_watch_del(&watch1);
+        loop_watch_del(&watch2);
+
+        close(fds1[0]);
+        close(fds1[1]);
+        close(fds2[0]);
+        close(fds2[1]);
+}
+
+TEST_DEF(test_loop_signal)
+{
+        const int signums[] = { SIGUSR1 };
+
+        TEST_ASSERT(loop_signal_setup(signums, ARRAY_SIZE(signums),
+                                      sig_cb) == 0,
+                    "loop_signal_setup() failed !");
+
+        sig_received = 0;
+        raise(SIGUSR1);
+
+        TEST_ASSERT(loop_run_once(1000) == 0, "loop_run_once() failed !");
+        TEST_ASSERT(sig_received == SIGUSR1,
+                    "signal %d received (%d expected)",
+                    sig_received, SIGUSR1);
+}
+
+TEST_DEF(test_loop_signal_again)
+{
+        const int signums[] = { SIGUSR2 };
+
+        /* the signals of the first setup are still delivered */
+        TEST_ASSERT(loop_signal_setup(signums, ARRAY_SIZE(signums),
+                                      sig_cb) == 0,
+                    "loop_signal_setup() failed !");
+
+        sig_received = 0;
+        raise(SIGUSR1);
+
+        TEST_ASSERT(loop_run_once(1000) == 0, "loop_run_once() failed !");
+        TEST_ASSERT(sig_received == SIGUSR1,
+                    "signal %d received (%d expected)",
+                    sig_received, SIGUSR1);
+}
+
+TEST_DEF(test_loop_backend)
+{
+#if defined(USE_EPOLL)
+        const char *expected = "epoll";
+#else
+        const char *expected = "select";
+#endif
+
+        TEST_ASSERT(strcmp(loop_backend(), expected) == 0,
+                    "backend %s (%s expected)", loop_backend(), expected);
+}
+
+int main(void)
+{
+        TEST_INIT("loop");
+
+        if(loop_init() != 0)
+        {
+                return RET_ERROR;
+        }
+
+        TEST_RUN(test_loop_backend);
+        TEST_RUN(test_loop_watch);
+        TEST_RUN(test_loop_del_in_dispatch);
+        TEST_RUN(test_loop_signal);
+        TEST_RUN(test_loop_signal_again);
+
+        loop_cleanup();
+
+	return TEST_RETURN;
+}
@@ -0,0 +1,257 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "yatest.h"
+#include "yaserver.h"
+
+#include "../src/myip.h"
+#include "../src/config.h"
+#include "../src/request.h"
+#include "../src/resolv.h"
+#include "../src/loop.h"
+#include "../src/timer.h"
+#include "../src/util.h"
+
+/* a local stand-in of the myip services: /a and /b give an address,
+ * /err fails
+ */
+static struct yaserver echo_server;
+static unsigned short int echo_port = 0;
+
+static size_t echo_answer(unsigned char *buf, size_t len, size_t size,
+                          const struct sockaddr_in *from)
+{
+        const char *query = (const char *)buf;
+        const char *response = NULL;
+
+        UNUSED(len);
+        UNUSED(from);
+
+        if(strncmp(query, "GET /a ", 7) == 0)
+        {
+                response = "HTTP/1.0 200 OK\r\n\r\n"
+                        "Current IP Address: 192.0.2.1\n";
+        }
+        else if(strncmp(query, "GET /b ", 7) == 0)
+        {
+                response = "HTTP/1.0 200 OK\r\n\r\n198.51.100.7\n";
+        }
+        else
+        {
+                response = "HTTP/1.0 500 Internal Server Error"
+                        "\r\n\r\n";
+        }
+
+        return (size_t)snprintf((char *)buf, size, "%s", response);
+}
+
+static void myip_add(struct cfg_myip *cfg, unsigned short int port,
+                     const char *path)
+{
+        struct cfg_myip_provider *provider = &(cfg->provider[cfg->count++]);
+
+        cfgstr_set(&(provider->host), "127.0.0.1");
+        cfgstr_set(&(provider->path), path);
+        provider->port = port;
+}
+
+static int myip_inflight(const struct myip *myip)
+{
+        unsigned int i;
+
+        for(i = 0; i < CFG_MYIP_MAX; ++i)
+        {
+                if(myip->provider[i].inflight)
+                {
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+/*
+ * until the round is over and all its requests are done
+ */
+static void myip_run(struct myip *myip, const struct cfg_myip *cfg)
+{
+        uint64_t end = timer_now() + 5000;
+        struct in_addr addr;
+
+        do
+        {
+                wanip_getwanipaddr(&(myip->src), cfg, NULL, &addr);
+                loop_run_once(50);
+                timer_ctl_run();
+        } while((myip->src.status == WISWorking
+                 || myip->src.status == WISNeedUpdate
+                 || myip_inflight(myip))
+                && timer_now() < end);
+}
+
+static void myip_setup(struct cfg_myip *cfg, enum cfg_myip_mode mode)
+{
+        memset(cfg, 0, sizeof(struct cfg_myip));
+        cfg->mode = mode;
+        cfg->quorum = 2;
+        cfg->upint = 60;
+}
+
+TEST_DEF(test_myip_failover)
+{
+        struct cfg_myip cfg;
+        struct myip myip;
+        struct in_addr expected;
+
+        myip_setup(&cfg, cfg_myip_failover);
+        myip_add(&cfg, yaserver_closed_port(SOCK_STREAM), "/a");
+        myip_add(&cfg, echo_port, "/a");
+        inet_pton(AF_INET, "192.0.2.1", &expected);
+
+        /* the first one fails, the second one answers */
+        myip_init(&myip);
+        myip_run(&myip, &cfg);
+
+        TEST_ASSERT(myip.src.status == WISHaveIp
+                    && myip.src.wanaddr.s_addr == expected.s_addr,
+                    "no address (status %d)", myip.src.status);
+        TEST_ASSERT(myip.provider[0].errors == 1
+                    && myip.provider[0].failures == 1
+                    && myip.provider[1].requests == 1
+                    && myip.provider[1].errors == 0,
+                    "bad statistics");
+
+        /* the failing one is asked last now */
+        wanip_needupdate(&(myip.src));
+        myip_run(&myip, &cfg);
+
+        TEST_ASSERT(myip.src.status == WISHaveIp, "no address");
+        TEST_ASSERT(myip.provider[0].requests == 1
+                    && myip.provider[1].requests == 2,
+                    "failing provider asked first (%lu, %lu requests)",
+                    myip.provider[0].requests, myip.provider[1].requests);
+
+        wanip_cleanup(&(myip.src));
+}
+
+TEST_DEF(test_myip_race)
+{
+        struct cfg_myip cfg;
+        struct myip myip;
+        struct in_addr expected;
+        unsigned int i;
+
+        myip_setup(&cfg, cfg_myip_race);
+        myip_add(&cfg, echo_port, "/err");
+        myip_add(&cfg, yaserver_closed_port(SOCK_STREAM), "/a");
+        myip_add(&cfg, echo_port, "/b");
+        inet_pton(AF_INET, "198.51.100.7", &expected);
+
+        myip_init(&myip);
+        myip_run(&myip, &cfg);
+
+        TEST_ASSERT(myip.src.status == WISHaveIp
+                    && myip.src.wanaddr.s_addr == expected.s_addr,
+                    "no address (status %d)", myip.src.status);
+
+        /* all of them were asked at once */
+        for(i = 0; i < cfg.count; ++i)
+        {
+                TEST_ASSERT(myip.provider[i].requests == 1,
+                            "provider %u: %lu requests",
+                            i, myip.provider[i].requests);
+        }
+
+        TEST_ASSERT(myip.provider[0].errors == 1
+                    && myip.provider[1].errors == 1
+                    && myip.provider[2].errors == 0,
+                    "bad statistics");
+
+        wanip_cleanup(&(myip.src));
+
+        /* none answers */
+        myip_setup(&cfg, cfg_myip_race);
+        myip_add(&cfg, echo_port, "/err");
+        myip_add(&cfg, yaserver_closed_port(SOCK_STREAM), "/a");
+
+        myip_init(&myip);
+        myip_run(&myip, &cfg);
+
+        TEST_ASSERT(myip.src.status == WISError && !myip.src.have_wanaddr,
+                    "status %d without answer", myip.src.status);
+
+        wanip_cleanup(&(myip.src));
+}
+
+TEST_DEF(test_myip_quorum)
+{
+        struct cfg_myip cfg;
+        struct myip myip;
+        struct in_addr expected;
+
+        myip_setup(&cfg, cfg_myip_quorum);
+        myip_add(&cfg, echo_port, "/b");
+        myip_add(&cfg, echo_port, "/a");
+        myip_add(&cfg, echo_port, "/a");
+        inet_pton(AF_INET, "192.0.2.1", &expected);
+
+        myip_init(&myip);
+        myip_run(&myip, &cfg);
+
+        TEST_ASSERT(myip.src.status == WISHaveIp
+                    && myip.src.wanaddr.s_addr == expected.s_addr,
+                    "no agreed address (status %d)", myip.src.status);
+
+        wanip_cleanup(&(myip.src));
+
+        /* no quorum */
+        myip_setup(&cfg, cfg_myip_quorum);
+        myip_add(&cfg, echo_port, "/a");
+        myip_add(&cfg, echo_port, "/b");
+        myip_add(&cfg, echo_port, "/err");
+
+        myip_init(&myip);
+        myip_run(&myip, &cfg);
+
+        TEST_ASSERT(myip.src.status == WISError && !myip.src.have_wanaddr,
+                    "address accepted without quorum (status %d)",
+                    myip.src.status);
+
+        wanip_cleanup(&(myip.src));
+}
+
+int main(void)
+{
+        TEST_INIT("myip");
+
+        timer_ctl_init();
+        if(loop_init() != 0)
+        {
+                return RET_ERROR;
+        }
+        resolv_ctl_init("/nonexistent");
+        request_ctl_init();
+
+        echo_port = yaserver_start(&echo_server, SOCK_STREAM, echo_answer);
+        if(echo_port == 0)
+        {
+                return RET_ERROR;
+        }
+
+        TEST_RUN(test_myip_failover);
+        TEST_RUN(test_myip_race);
+        TEST_RUN(test_myip_quorum);
+
+        yaserver_stop(&echo_server);
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+
+	return TEST_RETURN;
+}
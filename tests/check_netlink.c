@@ -0,0 +1,539 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#if defined(USE_NETLINK)
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_addr.h>
+#endif
+
+#include "yatest.h"
+
+#include "../src/netlink.h"
+#include "../src/wan.h"
+#include "../src/account.h"
+#include "../src/request.h"
+#include "../src/config.h"
+#include "../src/loop.h"
+#include "../src/timer.h"
+#include "../src/myip.h"
+#include "../src/util.h"
+
+#if defined(USE_NETLINK)
+
+#define MSG_ALIGN(len) (((len) + 3) & ~(size_t)3)
+
+/* events got by record_cb() */
+static struct netlink_event records[64];
+static size_t records_count = 0;
+
+static void record_cb(const struct netlink_event *event, void *data)
+{
+        UNUSED(data);
+
+        if(records_count < ARRAY_SIZE(records))
+        {
+                records[records_count] = *event;
+        }
+
+        ++records_count;
+}
+
+static size_t msg_attr(unsigned char *buf, unsigned short type,
+                       const void *value, size_t len)
+{
+        struct rtattr rta;
+
+        rta.rta_len = (unsigned short)(sizeof(rta) + len);
+        rta.rta_type = type;
+        memcpy(buf, &rta, sizeof(rta));
+        memcpy(buf + sizeof(rta), value, len);
+
+        return MSG_ALIGN(rta.rta_len);
+}
+
+/*
+ * write at buf a RTM_NEWADDR or RTM_DELADDR message of addr
+ *
+ * @return its aligned length
+ */
+static size_t msg_addr(unsigned char *buf, unsigned short type, int family,
+                       int ifindex, unsigned char scope, uint32_t flags,
+                       const char *addr)
+{
+        struct nlmsghdr nlh;
+        struct ifaddrmsg ifa;
+        unsigned char value[sizeof(struct in6_addr)];
+        size_t len = MSG_ALIGN(sizeof(nlh));
+
+        inet_pton(family, addr, value);
+
+        memset(&ifa, 0, sizeof(ifa));
+        ifa.ifa_family = (unsigned char)family;
+        ifa.ifa_index = (unsigned int)ifindex;
+        ifa.ifa_scope = scope;
+        ifa.ifa_flags = (unsigned char)(flags & 0xff);
+        memcpy(buf + len, &ifa, sizeof(ifa));
+        len += MSG_ALIGN(sizeof(ifa));
+
+        len += msg_attr(buf + len, IFA_ADDRESS, value,
+                        (family == AF_INET
+                         ? sizeof(struct in_addr) : sizeof(struct in6_addr)));
+        len += msg_attr(buf + len, IFA_FLAGS, &flags, sizeof(flags));
+
+        memset(&nlh, 0, sizeof(nlh));
+        nlh.nlmsg_len = (uint32_t)len;
+        nlh.nlmsg_type = type;
+        memcpy(buf, &nlh, sizeof(nlh));
+
+        return len;
+}
+
+static size_t msg_link(unsigned char *buf, unsigned short type, int ifindex,
+                       unsigned int flags, const char *ifname)
+{
+        struct nlmsghdr nlh;
+        struct ifinfomsg ifi;
+        size_t len = MSG_ALIGN(sizeof(nlh));
+
+        memset(&ifi, 0, sizeof(ifi));
+        ifi.ifi_index = ifindex;
+        ifi.ifi_flags = flags;
+        memcpy(buf + len, &ifi, sizeof(ifi));
+        len += MSG_ALIGN(sizeof(ifi));
+
+        len += msg_attr(buf + len, IFLA_IFNAME, ifname, strlen(ifname) + 1);
+
+        memset(&nlh, 0, sizeof(nlh));
+        nlh.nlmsg_len = (uint32_t)len;
+        nlh.nlmsg_type = type;
+        memcpy(buf, &nlh, sizeof(nlh));
+
+        return len;
+}
+
+static size_t msg_route(unsigned char *buf, unsigned short type,
+                        unsigned char dst_len, int oif)
+{
+        struct nlmsghdr nlh;
+        struct rtmsg rtm;
+        uint32_t value = (uint32_t)oif;
+        size_t len = MSG_ALIGN(sizeof(nlh));
+
+        memset(&rtm, 0, sizeof(rtm));
+        rtm.rtm_family = AF_INET;
+        rtm.rtm_dst_len = dst_len;
+        rtm.rtm_table = RT_TABLE_MAIN;
+        rtm.rtm_type = RTN_UNICAST;
+        memcpy(buf + len, &rtm, sizeof(rtm));
+        len += MSG_ALIGN(sizeof(rtm));
+
+        len += msg_attr(buf + len, RTA_OIF, &value, sizeof(value));
+
+        memset(&nlh, 0, sizeof(nlh));
+        nlh.nlmsg_len = (uint32_t)len;
+        nlh.nlmsg_type = type;
+        memcpy(buf, &nlh, sizeof(nlh));
+
+        return len;
+}
+
+static size_t msg_done(unsigned char *buf)
+{
+        struct nlmsghdr nlh;
+        int error = 0;
+
+        memset(&nlh, 0, sizeof(nlh));
+        nlh.nlmsg_len = (uint32_t)(MSG_ALIGN(sizeof(nlh)) + sizeof(error));
+        nlh.nlmsg_type = NLMSG_DONE;
+        memcpy(buf, &nlh, sizeof(nlh));
+        memcpy(buf + MSG_ALIGN(sizeof(nlh)), &error, sizeof(error));
+
+        return MSG_ALIGN(nlh.nlmsg_len);
+}
+
+TEST_DEF(test_netlink_parse)
+{
+        uint32_t buf[256];
+        unsigned char *p = (unsigned char *)buf;
+        struct in_addr addr;
+        size_t len = 0;
+        int ret;
+
+        records_count = 0;
+
+        len += msg_link(p + len, RTM_NEWLINK, 7, IFF_UP, "ppp0");
+        len += msg_addr(p + len, RTM_NEWADDR, AF_INET, 7, RT_SCOPE_UNIVERSE,
+                        0, "192.0.2.1");
+        len += msg_addr(p + len, RTM_NEWADDR, AF_INET, 7, RT_SCOPE_UNIVERSE,
+                        IFA_F_SECONDARY, "192.0.2.9");
+        len += msg_addr(p + len, RTM_NEWADDR, AF_INET6, 7, RT_SCOPE_UNIVERSE,
+                        IFA_F_TEMPORARY, "2001:db8::1");
+        len += msg_addr(p + len, RTM_DELADDR, AF_INET6, 7, RT_SCOPE_LINK,
+                        0, "fe80::1");
+        len += msg_route(p + len, RTM_NEWROUTE, 24, 7);
+        len += msg_route(p + len, RTM_NEWROUTE, 0, 7);
+        len += msg_done(p + len);
+
+        ret = netlink_parse(buf, len, record_cb, NULL);
+        TEST_ASSERT(ret == 1, "end of dump not seen (%d)", ret);
+        TEST_ASSERT(records_count == 6, "%zu events", records_count);
+
+        TEST_ASSERT(records[0].type == NETLINK_LINK_NEW
+                    && records[0].ifindex == 7
+                    && strcmp(records[0].ifname, "ppp0") == 0
+                    && (records[0].flags & IFF_UP),
+                    "bad link event");
+
+        inet_pton(AF_INET, "192.0.2.1", &addr);
+        TEST_ASSERT(records[1].type == NETLINK_ADDR_NEW
+                    && records[1].family == AF_INET
+                    && records[1].addr.v4.s_addr == addr.s_addr
+                    && records[1].flags == 0,
+                    "bad primary address event");
+
+        TEST_ASSERT(records[2].flags == NETLINK_F_SECONDARY,
+                    "secondary address not flagged");
+        TEST_ASSERT(records[3].family == AF_INET6
+                    && records[3].flags == NETLINK_F_UNSTABLE,
+                    "temporary address not flagged");
+        TEST_ASSERT(records[4].type == NETLINK_ADDR_DEL
+                    && records[4].flags == NETLINK_F_LOCAL,
+                    "link local address not flagged");
+        TEST_ASSERT(records[5].type == NETLINK_ROUTE_NEW
+                    && records[5].ifindex == 7,
+                    "bad default route event");
+
+        /* a truncated message */
+        records_count = 0;
+        len = msg_addr(p, RTM_NEWADDR, AF_INET, 7, RT_SCOPE_UNIVERSE,
+                       0, "192.0.2.1");
+        TEST_ASSERT(netlink_parse(buf, len - 4, record_cb, NULL) == -1,
+                    "truncated message accepted");
+        TEST_ASSERT(records_count == 0, "event of a truncated message");
+}
+
+TEST_DEF(test_netlink_wan)
+{
+        uint32_t buf[256];
+        unsigned char *p = (unsigned char *)buf;
+        struct in_addr addr1, addr2;
+        struct cfg cfg;
+        size_t len;
+
+        timer_ctl_init();
+        request_ctl_init();
+        wan_ctl_init();
+        account_ctl_init();
+        config_init(&cfg);
+
+        cfg.wan_cnt_type = wan_cnt_direct;
+        cfgstr_set(&(cfg.wan_ifname), "ppp0");
+        TEST_ASSERT(wan_ctl_mapcfg(&cfg) == 0, "wan_ctl_mapcfg() failed !");
+
+        inet_pton(AF_INET, "192.0.2.1", &addr1);
+        inet_pton(AF_INET, "192.0.2.9", &addr2);
+
+        /* the connection: a new link then its address */
+        len = msg_link(p, RTM_NEWLINK, 7, IFF_UP, "ppp0");
+        len += msg_addr(p + len, RTM_NEWADDR, AF_INET, 7, RT_SCOPE_UNIVERSE,
+                        0, "192.0.2.1");
+        len += msg_addr(p + len, RTM_NEWADDR, AF_INET, 7, RT_SCOPE_UNIVERSE,
+                        IFA_F_SECONDARY, "192.0.2.9");
+        len += msg_addr(p + len, RTM_NEWADDR, AF_INET, 8, RT_SCOPE_UNIVERSE,
+                        0, "198.51.100.1");
+        TEST_ASSERT(netlink_parse(buf, len, wan_ctl_event, NULL) == 0,
+                    "netlink_parse() failed !");
+
+        TEST_ASSERT(wan_default.ifindex == 7, "ifindex %d",
+                    wan_default.ifindex);
+        TEST_ASSERT(wan_default.have_ip
+                    && wan_default.ip.s_addr == addr1.s_addr
+                    && wan_default.bind_addr.s_addr == addr1.s_addr,
+                    "wan ip not set to the primary address");
+
+        /* only the stable global ipv6 address */
+        len = msg_addr(p, RTM_NEWADDR, AF_INET6, 7, RT_SCOPE_LINK,
+                       0, "fe80::1");
+        len += msg_addr(p + len, RTM_NEWADDR, AF_INET6, 7, RT_SCOPE_UNIVERSE,
+                        IFA_F_TEMPORARY, "2001:db8::1");
+        len += msg_addr(p + len, RTM_NEWADDR, AF_INET6, 7, RT_SCOPE_UNIVERSE,
+                        0, "2001:db8::2");
+        TEST_ASSERT(netlink_parse(buf, len, wan_ctl_event, NULL) == 0,
+                    "netlink_parse() failed !");
+        TEST_ASSERT(wan_default.have_ip6
+                    && wan_default.ip6.s6_addr[15] == 2,
+                    "stable ipv6 address not selected");
+
+        /* the secondary address is promoted */
+        len = msg_addr(p, RTM_DELADDR, AF_INET, 7, RT_SCOPE_UNIVERSE,
+                       0, "192.0.2.1");
+        len += msg_addr(p + len, RTM_NEWADDR, AF_INET, 7, RT_SCOPE_UNIVERSE,
+                        0, "192.0.2.9");
+        TEST_ASSERT(netlink_parse(buf, len, wan_ctl_event, NULL) == 0,
+                    "netlink_parse() failed !");
+        TEST_ASSERT(wan_default.have_ip
+                    && wan_default.ip.s_addr == addr2.s_addr,
+                    "wan ip not changed");
+
+        /* the primary address announced again (a dhcp renew) */
+        len = msg_addr(p, RTM_NEWADDR, AF_INET, 7, RT_SCOPE_UNIVERSE,
+                       0, "192.0.2.9");
+        TEST_ASSERT(netlink_parse(buf, len, wan_ctl_event, NULL) == 0,
+                    "netlink_parse() failed !");
+        TEST_ASSERT(wan_default.have_ip
+                    && wan_default.ip.s_addr == addr2.s_addr
+                    && wan_default.bind_addr.s_addr == addr2.s_addr,
+                    "wan ip dropped on a repeated address");
+
+        /* the disconnection */
+        len = msg_link(p, RTM_DELLINK, 7, 0, "ppp0");
+        TEST_ASSERT(netlink_parse(buf, len, wan_ctl_event, NULL) == 0,
+                    "netlink_parse() failed !");
+        TEST_ASSERT(!wan_default.have_ip && !wan_default.have_ip6
+                    && wan_default.ifindex == 0
+                    && wan_default.bind_addr.s_addr == INADDR_ANY,
+                    "wan ip kept after the link removal");
+
+        config_free(&cfg);
+        request_ctl_cleanup();
+        account_ctl_cleanup();
+        wan_ctl_cleanup();
+        timer_ctl_cleanup();
+}
+
+TEST_DEF(test_netlink_resync)
+{
+        uint32_t buf[256];
+        unsigned char *p = (unsigned char *)buf;
+        struct netlink_event resync;
+        struct in_addr addr1, addr2;
+        int lo = (int)if_nametoindex("lo");
+        struct cfg cfg;
+        size_t len;
+
+        TEST_ASSERT(lo != 0, "no lo interface");
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        TEST_ASSERT(netlink_ctl_init(wan_ctl_event, NULL) == 0,
+                    "netlink_ctl_init() failed !");
+        request_ctl_init();
+        wan_ctl_init();
+        account_ctl_init();
+        config_init(&cfg);
+
+        cfg.wan_cnt_type = wan_cnt_direct;
+        cfgstr_set(&(cfg.wan_ifname), "lo");
+        TEST_ASSERT(wan_ctl_mapcfg(&cfg) == 0, "wan_ctl_mapcfg() failed !");
+
+        inet_pton(AF_INET, "192.0.2.1", &addr1);
+        inet_pton(AF_INET, "192.0.2.2", &addr2);
+
+        len = msg_addr(p, RTM_NEWADDR, AF_INET, lo, RT_SCOPE_UNIVERSE,
+                       0, "192.0.2.1");
+        TEST_ASSERT(netlink_parse(buf, len, wan_ctl_event, NULL) == 0,
+                    "netlink_parse() failed !");
+        TEST_ASSERT(wan_default.have_ip
+                    && wan_default.ip.s_addr == addr1.s_addr,
+                    "wan ip not set to the primary address");
+
+        /* its removal is lost in an overflow, the dump only shows the
+         * new address
+         */
+        memset(&resync, 0, sizeof(resync));
+        resync.type = NETLINK_RESYNC;
+        wan_ctl_event(&resync, NULL);
+
+        len = msg_addr(p, RTM_NEWADDR, AF_INET, lo, RT_SCOPE_UNIVERSE,
+                       0, "192.0.2.2");
+        len += msg_done(p + len);
+        TEST_ASSERT(netlink_parse(buf, len, wan_ctl_event, NULL) == 1,
+                    "netlink_parse() failed !");
+        TEST_ASSERT(wan_default.have_ip
+                    && wan_default.ip.s_addr == addr2.s_addr
+                    && wan_default.bind_addr.s_addr == addr2.s_addr,
+                    "wan ip not replaced by the dumped address");
+
+        config_free(&cfg);
+        request_ctl_cleanup();
+        account_ctl_cleanup();
+        wan_ctl_cleanup();
+        netlink_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
+static uint64_t vclock = 0;
+
+static uint64_t vclock_now(void)
+{
+        return vclock;
+}
+
+TEST_DEF(test_netlink_trigger)
+{
+        uint32_t buf[256];
+        unsigned char *p = (unsigned char *)buf;
+        const unsigned int ppp_up = IFF_UP | IFF_RUNNING | IFF_POINTOPOINT;
+        struct cfg_wan *wancfg = NULL;
+        struct wan *dsl = NULL;
+        struct cfg cfg;
+        size_t len;
+
+        vclock = 1000000;
+        timer_ctl_set_clock(vclock_now);
+        timer_ctl_init();
+        request_ctl_init();
+        wan_ctl_init();
+        account_ctl_init();
+        config_init(&cfg);
+
+        /* the default wan isn't bound, dsl is bound to ppp0 */
+        cfg.wan_cnt_type = wan_cnt_indirect;
+        cfgstr_set(&(cfg.myip.provider[0].host), "127.0.0.1");
+        cfgstr_set(&(cfg.myip.provider[0].path), "/");
+        cfg.myip.provider[0].port = 1;
+        cfg.myip.count = 1;
+        cfg.myip.upint = 60;
+
+        wancfg = calloc(1, sizeof(struct cfg_wan));
+        TEST_ASSERT(wancfg != NULL, "calloc failed");
+        cfgstr_set(&(wancfg->name), "dsl");
+        wancfg->type = wan_cnt_indirect;
+        cfgstr_set(&(wancfg->ifname), "ppp0");
+        cfgstr_set(&(wancfg->myip.provider[0].host), "127.0.0.1");
+        cfgstr_set(&(wancfg->myip.provider[0].path), "/");
+        wancfg->myip.provider[0].port = 1;
+        wancfg->myip.count = 1;
+        wancfg->myip.upint = 60;
+        list_add_tail(&(wancfg->list), &(cfg.wan_list));
+
+        TEST_ASSERT(wan_ctl_mapcfg(&cfg) == 0, "wan_ctl_mapcfg() failed !");
+        dsl = wan_ctl_get("dsl");
+        TEST_ASSERT(dsl != NULL, "no dsl wan");
+
+        /* ppp0 comes up: both are asked again, once the burst is over */
+        wan_default.myip.src.status = WISHaveIp;
+        dsl->myip.src.status = WISHaveIp;
+        len = msg_link(p, RTM_NEWLINK, 7, ppp_up, "ppp0");
+        len += msg_route(p + len, RTM_NEWROUTE, 0, 7);
+        TEST_ASSERT(netlink_parse(buf, len, wan_ctl_event, NULL) == 0,
+                    "netlink_parse() failed !");
+
+        vclock += 1000;
+        timer_ctl_run();
+        TEST_ASSERT(wan_default.myip.src.status == WISHaveIp
+                    && dsl->myip.src.status == WISHaveIp,
+                    "asked before the end of the burst");
+
+        vclock += 1000;
+        timer_ctl_run();
+        TEST_ASSERT(wan_default.myip.src.status == WISNeedUpdate
+                    && dsl->myip.src.status == WISNeedUpdate,
+                    "not asked after ppp0 came up");
+
+        /* ppp0 was already running */
+        wan_default.myip.src.status = WISHaveIp;
+        dsl->myip.src.status = WISHaveIp;
+        len = msg_link(p, RTM_NEWLINK, 7, ppp_up, "ppp0");
+        TEST_ASSERT(netlink_parse(buf, len, wan_ctl_event, NULL) == 0,
+                    "netlink_parse() failed !");
+        TEST_ASSERT(!timer_pending(&(dsl->trigger)),
+                    "dsl asked again while running");
+
+        /* a default route by another interface only moves the default
+         * wan
+         */
+        vclock += 2000;
+        timer_ctl_run();
+        wan_default.myip.src.status = WISHaveIp;
+        len = msg_route(p, RTM_NEWROUTE, 0, 8);
+        len += msg_route(p + len, RTM_NEWROUTE, 24, 7);
+        TEST_ASSERT(netlink_parse(buf, len, wan_ctl_event, NULL) == 0,
+                    "netlink_parse() failed !");
+        TEST_ASSERT(timer_pending(&(wan_default.trigger))
+                    && !timer_pending(&(dsl->trigger)),
+                    "bad route triggers");
+
+        /* no request while one is on the way */
+        wan_default.myip.src.status = WISWorking;
+        vclock += 2000;
+        timer_ctl_run();
+        TEST_ASSERT(wan_default.myip.src.status == WISWorking,
+                    "asked while a request is on the way");
+
+        config_free(&cfg);
+        request_ctl_cleanup();
+        account_ctl_cleanup();
+        wan_ctl_cleanup();
+        timer_ctl_cleanup();
+        timer_ctl_set_clock(NULL);
+}
+
+TEST_DEF(test_netlink_dump)
+{
+        struct in_addr loopback;
+        int lo = (int)if_nametoindex("lo");
+        int found = 0;
+        size_t i;
+        unsigned int n;
+
+        TEST_ASSERT(lo != 0, "no lo interface");
+        inet_pton(AF_INET, "127.0.0.1", &loopback);
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+
+        records_count = 0;
+        TEST_ASSERT(netlink_ctl_init(record_cb, NULL) == 0,
+                    "netlink_ctl_init() failed !");
+        TEST_ASSERT(netlink_ctl_available(), "netlink not available");
+        TEST_ASSERT(netlink_ctl_dump() == 0, "netlink_ctl_dump() failed !");
+
+        for(n = 0; n < 20 && !found; ++n)
+        {
+                loop_run_once(100);
+
+                for(i = 0; i < MIN(records_count, ARRAY_SIZE(records)); ++i)
+                {
+                        if(records[i].type == NETLINK_ADDR_NEW
+                           && records[i].ifindex == lo
+                           && records[i].family == AF_INET
+                           && records[i].addr.v4.s_addr == loopback.s_addr)
+                        {
+                                found = 1;
+                        }
+                }
+        }
+
+        netlink_ctl_cleanup();
+        TEST_ASSERT(!netlink_ctl_available(), "netlink still available");
+        loop_cleanup();
+        timer_ctl_cleanup();
+
+        TEST_ASSERT(found, "127.0.0.1 of lo not dumped (%zu events)",
+                    records_count);
+}
+
+#endif
+
+int main(void)
+{
+        TEST_INIT("netlink");
+
+#if defined(USE_NETLINK)
+        TEST_RUN(test_netlink_parse);
+        TEST_RUN(test_netlink_wan);
+        TEST_RUN(test_netlink_resync);
+        TEST_RUN(test_netlink_trigger);
+        TEST_RUN(test_netlink_dump);
+#endif
+
+	return TEST_RETURN;
+}
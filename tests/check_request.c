@@ -1,9 +1,16 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "yatest.h"
 
 #include "../src/request.h"
+#include "../src/loop.h"
+#include "../src/timer.h"
+#include "../src/resolv.h"
 #include "../src/util.h"
 
 extern struct list_head request_list;
@@ -91,6 +98,675 @@ TEST_DEF(test_request_remove)
                     datas[6], ret);
 }
 
+static int hook_count = 0;
+static int hook_received = 0;
+static int hook_state = FSCreated;
+static unsigned int hook_errcode = 0;
+static char hook_response[REQUEST_BODY_MAX_SIZE];
+static int hook_paths[16];          /* hook_data of the request /N */
+static int hook_mismatch = 0;       /* responses of another request */
+static int hook_status = 0;
+static size_t hook_body_size = 0;
+static char hook_xtest[32];         /* X-Test response header */
+
+static void hook(struct request *request, void *data)
+{
+        const char *echo = NULL, *xtest = NULL;
+
+        ++hook_count;
+        hook_state = request->state;
+        hook_errcode = request->errcode;
+
+        if(request->state == FSResponseReceived)
+        {
+                ++hook_received;
+                snprintf(hook_response, sizeof(hook_response),
+                         "%s", request->response.body);
+                hook_status = request->response.status;
+                hook_body_size = request->response.body_size;
+                xtest = request_response_header(&(request->response),
+                                                "x-test");
+                snprintf(hook_xtest, sizeof(hook_xtest), "%s",
+                         (xtest != NULL ? xtest : ""));
+
+                /* the keep-alive server echoes the path */
+                echo = strstr(request->response.body, "good /");
+                if(echo != NULL && data != NULL
+                   && atoi(echo + 6) != (int)((int *)data - hook_paths))
+                {
+                        ++hook_mismatch;
+                }
+        }
+}
+
+static void hook_reset(void)
+{
+        hook_count = 0;
+        hook_received = 0;
+        hook_state = FSCreated;
+        hook_errcode = 0;
+        hook_response[0] = '\0';
+        hook_mismatch = 0;
+        hook_status = 0;
+        hook_body_size = 0;
+        hook_xtest[0] = '\0';
+}
+
+/*
+ * A http server on 127.0.0.1, closing after each response or
+ * keeping the connections alive.
+ */
+static int server = -1;
+static struct loop_watch server_watch;
+static int server_keepalive = 0;
+static int server_drop_second = 0;  /* close at the 2nd query of a conn */
+static int server_accepted = 0;
+static int server_pipelined = 0;    /* max queries read at once */
+
+static struct server_conn {
+        struct loop_watch watch;
+        int served;
+        char path[16];      /* of the query being read */
+} conns[8];
+
+/* a response sent in parts, 20 ms apart */
+static const char *server_parts[8];
+static size_t server_part = 0;
+static int server_part_fd = -1;
+static struct timer server_part_timer;
+
+static void server_part_cb(struct timer *timer, void *data)
+{
+        const char *part = server_parts[server_part++];
+
+        UNUSED(data);
+
+        if(send(server_part_fd, part, strlen(part), 0) > 0
+           && server_parts[server_part] != NULL)
+        {
+                timer_start(timer, 20);
+        }
+}
+
+static void conn_cb(struct loop_watch *watch, unsigned int revents)
+{
+        const char response[] = "HTTP/1.0 200 OK\r\n\r\ngood";
+        char query[REQUEST_DATA_MAX_SIZE];
+        char response_ka[128];
+        char *q = NULL, *end = NULL;
+        struct server_conn *conn = watch->data;
+        int s = watch->fd;
+        int queries = 0;
+        ssize_t ret = 0;
+        int len;
+
+        UNUSED(revents);
+
+        ret = recv(s, query, sizeof(query) - 1, 0);
+        if(ret > 0 && server_parts[0] != NULL)
+        {
+                server_part = 0;
+                server_part_fd = s;
+                server_part_cb(&server_part_timer, NULL);
+                return;
+        }
+
+        if(ret > 0)
+        {
+                query[ret] = '\0';
+
+                /* pipelined queries are read together, a long one in
+                 * several times
+                 */
+                for(q = query;
+                    (end = strstr(q, "\r\n\r\n")) != NULL;
+                    q = end + 4)
+                {
+                        if(strncmp(q, "GET ", 4) == 0)
+                        {
+                                snprintf(conn->path, sizeof(conn->path),
+                                         "%.*s",
+                                         (int)strcspn(q + 4, " "), q + 4);
+                        }
+
+                        ++queries;
+                        ++conn->served;
+
+                        if(server_drop_second && conn->served == 2)
+                        {
+                                ret = 0;
+                                break;
+                        }
+
+                        if(!server_keepalive)
+                        {
+                                ret = send(s, response,
+                                           sizeof(response) - 1, 0);
+                                break;
+                        }
+
+                        /* echo the path to match queries and responses */
+                        len = snprintf(response_ka, sizeof(response_ka),
+                                       "HTTP/1.1 200 OK\r\n"
+                                       "Content-Length: %zu\r\n\r\n"
+                                       "good %s",
+                                       strlen(conn->path) + 5, conn->path);
+                        ret = send(s, response_ka, (size_t)len, 0);
+                }
+
+                if(strncmp(q, "GET ", 4) == 0)
+                {
+                        snprintf(conn->path, sizeof(conn->path), "%.*s",
+                                 (int)strcspn(q + 4, " "), q + 4);
+                }
+
+                if(queries > server_pipelined)
+                {
+                        server_pipelined = queries;
+                }
+
+                if(ret > 0 && server_keepalive)
+                {
+                        return;
+                }
+        }
+
+        loop_watch_del(watch);
+        close(s);
+}
+
+static void server_cb(struct loop_watch *watch, unsigned int revents)
+{
+        size_t i;
+        int s;
+
+        UNUSED(watch);
+        UNUSED(revents);
+
+        s = accept(server, NULL, NULL);
+        if(s < 0)
+        {
+                return;
+        }
+
+        ++server_accepted;
+
+        for(i = 0; i < ARRAY_SIZE(conns); ++i)
+        {
+                if(!conns[i].watch.registered)
+                {
+                        conns[i].served = 0;
+                        conns[i].path[0] = '\0';
+                        loop_watch_init(&conns[i].watch, conn_cb,
+                                        &conns[i]);
+                        if(loop_watch_add(&conns[i].watch, s, LOOP_READ) == 0)
+                        {
+                                return;
+                        }
+                        break;
+                }
+        }
+
+        close(s);
+}
+
+/*
+ * listen on 127.0.0.1 (or just reserve a closed port if !listening)
+ */
+static unsigned short int server_start(int listening)
+{
+        struct sockaddr_in addr;
+        socklen_t addrlen = sizeof(addr);
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        server = socket(AF_INET, SOCK_STREAM, 0);
+        if(server < 0
+           || bind(server, (struct sockaddr *)&addr, sizeof(addr)) < 0
+           || getsockname(server, (struct sockaddr *)&addr, &addrlen) < 0)
+        {
+                return 0;
+        }
+
+        if(!listening)
+        {
+                close(server);
+                server = -1;
+                return ntohs(addr.sin_port);
+        }
+
+        server_accepted = 0;
+        server_pipelined = 0;
+        timer_init(&server_part_timer, server_part_cb, NULL);
+        loop_watch_init(&server_watch, server_cb, NULL);
+        if(listen(server, 16) < 0
+           || loop_watch_add(&server_watch, server, LOOP_READ) != 0)
+        {
+                return 0;
+        }
+
+        return ntohs(addr.sin_port);
+}
+
+static void server_stop(void)
+{
+        size_t i;
+
+        timer_stop(&server_part_timer);
+
+        for(i = 0; i < ARRAY_SIZE(conns); ++i)
+        {
+                if(conns[i].watch.registered)
+                {
+                        close(conns[i].watch.fd);
+                        loop_watch_del(&conns[i].watch);
+                }
+        }
+
+        if(server >= 0)
+        {
+                loop_watch_del(&server_watch);
+                close(server);
+                server = -1;
+        }
+}
+
+static int send_request_path(unsigned short int port, int path,
+                             struct request_opt *opt)
+{
+        struct request_host host;
+        struct request_ctl ctl;
+        struct request_buff buff;
+
+        snprintf(host.addr, sizeof(host.addr), "127.0.0.1");
+        host.port = port;
+
+        ctl.hook_func = hook;
+        ctl.hook_data = &hook_paths[path];
+
+        memset(&buff, 0, sizeof(buff));
+        request_buff_printf(&buff, "GET /%d", path);
+        request_buff_add(&buff, " HTTP/1.0\r\n\r\n", 13, 0);
+
+        return request_send(&host, &ctl, &buff, opt);
+}
+
+static int send_request(unsigned short int port)
+{
+        return send_request_path(port, 0, NULL);
+}
+
+static void run_requests(void)
+{
+        uint64_t end = timer_now() + 5000;
+
+        while(!list_empty(&request_list) && timer_now() < end)
+        {
+                loop_run_once(100);
+                timer_ctl_run();
+        }
+}
+
+TEST_DEF(test_request_flow)
+{
+        struct request_host host;
+        struct request_ctl ctl = {
+                .hook_func = hook,
+                .hook_data = NULL,
+        };
+        struct request_buff buff;
+        unsigned short int port;
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        resolv_ctl_init("/nonexistent");
+
+        port = server_start(1);
+        TEST_ASSERT(port != 0, "unable to start the server");
+
+        hook_reset();
+        TEST_ASSERT(send_request(port) == 0, "request_send() failed !");
+        TEST_ASSERT(hook_count == 0, "hook called from request_send()");
+
+        run_requests();
+
+        TEST_ASSERT(hook_count == 2 && hook_state == FSFinished,
+                    "hook called %d times, last state %d",
+                    hook_count, hook_state);
+        TEST_ASSERT(strstr(hook_response, "good") != NULL,
+                    "response is '%.64s'", hook_response);
+
+        server_stop();
+
+        /* nobody listens: fail at once, not after the timeout */
+        port = server_start(0);
+        hook_reset();
+        TEST_ASSERT(send_request(port) == 0, "request_send() failed !");
+
+        run_requests();
+
+        TEST_ASSERT(hook_count == 1 && hook_state == FSError
+                    && hook_errcode == REQ_ERR_CONNECT_FAILED,
+                    "hook called %d times, last state %d, errcode %u",
+                    hook_count, hook_state, hook_errcode);
+
+        server_stop();
+
+        /* connect() fails synchronously on every address */
+        hook_reset();
+        snprintf(host.addr, sizeof(host.addr), "255.255.255.255");
+        host.port = port;
+        memset(&buff, 0, sizeof(buff));
+        request_buff_printf(&buff, "GET / HTTP/1.0\r\n\r\n");
+        TEST_ASSERT(request_send(&host, &ctl, &buff, NULL) == 0,
+                    "request_send() failed !");
+
+        run_requests();
+
+        TEST_ASSERT(hook_count == 1 && hook_state == FSError
+                    && hook_errcode == REQ_ERR_CONNECT_FAILED,
+                    "hook called %d times, last state %d, errcode %u",
+                    hook_count, hook_state, hook_errcode);
+
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
+TEST_DEF(test_request_pool)
+{
+        unsigned short int port;
+        int i;
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        resolv_ctl_init("/nonexistent");
+
+        server_keepalive = 1;
+        port = server_start(1);
+        TEST_ASSERT(port != 0, "unable to start the server");
+
+        /* one after the other: a single connection */
+        hook_reset();
+        for(i = 0; i < 3; ++i)
+        {
+                send_request(port);
+                run_requests();
+        }
+
+        TEST_ASSERT(hook_received == 3 && server_accepted == 1,
+                    "%d responses, %d connections (3 and 1 expected)",
+                    hook_received, server_accepted);
+
+        /* all at once: at most REQUEST_POOL_HOST_MAX_CONNS */
+        hook_reset();
+        for(i = 0; i < 10; ++i)
+        {
+                send_request(port);
+        }
+        run_requests();
+
+        TEST_ASSERT(hook_received == 10
+                    && server_accepted <= REQUEST_POOL_HOST_MAX_CONNS,
+                    "%d responses, %d connections (10 and <= %d expected)",
+                    hook_received, server_accepted,
+                    REQUEST_POOL_HOST_MAX_CONNS);
+
+        server_stop();
+
+        /* a connection closed by the server is replaced */
+        server_drop_second = 1;
+        port = server_start(1);
+
+        hook_reset();
+        send_request(port);
+        run_requests();
+        send_request(port);
+        run_requests();
+
+        TEST_ASSERT(hook_received == 2 && server_accepted == 2,
+                    "%d responses, %d connections (2 and 2 expected)",
+                    hook_received, server_accepted);
+
+        server_stop();
+        server_keepalive = 0;
+        server_drop_second = 0;
+
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
+TEST_DEF(test_request_pipeline)
+{
+        struct request_opt opt = {
+                .mask = REQ_OPT_PIPELINE,
+                .pipeline_depth = 4,
+        };
+        unsigned short int port;
+        int i;
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        resolv_ctl_init("/nonexistent");
+
+        server_keepalive = 1;
+        port = server_start(1);
+        TEST_ASSERT(port != 0, "unable to start the server");
+
+        /* prove the connections are kept alive first */
+        hook_reset();
+        for(i = 0; i < REQUEST_POOL_HOST_MAX_CONNS; ++i)
+        {
+                send_request_path(port, i, &opt);
+        }
+        run_requests();
+
+        /* then they carry several queries at once */
+        for(i = 0; i < 12; ++i)
+        {
+                send_request_path(port, i, &opt);
+        }
+        run_requests();
+
+        TEST_ASSERT(hook_received == 12 + REQUEST_POOL_HOST_MAX_CONNS
+                    && server_accepted <= REQUEST_POOL_HOST_MAX_CONNS,
+                    "%d responses, %d connections (%d and <= %d expected)",
+                    hook_received, server_accepted,
+                    12 + REQUEST_POOL_HOST_MAX_CONNS,
+                    REQUEST_POOL_HOST_MAX_CONNS);
+        TEST_ASSERT(server_pipelined > 1,
+                    "at most %d query read at once", server_pipelined);
+        TEST_ASSERT(hook_mismatch == 0,
+                    "%d responses given to the wrong request",
+                    hook_mismatch);
+
+        server_stop();
+        server_keepalive = 0;
+
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
+TEST_DEF(test_request_parser)
+{
+        static char body[1500 + 1];
+        unsigned short int port;
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        resolv_ctl_init("/nonexistent");
+
+        port = server_start(1);
+        TEST_ASSERT(port != 0, "unable to start the server");
+
+        /* chunked, cut anywhere */
+        server_parts[0] = "HTTP/1.1 200 OK\r\nTransfer-Enc";
+        server_parts[1] = "oding: chunked\r\nX-Test:  yes \r\n\r\n5\r\ngo";
+        server_parts[2] = "od \r\n3;ext=1\r\nall\r";
+        server_parts[3] = "\n0\r\nTrailer: 1\r\n\r\n";
+        server_parts[4] = NULL;
+
+        hook_reset();
+        send_request(port);
+        run_requests();
+
+        TEST_ASSERT(hook_received == 1 && hook_status == 200
+                    && strcmp(hook_response, "good all") == 0
+                    && strcmp(hook_xtest, "yes") == 0,
+                    "status %d, body '%.64s', X-Test '%s'",
+                    hook_status, hook_response, hook_xtest);
+
+        /* a body larger than a read */
+        memset(body, 'a', sizeof(body) - 1);
+        server_parts[0] = "HTTP/1.0 200 OK\r\nContent-Length: 1500\r\n"
+                "Connection: keep-alive\r\n\r\n";
+        server_parts[1] = body + 1000;
+        server_parts[2] = body + 500;
+        server_parts[3] = NULL;
+
+        hook_reset();
+        send_request(port);
+        run_requests();
+
+        TEST_ASSERT(hook_received == 1 && hook_body_size == 1500,
+                    "%d responses, body of %zu bytes (1500 expected)",
+                    hook_received, hook_body_size);
+
+        /* garbage, even after a retry */
+        server_parts[0] = "HTTP/9 what ?\r\n\r\n";
+        server_parts[1] = NULL;
+
+        hook_reset();
+        send_request(port);
+        run_requests();
+
+        TEST_ASSERT(hook_count == 1 && hook_state == FSError
+                    && hook_errcode == REQ_ERR_BAD_RESPONSE,
+                    "hook called %d times, last state %d, errcode %u",
+                    hook_count, hook_state, hook_errcode);
+
+        server_parts[0] = NULL;
+        server_stop();
+
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
+TEST_DEF(test_request_reserve)
+{
+        struct request_stats stats;
+        unsigned short int port;
+        int i;
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        resolv_ctl_init("/nonexistent");
+
+        TEST_ASSERT(request_ctl_reserve(4) == 0,
+                    "request_ctl_reserve() failed !");
+        TEST_ASSERT(request_ctl_reserve(2) == 0,
+                    "request_ctl_reserve() can't shrink");
+
+        /* nobody listens, the requests fail fast */
+        port = server_start(0);
+
+        hook_reset();
+        for(i = 0; i < 6; ++i)
+        {
+                send_request(port);
+        }
+        run_requests();
+
+        request_ctl_stats(&stats);
+        TEST_ASSERT(hook_count == 6 && stats.reserved == 4
+                    && stats.in_use == 0 && stats.high_water == 6
+                    && stats.heap_allocs == 2,
+                    "%d hooks, %u reserved, %u in use, high water %u,"
+                    " %lu heap allocations",
+                    hook_count, stats.reserved, stats.in_use,
+                    stats.high_water, stats.heap_allocs);
+
+        /* steady state: all from the reserve */
+        for(i = 0; i < 3; ++i)
+        {
+                send_request(port);
+                run_requests();
+        }
+
+        request_ctl_stats(&stats);
+        TEST_ASSERT(stats.heap_allocs == 2,
+                    "%lu heap allocations (2 expected)", stats.heap_allocs);
+
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
+TEST_DEF(test_request_segments)
+{
+        struct request_host host;
+        struct request_ctl ctl = {
+                .hook_func = hook,
+                .hook_data = &hook_paths[7],
+        };
+        struct request_buff buff;
+        char *pad = NULL;
+
+        timer_ctl_init();
+        TEST_ASSERT(loop_init() == 0, "loop_init() failed !");
+        resolv_ctl_init("/nonexistent");
+
+        server_keepalive = 1;
+        snprintf(host.addr, sizeof(host.addr), "127.0.0.1");
+        host.port = server_start(1);
+        TEST_ASSERT(host.port != 0, "unable to start the server");
+
+        /* a query far larger than a read, in segments */
+        pad = malloc(3000);
+        TEST_ASSERT(pad != NULL, "malloc() failed");
+        memset(pad, 'a', 3000);
+        memcpy(pad, "X-Pad: ", 7);
+        memcpy(pad + 2998, "\r\n", 2);
+
+        memset(&buff, 0, sizeof(buff));
+        TEST_ASSERT(request_buff_printf(&buff, "GET /%d HTTP/1.0\r\n", 7) == 0
+                    && request_buff_add(&buff, pad, 3000, 1) == 0
+                    && request_buff_add(&buff, "\r\n", 2, 0) == 0
+                    && buff.data_size == 3000 + 19,
+                    "query of %zu bytes", buff.data_size);
+
+        hook_reset();
+        TEST_ASSERT(request_send(&host, &ctl, &buff, NULL) == 0,
+                    "request_send() failed !");
+        TEST_ASSERT(buff.segs_count == 0 && buff.owned == 0,
+                    "the segments are still in buff");
+
+        run_requests();
+
+        TEST_ASSERT(hook_received == 1 && hook_mismatch == 0
+                    && strcmp(hook_response, "good /7") == 0,
+                    "%d responses, body '%.64s'",
+                    hook_received, hook_response);
+
+        server_stop();
+        server_keepalive = 0;
+
+        request_ctl_cleanup();
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
 int main(void)
 {
         TEST_INIT("request");
@@ -98,6 +774,12 @@ int main(void)
         setup();
 
         TEST_RUN(test_request_remove);
+        TEST_RUN(test_request_flow);
+        TEST_RUN(test_request_pool);
+        TEST_RUN(test_request_pipeline);
+        TEST_RUN(test_request_parser);
+        TEST_RUN(test_request_reserve);
+        TEST_RUN(test_request_segments);
 
         teardown();
 
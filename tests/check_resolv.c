@@ -0,0 +1,612 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "yatest.h"
+#include "yaserver.h"
+#include "yadns.h"
+
+#include "../src/resolv.h"
+#include "../src/loop.h"
+#include "../src/timer.h"
+#include "../src/util.h"
+
+/*
+ * A tiny dns server on 127.0.0.1 (udp and tcp on the same port)
+ * answering the A questions according to server_mode.
+ */
+enum server_mode {
+        ModeAnswer,
+        ModeNxdomain,
+        ModeDropFirst,
+        ModeTruncated,
+        ModeCname,
+        ModeServfail,
+        ModeSwapcase,
+};
+
+static enum server_mode server_mode = ModeAnswer;
+static struct yaserver server_udp;
+static struct yaserver server_tcp;
+static unsigned short int server_port = 0;
+static int server_udp_count = 0;
+static int server_tcp_count = 0;
+
+static int done = 0;
+static struct resolv_result last_result;
+
+/*
+ * build the answer of the query of pkt (len bytes) in place
+ */
+static size_t server_answer(unsigned char *pkt, size_t len, size_t size,
+                            int is_tcp)
+{
+        const unsigned char target[] = "\004host\007example\003net";
+        size_t n;
+
+        if(server_mode == ModeSwapcase)
+        {
+                yadns_swapcase(pkt, len);
+        }
+
+        switch(server_mode)
+        {
+        case ModeNxdomain:
+                return yadns_reply(pkt, len, YADNS_RA | YADNS_NXDOMAIN);
+        case ModeServfail:
+                return yadns_reply(pkt, len, YADNS_RA | YADNS_SERVFAIL);
+        case ModeTruncated:
+                if(!is_tcp)
+                {
+                        return yadns_reply(pkt, len, YADNS_RA | YADNS_TC);
+                }
+                break;
+        default:
+                break;
+        }
+
+        if(yadns_qtype(pkt, len) != 1)
+        {
+                /* no AAAA */
+                return yadns_reply(pkt, len, YADNS_RA);
+        }
+
+        n = yadns_reply(pkt, len, YADNS_RA);
+
+        if(server_mode == ModeCname)
+        {
+                /* www.example.com CNAME host.example.net (name
+                 * compressed to the question), then the A of the
+                 * target (compressed to the cname rdata)
+                 */
+                n = yadns_put_rr(pkt, n, size, YADNS_QNAME, 5, 600,
+                                 target, sizeof(target));
+                return yadns_put_a(pkt, n, size,
+                                   (unsigned int)(n - sizeof(target)), 120,
+                                   "192.0.2.1");
+        }
+
+        return yadns_put_a(pkt, n, size, YADNS_QNAME, 300,
+                           (is_tcp ? "192.0.2.2" : "192.0.2.1"));
+}
+
+static size_t server_udp_cb(unsigned char *buf, size_t len, size_t size,
+                            const struct sockaddr_in *from)
+{
+        UNUSED(from);
+
+        if(len < 17)
+        {
+                return 0;
+        }
+
+        ++server_udp_count;
+        if(server_mode == ModeDropFirst && server_udp_count == 1)
+        {
+                return 0;
+        }
+
+        return server_answer(buf, len, size, 0);
+}
+
+static size_t server_tcp_cb(unsigned char *buf, size_t len, size_t size,
+                            const struct sockaddr_in *from)
+{
+        size_t n;
+
+        UNUSED(from);
+
+        /* length prefixed */
+        if(len < 2 + 17 || len != 2 + (size_t)(buf[0] << 8 | buf[1]))
+        {
+                return 0;
+        }
+
+        ++server_tcp_count;
+        n = server_answer(buf + 2, len - 2, size - 2, 1);
+        buf[0] = (unsigned char)(n >> 8);
+        buf[1] = (unsigned char)(n & 0xff);
+
+        return n + 2;
+}
+
+static int server_start(void)
+{
+        server_port = yaserver_start(&server_tcp, SOCK_STREAM,
+                                     server_tcp_cb);
+        if(server_port == 0
+           || yaserver_start_port(&server_udp, SOCK_DGRAM, server_port,
+                                  server_udp_cb) == 0)
+        {
+                return -1;
+        }
+
+        return 0;
+}
+
+static void server_stop(void)
+{
+        yaserver_stop(&server_udp);
+        yaserver_stop(&server_tcp);
+}
+
+static void query_cb(struct resolv_query *query,
+                     const struct resolv_result *result,
+                     void *data)
+{
+        UNUSED(query);
+        UNUSED(data);
+
+        memcpy(&last_result, result, sizeof(last_result));
+        ++done;
+}
+
+/*
+ * run the loop until the query is done (or 5 seconds)
+ */
+static void run_query(void)
+{
+        uint64_t end = timer_now() + 5000;
+        int timeout;
+
+        while(done == 0 && timer_now() < end)
+        {
+                timeout = timer_ctl_next_timeout();
+                if(timeout < 0 || timeout > 100)
+                {
+                        timeout = 100;
+                }
+
+                loop_run_once(timeout);
+                timer_ctl_run();
+        }
+}
+
+static int setup(enum server_mode mode)
+{
+        timer_ctl_init();
+        if(loop_init() != 0)
+        {
+                return -1;
+        }
+
+        server_mode = mode;
+        server_udp_count = 0;
+        server_tcp_count = 0;
+        done = 0;
+        memset(&last_result, 0, sizeof(last_result));
+
+        if(server_start() != 0)
+        {
+                return -1;
+        }
+
+        resolv_ctl_init("/nonexistent");
+        resolv_ctl_set_options(200, 2);
+
+        return resolv_ctl_set_nameserver("127.0.0.1", server_port);
+}
+
+static void teardown(void)
+{
+        resolv_ctl_cleanup();
+        server_stop();
+        loop_cleanup();
+        timer_ctl_cleanup();
+}
+
+static const char *result_addr(size_t i)
+{
+        static char buf[UTIL_SOCKADDR_STRLEN];
+
+        return util_sockaddr_ntop((const struct sockaddr *)
+                                  &(last_result.addrs[i]),
+                                  buf, sizeof(buf));
+}
+
+TEST_DEF(test_resolv_answer)
+{
+        struct resolv_query query;
+
+        TEST_ASSERT(setup(ModeAnswer) == 0, "setup failed !");
+
+        TEST_ASSERT(resolv_query_start(&query, "members.example.test", 80,
+                                       AF_UNSPEC, query_cb, NULL) == 0,
+                    "resolv_query_start() failed !");
+        TEST_ASSERT(done == 0, "cb called from resolv_query_start()");
+
+        run_query();
+
+        TEST_ASSERT(done == 1, "cb called %d times (1 expected)", done);
+        TEST_ASSERT(last_result.err == RESOLV_ERR_OK,
+                    "err = %d (%s)", last_result.err,
+                    strresolverr(last_result.err));
+        TEST_ASSERT(last_result.count == 1,
+                    "%zu addresses (1 expected)", last_result.count);
+        TEST_ASSERT(strcmp(result_addr(0), "192.0.2.1:80") == 0,
+                    "address is %s (192.0.2.1:80 expected)",
+                    result_addr(0));
+        TEST_ASSERT(last_result.ttl == 300,
+                    "ttl = %u (300 expected)", last_result.ttl);
+
+        teardown();
+}
+
+TEST_DEF(test_resolv_nxdomain)
+{
+        struct resolv_query query;
+
+        TEST_ASSERT(setup(ModeNxdomain) == 0, "setup failed !");
+
+        resolv_query_start(&query, "nowhere.example.test", 80,
+                           AF_INET, query_cb, NULL);
+        run_query();
+
+        TEST_ASSERT(done == 1, "cb called %d times (1 expected)", done);
+        TEST_ASSERT(last_result.err == RESOLV_ERR_NOT_FOUND,
+                    "err = %d (%s)", last_result.err,
+                    strresolverr(last_result.err));
+
+        teardown();
+}
+
+TEST_DEF(test_resolv_retry)
+{
+        struct resolv_query query;
+
+        TEST_ASSERT(setup(ModeDropFirst) == 0, "setup failed !");
+
+        resolv_query_start(&query, "members.example.test", 443,
+                           AF_INET, query_cb, NULL);
+        run_query();
+
+        TEST_ASSERT(done == 1, "cb called %d times (1 expected)", done);
+        TEST_ASSERT(server_udp_count == 2,
+                    "%d udp queries (2 expected)", server_udp_count);
+        TEST_ASSERT(last_result.err == RESOLV_ERR_OK
+                    && strcmp(result_addr(0), "192.0.2.1:443") == 0,
+                    "err = %d, address is %s", last_result.err,
+                    result_addr(0));
+
+        teardown();
+}
+
+TEST_DEF(test_resolv_truncated)
+{
+        struct resolv_query query;
+
+        TEST_ASSERT(setup(ModeTruncated) == 0, "setup failed !");
+
+        resolv_query_start(&query, "members.example.test", 80,
+                           AF_INET, query_cb, NULL);
+        run_query();
+
+        TEST_ASSERT(done == 1, "cb called %d times (1 expected)", done);
+        TEST_ASSERT(server_tcp_count == 1,
+                    "%d tcp queries (1 expected)", server_tcp_count);
+        TEST_ASSERT(last_result.err == RESOLV_ERR_OK
+                    && strcmp(result_addr(0), "192.0.2.2:80") == 0,
+                    "err = %d, address is %s", last_result.err,
+                    result_addr(0));
+
+        teardown();
+}
+
+TEST_DEF(test_resolv_cname)
+{
+        struct resolv_query query;
+
+        TEST_ASSERT(setup(ModeCname) == 0, "setup failed !");
+
+        resolv_query_start(&query, "WWW.Example.Test", 80,
+                           AF_INET, query_cb, NULL);
+        run_query();
+
+        TEST_ASSERT(done == 1, "cb called %d times (1 expected)", done);
+        TEST_ASSERT(last_result.err == RESOLV_ERR_OK
+                    && last_result.count == 1,
+                    "err = %d, %zu addresses", last_result.err,
+                    last_result.count);
+        TEST_ASSERT(last_result.ttl == 120,
+                    "ttl = %u (120 expected)", last_result.ttl);
+
+        teardown();
+}
+
+TEST_DEF(test_resolv_servfail)
+{
+        struct resolv_query query;
+
+        TEST_ASSERT(setup(ModeServfail) == 0, "setup failed !");
+
+        resolv_query_start(&query, "members.example.test", 80,
+                           AF_INET, query_cb, NULL);
+        run_query();
+
+        TEST_ASSERT(done == 1, "cb called %d times (1 expected)", done);
+        TEST_ASSERT(server_udp_count == 2,
+                    "%d udp queries (2 expected)", server_udp_count);
+        TEST_ASSERT(last_result.err == RESOLV_ERR_SERVER,
+                    "err = %d (%s)", last_result.err,
+                    strresolverr(last_result.err));
+
+        teardown();
+}
+
+TEST_DEF(test_resolv_numeric_cancel)
+{
+        struct resolv_query query;
+
+        TEST_ASSERT(setup(ModeAnswer) == 0, "setup failed !");
+
+        /* numeric host, no dns query */
+        resolv_query_start(&query, "198.51.100.7", 8080,
+                           AF_INET, query_cb, NULL);
+        TEST_ASSERT(done == 0, "cb called from resolv_query_start()");
+        run_query();
+
+        TEST_ASSERT(done == 1 && server_udp_count == 0,
+                    "cb called %d times, %d udp queries",
+                    done, server_udp_count);
+        TEST_ASSERT(strcmp(result_addr(0), "198.51.100.7:8080") == 0,
+                    "address is %s", result_addr(0));
+
+        /* a cancelled query never calls back */
+        done = 0;
+        resolv_query_start(&query, "members.example.test", 80,
+                           AF_INET, query_cb, NULL);
+        resolv_query_cancel(&query);
+        resolv_query_cancel(&query);
+
+        loop_run_once(300);
+        timer_ctl_run();
+        TEST_ASSERT(done == 0, "cb called %d times (0 expected)", done);
+
+        teardown();
+}
+
+TEST_DEF(test_resolv_cache)
+{
+        struct resolv_query queries[3];
+        size_t i;
+
+        TEST_ASSERT(setup(ModeAnswer) == 0, "setup failed !");
+
+        /* concurrent queries of a host share one lookup */
+        for(i = 0; i < 3; ++i)
+        {
+                resolv_query_start(&queries[i], "members.example.test",
+                                   (unsigned short int)(80 + i),
+                                   AF_INET, query_cb, NULL);
+        }
+
+        /* the owner of the first one gives up */
+        resolv_query_cancel(&queries[0]);
+
+        while(done < 2 && timer_ctl_next_timeout() != -1)
+        {
+                run_query();
+        }
+
+        TEST_ASSERT(done == 2, "cb called %d times (2 expected)", done);
+        TEST_ASSERT(server_udp_count == 1,
+                    "%d udp queries (1 expected)", server_udp_count);
+        TEST_ASSERT(strcmp(result_addr(0), "192.0.2.1:82") == 0,
+                    "address is %s (192.0.2.1:82 expected)",
+                    result_addr(0));
+
+        /* then answered from the cache, with the remaining ttl */
+        done = 0;
+        resolv_query_start(&queries[0], "Members.Example.Test", 443,
+                           AF_INET, query_cb, NULL);
+        TEST_ASSERT(done == 0, "cb called from resolv_query_start()");
+        run_query();
+
+        TEST_ASSERT(done == 1 && server_udp_count == 1,
+                    "cb called %d times, %d udp queries (1 and 1 expected)",
+                    done, server_udp_count);
+        TEST_ASSERT(last_result.err == RESOLV_ERR_OK
+                    && last_result.ttl <= 300 && last_result.ttl >= 298,
+                    "err = %d, ttl = %u", last_result.err, last_result.ttl);
+        TEST_ASSERT(strcmp(result_addr(0), "192.0.2.1:443") == 0,
+                    "address is %s (192.0.2.1:443 expected)",
+                    result_addr(0));
+
+        /* another family is another entry */
+        done = 0;
+        resolv_query_start(&queries[0], "members.example.test", 80,
+                           AF_UNSPEC, query_cb, NULL);
+        run_query();
+        TEST_ASSERT(done == 1 && server_udp_count == 3,
+                    "cb called %d times, %d udp queries (1 and 3 expected)",
+                    done, server_udp_count);
+
+        /* reading resolv.conf again drops the answers */
+        resolv_ctl_init("/nonexistent");
+        resolv_ctl_set_nameserver("127.0.0.1", server_port);
+
+        done = 0;
+        resolv_query_start(&queries[0], "members.example.test", 80,
+                           AF_INET, query_cb, NULL);
+        run_query();
+        TEST_ASSERT(done == 1 && server_udp_count == 4,
+                    "cb called %d times, %d udp queries (1 and 4 expected)",
+                    done, server_udp_count);
+
+        teardown();
+}
+
+TEST_DEF(test_resolv_cache_negative)
+{
+        struct resolv_query query;
+
+        TEST_ASSERT(setup(ModeNxdomain) == 0, "setup failed !");
+
+        resolv_query_start(&query, "nowhere.example.test", 80,
+                           AF_INET, query_cb, NULL);
+        run_query();
+
+        /* nxdomain is remembered */
+        done = 0;
+        resolv_query_start(&query, "nowhere.example.test", 80,
+                           AF_INET, query_cb, NULL);
+        run_query();
+
+        TEST_ASSERT(done == 1 && server_udp_count == 1,
+                    "cb called %d times, %d udp queries (1 and 1 expected)",
+                    done, server_udp_count);
+        TEST_ASSERT(last_result.err == RESOLV_ERR_NOT_FOUND,
+                    "err = %d (%s)", last_result.err,
+                    strresolverr(last_result.err));
+
+        teardown();
+
+        /* a server failure isn't */
+        TEST_ASSERT(setup(ModeServfail) == 0, "setup failed !");
+
+        resolv_query_start(&query, "members.example.test", 80,
+                           AF_INET, query_cb, NULL);
+        run_query();
+
+        done = 0;
+        resolv_query_start(&query, "members.example.test", 80,
+                           AF_INET, query_cb, NULL);
+        run_query();
+
+        TEST_ASSERT(done == 1 && server_udp_count == 4,
+                    "cb called %d times, %d udp queries (1 and 4 expected)",
+                    done, server_udp_count);
+
+        teardown();
+}
+
+TEST_DEF(test_resolv_fresh)
+{
+        struct resolv_query query;
+
+        TEST_ASSERT(setup(ModeAnswer) == 0, "setup failed !");
+
+        /* the cached answer isn't given to a fresh query */
+        resolv_query_start(&query, "members.example.test", 80,
+                           AF_INET, query_cb, NULL);
+        run_query();
+
+        done = 0;
+        TEST_ASSERT(resolv_query_start_fresh(&query, "members.example.test",
+                                             AF_INET, NULL, 0, NULL,
+                                             query_cb, NULL) == 0,
+                    "resolv_query_start_fresh() failed !");
+        run_query();
+        TEST_ASSERT(done == 1 && server_udp_count == 2
+                    && last_result.err == RESOLV_ERR_OK
+                    && strcmp(result_addr(0), "192.0.2.1:0") == 0,
+                    "cb called %d times, %d udp queries, address is %s",
+                    done, server_udp_count, result_addr(0));
+
+        /* a given nameserver, not the ones of resolv.conf */
+        resolv_ctl_set_nameserver("127.0.0.1", 9);
+
+        done = 0;
+        resolv_query_start_fresh(&query, "members.example.test", AF_INET,
+                                 "127.0.0.1", server_port, NULL,
+                                 query_cb, NULL);
+        run_query();
+        TEST_ASSERT(done == 1 && server_udp_count == 3
+                    && last_result.err == RESOLV_ERR_OK,
+                    "cb called %d times, %d udp queries, err = %d",
+                    done, server_udp_count, last_result.err);
+
+        TEST_ASSERT(resolv_query_start_fresh(&query, "members.example.test",
+                                             AF_INET, "not an address", 53,
+                                             NULL, query_cb, NULL) != 0,
+                    "started with an invalid nameserver");
+
+        teardown();
+}
+
+TEST_DEF(test_resolv_0x20)
+{
+        struct resolv_query query;
+        struct resolv_opt opt = {
+                .mask = RESOLV_OPT_0X20 | RESOLV_OPT_BIND_ADDR,
+        };
+
+        opt.bind_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        TEST_ASSERT(setup(ModeAnswer) == 0, "setup failed !");
+
+        /* the case of the question is echoed */
+        TEST_ASSERT(resolv_query_start_fresh(&query,
+                                             "members.example.test",
+                                             AF_INET, "127.0.0.1",
+                                             server_port, &opt,
+                                             query_cb, NULL) == 0,
+                    "resolv_query_start_fresh() failed !");
+        run_query();
+        TEST_ASSERT(done == 1 && last_result.err == RESOLV_ERR_OK
+                    && strcmp(result_addr(0), "192.0.2.1:0") == 0,
+                    "cb called %d times, err = %d", done, last_result.err);
+        TEST_ASSERT(strcasecmp(query.qname, "members.example.test") == 0,
+                    "question asked as %.64s", query.qname);
+
+        teardown();
+
+        /* not echoed: the answers are ignored */
+        TEST_ASSERT(setup(ModeSwapcase) == 0, "setup failed !");
+
+        opt.mask = RESOLV_OPT_0X20;
+        resolv_query_start_fresh(&query, "members.example.test", AF_INET,
+                                 "127.0.0.1", server_port, &opt,
+                                 query_cb, NULL);
+        run_query();
+        TEST_ASSERT(done == 1 && last_result.err == RESOLV_ERR_TIMEOUT
+                    && server_udp_count == 2,
+                    "cb called %d times, %d udp queries, err = %d",
+                    done, server_udp_count, last_result.err);
+
+        teardown();
+}
+
+int main(void)
+{
+        TEST_INIT("resolv");
+
+        TEST_RUN(test_resolv_answer);
+        TEST_RUN(test_resolv_nxdomain);
+        TEST_RUN(test_resolv_retry);
+        TEST_RUN(test_resolv_truncated);
+        TEST_RUN(test_resolv_cname);
+        TEST_RUN(test_resolv_servfail);
+        TEST_RUN(test_resolv_numeric_cancel);
+        TEST_RUN(test_resolv_cache);
+        TEST_RUN(test_resolv_cache_negative);
+        TEST_RUN(test_resolv_fresh);
+        TEST_RUN(test_resolv_0x20);
+
+	return TEST_RETURN;
+}
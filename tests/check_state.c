@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "yatest.h"
+
+#include "../src/state.h"
+#include "../src/wan.h"
+#include "../src/account.h"
+#include "../src/config.h"
+#include "../src/request.h"
+#include "../src/services.h"
+#include "../src/timer.h"
+#include "../src/util.h"
+
+#define STATE_FILE "check_state.state"
+
+static const char *names[] = {
+        "updated", "locked", "freezed", "not updated",
+};
+
+static void state_cfg(struct cfg *cfg)
+{
+        struct cfg_account *accountcfg = NULL;
+        char hostname[32];
+        size_t i;
+
+        config_init(cfg);
+
+        for(i = 0; i < ARRAY_SIZE(names); ++i)
+        {
+                accountcfg = calloc(1, sizeof(struct cfg_account));
+                if(accountcfg == NULL)
+                {
+                        exit(1);
+                }
+
+                cfgstr_set(&(accountcfg->name), names[i]);
+                cfgstr_set(&(accountcfg->service), "dyndns");
+                cfgstr_set(&(accountcfg->username), "user");
+                cfgstr_set(&(accountcfg->passwd), "passwd");
+                snprintf(hostname, sizeof(hostname), "host%zu.example.org", i);
+                cfgstr_dup(&(accountcfg->hostname), hostname);
+                config_account_add(cfg, accountcfg);
+        }
+}
+
+TEST_DEF(test_state_restart)
+{
+        struct account_state state;
+        struct account *account = NULL;
+        struct cfg cfg;
+        time_t now = time(NULL);
+
+        timer_ctl_init();
+        request_ctl_init();
+        account_ctl_init();
+        state_cfg(&cfg);
+        TEST_ASSERT(account_ctl_mapcfg(&cfg) == 0,
+                    "account_ctl_mapcfg() failed !");
+
+        /* the states before the restart */
+        account = account_ctl_get("updated");
+        account_getstate(account, &state);
+        state.updated_at = now - 3600;
+        inet_pton(AF_INET, "192.0.2.1", &(state.ip));
+        account_setstate(account, &state);
+
+        account = account_ctl_get("locked");
+        account_getstate(account, &state);
+        state.locked = 1;
+        account_setstate(account, &state);
+
+        account = account_ctl_get("freezed");
+        account_getstate(account, &state);
+        state.freezed_until = now + 600;
+        state.attempts = 3;
+        account_setstate(account, &state);
+
+        TEST_ASSERT(state_save(STATE_FILE) == 0, "state_save() failed");
+        TEST_ASSERT(access(STATE_FILE ".tmp", F_OK) != 0,
+                    "temporary file left");
+
+        /* restart */
+        account_ctl_cleanup();
+        config_free(&cfg);
+        account_ctl_init();
+        state_cfg(&cfg);
+        TEST_ASSERT(account_ctl_mapcfg(&cfg) == 0,
+                    "account_ctl_mapcfg() failed !");
+
+        TEST_ASSERT(state_load(STATE_FILE) == (int)ARRAY_SIZE(names),
+                    "state_load() failed");
+
+        account = account_ctl_get("updated");
+        TEST_ASSERT(account->updated && account->status == ASOk
+                    && account->ip.s_addr == inet_addr("192.0.2.1")
+                    && account->updated_at == now - 3600
+                    && timer_pending(&(account->refresh_timer)),
+                    "update not restored");
+
+        account = account_ctl_get("locked");
+        TEST_ASSERT(account->locked && !account->updated,
+                    "lock not restored");
+
+        account = account_ctl_get("freezed");
+        TEST_ASSERT(account->freezed && account->backoff.attempts == 3
+                    && account->freeze_timer.expire > timer_now() + 500000,
+                    "freeze not restored");
+
+        account = account_ctl_get("not updated");
+        TEST_ASSERT(!account->updated && !account->locked
+                    && !account->freezed,
+                    "not updated account restored");
+
+        /* the wan ip pushed before the restart: no update */
+        inet_pton(AF_INET, "192.0.2.1", &(wan_default.ip));
+        account_ctl_wanipchanged(&wan_default);
+        TEST_ASSERT(account_ctl_get("updated")->updated,
+                    "updated again with the same wan ip");
+
+        /* an other wan ip */
+        inet_pton(AF_INET, "192.0.2.2", &(wan_default.ip));
+        account_ctl_wanipchanged(&wan_default);
+        TEST_ASSERT(!account_ctl_get("updated")->updated,
+                    "not updated with a new wan ip");
+
+        /* a changed cfg (another fingerprint) forgets the state */
+        account_ctl_cleanup();
+        config_free(&cfg);
+        account_ctl_init();
+        state_cfg(&cfg);
+        config_account_get(&cfg, "locked")->fingerprint ^= 1;
+        TEST_ASSERT(account_ctl_mapcfg(&cfg) == 0,
+                    "account_ctl_mapcfg() failed !");
+
+        TEST_ASSERT(state_load(STATE_FILE) == (int)ARRAY_SIZE(names) - 1
+                    && !account_ctl_get("locked")->locked,
+                    "state of a changed account restored");
+
+        unlink(STATE_FILE);
+        wan_default.ip.s_addr = 0;
+        account_ctl_cleanup();
+        config_free(&cfg);
+        request_ctl_cleanup();
+        timer_ctl_cleanup();
+}
+
+TEST_DEF(test_state_invalid)
+{
+        FILE *fp = NULL;
+
+        TEST_ASSERT(state_load("nonexistent.state") == -1,
+                    "loaded a missing file");
+
+        fp = fopen(STATE_FILE, "w");
+        TEST_ASSERT(fp != NULL, "Unable to write " STATE_FILE);
+        fprintf(fp, "yaddns-state 0\n");
+        fclose(fp);
+
+        TEST_ASSERT(state_load(STATE_FILE) == -1,
+                    "loaded a file of an other version");
+
+        unlink(STATE_FILE);
+}
+
+int main(void)
+{
+        TEST_INIT("state");
+
+        if(services_populate_list() != 0)
+        {
+                return RET_ERROR;
+        }
+
+        TEST_RUN(test_state_restart);
+        TEST_RUN(test_state_invalid);
+
+	return TEST_RETURN;
+}
@@ -0,0 +1,323 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "yatest.h"
+#include "yaserver.h"
+
+#include "../src/stun.h"
+#include "../src/config.h"
+#include "../src/resolv.h"
+#include "../src/loop.h"
+#include "../src/timer.h"
+#include "../src/util.h"
+
+static const uint8_t tid[STUN_TID_SIZE] = {
+        0xb7, 0xe7, 0xa7, 0x01, 0xbc, 0x34,
+        0xd6, 0x86, 0xfa, 0x87, 0xdf, 0xae,
+};
+
+/*
+ * a binding response of tid: its header then its attributes
+ */
+static size_t msg_header(uint8_t *buf, uint16_t type)
+{
+        buf[0] = (uint8_t)(type >> 8);
+        buf[1] = (uint8_t)type;
+        buf[2] = 0;
+        buf[3] = 0;
+        buf[4] = 0x21;
+        buf[5] = 0x12;
+        buf[6] = 0xa4;
+        buf[7] = 0x42;
+        memcpy(buf + 8, tid, STUN_TID_SIZE);
+
+        return STUN_HEADER_SIZE;
+}
+
+static size_t msg_attr(uint8_t *buf, size_t len, uint16_t type,
+                       const uint8_t *value, size_t vlen)
+{
+        size_t padded = (vlen + 3) & ~(size_t)3;
+
+        buf[len] = (uint8_t)(type >> 8);
+        buf[len + 1] = (uint8_t)type;
+        buf[len + 2] = (uint8_t)(vlen >> 8);
+        buf[len + 3] = (uint8_t)vlen;
+        memset(buf + len + 4, 0, padded);
+        memcpy(buf + len + 4, value, vlen);
+        len += 4 + padded;
+
+        /* length of the attributes */
+        buf[2] = (uint8_t)((len - STUN_HEADER_SIZE) >> 8);
+        buf[3] = (uint8_t)(len - STUN_HEADER_SIZE);
+
+        return len;
+}
+
+TEST_DEF(test_stun_parse)
+{
+        /* RFC 5769 2.2 and 2.3: 192.0.2.1 and
+         * 2001:db8:1234:5678:11:2233:4455:6677, port 32853
+         */
+        const uint8_t xor_v4[] = {
+                0x00, 0x01, 0xa1, 0x47, 0xe1, 0x12, 0xa6, 0x43,
+        };
+        const uint8_t xor_v6[] = {
+                0x00, 0x02, 0xa1, 0x47,
+                0x01, 0x13, 0xa9, 0xfa, 0xa5, 0xd3, 0xf1, 0x79,
+                0xbc, 0x25, 0xf4, 0xb5, 0xbe, 0xd2, 0xb9, 0xd9,
+        };
+        const uint8_t mapped_v4[] = {
+                0x00, 0x01, 0x0d, 0x96, 198, 51, 100, 7,
+        };
+        const uint8_t software[] = { 'y', 'a', 'd', 'd', 'n', 's' };
+        const uint8_t error[] = { 0x00, 0x00, 0x04, 0x00, 'B', 'a', 'd' };
+        uint8_t other[STUN_TID_SIZE];
+        struct stun_mapped mapped;
+        struct in6_addr v6;
+        uint8_t buf[256];
+        size_t len;
+
+        len = msg_header(buf, 0x0101);
+        len = msg_attr(buf, len, 0x8022, software, sizeof(software));
+        len = msg_attr(buf, len, 0x0020, xor_v4, sizeof(xor_v4));
+        TEST_ASSERT(stun_parse(buf, len, tid, &mapped) == 0
+                    && mapped.family == AF_INET
+                    && mapped.v4.s_addr == inet_addr("192.0.2.1")
+                    && mapped.port == 32853,
+                    "xor mapped ipv4 address not read");
+
+        len = msg_header(buf, 0x0101);
+        len = msg_attr(buf, len, 0x0020, xor_v6, sizeof(xor_v6));
+        inet_pton(AF_INET6, "2001:db8:1234:5678:11:2233:4455:6677", &v6);
+        TEST_ASSERT(stun_parse(buf, len, tid, &mapped) == 0
+                    && mapped.family == AF_INET6
+                    && memcmp(&(mapped.v6), &v6, sizeof(v6)) == 0
+                    && mapped.port == 32853,
+                    "xor mapped ipv6 address not read");
+
+        /* an old server, the xored one is preferred */
+        len = msg_header(buf, 0x0101);
+        len = msg_attr(buf, len, 0x0001, mapped_v4, sizeof(mapped_v4));
+        TEST_ASSERT(stun_parse(buf, len, tid, &mapped) == 0
+                    && mapped.v4.s_addr == inet_addr("198.51.100.7")
+                    && mapped.port == 3478,
+                    "mapped address not read");
+        len = msg_attr(buf, len, 0x0020, xor_v4, sizeof(xor_v4));
+        TEST_ASSERT(stun_parse(buf, len, tid, &mapped) == 0
+                    && mapped.v4.s_addr == inet_addr("192.0.2.1"),
+                    "mapped address preferred to the xored one");
+
+        /* not an answer of the transaction */
+        memcpy(other, tid, sizeof(other));
+        other[0] ^= 0xff;
+        TEST_ASSERT(stun_parse(buf, len, other, &mapped) == -1,
+                    "answer of another transaction accepted");
+        TEST_ASSERT(stun_parse(buf, len - 4, tid, &mapped) == -1,
+                    "truncated answer accepted");
+        buf[4] = 0;
+        TEST_ASSERT(stun_parse(buf, len, tid, &mapped) == -1,
+                    "answer without magic cookie accepted");
+
+        /* failed */
+        len = msg_header(buf, 0x0111);
+        len = msg_attr(buf, len, 0x0009, error, sizeof(error));
+        TEST_ASSERT(stun_parse(buf, len, tid, &mapped) == 1,
+                    "error response accepted");
+
+        len = msg_header(buf, 0x0101);
+        len = msg_attr(buf, len, 0x0020, xor_v4, sizeof(xor_v4));
+        len = msg_attr(buf, len, 0x0003, software, 4);
+        TEST_ASSERT(stun_parse(buf, len, tid, &mapped) == 1,
+                    "unknown comprehension-required attribute accepted");
+
+        len = msg_header(buf, 0x0101);
+        len = msg_attr(buf, len, 0x8022, software, sizeof(software));
+        TEST_ASSERT(stun_parse(buf, len, tid, &mapped) == 1,
+                    "response without address accepted");
+
+        TEST_ASSERT(stun_request(buf, sizeof(buf), tid) == STUN_HEADER_SIZE
+                    && buf[0] == 0x00 && buf[1] == 0x01
+                    && buf[2] == 0x00 && buf[3] == 0x00
+                    && memcmp(buf + 8, tid, STUN_TID_SIZE) == 0,
+                    "bad binding request");
+}
+
+/* a local stand-in of a stun server: it answers with echo_mapped_addr
+ * (the source of the request if INADDR_ANY), after dropping echo_drops
+ * requests
+ */
+static struct yaserver echo_server;
+static unsigned short int echo_port = 0;
+static struct in_addr echo_mapped_addr;
+static unsigned int echo_drops = 0;
+static unsigned int echo_requests = 0;
+
+static size_t echo_answer(unsigned char *buf, size_t len, size_t size,
+                          const struct sockaddr_in *from)
+{
+        uint8_t value[8];
+        uint32_t addr;
+        uint16_t port;
+
+        UNUSED(size);
+
+        if(len != STUN_HEADER_SIZE || buf[0] != 0x00 || buf[1] != 0x01)
+        {
+                return 0;
+        }
+
+        ++echo_requests;
+        if(echo_drops > 0)
+        {
+                --echo_drops;
+                return 0;
+        }
+
+        addr = ntohl(echo_mapped_addr.s_addr != INADDR_ANY
+                     ? echo_mapped_addr.s_addr : from->sin_addr.s_addr);
+        port = ntohs(from->sin_port);
+
+        value[0] = 0;
+        value[1] = 0x01;
+        value[2] = (uint8_t)((port >> 8) ^ 0x21);
+        value[3] = (uint8_t)(port ^ 0x12);
+        value[4] = (uint8_t)((addr >> 24) ^ 0x21);
+        value[5] = (uint8_t)((addr >> 16) ^ 0x12);
+        value[6] = (uint8_t)((addr >> 8) ^ 0xa4);
+        value[7] = (uint8_t)(addr ^ 0x42);
+
+        /* the transaction id of the request */
+        buf[0] = 0x01;
+        return msg_attr(buf, STUN_HEADER_SIZE, 0x0020, value, sizeof(value));
+}
+
+static void stun_setup(struct cfg_stun *cfg)
+{
+        memset(cfg, 0, sizeof(struct cfg_stun));
+        cfg->rto = 10;
+        cfg->upint = 60;
+}
+
+static void stun_add(struct cfg_stun *cfg, unsigned short int port)
+{
+        struct cfg_stun_server *server = &(cfg->server[cfg->count++]);
+
+        cfgstr_set(&(server->host), "127.0.0.1");
+        server->port = port;
+}
+
+/*
+ * until a server answered or all of them failed
+ */
+static void stun_run(struct stun *stun, const struct cfg_stun *cfg)
+{
+        uint64_t end = timer_now() + 5000;
+        struct in_addr addr;
+
+        do
+        {
+                wanip_getwanipaddr(&(stun->src), cfg, NULL, &addr);
+                loop_run_once(5);
+                timer_ctl_run();
+        } while((stun->src.status == WISWorking
+                 || stun->src.status == WISNeedUpdate)
+                && timer_now() < end);
+}
+
+TEST_DEF(test_stun_server)
+{
+        struct cfg_stun cfg;
+        struct stun stun;
+
+        /* the first one is unreachable, the second one answers */
+        stun_setup(&cfg);
+        stun_add(&cfg, yaserver_closed_port(SOCK_DGRAM));
+        stun_add(&cfg, echo_port);
+        inet_pton(AF_INET, "203.0.113.5", &echo_mapped_addr);
+
+        stun_init(&stun);
+        stun_run(&stun, &cfg);
+
+        TEST_ASSERT(stun.src.status == WISHaveIp
+                    && stun.src.wanaddr.s_addr == echo_mapped_addr.s_addr,
+                    "no address (status %d)", stun.src.status);
+        TEST_ASSERT(stun.nat == 1, "no nat seen");
+
+        /* the lost requests are sent again */
+        echo_drops = 2;
+        echo_requests = 0;
+        echo_mapped_addr.s_addr = INADDR_ANY;
+        wanip_needupdate(&(stun.src));
+        stun_run(&stun, &cfg);
+
+        TEST_ASSERT(stun.src.status == WISHaveIp
+                    && stun.src.wanaddr.s_addr == htonl(INADDR_LOOPBACK),
+                    "no address after retransmissions (status %d)",
+                    stun.src.status);
+        TEST_ASSERT(echo_requests == 3, "%u requests", echo_requests);
+        TEST_ASSERT(stun.nat == 0, "nat seen without translation");
+
+        wanip_cleanup(&(stun.src));
+
+        /* none answers */
+        stun_setup(&cfg);
+        stun_add(&cfg, yaserver_closed_port(SOCK_DGRAM));
+        echo_drops = 100;
+
+        stun_init(&stun);
+        stun_run(&stun, &cfg);
+
+        TEST_ASSERT(stun.src.status == WISError && !stun.src.have_wanaddr,
+                    "status %d without answer", stun.src.status);
+
+        wanip_cleanup(&(stun.src));
+
+        /* given up after the retransmissions */
+        stun_setup(&cfg);
+        stun_add(&cfg, echo_port);
+        echo_requests = 0;
+
+        stun_init(&stun);
+        stun_run(&stun, &cfg);
+
+        TEST_ASSERT(stun.src.status == WISError && echo_requests == 7,
+                    "status %d after %u requests", stun.src.status,
+                    echo_requests);
+
+        wanip_cleanup(&(stun.src));
+        echo_drops = 0;
+}
+
+int main(void)
+{
+        TEST_INIT("stun");
+
+        timer_ctl_init();
+        if(loop_init() != 0)
+        {
+                return RET_ERROR;
+        }
+        resolv_ctl_init("/nonexistent");
+
+        echo_port = yaserver_start(&echo_server, SOCK_DGRAM, echo_answer);
+        if(echo_port == 0)
+        {
+                return RET_ERROR;
+        }
+
+        TEST_RUN(test_stun_parse);
+        TEST_RUN(test_stun_server);
+
+        yaserver_stop(&echo_server);
+        resolv_ctl_cleanup();
+        loop_cleanup();
+        timer_ctl_cleanup();
+
+	return TEST_RETURN;
+}
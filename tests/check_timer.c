@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "yatest.h"
+
+#include "../src/timer.h"
+#include "../src/util.h"
+
+static uint64_t vclock = 0;
+static int fired[8];
+static int fired_count = 0;
+
+static uint64_t vclock_now(void)
+{
+        return vclock;
+}
+
+static void timer_cb_record(struct timer *timer, void *data)
+{
+        UNUSED(timer);
+
+        fired[fired_count++] = *(int *)data;
+}
+
+static void timer_cb_rearm(struct timer *timer, void *data)
+{
+        UNUSED(data);
+
+        ++fired_count;
+        timer_start(timer, 10);
+}
+
+static void setup(void)
+{
+        timer_ctl_init();
+        timer_ctl_set_clock(vclock_now);
+        vclock = 1000;
+        fired_count = 0;
+}
+
+static void teardown(void)
+{
+        timer_ctl_cleanup();
+        timer_ctl_set_clock(NULL);
+}
+
+TEST_DEF(test_timer_order)
+{
+        struct timer timers[5];
+        int ids[5] = { 0, 1, 2, 3, 4 };
+        uint64_t delays[5] = { 500, 100, 300, 100, 200 };
+        int expected[5] = { 1, 3, 4, 2, 0 };
+        int ret, i;
+
+        setup();
+
+        TEST_ASSERT(timer_ctl_next_timeout() == -1,
+                    "timer_ctl_next_timeout() = %d with empty heap",
+                    timer_ctl_next_timeout());
+
+        for(i = 0; i < 5; ++i)
+        {
+                timer_init(&timers[i], timer_cb_record, &ids[i]);
+                TEST_ASSERT(timer_start(&timers[i], delays[i]) == 0,
+                            "timer_start(%d) failed !", i);
+        }
+
+        TEST_ASSERT(timer_ctl_next_timeout() == 100,
+                    "timer_ctl_next_timeout() = %d (100 expected)",
+                    timer_ctl_next_timeout());
+
+        /* nothing expired yet */
+        vclock += 99;
+        ret = timer_ctl_run();
+        TEST_ASSERT(ret == 0, "%d timers expired (0 expected)", ret);
+
+        vclock += 1000;
+        ret = timer_ctl_run();
+        TEST_ASSERT(ret == 5, "%d timers expired (5 expected)", ret);
+
+        for(i = 0; i < 5; ++i)
+        {
+                TEST_ASSERT(fired[i] == expected[i],
+                            "timer %d fired at rank %d (%d expected)",
+                            fired[i], i, expected[i]);
+                TEST_ASSERT(!timer_pending(&timers[i]),
+                            "timer %d is still pending", i);
+        }
+
+        teardown();
+}
+
+TEST_DEF(test_timer_stop_restart)
+{
+        struct timer timers[4];
+        int ids[4] = { 0, 1, 2, 3 };
+        int ret, i;
+
+        setup();
+
+        for(i = 0; i < 4; ++i)
+        {
+                timer_init(&timers[i], timer_cb_record, &ids[i]);
+                timer_start(&timers[i], (uint64_t)(i + 1) * 100);
+        }
+
+        /* stop the earliest and one in the middle */
+        timer_stop(&timers[0]);
+        timer_stop(&timers[2]);
+        timer_stop(&timers[2]);
+
+        TEST_ASSERT(timer_ctl_next_timeout() == 200,
+                    "timer_ctl_next_timeout() = %d (200 expected)",
+                    timer_ctl_next_timeout());
+
+        /* push back timer 1 after timer 3 */
+        timer_start(&timers[1], 1000);
+
+        vclock += 500;
+        ret = timer_ctl_run();
+        TEST_ASSERT(ret == 1 && fired[0] == 3,
+                    "%d timers expired, first is %d (1 and 3 expected)",
+                    ret, fired[0]);
+
+        TEST_ASSERT(timer_ctl_next_timeout() == 500,
+                    "timer_ctl_next_timeout() = %d (500 expected)",
+                    timer_ctl_next_timeout());
+
+        vclock += 500;
+        ret = timer_ctl_run();
+        TEST_ASSERT(ret == 1 && fired[1] == 1,
+                    "%d timers expired, second is %d (1 and 1 expected)",
+                    ret, fired[1]);
+
+        TEST_ASSERT(timer_ctl_next_timeout() == -1,
+                    "timer_ctl_next_timeout() = %d (-1 expected)",
+                    timer_ctl_next_timeout());
+
+        teardown();
+}
+
+TEST_DEF(test_timer_rearm_in_cb)
+{
+        struct timer timer;
+        int ret;
+
+        setup();
+
+        timer_init(&timer, timer_cb_rearm, NULL);
+        timer_start(&timer, 10);
+
+        /* a timer re-armed from its callback runs once per pass */
+        vclock += 100;
+        ret = timer_ctl_run();
+        TEST_ASSERT(ret == 1, "%d timers expired (1 expected)", ret);
+        TEST_ASSERT(timer_pending(&timer), "timer isn't pending");
+        TEST_ASSERT(timer_ctl_next_timeout() == 10,
+                    "timer_ctl_next_timeout() = %d (10 expected)",
+                    timer_ctl_next_timeout());
+
+        timer_stop(&timer);
+
+        teardown();
+}
+
+static uint64_t last_expire = 0;
+static int ordered = 1;
+
+static void timer_cb_ordered(struct timer *timer, void *data)
+{
+        UNUSED(data);
+
+        if(timer->expire < last_expire)
+        {
+                ordered = 0;
+        }
+
+        last_expire = timer->expire;
+        ++fired_count;
+}
+
+TEST_DEF(test_timer_many)
+{
+        struct timer *timers = NULL;
+        int count = 2000;
+        int i;
+
+        setup();
+
+        timers = calloc((size_t)count, sizeof(struct timer));
+        for(i = 0; i < count; ++i)
+        {
+                timer_init(&timers[i], timer_cb_ordered, NULL);
+                timer_start(&timers[i], (uint64_t)((i * 7919) % count));
+        }
+
+        /* stop every other timer, the heap must stay ordered */
+        for(i = 0; i < count; i += 2)
+        {
+                timer_stop(&timers[i]);
+        }
+
+        last_expire = 0;
+        ordered = 1;
+        while(timer_ctl_next_timeout() != -1)
+        {
+                vclock += 7;
+                timer_ctl_run();
+        }
+
+        free(timers);
+
+        TEST_ASSERT(ordered, "timers expired out of order");
+        TEST_ASSERT(fired_count == count / 2,
+                    "%d timers expired (%d expected)",
+                    fired_count, count / 2);
+
+        teardown();
+}
+
+int main(void)
+{
+        TEST_INIT("timer");
+
+        TEST_RUN(test_timer_order);
+        TEST_RUN(test_timer_stop_restart);
+        TEST_RUN(test_timer_rearm_in_cb);
+        TEST_RUN(test_timer_many);
+
+	return TEST_RETURN;
+}
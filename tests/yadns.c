@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+
+#include "yadns.h"
+
+static void yadns_put16(unsigned char *p, unsigned int v)
+{
+        p[0] = (unsigned char)(v >> 8);
+        p[1] = (unsigned char)(v & 0xff);
+}
+
+/*
+ * @return the offset of the end of the name of the question, 0 if
+ *         it's malformed
+ */
+static size_t yadns_qname_end(const unsigned char *pkt, size_t len)
+{
+        size_t i;
+
+        for(i = 12; i < len && pkt[i] != 0; i += 1 + pkt[i])
+        {
+        }
+
+        return (i + 5 <= len ? i + 1 : 0);
+}
+
+unsigned int yadns_qtype(const unsigned char *pkt, size_t len)
+{
+        size_t end = yadns_qname_end(pkt, len);
+
+        if(end == 0)
+        {
+                return 0;
+        }
+
+        return (unsigned int)(pkt[end] << 8 | pkt[end + 1]);
+}
+
+void yadns_qname(const unsigned char *pkt, size_t len,
+                 char *buf, size_t size)
+{
+        size_t i, n = 0;
+        int ret;
+
+        buf[0] = '\0';
+
+        for(i = 12; i < len && pkt[i] != 0 && n < size; i += 1 + pkt[i])
+        {
+                ret = snprintf(buf + n, size - n, "%s%.*s",
+                               (n > 0 ? "." : ""), pkt[i], pkt + i + 1);
+                if(ret < 0)
+                {
+                        break;
+                }
+
+                n += (size_t)ret;
+        }
+}
+
+void yadns_swapcase(unsigned char *pkt, size_t len)
+{
+        size_t i;
+
+        for(i = 12; i < len && pkt[i] != 0; ++i)
+        {
+                if(isalpha(pkt[i]))
+                {
+                        pkt[i] = (unsigned char)(pkt[i] ^ 0x20);
+                }
+        }
+}
+
+size_t yadns_reply(unsigned char *pkt, size_t len, unsigned int flags)
+{
+        /* QR, RD as asked */
+        yadns_put16(pkt + 2, 0x8000 | (unsigned int)(pkt[2] & 0x01) << 8
+                    | flags);
+
+        /* no answer, authority or additional record yet */
+        memset(pkt + 6, 0, 6);
+
+        return len;
+}
+
+size_t yadns_put_rr(unsigned char *pkt, size_t len, size_t size,
+                    unsigned int name, unsigned int type,
+                    unsigned int ttl, const void *rdata, size_t rdlen)
+{
+        if(len + 12 + rdlen > size)
+        {
+                return 0;
+        }
+
+        yadns_put16(pkt + len, 0xc000 | name);
+        yadns_put16(pkt + len + 2, type);
+        yadns_put16(pkt + len + 4, 1);      /* IN */
+        yadns_put16(pkt + len + 6, ttl >> 16);
+        yadns_put16(pkt + len + 8, ttl & 0xffff);
+        yadns_put16(pkt + len + 10, (unsigned int)rdlen);
+        memcpy(pkt + len + 12, rdata, rdlen);
+
+        /* one more answer */
+        yadns_put16(pkt + 6, (unsigned int)(pkt[6] << 8 | pkt[7]) + 1);
+
+        return len + 12 + rdlen;
+}
+
+size_t yadns_put_a(unsigned char *pkt, size_t len, size_t size,
+                   unsigned int name, unsigned int ttl, const char *addr)
+{
+        struct in_addr in;
+
+        if(inet_pton(AF_INET, addr, &in) != 1)
+        {
+                return 0;
+        }
+
+        return yadns_put_rr(pkt, len, size, name, 1, ttl, &in, 4);
+}
@@ -0,0 +1,68 @@
+#ifndef _YADNS_H_
+#define _YADNS_H_
+
+#include <stddef.h>
+
+/*
+ * The answers of the dns stand-ins of the check programs, built in
+ * place of the query (one question, its name at offset 12).
+ */
+
+/* the name of the question, to point to */
+#define YADNS_QNAME 0x0c
+
+/* flags of yadns_reply() */
+#define YADNS_AA        0x0400          /* authoritative */
+#define YADNS_TC        0x0200          /* truncated */
+#define YADNS_RA        0x0080          /* recursion available */
+#define YADNS_SERVFAIL  2               /* rcodes */
+#define YADNS_NXDOMAIN  3
+
+/*
+ * the type of the question of the query of len bytes in pkt
+ *
+ * @return 0 if the query is malformed
+ */
+extern unsigned int yadns_qtype(const unsigned char *pkt, size_t len);
+
+/*
+ * write the name of the question (dotted) in buf
+ */
+extern void yadns_qname(const unsigned char *pkt, size_t len,
+                        char *buf, size_t size);
+
+/*
+ * swap the case of the letters of the name of the question, like a
+ * server (or a spoofer) which doesn't echo it
+ */
+extern void yadns_swapcase(unsigned char *pkt, size_t len);
+
+/*
+ * turn the query of pkt into its answer, with no record. The header
+ * gets QR, the RD of the query and flags (YADNS_* and a rcode).
+ *
+ * @return the length of the answer
+ */
+extern size_t yadns_reply(unsigned char *pkt, size_t len, unsigned int flags);
+
+/*
+ * append to the answer of len bytes in pkt (of size bytes) a record of
+ * the name at offset name (compressed), type, ttl and rdata
+ *
+ * @return the new length, 0 if there's no room
+ */
+extern size_t yadns_put_rr(unsigned char *pkt, size_t len, size_t size,
+                           unsigned int name, unsigned int type,
+                           unsigned int ttl, const void *rdata,
+                           size_t rdlen);
+
+/*
+ * append an A record of addr (dotted) to the answer
+ *
+ * @return the new length, 0 if there's no room
+ */
+extern size_t yadns_put_a(unsigned char *pkt, size_t len, size_t size,
+                          unsigned int name, unsigned int ttl,
+                          const char *addr);
+
+#endif
@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "yaserver.h"
+
+#include "../src/util.h"
+
+/*
+ * a socket of type bound to 127.0.0.1, on *port (given by the system
+ * if 0)
+ */
+static int yaserver_socket(int type, unsigned short int *port)
+{
+        struct sockaddr_in addr;
+        socklen_t addrlen = sizeof(addr);
+        int s;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(*port);
+
+        s = socket(AF_INET, type, 0);
+        if(s < 0)
+        {
+                return -1;
+        }
+
+        if(bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0
+           || getsockname(s, (struct sockaddr *)&addr, &addrlen) < 0)
+        {
+                close(s);
+                return -1;
+        }
+
+        *port = ntohs(addr.sin_port);
+
+        return s;
+}
+
+static void yaserver_conn_cb(struct loop_watch *watch, unsigned int revents)
+{
+        struct yaserver *server = watch->data;
+        unsigned char buf[YASERVER_BUF_SIZE];
+        struct sockaddr_in from;
+        socklen_t fromlen = sizeof(from);
+        size_t len;
+        ssize_t ret;
+
+        UNUSED(revents);
+
+        ret = recv(watch->fd, buf, sizeof(buf) - 1, 0);
+        if(ret > 0
+           && getpeername(watch->fd, (struct sockaddr *)&from, &fromlen) == 0)
+        {
+                buf[ret] = '\0';
+
+                len = server->cb(buf, (size_t)ret, sizeof(buf), &from);
+                if(len > 0)
+                {
+                        ret = send(watch->fd, buf, MIN(len, sizeof(buf)), 0);
+                }
+        }
+
+        close(watch->fd);
+        loop_watch_del(watch);
+}
+
+static void yaserver_cb_dgram(struct yaserver *server)
+{
+        unsigned char buf[YASERVER_BUF_SIZE];
+        struct sockaddr_in from;
+        socklen_t fromlen = sizeof(from);
+        size_t len;
+        ssize_t ret;
+
+        ret = recvfrom(server->watch.fd, buf, sizeof(buf) - 1, 0,
+                       (struct sockaddr *)&from, &fromlen);
+        if(ret < 0)
+        {
+                return;
+        }
+
+        buf[ret] = '\0';
+
+        len = server->cb(buf, (size_t)ret, sizeof(buf), &from);
+        if(len > 0)
+        {
+                ret = sendto(server->watch.fd, buf, MIN(len, sizeof(buf)), 0,
+                             (struct sockaddr *)&from, fromlen);
+        }
+}
+
+static void yaserver_cb_stream(struct yaserver *server)
+{
+        size_t i;
+        int s;
+
+        s = accept(server->watch.fd, NULL, NULL);
+        if(s < 0)
+        {
+                return;
+        }
+
+        for(i = 0; i < ARRAY_SIZE(server->conns); ++i)
+        {
+                if(!server->conns[i].registered)
+                {
+                        loop_watch_init(&(server->conns[i]),
+                                        yaserver_conn_cb, server);
+                        if(loop_watch_add(&(server->conns[i]),
+                                          s, LOOP_READ) == 0)
+                        {
+                                return;
+                        }
+                        break;
+                }
+        }
+
+        close(s);
+}
+
+static void yaserver_watch_cb(struct loop_watch *watch, unsigned int revents)
+{
+        struct yaserver *server = watch->data;
+
+        UNUSED(revents);
+
+        if(server->type == SOCK_DGRAM)
+        {
+                yaserver_cb_dgram(server);
+        }
+        else
+        {
+                yaserver_cb_stream(server);
+        }
+}
+
+unsigned short int yaserver_start(struct yaserver *server, int type,
+                                  yaserver_cb cb)
+{
+        return yaserver_start_port(server, type, 0, cb);
+}
+
+unsigned short int yaserver_start_port(struct yaserver *server, int type,
+                                       unsigned short int port,
+                                       yaserver_cb cb)
+{
+        int s;
+
+        memset(server, 0, sizeof(struct yaserver));
+        server->type = type;
+        server->cb = cb;
+
+        s = yaserver_socket(type, &port);
+        if(s < 0)
+        {
+                return 0;
+        }
+
+        loop_watch_init(&(server->watch), yaserver_watch_cb, server);
+        if((type == SOCK_STREAM && listen(s, 16) < 0)
+           || loop_watch_add(&(server->watch), s, LOOP_READ) != 0)
+        {
+                close(s);
+                return 0;
+        }
+
+        return port;
+}
+
+void yaserver_stop(struct yaserver *server)
+{
+        size_t i;
+        int s;
+
+        for(i = 0; i < ARRAY_SIZE(server->conns); ++i)
+        {
+                if(server->conns[i].registered)
+                {
+                        s = server->conns[i].fd;
+                        loop_watch_del(&(server->conns[i]));
+                        close(s);
+                }
+        }
+
+        if(server->watch.registered)
+        {
+                s = server->watch.fd;
+                loop_watch_del(&(server->watch));
+                close(s);
+        }
+}
+
+unsigned short int yaserver_closed_port(int type)
+{
+        unsigned short int port = 0;
+        int s;
+
+        s = yaserver_socket(type, &port);
+        if(s < 0)
+        {
+                return 0;
+        }
+
+        close(s);
+
+        return port;
+}
@@ -0,0 +1,66 @@
+#ifndef _YASERVER_H_
+#define _YASERVER_H_
+
+#include <stddef.h>
+#include <netinet/in.h>
+
+#include "../src/loop.h"
+
+/*
+ * A local stand-in of a server on 127.0.0.1 for the check programs,
+ * driven by the event loop.
+ *
+ * A datagram server answers each query to its sender. A stream server
+ * reads one query by connection, answers it and closes.
+ */
+
+/* the largest query or answer */
+#define YASERVER_BUF_SIZE 1024
+
+/* a query of len bytes is in buf (nul terminated), from from. The
+ * answer is written in buf (up to size bytes).
+ *
+ * @return the size of the answer, 0 if none
+ */
+typedef size_t (*yaserver_cb)(unsigned char *buf, size_t len, size_t size,
+                              const struct sockaddr_in *from);
+
+struct yaserver {
+        int type;                   /* SOCK_DGRAM or SOCK_STREAM */
+        yaserver_cb cb;
+        struct loop_watch watch;    /* of its socket */
+        struct loop_watch conns[8]; /* accepted (stream) */
+};
+
+/*
+ * start server
+ *
+ * @return the port of server, 0 if error
+ */
+extern unsigned short int yaserver_start(struct yaserver *server, int type,
+                                         yaserver_cb cb);
+
+/*
+ * start server on port of 127.0.0.1 (given by the system if 0), a
+ * datagram and a stream server can share it
+ *
+ * @return the port of server, 0 if error
+ */
+extern unsigned short int yaserver_start_port(struct yaserver *server,
+                                              int type,
+                                              unsigned short int port,
+                                              yaserver_cb cb);
+
+/*
+ * stop server (and close its connections), if started
+ */
+extern void yaserver_stop(struct yaserver *server);
+
+/*
+ * a port of 127.0.0.1 nobody listens to, for sockets of type
+ *
+ * @return 0 if error
+ */
+extern unsigned short int yaserver_closed_port(int type);
+
+#endif